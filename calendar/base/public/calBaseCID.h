@@ -42,6 +42,11 @@
 #define CAL_RECURRENCERULE_CONTRACTID \
     "@mozilla.org/calendar/recurrence-rule;1"
 
+#define CAL_RECURRENCESET_CID \
+    { 0x9e0c4b2a, 0x3f61, 0x4d8e, { 0xa5, 0x27, 0x6b, 0x1d, 0x90, 0xe4, 0x53, 0xc8 } }
+#define CAL_RECURRENCESET_CONTRACTID \
+    "@mozilla.org/calendar/recurrence-set;1"
+
 /* JS -- Update these from calItemModule.js */
 #define CAL_EVENT_CID \
     { 0x974339d5, 0xab86, 0x4491, { 0xaa, 0xaf, 0x2b, 0x2c, 0xa1, 0x77, 0xc1, 0x2b } }
@@ -48,16 +48,11 @@ calIcsSerializer.prototype = {
     },
 
     serializeToStream: function(aStream) {
-        let str = this.serializeToString();
-
-        // Convert the javascript string to an array of bytes, using the
-        // UTF8 encoder
-        let convStream = Components.classes["@mozilla.org/intl/converter-output-stream;1"]
-                                   .createInstance(Components.interfaces.nsIConverterOutputStream);
-        convStream.init(aStream, "UTF-8", 0, 0x0000);
-
-        convStream.writeString(str);
-        convStream.close();
+        // Written as it is serialized, without a string of the whole
+        // calendar in between
+        let calComp = this.getIcalComponent();
+        calComp.serializeToICSOutputStream(aStream);
+        aStream.close();
     },
 
     getIcalComponent: function() {
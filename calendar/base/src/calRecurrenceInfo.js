@@ -16,6 +16,22 @@ function getRidKey(date) {
     return date.icalString;
 }
 
+/**
+ * Gets the service expanding recurrence sets natively. It takes the libical
+ * date-times and rules only, see calculateNativeDates.
+ */
+function getRecurrenceSet() {
+    if (getRecurrenceSet.mObject === undefined) {
+        getRecurrenceSet.mObject = Components.classes["@mozilla.org/calendar/recurrence-set;1"]
+                                             .getService(Components.interfaces.calIRecurrenceSet);
+    }
+    return getRecurrenceSet.mObject;
+}
+
+function isNativeDate(aDate) {
+    return !aDate || aDate instanceof Components.interfaces.calIDateTimeLibical;
+}
+
 function calRecurrenceInfo() {
     this.mRecurrenceItems = [];
     this.mExceptionMap = {};
@@ -452,6 +468,11 @@ calRecurrenceInfo.prototype = {
             return [];
         }
 
+        let nativeDates = this.calculateNativeDates(startDate, aRangeStart, aRangeEnd, aMaxCount);
+        if (nativeDates) {
+            return nativeDates;
+        }
+
         let dates = [];
 
         // toss in exceptions first. Save a map of all exceptions ids, so we
@@ -543,18 +564,12 @@ calRecurrenceInfo.prototype = {
             for (let dateToRemove of cur_dates) {
                 let dateToRemoveKey = getRidKey(dateToRemove);
                 if (dateToRemove.isDate) {
-                    // As decided in bug 734245, an EXDATE of type DATE shall also match a DTSTART of type DATE-TIME
-                    let toRemove = [];
-                    for (let occurenceKey in occurrenceMap) {
-                        if (occurrenceMap[occurenceKey] && occurenceKey.substring(0, 8) == dateToRemoveKey) {
-                            dates = dates.filter(date => date.id.compare(dateToRemove) != 0);
-                            toRemove.push(occurenceKey);
-                        }
-                    }
-                    for (let i = 0; i < toRemove.length; i++) {
-                        delete occurrenceMap[toRemove[i]];
-                    }
-                } else if (occurrenceMap[dateToRemoveKey]) {
+                    // As decided in bug 734245, an EXDATE of type DATE shall also match a DTSTART of type DATE-TIME.
+                    // It matches the occurrences on that day in their own timezone, which may not be the day in UTC
+                    // the keys are for.
+                    dates = dates.filter(date => date.id.compare(dateToRemove) != 0);
+                } else if (occurrenceMap[dateToRemoveKey] || dateToRemove.timezone.isFloating) {
+                    // A floating date matches the occurrences by their wall clock time, whatever their timezone.
                     // TODO PERF Theoretically we could use occurrence map
                     // to construct the array of occurrences. Right now I'm
                     // just using the occurrence map to skip the filter
@@ -574,6 +589,71 @@ calRecurrenceInfo.prototype = {
         return dates;
     },
 
+    /**
+     * Works out the dates as calculateDates does, but has the recurrence set
+     * service merge the occurrences of the recurrence items as they are
+     * iterated. Returns null if any of the dates or rules are not libical
+     * ones, in which case the dates are worked out here.
+     */
+    calculateNativeDates: function(aStartDate, aRangeStart, aRangeEnd, aMaxCount) {
+        if (!isNativeDate(aStartDate) || !isNativeDate(aRangeStart) || !isNativeDate(aRangeEnd)) {
+            return null;
+        }
+        for (let ritem of this.mRecurrenceItems) {
+            if (ritem instanceof Components.interfaces.calIRecurrenceDate) {
+                if (!isNativeDate(ritem.date)) {
+                    return null;
+                }
+            } else if (!(ritem instanceof Components.interfaces.calIRecurrenceRuleLibical)) {
+                return null;
+            }
+        }
+        let duration = this.mBaseItem.duration;
+        if (duration && !(duration instanceof Components.interfaces.calIDurationLibical)) {
+            return null;
+        }
+
+        // The exceptions take out the occurrences of their recurrence ids,
+        // those in the range are put in at their start dates. DTSTART/DUE
+        // is always part of the expanded set, unless it is an exception.
+        let overrideIds = [];
+        let overrideStarts = [];
+        let occurrenceMap = {};
+        for (let ex in this.mExceptionMap) {
+            let item = this.mExceptionMap[ex];
+            let occDate = checkIfInRange(item, aRangeStart, aRangeEnd, true);
+            if (!isNativeDate(item.recurrenceId) || !isNativeDate(occDate)) {
+                return null;
+            }
+            occurrenceMap[ex] = true;
+            overrideIds.push(item.recurrenceId);
+            overrideStarts.push(occDate);
+        }
+        let baseOccDate = checkIfInRange(this.mBaseItem, aRangeStart, aRangeEnd, true);
+        if (baseOccDate && !occurrenceMap[getRidKey(baseOccDate)]) {
+            if (!isNativeDate(baseOccDate)) {
+                return null;
+            }
+            overrideIds.push(baseOccDate);
+            overrideStarts.push(baseOccDate);
+        }
+
+        let recurrenceIds = {};
+        let startDates = getRecurrenceSet().expand(aStartDate,
+                                                   this.mRecurrenceItems.length,
+                                                   this.mRecurrenceItems,
+                                                   aRangeStart,
+                                                   aRangeEnd,
+                                                   duration,
+                                                   aMaxCount,
+                                                   overrideIds.length,
+                                                   overrideIds,
+                                                   overrideStarts,
+                                                   {},
+                                                   recurrenceIds);
+        return startDates.map((rstart, i) => ({ id: recurrenceIds.value[i], rstart: rstart }));
+    },
+
     getOccurrenceDates: function(aRangeStart, aRangeEnd, aMaxCount, aCount) {
         let dates = this.calculateDates(aRangeStart, aRangeEnd, aMaxCount);
         dates = dates.map(date => date.rstart);
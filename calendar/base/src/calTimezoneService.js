@@ -47,6 +47,7 @@ var calTimezoneServiceInterfaces = [
     Components.interfaces.calIStartupService
 ];
 calTimezoneService.prototype = {
+    mDatabase: null,
     mDefaultTimezone: null,
     mHasSetupObservers: false,
     mVersion: null,
@@ -101,6 +102,23 @@ calTimezoneService.prototype = {
             });
         }
 
+        // The compiled database is mapped into memory, so nothing needs to
+        // be read or parsed up front. It needs the libical backend and an
+        // unpacked add-on, else we fall back to the JSON file.
+        function openDatabase(aResProtocol, aURL) {
+            try {
+                let uri = Services.io.newURI(aResProtocol.resolveURI(Services.io.newURI(aURL, null, null)), null, null);
+                let file = uri.QueryInterface(Components.interfaces.nsIFileURL).file;
+                if (file.exists()) {
+                    cal.LOG("[calTimezoneService] Opening " + file.path);
+                    return cal.getIcsService().openTimezoneDatabase(file);
+                }
+            } catch (ex) {
+                cal.LOG("[calTimezoneService] Could not open " + aURL + ": " + ex);
+            }
+            return null;
+        }
+
         let resNamespace = "calendar";
         // Check for presence of the calendar timezones add-on.
         let resProtocol = Services.io.getProtocolHandler("resource")
@@ -109,21 +127,31 @@ calTimezoneService.prototype = {
             resNamespace = "calendar-timezones";
         }
 
-        fetchJSON("resource://" + resNamespace + "/timezones/zones.json").then((tzData) => {
-            for (let tzid of Object.keys(tzData.aliases)) {
-                let data = tzData.aliases[tzid];
-                if (typeof data == "object" && data !== null) {
-                    this.mZones.set(tzid, data);
+        let zonesLoaded;
+        this.mDatabase = openDatabase(resProtocol, "resource://" + resNamespace + "/timezones/zones.bin");
+        if (this.mDatabase) {
+            this.mVersion = this.mDatabase.version;
+            zonesLoaded = Promise.resolve();
+        } else {
+            zonesLoaded = fetchJSON("resource://" + resNamespace + "/timezones/zones.json").then((tzData) => {
+                for (let tzid of Object.keys(tzData.aliases)) {
+                    let data = tzData.aliases[tzid];
+                    if (typeof data == "object" && data !== null) {
+                        this.mZones.set(tzid, data);
+                    }
                 }
-            }
-            for (let tzid of Object.keys(tzData.zones)) {
-                let data = tzData.zones[tzid];
-                if (typeof data == "object" && data !== null) {
-                    this.mZones.set(tzid, data);
+                for (let tzid of Object.keys(tzData.zones)) {
+                    let data = tzData.zones[tzid];
+                    if (typeof data == "object" && data !== null) {
+                        this.mZones.set(tzid, data);
+                    }
                 }
-            }
 
-            this.mVersion = tzData.version;
+                this.mVersion = tzData.version;
+            });
+        }
+
+        zonesLoaded.then(() => {
             cal.LOG("[calTimezoneService] Timezones version " + this.version + " loaded");
 
             let bundleURL = "chrome://" + resNamespace + "/locale/timezones.properties";
@@ -132,6 +160,10 @@ calTimezoneService.prototype = {
             // Make sure UTC and floating are cached by calling their getters
             this.UTC; // eslint-disable-line no-unused-expressions
             this.floating; // eslint-disable-line no-unused-expressions
+
+            // The native code caches zones it has looked up, let it know
+            // that they may have changed.
+            Services.obs.notifyObservers(null, "calendar-timezones-updated", this.version);
         }).then(() => {
             if (aCompleteListener) {
                 aCompleteListener.onResult(null, Components.results.NS_OK);
@@ -195,6 +227,9 @@ calTimezoneService.prototype = {
         }
 
         let timezone = this.mZones.get(tzid);
+        if (!timezone && this.mDatabase) {
+            timezone = this.getDatabaseEntry(tzid);
+        }
         if (!timezone) {
             cal.ERROR("Couldn't find " + tzid);
             return null;
@@ -203,6 +238,9 @@ calTimezoneService.prototype = {
             if (timezone.aliasTo) {
                 // This zone is an alias.
                 timezone.zone = this.getTimezone(timezone.aliasTo);
+            } else if (this.mDatabase) {
+                timezone.zone = new calLibicalTimezone(tzid, this.mDatabase.getZoneComponent(tzid),
+                                                       timezone.latitude, timezone.longitude);
             } else if (Preferences.get("calendar.icaljs", false)) {
                 let parsedComp = ICAL.parse("BEGIN:VCALENDAR\r\n" + timezone.ics + "\r\nEND:VCALENDAR");
                 let icalComp = new ICAL.Component(parsedComp);
@@ -220,7 +258,31 @@ calTimezoneService.prototype = {
         return timezone.zone;
     },
 
+    /**
+     * Looks up a zone or alias in the timezone database and remembers it
+     * like those read from zones.json.
+     */
+    getDatabaseEntry: function(tzid) {
+        let entry = null;
+        let aliasTo = this.mDatabase.getAliasTarget(tzid);
+        if (aliasTo) {
+            entry = { aliasTo: aliasTo };
+        } else {
+            let ics = {}, latitude = {}, longitude = {};
+            if (this.mDatabase.getZone(tzid, ics, latitude, longitude)) {
+                entry = { ics: ics.value, latitude: latitude.value, longitude: longitude.value };
+            }
+        }
+        if (entry) {
+            this.mZones.set(tzid, entry);
+        }
+        return entry;
+    },
+
     get timezoneIds() {
+        if (this.mDatabase) {
+            return this.mDatabase.timezoneIds;
+        }
         let zones = [];
         for (let [k, v] of this.mZones.entries()) {
             if (!v.aliasTo && k != "UTC" && k != "floating") {
@@ -231,6 +293,9 @@ calTimezoneService.prototype = {
     },
 
     get aliasIds() {
+        if (this.mDatabase) {
+            return this.mDatabase.aliasIds;
+        }
         let zones = [];
         for (let [key, value] of this.mZones.entries()) {
             if (value.aliasTo && key != "UTC" && key != "floating") {
@@ -8,6 +8,7 @@
 #include "calPeriod.h"
 #include "calICSService.h"
 #include "calRecurrenceRule.h"
+#include "calRecurrenceSet.h"
 
 #include "calBaseCID.h"
 
@@ -26,6 +27,9 @@ NS_DEFINE_NAMED_CID(CAL_PERIOD_CID);
 NS_GENERIC_FACTORY_CONSTRUCTOR(calRecurrenceRule)
 NS_DEFINE_NAMED_CID(CAL_RECURRENCERULE_CID);
 
+NS_GENERIC_FACTORY_CONSTRUCTOR(calRecurrenceSet)
+NS_DEFINE_NAMED_CID(CAL_RECURRENCESET_CID);
+
 
 const mozilla::Module::CIDEntry kCalBaseCIDs[] = {
     { &kCAL_DATETIME_CID, false, NULL, calDateTimeConstructor },
@@ -33,6 +37,7 @@ const mozilla::Module::CIDEntry kCalBaseCIDs[] = {
     { &kCAL_ICSSERVICE_CID, true, NULL, calICSServiceConstructor },
     { &kCAL_PERIOD_CID, false, NULL, calPeriodConstructor },
     { &kCAL_RECURRENCERULE_CID, false, NULL, calRecurrenceRuleConstructor },
+    { &kCAL_RECURRENCESET_CID, true, NULL, calRecurrenceSetConstructor },
     { NULL }
 };
 
@@ -42,6 +47,7 @@ const mozilla::Module::ContractIDEntry kCalBaseContracts[] = {
     { CAL_ICSSERVICE_CONTRACTID, &kCAL_ICSSERVICE_CID },
     { CAL_PERIOD_CONTRACTID, &kCAL_PERIOD_CID },
     { CAL_RECURRENCERULE_CONTRACTID, &kCAL_RECURRENCERULE_CID },
+    { CAL_RECURRENCESET_CONTRACTID, &kCAL_RECURRENCESET_CID },
     { NULL }
 };
 
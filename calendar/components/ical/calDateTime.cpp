@@ -15,6 +15,8 @@
 #include "jsfriendapi.h"
 #include "jswrapper.h"
 #include "prprf.h"
+#include "mozilla/Alignment.h"
+#include "mozilla/StaticMutex.h"
 
 extern "C" {
 #include "ical.h"
@@ -27,6 +29,124 @@ extern "C" {
 NS_IMPL_CLASSINFO(calDateTime, nullptr, 0, CAL_DATETIME_CID)
 NS_IMPL_ISUPPORTS_CI(calDateTime, calIDateTime, calIDateTimeLibical)
 
+namespace {
+
+/**
+ * Date-times are allocated in slabs of blocks. The blocks of a slab are
+ * handed out before the next slab is used, so the many date-times created
+ * together, e.g. the occurrences of a rule, don't each take a malloc() and
+ * lie close together. A slab is freed once all its date-times have been
+ * deleted, unless it is the only one with free blocks.
+ */
+struct PoolSlab;
+
+struct PoolBlock
+{
+    PoolSlab * mSlab;
+    union {
+        PoolBlock * mNextFree;
+        mozilla::AlignedStorage2<calDateTime> mStorage;
+    };
+};
+
+static uint32_t const kBlocksPerSlab = 256;
+
+struct PoolSlab
+{
+    // the list of slabs with free blocks
+    PoolSlab * mPrev;
+    PoolSlab * mNext;
+
+    PoolBlock * mFree;
+    uint32_t mUsed;
+    PoolBlock mBlocks[kBlocksPerSlab];
+};
+
+static mozilla::StaticMutex sPoolMutex;
+static PoolSlab * sFreeSlabs = nullptr;
+
+static void unlinkSlab(PoolSlab * slab)
+{
+    if (slab->mPrev) {
+        slab->mPrev->mNext = slab->mNext;
+    } else {
+        sFreeSlabs = slab->mNext;
+    }
+    if (slab->mNext) {
+        slab->mNext->mPrev = slab->mPrev;
+    }
+    slab->mPrev = slab->mNext = nullptr;
+}
+
+static void linkSlab(PoolSlab * slab)
+{
+    slab->mPrev = nullptr;
+    slab->mNext = sFreeSlabs;
+    if (sFreeSlabs) {
+        sFreeSlabs->mPrev = slab;
+    }
+    sFreeSlabs = slab;
+}
+
+} // anonymous namespace
+
+void * calDateTime::operator new(size_t size)
+{
+    if (size != sizeof(calDateTime)) {
+        return moz_xmalloc(size);
+    }
+
+    mozilla::StaticMutexAutoLock lock(sPoolMutex);
+    PoolSlab * slab = sFreeSlabs;
+    if (!slab) {
+        slab = static_cast<PoolSlab *>(moz_xmalloc(sizeof(PoolSlab)));
+        slab->mFree = nullptr;
+        slab->mUsed = 0;
+        for (uint32_t i = kBlocksPerSlab; i-- > 0;) {
+            slab->mBlocks[i].mSlab = slab;
+            slab->mBlocks[i].mNextFree = slab->mFree;
+            slab->mFree = &slab->mBlocks[i];
+        }
+        linkSlab(slab);
+    }
+
+    PoolBlock * const block = slab->mFree;
+    slab->mFree = block->mNextFree;
+    slab->mUsed++;
+    if (!slab->mFree) {
+        unlinkSlab(slab);
+    }
+    return block->mStorage.addr();
+}
+
+void calDateTime::operator delete(void * ptr, size_t size)
+{
+    if (!ptr) {
+        return;
+    }
+    if (size != sizeof(calDateTime)) {
+        free(ptr);
+        return;
+    }
+
+    PoolBlock * const block = reinterpret_cast<PoolBlock *>(
+        static_cast<char *>(ptr) - offsetof(PoolBlock, mStorage));
+    PoolSlab * const slab = block->mSlab;
+
+    mozilla::StaticMutexAutoLock lock(sPoolMutex);
+    bool const wasFull = !slab->mFree;
+    block->mNextFree = slab->mFree;
+    slab->mFree = block;
+    slab->mUsed--;
+    if (wasFull) {
+        linkSlab(slab);
+    }
+    if (!slab->mUsed && (slab->mPrev || slab->mNext)) {
+        unlinkSlab(slab);
+        free(slab);
+    }
+}
+
 calDateTime::calDateTime()
     : mImmutable(false)
 {
@@ -39,6 +159,13 @@ calDateTime::calDateTime(icaltimetype const* atimeptr, calITimezone *tz)
     FromIcalTime(atimeptr, tz);
 }
 
+calDateTime::calDateTime(icaltimetype const* atimeptr, calITimezone *tz,
+                         icaltimezone const* icaltz)
+    : mImmutable(false)
+{
+    FromIcalTime(atimeptr, tz, icaltz);
+}
+
 NS_IMETHODIMP
 calDateTime::GetIsMutable(bool *aResult)
 {
@@ -104,6 +231,10 @@ calDateTime::Reset()
     mIsDate = false;
     mTimezone = nullptr;
     mNativeTime = 0;
+    mUtcTime = 0;
+    mLocalTime = 0;
+    mZone = icaltimezone_get_utc_timezone(); // see ensureTimezone()
+    mIsSortable = true;
     mIsValid = true;
     return NS_OK;
 }
@@ -375,10 +506,10 @@ calDateTime::GetIcalString(nsACString& aResult)
     icaltimetype t;
     ToIcalTime(&t);
 
-    // note that ics is owned by libical, so we don't need to free
-    char const * const ics = icaltime_as_ical_string(t);
+    char * const ics = icaltime_as_ical_string_r(t);
     CAL_ENSURE_MEMORY(ics);
     aResult.Assign(ics);
+    free(ics);
     return NS_OK;
 }
 
@@ -443,6 +574,16 @@ calDateTime::ToIcalTime(struct icaltimetype * icalt)
 }
 
 void calDateTime::FromIcalTime(icaltimetype const* icalt, calITimezone * tz)
+{
+    nsCOMPtr<calITimezone> ctz = tz;
+    if (!ctz) {
+        ctz = cal::detectTimezone(*icalt, nullptr);
+    }
+    FromIcalTime(icalt, ctz, cal::getIcalTimezone(ctz));
+}
+
+void calDateTime::FromIcalTime(icaltimetype const* icalt, calITimezone * tz,
+                               icaltimezone const* icaltz)
 {
     icaltimetype t = *icalt;
     mIsValid = (icaltime_is_null_time(t) ||
@@ -466,11 +607,7 @@ void calDateTime::FromIcalTime(icaltimetype const* icalt, calITimezone * tz)
     mMinute = static_cast<int16_t>(t.minute);
     mSecond = static_cast<int16_t>(t.second);
 
-    if (tz) {
-        mTimezone = tz;
-    } else {
-        mTimezone = cal::detectTimezone(t, nullptr);
-    }
+    mTimezone = tz;
 #if defined(DEBUG)
     if (mTimezone) {
         if (t.is_utc) {
@@ -499,12 +636,41 @@ void calDateTime::FromIcalTime(icaltimetype const* icalt, calITimezone * tz)
     // but merely representing it a UTC-based way.
     t.is_date = 0;
     mNativeTime = IcaltimeToPRTime(&t, icaltimezone_get_utc_timezone());
+
+    // The sort key. Compare() converts the time it gets from ToIcalTime(),
+    // which doesn't keep is_daylight; that only matters for a time that
+    // occurs twice when daylight saving time ends.
+    if (t.is_daylight) {
+        t.is_daylight = 0;
+        mUtcTime = IcaltimeToPRTime(&t, icaltimezone_get_utc_timezone());
+    } else {
+        mUtcTime = mNativeTime;
+    }
+    mLocalTime = IcaltimeToPRTime(&t, nullptr) / PR_USEC_PER_SEC;
+    mZone = icaltz;
+    // mUtcTime is only good if it has been converted from the timezone
+    // ToIcalTime() gives.
+    icaltimezone const* const zone = (t.zone || !t.is_utc ? t.zone : icaltimezone_get_utc_timezone());
+    mIsSortable = (mIsValid && !icaltime_is_null_time(*icalt) &&
+                   (zone == mZone || !mZone));
+}
+
+PRTime calDateTime::NativeTimeOf(icaltimetype const* icalt)
+{
+    // as FromIcalTime() sets mNativeTime
+    icaltimetype t = *icalt;
+    if (t.is_date) {
+        t.hour = 0;
+        t.minute = 0;
+        t.second = 0;
+        t.is_date = 0;
+    }
+    return IcaltimeToPRTime(&t, icaltimezone_get_utc_timezone());
 }
 
 PRTime calDateTime::IcaltimeToPRTime(icaltimetype const* icalt, icaltimezone const* tz)
 {
     icaltimetype tt;
-    PRExplodedTime et;
 
     /* If the time is the special null time, return 0. */
     if (icaltime_is_null_time(*icalt)) {
@@ -519,34 +685,32 @@ PRTime calDateTime::IcaltimeToPRTime(icaltimetype const* icalt, icaltimezone con
         tt = *icalt;
     }
 
-    /* Empty the destination */
-    memset(&et, 0, sizeof(struct PRExplodedTime));
-
-    /* Fill the fields */
-    if (icaltime_is_date(tt)) {
-        et.tm_sec = et.tm_min = et.tm_hour = 0;
-    } else {
-        et.tm_sec = tt.second;
-        et.tm_min = tt.minute;
-        et.tm_hour = tt.hour;
+    // Fields out of range carry over, as they did with PR_ImplodeTime().
+    PRTime seconds = PRTime(icaltime_days_from_civil(tt.year, tt.month, tt.day)) * 86400;
+    if (!icaltime_is_date(tt)) {
+        seconds += PRTime(tt.hour) * 3600 + tt.minute * 60 + tt.second;
     }
-    et.tm_mday = static_cast<int16_t>(tt.day);
-    et.tm_month = static_cast<int16_t>(tt.month-1);
-    et.tm_year = static_cast<int16_t>(tt.year);
-
-    return PR_ImplodeTime(&et);
+    return seconds * PR_USEC_PER_SEC;
 }
 
 void calDateTime::PRTimeToIcaltime(PRTime time, bool isdate,
                                    icaltimezone const* tz,
                                    icaltimetype * icalt)
 {
-    PRExplodedTime et;
-    PR_ExplodeTime(time, PR_GMTParameters, &et);
+    // Split the time into days and seconds in the day, rounding down for
+    // times before the epoch like PR_ExplodeTime() does.
+    PRTime seconds = time / PR_USEC_PER_SEC;
+    if (time % PR_USEC_PER_SEC < 0) {
+        --seconds;
+    }
+    PRTime days = seconds / 86400;
+    int32_t secondOfDay = int32_t(seconds % 86400);
+    if (secondOfDay < 0) {
+        secondOfDay += 86400;
+        --days;
+    }
 
-    icalt->year   = et.tm_year;
-    icalt->month  = et.tm_month + 1;
-    icalt->day    = et.tm_mday;
+    icaltime_civil_from_days(int32_t(days), &icalt->year, &icalt->month, &icalt->day);
 
     if (isdate) {
         icalt->hour    = 0;
@@ -554,9 +718,9 @@ void calDateTime::PRTimeToIcaltime(PRTime time, bool isdate,
         icalt->second  = 0;
         icalt->is_date = 1;
     } else {
-        icalt->hour   = et.tm_hour;
-        icalt->minute = et.tm_min;
-        icalt->second = et.tm_sec;
+        icalt->hour   = secondOfDay / 3600;
+        icalt->minute = secondOfDay / 60 % 60;
+        icalt->second = secondOfDay % 60;
         icalt->is_date = 0;
     }
 
@@ -569,6 +733,47 @@ void calDateTime::PRTimeToIcaltime(PRTime time, bool isdate,
 //     }
 }
 
+NS_IMETHODIMP_(void)
+calDateTime::GetSortKey(calDateTimeSortKey * key)
+{
+    key->utcTime = mUtcTime;
+    key->localTime = mLocalTime;
+    key->zone = mZone;
+    key->isDate = mIsDate;
+    key->isSortable = mIsSortable;
+}
+
+bool
+calDateTime::CompareSortKeys(calDateTimeSortKey const& a,
+                             calDateTimeSortKey const& b,
+                             int32_t *result)
+{
+    if (!a.isSortable || !b.isSortable) {
+        return false;
+    }
+
+    // If either is floating, both are compared as they are in their
+    // timezones, see Compare().
+    bool const floating = (!a.zone || !b.zone);
+    int64_t x, y;
+    if (a.isDate || b.isDate) {
+        // The dates in the timezone of a. Only b may need a conversion.
+        if (!b.isDate && !floating && b.zone != a.zone) {
+            return false;
+        }
+        x = a.localTime / 86400 - (a.localTime % 86400 < 0 ? 1 : 0);
+        y = b.localTime / 86400 - (b.localTime % 86400 < 0 ? 1 : 0);
+    } else if (floating) {
+        x = a.localTime;
+        y = b.localTime;
+    } else {
+        x = a.utcTime;
+        y = b.utcTime;
+    }
+    *result = (x < y ? -1 : (x > y ? 1 : 0));
+    return true;
+}
+
 NS_IMETHODIMP
 calDateTime::Compare(calIDateTime * aOther, int32_t * aResult)
 {
@@ -579,6 +784,13 @@ calDateTime::Compare(calIDateTime * aOther, int32_t * aResult)
     nsCOMPtr<calIDateTimeLibical> icalother = do_QueryInterface(aOther, &rv);
     NS_ENSURE_SUCCESS(rv, rv);
 
+    calDateTimeSortKey key, otherKey;
+    GetSortKey(&key);
+    icalother->GetSortKey(&otherKey);
+    if (CompareSortKeys(key, otherKey, aResult)) {
+        return NS_OK;
+    }
+
     bool otherIsDate = false;
     aOther->GetIsDate(&otherIsDate);
 
@@ -11,12 +11,38 @@
 struct icaltimetype;
 typedef struct _icaltimezone icaltimezone;
 
+/**
+ * What calDateTime::Compare() orders by. Comparing these doesn't need any
+ * timezone conversion, except for comparing the date of a date-time with
+ * a date in another timezone.
+ */
+struct calDateTimeSortKey
+{
+    PRTime utcTime;             // the time in UTC
+    int64_t localTime;          // the time in its timezone, in seconds
+    icaltimezone const* zone;   // null if floating
+    bool isDate;
+    bool isSortable;            // false if the key must not be used
+};
+
 class calDateTime : public calIDateTimeLibical,
                     public cal::XpcomBase
 {
 public:
     calDateTime();
     calDateTime(icaltimetype const* icalt, calITimezone * tz);
+    // icaltz has to be cal::getIcalTimezone(tz), which the caller may
+    // already know for many date-times.
+    calDateTime(icaltimetype const* icalt, calITimezone * tz,
+                icaltimezone const* icaltz);
+
+    // Date-times are allocated in slabs, see calDateTime.cpp.
+    static void * operator new(size_t size);
+    static void operator delete(void * ptr, size_t size);
+
+    // The nativeTime a date-time created from icalt would have, for
+    // callers that only need that.
+    static PRTime NativeTimeOf(icaltimetype const* icalt);
 
     NS_DECL_ISUPPORTS
     NS_DECL_CALIDATETIME
@@ -40,10 +66,28 @@ protected:
     PRTime mNativeTime;
     nsCOMPtr<calITimezone> mTimezone;
 
+    // the sort key, updated along with mNativeTime
+    PRTime mUtcTime;
+    int64_t mLocalTime;
+    icaltimezone const* mZone;
+    bool mIsSortable;
+
     void Normalize();
     void FromIcalTime(icaltimetype const* icalt, calITimezone *tz);
+    void FromIcalTime(icaltimetype const* icalt, calITimezone *tz,
+                      icaltimezone const* icaltz);
     void ensureTimezone();
 
+public:
+    /**
+     * Compares two sort keys like Compare() compares their date-times.
+     * Returns false if that takes a timezone conversion.
+     */
+    static bool CompareSortKeys(calDateTimeSortKey const& a,
+                                calDateTimeSortKey const& b,
+                                int32_t *result);
+
+protected:
     static PRTime IcaltimeToPRTime(icaltimetype const* icalt, icaltimezone const* tz);
     static void PRTimeToIcaltime(PRTime time, bool isdate,
                                  icaltimezone const* tz, icaltimetype *icalt);
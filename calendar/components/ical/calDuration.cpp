@@ -295,11 +295,11 @@ calDuration::FromIcalDuration(const struct icaldurationtype * const icald)
 NS_IMETHODIMP
 calDuration::GetIcalString(nsACString& aResult)
 {
-    // note that ics is owned by libical, so we don't need to free
-    const char *ics = icaldurationtype_as_ical_string(mDuration);
+    char * const ics = icaldurationtype_as_ical_string_r(mDuration);
     
     if (ics) {
         aResult.Assign(ics);
+        free(ics);
         return NS_OK;
     }
 
@@ -1,11 +1,33 @@
 /* This Source Code Form is subject to the terms of the Mozilla Public
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+#include <algorithm>
+#include <string.h>
+#include <wctype.h>
+
 #include "nsStringStream.h"
+#include "nsStreamUtils.h"
+#include "nsIOutputStream.h"
+#include "nsCOMArray.h"
 #include "nsComponentManagerUtils.h"
+#include "nsIThreadPool.h"
+#include "nsTArray.h"
+#include "nsVariant.h"
+#include "nsIObserverService.h"
+#include "nsXPCOMCIDInternal.h"
+#include "mozilla/ArrayUtils.h"
+#include "mozilla/Atomics.h"
+#include "mozilla/ClearOnShutdown.h"
+#include "mozilla/Monitor.h"
+#include "mozilla/Preferences.h"
+#include "mozilla/Services.h"
+#include "mozilla/StaticPtr.h"
+#include "plstr.h"
+#include "prsystem.h"
 
 #include "calICSService.h"
 #include "calTimezone.h"
+#include "calTimezoneDatabase.h"
 #include "calDateTime.h"
 #include "calDuration.h"
 #include "calIErrors.h"
@@ -40,7 +62,7 @@ calIcalProperty::GetLibicalComponent()
 NS_IMETHODIMP
 calIcalProperty::GetIcalString(nsACString &str)
 {
-    char const* icalstr = icalproperty_as_ical_string(mProperty);
+    char * const icalstr = icalproperty_as_ical_string_r(mProperty);
     if (icalstr == 0) {
 #ifdef DEBUG
         fprintf(stderr, "Error getting ical string: %d (%s)\n",
@@ -49,6 +71,7 @@ calIcalProperty::GetIcalString(nsACString &str)
         return static_cast<nsresult>(calIErrors::ICS_ERROR_BASE + icalerrno);
     }
     str.Assign(icalstr);
+    free(icalstr);
     return NS_OK;
 }
 
@@ -65,6 +88,7 @@ calIcalProperty::GetValue(nsACString &str)
     icalvalue_kind valuekind = icalvalue_isa(value);
 
     const char *icalstr;
+    char *ownedstr = nullptr;
     if (valuekind == ICAL_TEXT_VALUE) {
         icalstr = icalvalue_get_text(value);
     } else if (valuekind == ICAL_X_VALUE) {
@@ -77,7 +101,7 @@ calIcalProperty::GetValue(nsACString &str)
             icalstr = (const char *)icalattach_get_data(attach);
         }
     } else {
-        icalstr = icalproperty_get_value_as_string(mProperty);
+        icalstr = ownedstr = icalproperty_get_value_as_string_r(mProperty);
     }
 
     if (!icalstr) {
@@ -97,6 +121,7 @@ calIcalProperty::GetValue(nsACString &str)
     }
 
     str.Assign(icalstr);
+    free(ownedstr);
     return NS_OK;
 }
 
@@ -124,7 +149,7 @@ calIcalProperty::SetValue(const nsACString &str)
 NS_IMETHODIMP
 calIcalProperty::GetValueAsIcalString(nsACString &str)
 {
-    const char *icalstr = icalproperty_get_value_as_string(mProperty);
+    char * const icalstr = icalproperty_get_value_as_string_r(mProperty);
     if (!icalstr) {
         if (icalerrno == ICAL_BADARG_ERROR) {
             str.Truncate();
@@ -142,6 +167,7 @@ calIcalProperty::GetValueAsIcalString(nsACString &str)
     }
 
     str.Assign(icalstr);
+    free(icalstr);
     return NS_OK;
 }
 
@@ -159,7 +185,7 @@ calIcalProperty::SetValueAsIcalString(const nsACString &str)
 NS_IMETHODIMP
 calIcalProperty::GetPropertyName(nsACString &name)
 {
-    const char *icalstr = icalproperty_get_property_name(mProperty);
+    char * const icalstr = icalproperty_get_property_name_r(mProperty);
     if (!icalstr) {
 #ifdef DEBUG
         fprintf(stderr, "Error getting property name: %d (%s)\n",
@@ -168,6 +194,7 @@ calIcalProperty::GetPropertyName(nsACString &name)
         return NS_ERROR_FAILURE;
     }
     name.Assign(icalstr);
+    free(icalstr);
     return NS_OK;
 }
 
@@ -195,6 +222,7 @@ calIcalProperty::GetParameter(const nsACString &param, nsACString &value)
         return NS_ERROR_INVALID_ARG;
 
     const char *icalstr = nullptr;
+    char *ownedstr = nullptr;
     if (paramkind == ICAL_X_PARAMETER) {
         icalparameter *icalparam = FindParameter(mProperty, param, ICAL_X_PARAMETER);
         if (icalparam)
@@ -204,8 +232,9 @@ calIcalProperty::GetParameter(const nsACString &param, nsACString &value)
         if (icalparam)
             icalstr = icalparameter_get_iana_value(icalparam);
     } else {
-        icalstr = icalproperty_get_parameter_as_string(mProperty,
-                                                       PromiseFlatCString(param).get());
+        icalstr = ownedstr =
+            icalproperty_get_parameter_as_string_r(mProperty,
+                                                   PromiseFlatCString(param).get());
     }
 
     if (!icalstr) {
@@ -214,6 +243,7 @@ calIcalProperty::GetParameter(const nsACString &param, nsACString &value)
     } else {
         value.Assign(icalstr);
     }
+    free(ownedstr);
     return NS_OK;
 }
 
@@ -344,6 +374,76 @@ calIcalProperty::GetValueAsDatetime(calIDateTime **dtp)
     return getDatetime_(toIcalComponent(mParent), mProperty, dtp);
 }
 
+// The copies of embedded VTIMEZONEs, by TZID and the hash of the rest of
+// the VTIMEZONE. Feeds that embed the same zones in every calendar share
+// one copy, which libical then expands only once. A copy is only reused
+// if its text matches, the hash alone may collide. Main thread only.
+typedef nsInterfaceHashtable<nsCStringHashKey, calITimezone> calEmbeddedTimezones;
+static mozilla::StaticAutoPtr<calEmbeddedTimezones> sEmbeddedTimezones;
+static uint32_t const kEmbeddedTimezonesMax = 1024;
+
+static bool
+IsEmbeddedTimezone(calITimezone *tz, icalcomponent *vtimezone)
+{
+    nsCOMPtr<calIIcalComponent> tzComp;
+    tz->GetIcalComponent(getter_AddRefs(tzComp));
+    nsCOMPtr<calIIcalComponentLibical> const tzCompLibical = do_QueryInterface(tzComp);
+    return tzCompLibical &&
+           icalcomponent_compare_vtimezone_text(tzCompLibical->GetLibicalComponent(),
+                                                vtimezone) == 1;
+}
+
+// Wraps a copy of a VTIMEZONE. We need to decouple the (inner) VTIMEZONE
+// from its parent VCALENDAR to avoid running into circular references
+// (referenced timezones).
+static nsresult
+CloneTimezone(nsCString const& tzid, icalcomponent *vtimezone, calITimezone **tzp)
+{
+    nsAutoCString key;
+    uint64_t const hash = icalcomponent_get_vtimezone_hash(vtimezone);
+    bool const shared = (hash != 0 && NS_IsMainThread());
+    if (shared) {
+        key.Assign(tzid);
+        key.Append(' ');
+        key.AppendInt(hash, 16);
+        nsCOMPtr<calITimezone> cached;
+        if (sEmbeddedTimezones && sEmbeddedTimezones->Get(key, getter_AddRefs(cached)) &&
+            IsEmbeddedTimezone(cached, vtimezone)) {
+            cached.forget(tzp);
+            return NS_OK;
+        }
+    }
+
+    icaltimezone * const clonedZone = icaltimezone_new();
+    CAL_ENSURE_MEMORY(clonedZone);
+    icalcomponent * const clonedZoneComp = icalcomponent_new_clone(vtimezone);
+    if (!clonedZoneComp) {
+        icaltimezone_free(clonedZone, 1 /* free struct */);
+        CAL_ENSURE_MEMORY(clonedZoneComp);
+    }
+    if (!icaltimezone_set_component(clonedZone, clonedZoneComp)) {
+        icaltimezone_free(clonedZone, 1 /* free struct */);
+        return NS_ERROR_INVALID_ARG;
+    }
+    nsCOMPtr<calIIcalComponent> const tzComp(new calIcalComponent(clonedZone, clonedZoneComp));
+    CAL_ENSURE_MEMORY(tzComp);
+    calITimezone * const tz = new calTimezone(tzid, tzComp);
+    CAL_ENSURE_MEMORY(tz);
+
+    if (shared) {
+        if (!sEmbeddedTimezones) {
+            sEmbeddedTimezones = new calEmbeddedTimezones();
+            mozilla::ClearOnShutdown(&sEmbeddedTimezones);
+        } else if (sEmbeddedTimezones->Count() >= kEmbeddedTimezonesMax) {
+            sEmbeddedTimezones->Clear();
+        }
+        sEmbeddedTimezones->Put(key, tz);
+    }
+
+    NS_ADDREF(*tzp = tz);
+    return NS_OK;
+}
+
 nsresult calIcalProperty::getDatetime_(calIcalComponent * parent,
                                        icalproperty * prop,
                                        calIDateTime ** dtp)
@@ -385,7 +485,7 @@ nsresult calIcalProperty::getDatetime_(calIcalComponent * parent,
             if (parent) {
                 // passed tz provider has precedence over timezone service:
                 calITimezoneProvider * const tzProvider = parent->getTzProvider();
-                if (tzProvider) {
+                if (tzProvider && !cal::isTimezoneService(tzProvider)) {
                     tzProvider->GetTimezone(tzid, getter_AddRefs(tz));
                     NS_ASSERTION(tz, tzid_);
                 }
@@ -395,9 +495,9 @@ nsresult calIcalProperty::getDatetime_(calIcalComponent * parent,
                 // this hides errors from incorrect ics files, which could state
                 // a TZID that is not present in the ics file.
                 // The other way round, it makes this product more error tolerant.
-                nsresult rv = cal::getTimezoneService()->GetTimezone(tzid, getter_AddRefs(tz));
+                tz = cal::getTimezone(tzid);
 
-                if (NS_FAILED(rv) || !tz) {
+                if (!tz) {
                     icaltimezone const* zone = itt.zone;
                     if (!zone && comp) {
                         // look up parent VCALENDAR for VTIMEZONE:
@@ -405,24 +505,10 @@ nsresult calIcalProperty::getDatetime_(calIcalComponent * parent,
                         NS_ASSERTION(zone, tzid_);
                     }
                     if (zone) {
-                        // We need to decouple this (inner) VTIMEZONE from the parent VCALENDAR to avoid
-                        // running into circular references (referenced timezones):
-                        icaltimezone * const clonedZone = icaltimezone_new();
-                        CAL_ENSURE_MEMORY(clonedZone);
-                        icalcomponent * const clonedZoneComp =
-                            icalcomponent_new_clone(icaltimezone_get_component(const_cast<icaltimezone *>(zone)));
-                        if (!clonedZoneComp) {
-                            icaltimezone_free(clonedZone, 1 /* free struct */);
-                            CAL_ENSURE_MEMORY(clonedZoneComp);
-                        }
-                        if (!icaltimezone_set_component(clonedZone, clonedZoneComp)) {
-                            icaltimezone_free(clonedZone, 1 /* free struct */);
-                            return NS_ERROR_INVALID_ARG;
-                        }
-                        nsCOMPtr<calIIcalComponent> const tzComp(new calIcalComponent(clonedZone, clonedZoneComp));
-                        CAL_ENSURE_MEMORY(tzComp);
-                        tz = new calTimezone(tzid, tzComp);
-                        CAL_ENSURE_MEMORY(tz);
+                        nsresult rv = CloneTimezone(tzid,
+                                                    icaltimezone_get_component(const_cast<icaltimezone *>(zone)),
+                                                    getter_AddRefs(tz));
+                        NS_ENSURE_SUCCESS(rv, rv);
                     } else { // install phantom timezone, so the data could be repaired:
                         tz = new calTimezone(tzid, nullptr);
                         CAL_ENSURE_MEMORY(tz);
@@ -983,6 +1069,7 @@ calIcalComponent::SerializeToICS(nsACString &serialized)
     }
 
     serialized.Assign(icalstr);
+    free(icalstr);
     return NS_OK;
 }
 
@@ -1004,21 +1091,71 @@ calIcalComponent::SerializeToICSStream(nsIInputStream **aStreamResult)
     nsCOMPtr<nsIStringInputStream> const aStringStream(
         do_CreateInstance(NS_STRINGINPUTSTREAM_CONTRACTID, &rv));
     NS_ENSURE_SUCCESS(rv, rv);
-    // copies the string into the input stream that's handed back.
-    // This copy is necessary because we don't really own icalstr;
-    // it's one of libical's ring buffers
-    rv = aStringStream->SetData(icalstr, -1);
-    NS_ENSURE_SUCCESS(rv, rv);
+    // hands the string over to the input stream, which frees it
+    rv = aStringStream->AdoptData(icalstr, -1);
+    if (NS_FAILED(rv)) {
+        free(icalstr);
+        return rv;
+    }
     NS_ADDREF(*aStreamResult = aStringStream);
     return rv;
 }
 
-nsresult
-calIcalComponent::Serialize(char **icalstr)
+namespace {
+
+// Passes the output of icalcomponent_write to an nsIOutputStream.
+struct OutputStreamWriter {
+    nsIOutputStream * mStream;
+    nsresult          mStatus;
+
+    static int Write(const char *data, size_t len, void *closure)
+    {
+        OutputStreamWriter * const writer = static_cast<OutputStreamWriter *>(closure);
+        while (len > 0) {
+            uint32_t const count = static_cast<uint32_t>(std::min(len, size_t(UINT32_MAX)));
+            uint32_t written = 0;
+            writer->mStatus = writer->mStream->Write(data, count, &written);
+            if (NS_FAILED(writer->mStatus)) {
+                return 0;
+            }
+            if (written == 0) {
+                writer->mStatus = NS_BASE_STREAM_CLOSED;
+                return 0;
+            }
+            data += written;
+            len -= written;
+        }
+        return 1;
+    }
+};
+
+} // anonymous namespace
+
+NS_IMETHODIMP
+calIcalComponent::SerializeToICSOutputStream(nsIOutputStream *aStream)
 {
-    NS_ENSURE_ARG_POINTER(icalstr);
+    NS_ENSURE_ARG_POINTER(aStream);
 
-    // add the timezone bits
+    AddTimezoneComponents();
+
+    // written in chunks as the serializer goes, not as one string
+    OutputStreamWriter writer = { aStream, NS_OK };
+    if (!icalcomponent_write(mComponent, OutputStreamWriter::Write, &writer)) {
+        if (NS_FAILED(writer.mStatus)) {
+            return writer.mStatus;
+        }
+#ifdef DEBUG
+        fprintf(stderr, "Error serializing: %d (%s)\n",
+                icalerrno, icalerror_strerror(icalerrno));
+#endif
+        return static_cast<nsresult>(calIErrors::ICS_ERROR_BASE + icalerrno);
+    }
+    return NS_OK;
+}
+
+void
+calIcalComponent::AddTimezoneComponents()
+{
     if (icalcomponent_isa(mComponent) == ICAL_VCALENDAR_COMPONENT && mReferencedTimezones.Count() > 0) {
         for (auto iter = mReferencedTimezones.ConstIter(); !iter.Done(); iter.Next() ) {
             icaltimezone * icaltz = cal::getIcalTimezone(iter.Data());
@@ -1028,8 +1165,18 @@ calIcalComponent::Serialize(char **icalstr)
             }
         }
     }
+}
+
+nsresult
+calIcalComponent::Serialize(char **icalstr)
+{
+    NS_ENSURE_ARG_POINTER(icalstr);
+
+    // add the timezone bits
+    AddTimezoneComponents();
 
-    *icalstr = icalcomponent_as_ical_string(mComponent);
+    // serialized into one buffer, which grows as needed
+    *icalstr = icalcomponent_as_ical_string_r(mComponent);
     if (!*icalstr) {
         // xxx todo: what about NS_ERROR_OUT_OF_MEMORY?
 #ifdef DEBUG
@@ -1103,6 +1250,8 @@ calIcalComponent::AddSubcomponent(calIIcalComponent *aComp)
     if (failed)
         return rv;
 
+    // The clone is allocated on the heap, so moving a child out of a
+    // parsed tree also copies it out of the arena of that parse.
     if (ical->mParent) {
         ical->mComponent = icalcomponent_new_clone(ical->mComponent);
     }
@@ -1246,14 +1395,412 @@ calICSService::calICSService()
 {
 }
 
+calICSService::~calICSService()
+{
+}
+
+// Inputs smaller than this are parsed on the calling thread only; for them
+// the extra pass over the data and the thread startup do not pay off.
+static const size_t kParallelParseMinLength = 1024 * 1024;
+// Upper bound for the number of threads parsing one input.
+static const uint32_t kParallelParseMaxThreads = 8;
+// How many lines of a cancellable input are parsed between two looks at
+// whether it has been cancelled.
+static const uint32_t kCancellableLines = 1024;
+// Default for the number of threads parsing for parseICSAsync, if the
+// calendar.ics.parser.threads pref is 0.
+static const uint32_t kParseQueueMaxThreads = 4;
+
+namespace {
+
+// Frees the temporary buffers libical handed out on this thread while
+// the object was alive, so that a parse doesn't leave them behind in the
+// thread's ring.
+class AutoIcalRingScope {
+public:
+    AutoIcalRingScope() : mScope(icalmemory_open_ring_scope()) {}
+    ~AutoIcalRingScope() { icalmemory_close_ring_scope(mScope); }
+private:
+    size_t const mScope;
+};
+
+// The lines of one child of the top-level component, BEGIN to END.
+struct ChildSpan {
+    const char * mStart;
+    size_t       mLength;
+};
+
+static bool
+IsContentLineName(icalparser_contentline const& cl, char const* name, size_t len)
+{
+    // like the parser, ignore trailing white space after the name
+    size_t nameLen = cl.name_len;
+    while (nameLen > 0 && iswspace(cl.name[nameLen - 1])) {
+        nameLen--;
+    }
+    return nameLen == len && PL_strncasecmp(cl.name, name, len) == 0;
+}
+
+// Finds the children of the top-level component, which can be parsed
+// independently of each other. Everything else is collected in skeleton,
+// which parses to the top-level component without them. Returns false if
+// there is more than one top-level component or BEGIN and END lines do
+// not pair up, leaving it to the serial parser to recover from that.
+static bool
+FindChildren(char const* buf, size_t len,
+             nsTArray<ChildSpan> &children, nsACString &skeleton)
+{
+    icalparser * const parser = icalparser_new();
+    if (!parser) {
+        return false;
+    }
+
+    icalparser_contentline cl;
+    char const* pos = buf;
+    char const* const end = buf + len;
+    char const* gap = buf; // start of the skeleton data not yet copied
+    char const* childStart = nullptr;
+    int depth = 0;
+    bool seenTopLevel = false;
+    bool ok = true;
+
+    for (;;) {
+        char const* const lineStart = pos;
+        if (!icalparser_next_contentline(parser, &pos, end, &cl)) {
+            break;
+        }
+        if (!cl.name) {
+            continue;
+        }
+        if (IsContentLineName(cl, CAL_STRLEN_ARGS("BEGIN"))) {
+            if (depth == 0) {
+                if (seenTopLevel) {
+                    ok = false;
+                    break;
+                }
+                seenTopLevel = true;
+            } else if (depth == 1) {
+                childStart = lineStart;
+            }
+            depth++;
+        } else if (IsContentLineName(cl, CAL_STRLEN_ARGS("END"))) {
+            if (depth == 0) {
+                ok = false;
+                break;
+            }
+            depth--;
+            if (depth == 1) {
+                ChildSpan const child = { childStart, size_t(pos - childStart) };
+                children.AppendElement(child);
+                skeleton.Append(gap, childStart - gap);
+                gap = pos;
+            }
+        }
+    }
+    icalparser_free(parser);
+
+    skeleton.Append(gap, end - gap);
+    return ok && depth == 0;
+}
+
+// Parses the children found by FindChildren. The threads involved take
+// shards of consecutive children until all have been parsed.
+class ParallelParse
+{
+public:
+    ParallelParse(nsTArray<ChildSpan> const& children, uint32_t shardSize,
+                  mozilla::Atomic<bool> const* cancelled)
+        : mChildren(children),
+          mCancelled(cancelled),
+          mShardSize(shardSize),
+          mNextShard(0),
+          mMonitor("calICSService::ParallelParse"),
+          mRunningWorkers(0)
+    {
+        mResults.SetLength(children.Length());
+        for (uint32_t i = 0; i < mResults.Length(); i++) {
+            mResults[i] = nullptr;
+        }
+    }
+
+    ~ParallelParse()
+    {
+        for (uint32_t i = 0; i < mResults.Length(); i++) {
+            if (mResults[i]) {
+                icalcomponent_free(mResults[i]);
+            }
+        }
+    }
+
+    void ParseShards()
+    {
+        AutoIcalRingScope ringScope;
+        icalparser * const parser = icalparser_new();
+        if (!parser) {
+            return; // leaves results missing, the caller falls back
+        }
+        icalparser_use_arena(parser, 1);
+        uint32_t const count = mChildren.Length();
+        while (!(mCancelled && *mCancelled)) {
+            uint32_t const first = mShardSize * mNextShard++;
+            if (first >= count) {
+                break;
+            }
+            uint32_t const last = std::min(first + mShardSize, count);
+            for (uint32_t i = first; i < last; i++) {
+                mResults[i] = ParseChild(parser, mChildren[i]);
+            }
+        }
+        icalparser_free(parser);
+    }
+
+    // Runs ParseShards on a thread pool
+    class Worker : public mozilla::Runnable {
+    public:
+        explicit Worker(ParallelParse *parse) : mParse(parse) {}
+
+        NS_IMETHOD Run() override
+        {
+            mParse->ParseShards();
+            mozilla::MonitorAutoLock lock(mParse->mMonitor);
+            if (--mParse->mRunningWorkers == 0) {
+                lock.Notify();
+            }
+            return NS_OK;
+        }
+    protected:
+        ParallelParse * const mParse;
+    };
+
+    void AddWorker()
+    {
+        mozilla::MonitorAutoLock lock(mMonitor);
+        mRunningWorkers++;
+    }
+
+    void RemoveWorker()
+    {
+        mozilla::MonitorAutoLock lock(mMonitor);
+        mRunningWorkers--;
+    }
+
+    void WaitForWorkers()
+    {
+        mozilla::MonitorAutoLock lock(mMonitor);
+        while (mRunningWorkers > 0) {
+            lock.Wait();
+        }
+    }
+
+    // Moves the parsed children to parent, in document order.
+    bool AddResultsTo(icalcomponent *parent)
+    {
+        for (uint32_t i = 0; i < mResults.Length(); i++) {
+            if (!mResults[i]) {
+                return false;
+            }
+        }
+        for (uint32_t i = 0; i < mResults.Length(); i++) {
+            icalcomponent_add_component(parent, mResults[i]);
+            mResults[i] = nullptr;
+        }
+        return true;
+    }
+
+private:
+    static icalcomponent * ParseChild(icalparser *parser, ChildSpan const& child)
+    {
+        icalparser_contentline cl;
+        icalcomponent *ical = nullptr;
+        char const* pos = child.mStart;
+        char const* const end = child.mStart + child.mLength;
+        while (icalparser_next_contentline(parser, &pos, end, &cl)) {
+            icalcomponent * const c = icalparser_add_contentline(parser, &cl);
+            if (c) {
+                ical = c;
+            }
+        }
+        return ical;
+    }
+
+    nsTArray<ChildSpan> const&       mChildren;
+    mozilla::Atomic<bool> const*     mCancelled;
+    nsTArray<icalcomponent *>        mResults;
+    uint32_t const                   mShardSize;
+    mozilla::Atomic<uint32_t>        mNextShard;
+    mozilla::Monitor                 mMonitor;
+    uint32_t                         mRunningWorkers;
+};
+
+} // anonymous namespace
+
+// Parses the children of the VCALENDAR on several threads and puts them
+// together under the VCALENDAR in their original order, so the result is
+// the same as that of the serial parser. Returns null if the input is not
+// suitable for this, or if the parse has been cancelled.
+// The workers run on pool, which is shared by all parses; the caller waits
+// for them on a monitor, so that no events are run during the parse.
+static icalcomponent *
+ParseParallel(char const* buf, size_t len, mozilla::Atomic<bool> const* cancelled,
+              nsIThreadPool *pool)
+{
+    int32_t const processors = PR_GetNumberOfProcessors();
+    if (!pool || processors < 2) {
+        return nullptr;
+    }
+
+    // stop at an embedded NUL, as icalparser_parse_buffer does
+    char const* const nul = static_cast<char const*>(memchr(buf, '\0', len));
+    if (nul) {
+        len = nul - buf;
+    }
+
+    nsTArray<ChildSpan> children;
+    nsAutoCString skeleton;
+    if (!FindChildren(buf, len, children, skeleton)) {
+        return nullptr;
+    }
+
+    uint32_t const count = children.Length();
+    uint32_t const threads = std::min(uint32_t(processors), kParallelParseMaxThreads);
+    // a few shards per thread, so that they finish at about the same time
+    uint32_t const shardSize = std::max(count / (threads * 4), uint32_t(16));
+    uint32_t const shards = (count + shardSize - 1) / shardSize;
+    if (shards < 2) {
+        return nullptr;
+    }
+
+    uint32_t const workers = std::min(threads, shards) - 1; // the caller helps
+
+    icalerrorstate const es = icalerror_get_error_state(ICAL_MALFORMEDDATA_ERROR);
+    icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR, ICAL_ERROR_NONFATAL);
+
+    ParallelParse parse(children, shardSize, cancelled);
+    for (uint32_t i = 0; i < workers; i++) {
+        parse.AddWorker();
+        nsCOMPtr<nsIRunnable> const worker = new ParallelParse::Worker(&parse);
+        if (NS_FAILED(pool->Dispatch(worker, NS_DISPATCH_NORMAL))) {
+            parse.RemoveWorker();
+        }
+    }
+
+    // The VCALENDAR properties and anything the serial parser would also
+    // see outside of the children, parsed while the workers are busy.
+    icalparser * const parser = icalparser_new();
+    icalcomponent *root = nullptr;
+    if (parser) {
+        icalparser_use_arena(parser, 1);
+        root = icalparser_parse_buffer(parser, skeleton.BeginReading(), skeleton.Length());
+        icalparser_free(parser);
+    }
+
+    parse.ParseShards();
+    parse.WaitForWorkers();
+
+    icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR, es);
+
+    if (root && !parse.AddResultsTo(root)) {
+        icalcomponent_free(root);
+        root = nullptr;
+    }
+    return root;
+}
+
+// Top-level components after the first one go under an XROOT with it, as
+// icalparser_parse_buffer has them.
+static icalcomponent *
+AddRootComponent(icalcomponent *root, icalcomponent *c)
+{
+    if (!root) {
+        return c;
+    }
+    if (icalcomponent_isa(root) != ICAL_XROOT_COMPONENT) {
+        icalcomponent * const xroot = icalcomponent_new(ICAL_XROOT_COMPONENT);
+        if (!xroot) {
+            icalcomponent_free(c);
+            return root;
+        }
+        icalcomponent_add_component(xroot, root);
+        root = xroot;
+    }
+    icalcomponent_add_component(root, c);
+    return root;
+}
+
+// Parses the string in place, without flattening it or copying it line
+// by line into the parser. The result is allocated from an arena, which
+// is released when the last component parsed into it is freed.
+// If cancelled is passed, the parse stops soon after it has been set and
+// returns null. Large inputs are parsed on shardPool too, if passed.
+static icalcomponent *
+ParseBuffer(const nsACString &serialized,
+            mozilla::Atomic<bool> const* cancelled,
+            nsIThreadPool *shardPool)
+{
+    if (serialized.Length() >= kParallelParseMinLength) {
+        icalcomponent * const ical = ParseParallel(serialized.BeginReading(),
+                                                   serialized.Length(),
+                                                   cancelled, shardPool);
+        if (ical || (cancelled && *cancelled)) {
+            return ical;
+        }
+    }
+
+    AutoIcalRingScope ringScope;
+    icalparser *parser = icalparser_new();
+    if (!parser) {
+        return nullptr;
+    }
+    icalparser_use_arena(parser, 1);
+    icalcomponent *ical;
+    if (!cancelled) {
+        ical = icalparser_parse_buffer(parser, serialized.BeginReading(),
+                                       serialized.Length());
+    } else {
+        // line by line like icalparser_parse_buffer, to look for a
+        // cancellation in between
+        char const* pos = serialized.BeginReading();
+        char const* end = serialized.EndReading();
+        char const* const nul = static_cast<char const*>(memchr(pos, '\0', end - pos));
+        if (nul) {
+            end = nul;
+        }
+        icalerrorstate const es = icalerror_get_error_state(ICAL_MALFORMEDDATA_ERROR);
+        icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR, ICAL_ERROR_NONFATAL);
+        icalparser_contentline cl;
+        ical = nullptr;
+        for (uint32_t lines = 1; icalparser_next_contentline(parser, &pos, end, &cl); lines++) {
+            icalcomponent * const c = icalparser_add_contentline(parser, &cl);
+            if (c) {
+                ical = AddRootComponent(ical, c);
+            }
+            if (lines % kCancellableLines == 0 && *cancelled) {
+                break;
+            }
+        }
+        icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR, es);
+        if (ical && *cancelled) {
+            icalcomponent_free(ical);
+            ical = nullptr;
+        }
+    }
+    icalparser_free(parser);
+    return ical;
+}
+
 NS_IMETHODIMP
 calICSService::ParseICS(const nsACString& serialized,
                         calITimezoneProvider *tzProvider,
                         calIIcalComponent **component)
 {
     NS_ENSURE_ARG_POINTER(component);
-    icalcomponent *ical =
-        icalparser_parse_string(PromiseFlatCString(serialized).get());
+    // the shared threads are set up on the main thread, elsewhere the
+    // input is parsed on the calling thread only
+    nsCOMPtr<nsIThreadPool> shardPool;
+    if (NS_IsMainThread() && NS_SUCCEEDED(EnsureParseQueue())) {
+        shardPool = mParseQueue->GetShardPool();
+    }
+    icalcomponent *ical = ParseBuffer(serialized, nullptr, shardPool);
     if (!ical) {
 #ifdef DEBUG
         fprintf(stderr, "Error parsing: '%20s': %d (%s)\n",
@@ -1273,66 +1820,825 @@ calICSService::ParseICS(const nsACString& serialized,
     return NS_OK;
 }
 
-NS_IMETHODIMP
-calICSService::ParserWorker::Run()
+// Parses the strings one after the other, all with the same parser. The
+// results are null where a string could not be parsed, with the error in
+// statuses.
+static void
+ParseBatch(nsTArray<nsCString> const& strings,
+           mozilla::Atomic<bool> const* cancelled,
+           nsTArray<icalcomponent *> &results,
+           nsTArray<nsresult> &statuses)
 {
-    icalcomponent *ical = icalparser_parse_string(mString.get());
-    nsresult status = NS_OK;
-    calIIcalComponent *comp = nullptr;
-
-    if (ical) {
-        comp = new calIcalComponent(ical, nullptr, mProvider);
-        if (!comp) {
-            icalcomponent_free(ical);
+    AutoIcalRingScope ringScope;
+    icalparser * const parser = icalparser_new();
+    if (parser) {
+        icalparser_use_arena(parser, 1);
+    }
+    for (uint32_t i = 0; i < strings.Length(); i++) {
+        icalcomponent *ical = nullptr;
+        nsresult status = calIErrors::OPERATION_CANCELLED;
+        if (!parser) {
             status = NS_ERROR_OUT_OF_MEMORY;
+        } else if (!(cancelled && *cancelled)) {
+            icalerror_clear_errno();
+            ical = icalparser_parse_buffer(parser, strings[i].BeginReading(),
+                                           strings[i].Length());
+            status = ical ? NS_OK
+                          : static_cast<nsresult>(calIErrors::ICS_ERROR_BASE + icalerrno);
+            // the next string gets a new arena
+            icalparser_reset(parser);
+        }
+        results.AppendElement(ical);
+        statuses.AppendElement(status);
+    }
+    if (parser) {
+        icalparser_free(parser);
+    }
+}
+
+NS_IMPL_ISUPPORTS(calIcsParseOperation, calIOperation)
+
+calIcsParseOperation::calIcsParseOperation(calIcsParseQueue *queue,
+                                           const nsACString &icsString,
+                                           calITimezoneProvider *tzProvider,
+                                           calIIcsComponentParsingListener *listener,
+                                           uint32_t priority,
+                                           uint32_t serial)
+    : mQueue(queue),
+      mProvider(tzProvider),
+      mListener(new nsMainThreadPtrHolder<calIIcsComponentParsingListener>(listener)),
+      mPriority(priority),
+      mSerial(serial),
+      mCancelled(false),
+      mIsPending(true),
+      mStatus(NS_OK)
+{
+    mStrings.AppendElement(icsString);
+}
+
+calIcsParseOperation::calIcsParseOperation(calIcsParseQueue *queue,
+                                           nsTArray<nsCString> &icsStrings,
+                                           calITimezoneProvider *tzProvider,
+                                           calIIcsBatchParsingListener *listener,
+                                           uint32_t priority,
+                                           uint32_t serial)
+    : mQueue(queue),
+      mProvider(tzProvider),
+      mBatchListener(new nsMainThreadPtrHolder<calIIcsBatchParsingListener>(listener)),
+      mPriority(priority),
+      mSerial(serial),
+      mCancelled(false),
+      mIsPending(true),
+      mStatus(NS_OK)
+{
+    mStrings.SwapElements(icsStrings);
+}
+
+calIcsParseOperation::~calIcsParseOperation()
+{
+    for (uint32_t i = 0; i < mResults.Length(); i++) {
+        if (mResults[i]) {
+            icalcomponent_free(mResults[i]);
         }
+    }
+}
+
+void
+calIcsParseOperation::Parse()
+{
+    if (!mCancelled) {
+        if (mBatchListener) {
+            ParseBatch(mStrings, &mCancelled, mResults, mResultStatus);
+        } else {
+            nsCOMPtr<nsIThreadPool> const shardPool = mQueue->GetShardPool();
+            icalcomponent * const ical = ParseBuffer(mStrings[0], &mCancelled, shardPool);
+            mResults.AppendElement(ical);
+            mResultStatus.AppendElement(
+                ical ? NS_OK : static_cast<nsresult>(calIErrors::ICS_ERROR_BASE + icalerrno));
+        }
+    }
+    // the strings aren't needed anymore, though the operation may be kept
+    mStrings.Clear();
+
+    Complete();
+}
+
+void
+calIcsParseOperation::Complete()
+{
+    nsCOMPtr<nsIRunnable> const completer = new Completer(this);
+    NS_DispatchToMainThread(completer);
+}
+
+void
+calIcsParseOperation::NotifyListener()
+{
+    // The components are created here, so that they and the tz provider
+    // are only ever used on the main thread.
+    nsCOMArray<calIIcalComponent> comps;
+    nsresult status = NS_OK;
+    if (mCancelled) {
+        status = mStatus; // the listener gets the cancel status
+        for (uint32_t i = 0; i < mResults.Length(); i++) {
+            if (mResults[i]) {
+                icalcomponent_free(mResults[i]);
+            }
+        }
+        mResults.Clear();
+        mResultStatus.Clear();
     } else {
-        status = static_cast<nsresult>(calIErrors::ICS_ERROR_BASE + icalerrno);
+        for (uint32_t i = 0; i < mResults.Length(); i++) {
+            calIIcalComponent *comp = nullptr;
+            if (mResults[i]) {
+                comp = new calIcalComponent(mResults[i], nullptr, mProvider);
+                mResults[i] = nullptr;
+            }
+            comps.AppendObject(comp);
+        }
+        if (mListener) {
+            status = mResultStatus[0];
+        }
+        mIsPending = false;
+        mStatus = status;
     }
 
-    nsCOMPtr<nsIRunnable> completer = new ParserWorkerCompleter(mWorkerThread, status,
-                                                                comp, mListener);
-    mMainThread->Dispatch(completer, NS_DISPATCH_NORMAL);
+    if (mListener) {
+        mListener->OnParsingComplete(status, comps.SafeObjectAt(0));
+    } else {
+        mBatchListener->OnBatchParsingComplete(status, comps.Count(),
+                                               mResultStatus.Elements(),
+                                               comps.Elements());
+    }
+}
+
+NS_IMETHODIMP
+calIcsParseOperation::Completer::Run()
+{
+    mOperation->NotifyListener();
+    mOperation = nullptr;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+calIcsParseOperation::GetId(nsACString &aId)
+{
+    aId.AssignLiteral("ics-parse-");
+    aId.AppendInt(mSerial);
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+calIcsParseOperation::GetIsPending(bool *aIsPending)
+{
+    NS_ENSURE_ARG_POINTER(aIsPending);
+    *aIsPending = mIsPending;
+    return NS_OK;
+}
 
-    mWorkerThread = nullptr;
-    mMainThread = nullptr;
+NS_IMETHODIMP
+calIcsParseOperation::GetStatus(nsIVariant **aStatus)
+{
+    NS_ENSURE_ARG_POINTER(aStatus);
+    RefPtr<nsVariant> const status = new nsVariant();
+    status->SetAsUint32(static_cast<uint32_t>(mStatus));
+    status.forget(aStatus);
     return NS_OK;
 }
 
 NS_IMETHODIMP
-calICSService::ParserWorker::ParserWorkerCompleter::Run()
+calIcsParseOperation::Cancel(nsIVariant *aStatus)
+{
+    if (!mIsPending) {
+        return NS_OK;
+    }
+    uint32_t status = calIErrors::OPERATION_CANCELLED;
+    if (aStatus) {
+        aStatus->GetAsUint32(&status);
+    }
+    mIsPending = false;
+    mStatus = static_cast<nsresult>(status);
+    mCancelled = true;
+
+    // a running parse stops by itself and notifies the listener, a waiting
+    // one never starts
+    if (mQueue->Remove(this)) {
+        mStrings.Clear();
+        Complete();
+    }
+    return NS_OK;
+}
+
+NS_IMPL_ISUPPORTS(calIcsParseQueue, nsIObserver)
+
+calIcsParseQueue::calIcsParseQueue()
+    : mMutex("calIcsParseQueue::mMutex"),
+      mShutdown(false)
+{
+}
+
+nsresult
+calIcsParseQueue::Init()
 {
-    mListener->OnParsingComplete(mStatus, mComp);
+    nsCOMPtr<nsIObserverService> const observerService =
+        mozilla::services::GetObserverService();
+    NS_ENSURE_TRUE(observerService, NS_ERROR_UNEXPECTED);
+    return observerService->AddObserver(this, "xpcom-shutdown-threads", false);
+}
 
-    nsresult rv = mWorkerThread->Shutdown();
+nsresult
+calIcsParseQueue::EnsurePool()
+{
+    mMutex.AssertCurrentThreadOwns();
+    if (mPool) {
+        return NS_OK;
+    }
+
+    uint32_t threads = mozilla::Preferences::GetUint("calendar.ics.parser.threads", 0);
+    if (threads == 0) {
+        int32_t const processors = PR_GetNumberOfProcessors();
+        threads = std::min(uint32_t(std::max(processors, 1)), kParseQueueMaxThreads);
+    }
+
+    nsresult rv;
+    nsCOMPtr<nsIThreadPool> const pool = do_CreateInstance(NS_THREADPOOL_CONTRACTID, &rv);
     NS_ENSURE_SUCCESS(rv, rv);
+    pool->SetThreadLimit(threads);
+    pool->SetIdleThreadLimit(1);
+    pool->SetName(NS_LITERAL_CSTRING("ICS Async"));
+    mPool = pool;
+    return NS_OK;
+}
+
+already_AddRefed<nsIThreadPool>
+calIcsParseQueue::GetShardPool()
+{
+    mozilla::MutexAutoLock lock(mMutex);
+    if (!mShardPool && !mShutdown) {
+        int32_t const processors = PR_GetNumberOfProcessors();
+        uint32_t const threads = std::min(uint32_t(std::max(processors, 1)),
+                                          kParallelParseMaxThreads);
+        nsresult rv;
+        nsCOMPtr<nsIThreadPool> const pool = do_CreateInstance(NS_THREADPOOL_CONTRACTID, &rv);
+        if (NS_SUCCEEDED(rv)) {
+            // one thread less, as the caller of each parse helps
+            pool->SetThreadLimit(std::max(threads - 1, uint32_t(1)));
+            pool->SetIdleThreadLimit(0);
+            pool->SetName(NS_LITERAL_CSTRING("ICS Parser"));
+            mShardPool = pool;
+        }
+    }
+    nsCOMPtr<nsIThreadPool> pool = mShardPool;
+    return pool.forget();
+}
+
+nsresult
+calIcsParseQueue::Add(calIcsParseOperation *op)
+{
+    nsCOMPtr<nsIThreadPool> pool;
+    {
+        mozilla::MutexAutoLock lock(mMutex);
+        NS_ENSURE_TRUE(!mShutdown, NS_ERROR_NOT_AVAILABLE);
+        nsresult rv = EnsurePool();
+        NS_ENSURE_SUCCESS(rv, rv);
+        mWaiting[op->Priority()].AppendElement(op);
+        pool = mPool;
+    }
+
+    // Each runnable starts whichever operation is first in line when it
+    // runs, not necessarily this one.
+    nsCOMPtr<nsIRunnable> const runner =
+        mozilla::NewRunnableMethod(this, &calIcsParseQueue::RunNext);
+    nsresult rv = pool->Dispatch(runner, NS_DISPATCH_NORMAL);
+    if (NS_FAILED(rv)) {
+        Remove(op);
+    }
+    return rv;
+}
+
+bool
+calIcsParseQueue::Remove(calIcsParseOperation *op)
+{
+    mozilla::MutexAutoLock lock(mMutex);
+    return mWaiting[op->Priority()].RemoveElement(op);
+}
 
-    mWorkerThread = nullptr;
+void
+calIcsParseQueue::RunNext()
+{
+    RefPtr<calIcsParseOperation> op;
+    {
+        mozilla::MutexAutoLock lock(mMutex);
+        for (uint32_t i = mozilla::ArrayLength(mWaiting); i-- > 0 && !op;) {
+            if (!mWaiting[i].IsEmpty()) {
+                op = mWaiting[i][0];
+                mWaiting[i].RemoveElementAt(0);
+            }
+        }
+    }
+    // there are fewer operations than runnables if some have been cancelled
+    if (op) {
+        op->Parse();
+    }
+}
+
+NS_IMETHODIMP
+calIcsParseQueue::Observe(nsISupports *aSubject, const char *aTopic,
+                          const char16_t *aData)
+{
+    nsCOMPtr<nsIThreadPool> pool;
+    nsCOMPtr<nsIThreadPool> shardPool;
+    {
+        mozilla::MutexAutoLock lock(mMutex);
+        mShutdown = true;
+        for (uint32_t i = 0; i < mozilla::ArrayLength(mWaiting); i++) {
+            mWaiting[i].Clear();
+        }
+        pool.swap(mPool);
+        shardPool.swap(mShardPool);
+    }
+    if (pool) {
+        pool->Shutdown();
+    }
+    if (shardPool) {
+        shardPool->Shutdown();
+    }
+
+    nsCOMPtr<nsIObserverService> const observerService =
+        mozilla::services::GetObserverService();
+    if (observerService) {
+        observerService->RemoveObserver(this, "xpcom-shutdown-threads");
+    }
+    return NS_OK;
+}
+
+nsresult
+calICSService::EnsureParseQueue()
+{
+    if (!mParseQueue) {
+        RefPtr<calIcsParseQueue> const queue = new calIcsParseQueue();
+        nsresult rv = queue->Init();
+        NS_ENSURE_SUCCESS(rv, rv);
+        mParseQueue = queue;
+    }
     return NS_OK;
 }
 
+static uint32_t sParseOperationSerial = 0;
+
 NS_IMETHODIMP
 calICSService::ParseICSAsync(const nsACString& serialized,
                              calITimezoneProvider *tzProvider,
-                             calIIcsComponentParsingListener *listener)
+                             calIIcsComponentParsingListener *listener,
+                             uint32_t priority,
+                             calIOperation **_retval)
+{
+    NS_ENSURE_ARG_POINTER(listener);
+    NS_ENSURE_ARG_POINTER(_retval);
+    NS_ENSURE_ARG(priority <= PARSE_PRIORITY_INTERACTIVE);
+    // the listener is notified on the main thread
+    NS_ENSURE_TRUE(NS_IsMainThread(), NS_ERROR_NOT_SAME_THREAD);
+
+    nsresult rv = EnsureParseQueue();
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    RefPtr<calIcsParseOperation> const op =
+        new calIcsParseOperation(mParseQueue, serialized, tzProvider, listener,
+                                 priority, ++sParseOperationSerial);
+    rv = mParseQueue->Add(op);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    op.forget(_retval);
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+calICSService::ParseICSBatch(uint32_t count,
+                             const char16_t **serialized,
+                             calITimezoneProvider *tzProvider,
+                             uint32_t *resultCount,
+                             nsresult **statuses,
+                             calIIcalComponent ***_retval)
+{
+    NS_ENSURE_ARG_POINTER(resultCount);
+    NS_ENSURE_ARG_POINTER(statuses);
+    NS_ENSURE_ARG_POINTER(_retval);
+    NS_ENSURE_ARG(count == 0 || serialized);
+
+    nsTArray<nsCString> strings(count);
+    for (uint32_t i = 0; i < count; i++) {
+        strings.AppendElement(NS_ConvertUTF16toUTF8(serialized[i]));
+    }
+    nsTArray<icalcomponent *> results;
+    nsTArray<nsresult> resultStatus;
+    ParseBatch(strings, nullptr, results, resultStatus);
+
+    // one lookup per TZID for the whole batch
+    nsCOMPtr<calITimezoneProvider> const timezones = new calIcsStreamTimezones(tzProvider);
+    nsresult * const statusArray =
+        static_cast<nsresult *>(moz_xmalloc(sizeof(nsresult) * (count ? count : 1)));
+    calIIcalComponent ** const compArray =
+        static_cast<calIIcalComponent **>(moz_xmalloc(sizeof(calIIcalComponent *) * (count ? count : 1)));
+    for (uint32_t i = 0; i < count; i++) {
+        statusArray[i] = resultStatus[i];
+        compArray[i] = nullptr;
+        if (results[i]) {
+            NS_ADDREF(compArray[i] = new calIcalComponent(results[i], nullptr, timezones));
+        }
+    }
+
+    *resultCount = count;
+    *statuses = statusArray;
+    *_retval = compArray;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+calICSService::ParseICSBatchAsync(uint32_t count,
+                                  const char16_t **serialized,
+                                  calITimezoneProvider *tzProvider,
+                                  calIIcsBatchParsingListener *listener,
+                                  uint32_t priority,
+                                  calIOperation **_retval)
 {
-    nsresult rv;
     NS_ENSURE_ARG_POINTER(listener);
+    NS_ENSURE_ARG_POINTER(_retval);
+    NS_ENSURE_ARG(count == 0 || serialized);
+    NS_ENSURE_ARG(priority <= PARSE_PRIORITY_INTERACTIVE);
+    // the listener is notified on the main thread
+    NS_ENSURE_TRUE(NS_IsMainThread(), NS_ERROR_NOT_SAME_THREAD);
 
-    nsCOMPtr<nsIThread> workerThread;
-    nsCOMPtr<nsIThread> currentThread;
-    rv = NS_GetCurrentThread(getter_AddRefs(currentThread));
+    nsresult rv = EnsureParseQueue();
     NS_ENSURE_SUCCESS(rv, rv);
-    rv = NS_NewThread(getter_AddRefs(workerThread));
+
+    nsTArray<nsCString> strings(count);
+    for (uint32_t i = 0; i < count; i++) {
+        strings.AppendElement(NS_ConvertUTF16toUTF8(serialized[i]));
+    }
+    // one lookup per TZID for the whole batch
+    nsCOMPtr<calITimezoneProvider> const timezones = new calIcsStreamTimezones(tzProvider);
+    RefPtr<calIcsParseOperation> const op =
+        new calIcsParseOperation(mParseQueue, strings, timezones, listener,
+                                 priority, ++sParseOperationSerial);
+    rv = mParseQueue->Add(op);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    nsCOMPtr<nsIRunnable> worker = new ParserWorker(currentThread, workerThread,
-                                                    serialized, tzProvider, listener);
-    NS_ENSURE_TRUE(worker, NS_ERROR_OUT_OF_MEMORY);
+    op.forget(_retval);
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+calICSService::CreateStreamParser(calITimezoneProvider *tzProvider,
+                                  calIIcsComponentStreamListener *listener,
+                                  calIIcsStreamParser **_retval)
+{
+    NS_ENSURE_ARG_POINTER(listener);
+    NS_ENSURE_ARG_POINTER(_retval);
 
-    rv = workerThread->Dispatch(worker, NS_DISPATCH_NORMAL);
+    calIcsStreamParser * const parser = new calIcsStreamParser(tzProvider, listener);
+    CAL_ENSURE_MEMORY(parser);
+    nsCOMPtr<calIIcsStreamParser> const holder(parser);
+    nsresult rv = parser->Init();
     NS_ENSURE_SUCCESS(rv, rv);
 
+    NS_ADDREF(*_retval = parser);
+    return NS_OK;
+}
+
+NS_IMPL_ISUPPORTS(calIcsStreamTimezones, calITimezoneProvider)
+
+NS_IMETHODIMP
+calIcsStreamTimezones::GetTimezoneIds(nsIUTF8StringEnumerator **aTzids)
+{
+    return NS_ERROR_NOT_IMPLEMENTED;
+}
+
+NS_IMETHODIMP
+calIcsStreamTimezones::GetAliasIds(nsIUTF8StringEnumerator **aAliasIds)
+{
+    return NS_ERROR_NOT_IMPLEMENTED;
+}
+
+NS_IMETHODIMP
+calIcsStreamTimezones::GetTimezone(const nsACString &tzid, calITimezone **_retval)
+{
+    NS_ENSURE_ARG_POINTER(_retval);
+    *_retval = nullptr;
+
+    // Same order as for components that are still in their VCALENDAR, see
+    // calIcalProperty::getDatetime_: the passed tz provider, the timezone
+    // service, and only then the VTIMEZONEs of the stream.
+    if (!mResolved.Get(tzid, _retval)) {
+        if (mTzProvider) {
+            mTzProvider->GetTimezone(tzid, _retval);
+        }
+        if (!*_retval) {
+            cal::getTimezone(tzid).forget(_retval);
+        }
+        mResolved.Put(tzid, *_retval);
+    }
+    if (*_retval) {
+        return NS_OK;
+    }
+    mTimezones.Get(tzid, _retval);
+    return NS_OK;
+}
+
+nsresult
+calIcsStreamTimezones::AddTimezone(icalcomponent *vtimezone)
+{
+    icalproperty * const prop = icalcomponent_get_first_property(vtimezone, ICAL_TZID_PROPERTY);
+    if (!prop) {
+        return NS_OK; // nothing can refer to it
+    }
+    nsDependentCString const tzid(icalproperty_get_tzid(prop));
+
+    nsCOMPtr<calITimezone> tz;
+    nsresult rv = CloneTimezone(tzid, vtimezone, getter_AddRefs(tz));
+    NS_ENSURE_SUCCESS(rv, rv);
+    mTimezones.Put(tzid, tz);
+    return NS_OK;
+}
+
+NS_IMPL_ISUPPORTS(calIcsStreamParser, calIIcsStreamParser, nsIStreamListener, nsIRequestObserver)
+
+calIcsStreamParser::calIcsStreamParser(calITimezoneProvider *tzProvider,
+                                       calIIcsComponentStreamListener *listener)
+    : mParser(nullptr),
+      mTzProvider(tzProvider),
+      mTimezones(new calIcsStreamTimezones(tzProvider)),
+      mListener(listener),
+      mStatus(NS_OK)
+{
+}
+
+calIcsStreamParser::~calIcsStreamParser()
+{
+    if (mParser) {
+        icalparser_free(mParser);
+    }
+}
+
+nsresult
+calIcsStreamParser::Init()
+{
+    CAL_ENSURE_MEMORY(mTimezones);
+    mParser = icalparser_new();
+    CAL_ENSURE_MEMORY(mParser);
+    icalparser_set_child_func(mParser, OnChild, this);
+    return NS_OK;
+}
+
+void
+calIcsStreamParser::OnChild(icalcomponent *parent, icalcomponent *child, void *data)
+{
+    calIcsStreamParser * const self = static_cast<calIcsStreamParser *>(data);
+
+    if (icalcomponent_isa(parent) != ICAL_VCALENDAR_COMPONENT) {
+        return;
+    }
+    if (icalcomponent_isa(child) == ICAL_VTIMEZONE_COMPONENT) {
+        // stays in the VCALENDAR, but the components to come may need it
+        self->timezones()->AddTimezone(child);
+        return;
+    }
+
+    // Only the VCALENDAR itself is kept until the end of the stream
+    icalcomponent_remove_component(parent, child);
+    if (NS_FAILED(self->mStatus)) {
+        icalcomponent_free(child);
+        return;
+    }
+    nsCOMPtr<calIIcalComponent> const comp(new calIcalComponent(child, nullptr,
+                                                                self->mTimezones));
+    if (!comp) {
+        icalcomponent_free(child);
+        self->mStatus = NS_ERROR_OUT_OF_MEMORY;
+        return;
+    }
+    self->mStatus = self->mListener->OnComponent(comp);
+}
+
+nsresult
+calIcsStreamParser::PushSegment(nsIInputStream *stream, void *closure,
+                                const char *segment, uint32_t offset,
+                                uint32_t count, uint32_t *writeCount)
+{
+    calIcsStreamParser * const self = static_cast<calIcsStreamParser *>(closure);
+    icalparser_push_data(self->mParser, segment, count, 0);
+    *writeCount = count;
+    return NS_OK;
+}
+
+nsresult
+calIcsStreamParser::PushStream(nsIInputStream *stream, uint32_t count)
+{
+    NS_ENSURE_ARG_POINTER(stream);
+    NS_ENSURE_TRUE(mParser, NS_ERROR_NOT_AVAILABLE);
+
+    // Buffered streams hand out their segments for parsing in place,
+    // others (like file streams) have to be copied.
+    bool const buffered = NS_InputStreamIsBuffered(stream);
+    char buf[8192];
+    while (count > 0 && NS_SUCCEEDED(mStatus)) {
+        uint32_t read = 0;
+        nsresult rv;
+        if (buffered) {
+            rv = stream->ReadSegments(PushSegment, this, count, &read);
+        } else {
+            rv = stream->Read(buf, std::min<uint32_t>(count, sizeof(buf)), &read);
+            if (NS_SUCCEEDED(rv)) {
+                icalparser_push_data(mParser, buf, read, 0);
+            }
+        }
+        NS_ENSURE_SUCCESS(rv, rv);
+        if (read == 0) {
+            break;
+        }
+        count -= read;
+    }
+    return mStatus;
+}
+
+nsresult
+calIcsStreamParser::Complete(nsresult status)
+{
+    NS_ENSURE_TRUE(mParser, NS_ERROR_NOT_AVAILABLE);
+
+    icalcomponent *ical = icalparser_push_data(mParser, nullptr, 0, 1);
+    icalparser_free(mParser);
+    mParser = nullptr;
+
+    nsCOMPtr<calIIcalComponent> comp;
+    if (ical) {
+        comp = new calIcalComponent(ical, nullptr, mTzProvider);
+        if (!comp) {
+            icalcomponent_free(ical);
+            status = NS_ERROR_OUT_OF_MEMORY;
+        }
+    } else if (NS_SUCCEEDED(status)) {
+        status = static_cast<nsresult>(calIErrors::ICS_ERROR_BASE + icalerrno);
+    }
+    if (NS_SUCCEEDED(status)) {
+        status = mStatus;
+    }
+
+    return mListener->OnStreamComplete(status, comp);
+}
+
+NS_IMETHODIMP
+calIcsStreamParser::AppendData(const nsACString &chunk)
+{
+    NS_ENSURE_TRUE(mParser, NS_ERROR_NOT_AVAILABLE);
+    icalparser_push_data(mParser, chunk.BeginReading(), chunk.Length(), 0);
+    return mStatus;
+}
+
+NS_IMETHODIMP
+calIcsStreamParser::AppendStream(nsIInputStream *stream)
+{
+    return PushStream(stream, UINT32_MAX);
+}
+
+NS_IMETHODIMP
+calIcsStreamParser::Finish()
+{
+    return Complete(NS_OK);
+}
+
+NS_IMETHODIMP
+calIcsStreamParser::OnStartRequest(nsIRequest *request, nsISupports *context)
+{
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+calIcsStreamParser::OnDataAvailable(nsIRequest *request, nsISupports *context,
+                                    nsIInputStream *stream, uint64_t offset,
+                                    uint32_t count)
+{
+    return PushStream(stream, count);
+}
+
+NS_IMETHODIMP
+calIcsStreamParser::OnStopRequest(nsIRequest *request, nsISupports *context,
+                                  nsresult status)
+{
+    if (!mParser) {
+        return NS_OK; // finished already
+    }
+    return Complete(status);
+}
+
+NS_IMETHODIMP
+calICSService::OpenTimezoneDatabase(nsIFile *aFile, calITimezoneDatabase **_retval)
+{
+    return calTimezoneDatabase::Open(aFile, _retval);
+}
+
+namespace {
+
+struct DateTimeSortEntry
+{
+    calIDateTime *mDateTime;
+    PRTime mKey;
+    bool mIsDate;
+    uint32_t mIndex;
+};
+
+// compare() can't be sorted by when dates and date-times are mixed: a
+// date equals every date-time of its day, which are not equal to each
+// other. So all are sorted by their native times, those of dates being
+// the start of their days, and dates go first at the same time. Ties are
+// broken by the original position to keep the sort stable.
+struct DateTimeSortLess
+{
+    bool operator()(DateTimeSortEntry const& a, DateTimeSortEntry const& b) const {
+        if (a.mKey != b.mKey) {
+            return a.mKey < b.mKey;
+        }
+        if (a.mIsDate != b.mIsDate) {
+            return a.mIsDate;
+        }
+        return a.mIndex < b.mIndex;
+    }
+};
+
+} // anonymous namespace
+
+NS_IMETHODIMP
+calICSService::SortDateTimes(uint32_t count,
+                             calIDateTime **dateTimes,
+                             uint32_t *resultCount,
+                             calIDateTime ***_retval)
+{
+    NS_ENSURE_ARG_POINTER(resultCount);
+    NS_ENSURE_ARG_POINTER(_retval);
+    NS_ENSURE_ARG(count == 0 || dateTimes);
+
+    nsTArray<DateTimeSortEntry> entries(count);
+    for (uint32_t i = 0; i < count; i++) {
+        NS_ENSURE_ARG(dateTimes[i]);
+        DateTimeSortEntry * const entry = entries.AppendElement();
+        entry->mDateTime = dateTimes[i];
+        entry->mIndex = i;
+        nsresult rv = dateTimes[i]->GetNativeTime(&entry->mKey);
+        NS_ENSURE_SUCCESS(rv, rv);
+        rv = dateTimes[i]->GetIsDate(&entry->mIsDate);
+        NS_ENSURE_SUCCESS(rv, rv);
+    }
+    std::sort(entries.Elements(), entries.Elements() + entries.Length(),
+              DateTimeSortLess());
+
+    calIDateTime ** const sorted =
+        static_cast<calIDateTime **>(moz_xmalloc(sizeof(calIDateTime *) * (count ? count : 1)));
+    for (uint32_t i = 0; i < count; i++) {
+        NS_ADDREF(sorted[i] = entries[i].mDateTime);
+    }
+    *resultCount = count;
+    *_retval = sorted;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+calICSService::ConvertTimes(uint32_t count,
+                            PRTime *times,
+                            calITimezone *fromTimezone,
+                            calITimezone *toTimezone,
+                            uint32_t *resultCount,
+                            PRTime **_retval)
+{
+    NS_ENSURE_ARG_POINTER(fromTimezone);
+    NS_ENSURE_ARG_POINTER(toTimezone);
+    NS_ENSURE_ARG_POINTER(resultCount);
+    NS_ENSURE_ARG_POINTER(_retval);
+    NS_ENSURE_ARG(count == 0 || times);
+
+    PRTime * const converted =
+        static_cast<PRTime *>(moz_xmalloc(sizeof(PRTime) * (count ? count : 1)));
+
+    // Floating times only take the other timezone, like in GetInTimezone().
+    icaltimezone * const fromZone = cal::getIcalTimezone(fromTimezone);
+    icaltimezone * const toZone = cal::getIcalTimezone(toTimezone);
+    if (fromZone && toZone && fromZone != toZone) {
+        // libical converts whole seconds, so the microseconds are put aside,
+        // rounding down for times before the epoch.
+        for (uint32_t i = 0; i < count; i++) {
+            converted[i] = times[i] / PR_USEC_PER_SEC;
+            if (times[i] % PR_USEC_PER_SEC < 0) {
+                converted[i]--;
+            }
+        }
+        icaltimezone_convert_times(fromZone, toZone, converted, converted, count);
+        for (uint32_t i = 0; i < count; i++) {
+            converted[i] = converted[i] * PR_USEC_PER_SEC +
+                (times[i] % PR_USEC_PER_SEC + PR_USEC_PER_SEC) % PR_USEC_PER_SEC;
+        }
+    } else if (count) {
+        memcpy(converted, times, sizeof(PRTime) * count);
+    }
+
+    *resultCount = count;
+    *_retval = converted;
     return NS_OK;
 }
 
@@ -6,62 +6,33 @@
 
 #include "nsCOMPtr.h"
 #include "calIICSService.h"
+#include "calIOperation.h"
 #include "calITimezoneProvider.h"
+#include "nsIObserver.h"
+#include "nsIThreadPool.h"
 #include "nsInterfaceHashtable.h"
 #include "nsProxyRelease.h"
 #include "nsThreadUtils.h"
+#include "nsTArray.h"
+#include "mozilla/Atomics.h"
+#include "mozilla/Mutex.h"
 #include "calUtils.h"
 
 extern "C" {
 #include "ical.h"
 }
 
+class calIcsParseQueue;
+
 class calICSService : public calIICSService,
                       public cal::XpcomBase
 {
 protected:
-    virtual ~calICSService() {}
-    class ParserWorker : public mozilla::Runnable {
-    public:
-      ParserWorker(nsIThread *mainThread,
-                   nsIThread *workerThread,
-                   const nsACString &icsString,
-                   calITimezoneProvider *tzProvider,
-                   calIIcsComponentParsingListener *listener) :
-        mString(icsString), mProvider(tzProvider),
-        mMainThread(mainThread), mWorkerThread(workerThread)
-      {
-        mListener = new nsMainThreadPtrHolder<calIIcsComponentParsingListener>(listener);
-      }
-
-      NS_DECL_NSIRUNNABLE
+    virtual ~calICSService();
 
-    protected:
-      nsCString mString;
-      nsCOMPtr<calITimezoneProvider> mProvider;
-      nsMainThreadPtrHandle<calIIcsComponentParsingListener> mListener;
-      nsCOMPtr<nsIThread> mMainThread;
-      nsCOMPtr<nsIThread> mWorkerThread;
-
-      class ParserWorkerCompleter : public mozilla::Runnable {
-      public:
-        ParserWorkerCompleter(nsIThread *workerThread,
-                              nsresult status,
-                              calIIcalComponent *component,
-                              const nsMainThreadPtrHandle<calIIcsComponentParsingListener> &listener) :
-          mWorkerThread(workerThread), mListener(listener),
-          mComp(component), mStatus(status)
-        {
-        }
+    nsresult EnsureParseQueue();
 
-        NS_DECL_NSIRUNNABLE
-      protected:
-        nsCOMPtr<nsIThread> mWorkerThread;
-        nsMainThreadPtrHandle<calIIcsComponentParsingListener> mListener;
-        nsCOMPtr<calIIcalComponent> mComp;
-        nsresult mStatus;
-      };
-    };
+    RefPtr<calIcsParseQueue> mParseQueue; // created by the first parse
 public:
     calICSService();
 
@@ -69,6 +40,98 @@ public:
     NS_DECL_CALIICSSERVICE
 };
 
+// One parseICSAsync or parseICSBatchAsync call. It waits in the
+// calIcsParseQueue until one of its threads parses it, then the listener
+// is notified on the main thread.
+class calIcsParseOperation : public calIOperation,
+                             public cal::XpcomBase
+{
+public:
+    calIcsParseOperation(calIcsParseQueue *queue,
+                         const nsACString &icsString,
+                         calITimezoneProvider *tzProvider,
+                         calIIcsComponentParsingListener *listener,
+                         uint32_t priority,
+                         uint32_t serial);
+    calIcsParseOperation(calIcsParseQueue *queue,
+                         nsTArray<nsCString> &icsStrings, // emptied
+                         calITimezoneProvider *tzProvider,
+                         calIIcsBatchParsingListener *listener,
+                         uint32_t priority,
+                         uint32_t serial);
+
+    NS_DECL_THREADSAFE_ISUPPORTS
+    NS_DECL_CALIOPERATION
+
+    uint32_t Priority() const { return mPriority; }
+
+    // Called on a thread of the queue.
+    void Parse();
+
+protected:
+    virtual ~calIcsParseOperation();
+
+    void Complete();
+    void NotifyListener();
+
+    class Completer : public mozilla::Runnable {
+    public:
+        explicit Completer(calIcsParseOperation *op) : mOperation(op) {}
+
+        NS_DECL_NSIRUNNABLE
+    protected:
+        RefPtr<calIcsParseOperation> mOperation;
+    };
+
+    RefPtr<calIcsParseQueue> const                         mQueue;
+    nsTArray<nsCString>                                    mStrings;
+    nsCOMPtr<calITimezoneProvider> const                   mProvider;
+    // one of the two is set
+    nsMainThreadPtrHandle<calIIcsComponentParsingListener> mListener;
+    nsMainThreadPtrHandle<calIIcsBatchParsingListener>     mBatchListener;
+    uint32_t const                                         mPriority;
+    uint32_t const                                         mSerial;
+    mozilla::Atomic<bool>                                  mCancelled;
+    // one per string, set by Parse for the main thread:
+    nsTArray<icalcomponent *>                              mResults;
+    nsTArray<nsresult>                                     mResultStatus;
+    // main thread only:
+    bool                                                   mIsPending;
+    nsresult                                               mStatus;
+};
+
+// The threads parseICSAsync parses on, shared by all calls. Waiting
+// operations with a higher priority are started first, those with the
+// same priority in the order they were added. Also holds the threads the
+// children of large inputs are parsed on, see ParseParallel.
+class calIcsParseQueue final : public nsIObserver
+{
+public:
+    calIcsParseQueue();
+
+    NS_DECL_THREADSAFE_ISUPPORTS
+    NS_DECL_NSIOBSERVER
+
+    nsresult Init();
+    nsresult Add(calIcsParseOperation *op);
+    // Returns whether op was still waiting, i.e. it will not be parsed.
+    bool Remove(calIcsParseOperation *op);
+    // Null once the threads have been shut down.
+    already_AddRefed<nsIThreadPool> GetShardPool();
+
+protected:
+    ~calIcsParseQueue() {}
+
+    void RunNext();
+    nsresult EnsurePool();
+
+    mozilla::Mutex                                mMutex;
+    nsCOMPtr<nsIThreadPool>                       mPool;
+    nsCOMPtr<nsIThreadPool>                       mShardPool;
+    nsTArray<RefPtr<calIcsParseOperation> >       mWaiting[calIICSService::PARSE_PRIORITY_INTERACTIVE + 1];
+    bool                                          mShutdown;
+};
+
 class calIcalComponent;
 
 class calIcalProperty : public calIIcalPropertyLibical,
@@ -159,6 +222,7 @@ protected:
 
     void ClearAllProperties(icalproperty_kind kind);
 
+    void AddTimezoneComponents();
     nsresult Serialize(char ** icalstr);
 
     nsInterfaceHashtable<nsCStringHashKey, calITimezone> mReferencedTimezones;
@@ -175,4 +239,63 @@ inline calIcalComponent * toIcalComponent(calIIcalComponentLibical * p) {
     return static_cast<calIcalComponent *>(p);
 }
 
+// Resolves TZIDs for components handed out by calIcsStreamParser, which
+// have been taken out of their VCALENDAR, and for those of a batch parse.
+// What the tz provider and the timezone service return is remembered, so
+// that each TZID is looked up there only once.
+class calIcsStreamTimezones : public calITimezoneProvider,
+                              public cal::XpcomBase
+{
+public:
+    explicit calIcsStreamTimezones(calITimezoneProvider *tzProvider)
+        : mTzProvider(tzProvider) {}
+
+    NS_DECL_ISUPPORTS
+    NS_DECL_CALITIMEZONEPROVIDER
+
+    nsresult AddTimezone(icalcomponent *vtimezone);
+
+protected:
+    virtual ~calIcsStreamTimezones() {}
+
+    nsCOMPtr<calITimezoneProvider> const                 mTzProvider;
+    nsInterfaceHashtable<nsCStringHashKey, calITimezone> mResolved; // null if unknown
+    nsInterfaceHashtable<nsCStringHashKey, calITimezone> mTimezones;
+};
+
+class calIcsStreamParser : public calIIcsStreamParser,
+                           public cal::XpcomBase
+{
+public:
+    calIcsStreamParser(calITimezoneProvider *tzProvider,
+                       calIIcsComponentStreamListener *listener);
+
+    NS_DECL_ISUPPORTS
+    NS_DECL_NSIREQUESTOBSERVER
+    NS_DECL_NSISTREAMLISTENER
+    NS_DECL_CALIICSSTREAMPARSER
+
+    nsresult Init();
+
+protected:
+    virtual ~calIcsStreamParser();
+
+    static void OnChild(icalcomponent *parent, icalcomponent *child, void *data);
+    static nsresult PushSegment(nsIInputStream *stream, void *closure,
+                                const char *segment, uint32_t offset,
+                                uint32_t count, uint32_t *writeCount);
+    nsresult PushStream(nsIInputStream *stream, uint32_t count);
+    nsresult Complete(nsresult status);
+
+    calIcsStreamTimezones * timezones() const {
+        return static_cast<calIcsStreamTimezones *>(mTimezones.get());
+    }
+
+    icalparser *                             mParser;
+    nsCOMPtr<calITimezoneProvider> const     mTzProvider;
+    nsCOMPtr<calITimezoneProvider>           mTimezones; // calIcsStreamTimezones
+    nsCOMPtr<calIIcsComponentStreamListener> mListener;
+    nsresult                                 mStatus; // first listener failure
+};
+
 #endif // INCLUDED_CALICSSERVICE_H
@@ -157,11 +157,11 @@ calPeriod::GetIcalString(nsACString& aResult)
     struct icalperiodtype ip;
     ToIcalPeriod(&ip);
     
-    // note that ics is owned by libical, so we don't need to free
-    const char *ics = icalperiodtype_as_ical_string(ip);
+    char * const ics = icalperiodtype_as_ical_string_r(ip);
     
     if (ics) {
         aResult.Assign(ics);
+        free(ics);
         return NS_OK;
     }
 
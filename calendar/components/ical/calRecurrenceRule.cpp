@@ -13,14 +13,20 @@
 #include "calICSService.h"
 
 #include "nsIClassInfoImpl.h"
+#include "nsTArray.h"
+
+#include "jsapi.h"
+#include "jsfriendapi.h"
 
 #include <climits>
 
 NS_IMPL_CLASSINFO(calRecurrenceRule, NULL, 0, CAL_RECURRENCERULE_CID)
-NS_IMPL_ISUPPORTS_CI(calRecurrenceRule, calIRecurrenceItem, calIRecurrenceRule)
+NS_IMPL_ISUPPORTS_CI(calRecurrenceRule, calIRecurrenceItem, calIRecurrenceRule,
+                     calIRecurrenceRuleLibical)
 
 calRecurrenceRule::calRecurrenceRule()
-    : mImmutable(false),
+    : mPlan(nullptr),
+      mImmutable(false),
       mIsNegative(false),
       mIsByCount(false)
 {
@@ -130,6 +136,7 @@ calRecurrenceRule::SetType(const nsACString &aType)
     else
         return NS_ERROR_FAILURE;
 
+    ClearIterators();
     return NS_OK;
 }
 
@@ -169,7 +176,7 @@ calRecurrenceRule::SetCount(int32_t aRecurCount)
 
     mIcalRecur.until = icaltime_null_time();
 
-
+    ClearIterators();
     return NS_OK;
 }
 
@@ -227,6 +234,7 @@ calRecurrenceRule::SetUntilDate(calIDateTime * aRecurEnd)
 
     mIsByCount = false;
 
+    ClearIterators();
     return NS_OK;
 }
 
@@ -253,6 +261,7 @@ calRecurrenceRule::SetInterval(int32_t aInterval)
     if (aInterval < 0 || aInterval > SHRT_MAX)
         return NS_ERROR_ILLEGAL_VALUE;
     mIcalRecur.interval = static_cast<short>(aInterval);
+    ClearIterators();
     return NS_OK;
 }
 
@@ -331,9 +340,53 @@ calRecurrenceRule::SetComponent(const nsACString& aComponentType, uint32_t aCoun
     }
 #undef HANDLE_COMPONENT
 
+    ClearIterators();
     return NS_OK;
 }
 
+void
+calRecurrenceRule::ClearIterators()
+{
+    mIteratorCache = nullptr;
+    if (mPlan) {
+        icalrecur_plan_unref(mPlan);
+        mPlan = nullptr;
+    }
+}
+
+icalrecur_iterator *
+calRecurrenceRule::NewIterator(icaltimetype const& dtstart)
+{
+    if (!mPlan) {
+        mPlan = icalrecur_plan_get(&mIcalRecur);
+        if (!mPlan)
+            return nullptr;
+    }
+    return icalrecur_iterator_new_from_plan(mPlan, dtstart);
+}
+
+NS_IMETHODIMP_(icalrecur_iterator *)
+calRecurrenceRule::CreateIterator(struct icaltimetype * dtstart)
+{
+    return NewIterator(*dtstart);
+}
+
+void
+calRecurrenceRule::CachedIterator::Reset()
+{
+    if (mIter) {
+        icalrecur_iterator_free(mIter);
+        mIter = nullptr;
+    }
+    mTimezone = nullptr;
+}
+
+static inline bool isSameIcalTime(icaltimetype const& a, icaltimetype const& b) {
+    return a.year == b.year && a.month == b.month && a.day == b.day &&
+        a.hour == b.hour && a.minute == b.minute && a.second == b.second &&
+        a.is_date == b.is_date && a.zone == b.zone;
+}
+
 /* calIDateTime getNextOccurrence (in calIDateTime aStartTime, in calIDateTime aOccurrenceTime); */
 NS_IMETHODIMP
 calRecurrenceRule::GetNextOccurrence(calIDateTime *aStartTime,
@@ -358,28 +411,70 @@ calRecurrenceRule::GetNextOccurrence(calIDateTime *aStartTime,
     struct icaltimetype occurtime;
     icaloccurtime->ToIcalTime(&occurtime);
 
-    icalrecur_iterator* recur_iter;
-    recur_iter = icalrecur_iterator_new(mIcalRecur, dtstart);
-    if (!recur_iter)
-        return NS_ERROR_OUT_OF_MEMORY;
+    nsCOMPtr<calITimezone> tz;
+    aStartTime->GetTimezone(getter_AddRefs(tz));
 
-    struct icaltimetype next = icalrecur_iterator_next(recur_iter);
-    while (!icaltime_is_null_time(next)) {
-        if (icaltime_compare(next, occurtime) > 0)
-            break;
+    // Go on with a cached iterator for this start date if none of the
+    // occurrences it has passed is after aOccurrenceTime, as the
+    // occurrences are looked up one after the other going forward.
+    if (!mIteratorCache) {
+        mIteratorCache = new IteratorCache();
+    }
+    CachedIterator * cached = nullptr;
+    for (CachedIterator & it : mIteratorCache->mIterators) {
+        if (it.mIter && isSameIcalTime(it.mStart, dtstart) &&
+            (icaltime_is_null_time(it.mPassed) ||
+             icaltime_compare(it.mPassed, occurtime) <= 0) &&
+            (!cached || icaltime_compare(it.mPassed, cached->mPassed) > 0)) {
+            cached = &it;
+        }
+    }
+
+    if (!cached) {
+        // start a new iterator in place of the least recently used one
+        for (CachedIterator & it : mIteratorCache->mIterators) {
+            if (!cached || it.mLastUse < cached->mLastUse) {
+                cached = &it;
+            }
+        }
+        cached->Reset();
 
-        next = icalrecur_iterator_next(recur_iter);
+        icalrecur_iterator* recur_iter;
+        recur_iter = NewIterator(dtstart);
+        if (!recur_iter)
+            return NS_ERROR_OUT_OF_MEMORY;
+
+        cached->mIter = recur_iter;
+        cached->mTimezone = tz;
+        cached->mStart = dtstart;
+        cached->mPassed = icaltime_null_time();
+
+        // skip the periods of the rule that lie before aOccurrenceTime,
+        // all of whose occurrences are before it
+        if (icalrecur_iterator_set_start(recur_iter, occurtime))
+            cached->mPassed = occurtime;
+
+        cached->mNext = icalrecur_iterator_next(recur_iter);
     }
+    cached->mLastUse = ++mIteratorCache->mUse;
 
-    icalrecur_iterator_free(recur_iter);
+    while (!icaltime_is_null_time(cached->mNext)) {
+        if (icaltime_compare(cached->mNext, occurtime) > 0)
+            break;
 
+        if (icaltime_is_null_time(cached->mPassed) ||
+            icaltime_compare(cached->mNext, cached->mPassed) > 0) {
+            cached->mPassed = cached->mNext;
+        }
+        cached->mNext = icalrecur_iterator_next(cached->mIter);
+    }
+
+    struct icaltimetype const next = cached->mNext;
     if (icaltime_is_null_time(next)) {
         *_retval = nullptr;
         return NS_OK;
     }
 
-    nsCOMPtr<calITimezone> tz;
-    aStartTime->GetTimezone(getter_AddRefs(tz));
     *_retval = new calDateTime(&next, tz);
     CAL_ENSURE_MEMORY(*_retval);
     NS_ADDREF(*_retval);
@@ -399,32 +494,29 @@ static inline icaltimetype ensureDateTime(icaltimetype const& icalt) {
     }
 }
 
-NS_IMETHODIMP
-calRecurrenceRule::GetOccurrences(calIDateTime *aStartTime,
-                                  calIDateTime *aRangeStart,
-                                  calIDateTime *aRangeEnd,
-                                  uint32_t aMaxCount,
-                                  uint32_t *aCount, calIDateTime ***aDates)
+nsresult
+calRecurrenceRule::ExpandOccurrences(calIDateTime *aStartTime,
+                                     calIDateTime *aRangeStart,
+                                     calIDateTime *aRangeEnd,
+                                     uint32_t aMaxCount,
+                                     nsTArray<icaltimetype> &aOccurrences)
 {
     NS_ENSURE_ARG_POINTER(aStartTime);
     NS_ENSURE_ARG_POINTER(aRangeStart);
-    NS_ENSURE_ARG_POINTER(aCount);
-    NS_ENSURE_ARG_POINTER(aDates);
 
     // make sure the request is sane; infinite recurrence
     // with no end time is bad times.
     if (!aMaxCount && !aRangeEnd && mIcalRecur.count == 0 && icaltime_is_null_time(mIcalRecur.until))
         return NS_ERROR_INVALID_ARG;
 
-    nsCOMArray<calIDateTime> dates;
-
 #ifdef DEBUG_dbo
     {
-        char const * const ss = icalrecurrencetype_as_string(&mIcalRecur);
+        char * const ss = icalrecurrencetype_as_string_r(&mIcalRecur);
         nsAutoCString tst, tend;
         aRangeStart->ToString(tst);
         aRangeEnd->ToString(tend);
         printf("RULE: [%s -> %s, %d]: %s\n", tst.get(), tend.get(), mIcalRecur.count, ss);
+        free(ss);
     }
 #endif
 
@@ -439,8 +531,6 @@ calRecurrenceRule::GetOccurrences(calIDateTime *aStartTime,
     icalrangestart->ToIcalTime(&rangestart);
     rangestart = ensureDateTime(rangestart);
     icaldtstart->ToIcalTime(&dtstart);
-    nsCOMPtr<calITimezone> tz;
-    aStartTime->GetTimezone(getter_AddRefs(tz));
 
     if (aRangeEnd) {
         nsCOMPtr<calIDateTimeLibical> icalrangeend = do_QueryInterface(aRangeEnd, &rv);
@@ -452,18 +542,18 @@ calRecurrenceRule::GetOccurrences(calIDateTime *aStartTime,
         // if the start of the recurrence is past the end,
         // we have no dates
         if (icaltime_compare (dtstart, dtend) >= 0) {
-            *aDates = nullptr;
-            *aCount = 0;
             return NS_OK;
         }
     }
 
     icalrecur_iterator* recur_iter;
-    recur_iter = icalrecur_iterator_new(mIcalRecur, dtstart);
+    recur_iter = NewIterator(dtstart);
     if (!recur_iter)
         return NS_ERROR_OUT_OF_MEMORY;
 
-    uint32_t count = 0;
+    // skip the periods of the rule that lie before the range, the
+    // occurrences left before it are filtered below
+    icalrecur_iterator_set_start(recur_iter, rangestart);
 
     for (icaltimetype next = icalrecur_iterator_next(recur_iter);
          !icaltime_is_null_time(next);
@@ -479,44 +569,102 @@ calRecurrenceRule::GetOccurrences(calIDateTime *aStartTime,
         if (aRangeEnd && icaltime_compare(dtNext, dtend) >= 0)
             break;
 
-        calIDateTime * const cdt = new calDateTime(&next, tz);
-        if (!cdt) {
-            icalrecur_iterator_free(recur_iter);
-            return NS_ERROR_OUT_OF_MEMORY;
-        }
-
-        dates.AppendObject(cdt);
-#ifdef DEBUG_dbo
-        {
-            nsAutoCString str;
-            cdt->ToString(str);
-            printf("  occ: %s\n", str.get());
-        }
-#endif
-        count++;
-        if (aMaxCount && aMaxCount <= count)
+        aOccurrences.AppendElement(next);
+        if (aMaxCount && aMaxCount <= aOccurrences.Length())
             break;
     }
 
     icalrecur_iterator_free(recur_iter);
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+calRecurrenceRule::GetOccurrences(calIDateTime *aStartTime,
+                                  calIDateTime *aRangeStart,
+                                  calIDateTime *aRangeEnd,
+                                  uint32_t aMaxCount,
+                                  uint32_t *aCount, calIDateTime ***aDates)
+{
+    NS_ENSURE_ARG_POINTER(aCount);
+    NS_ENSURE_ARG_POINTER(aDates);
 
+    nsTArray<icaltimetype> occurrences;
+    nsresult rv = ExpandOccurrences(aStartTime, aRangeStart, aRangeEnd,
+                                    aMaxCount, occurrences);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    uint32_t const count = occurrences.Length();
+    calIDateTime ** dateArray = nullptr;
     if (count) {
-        calIDateTime ** const dateArray =
-            static_cast<calIDateTime **>(moz_xmalloc(sizeof(calIDateTime*) * count));
-        CAL_ENSURE_MEMORY(dateArray);
-        for (uint32_t i = 0; i < count; ++i) {
-            NS_ADDREF(dateArray[i] = dates[i]);
+        // All occurrences share the timezone, and they are put straight
+        // into the array we return, holding its reference to them.
+        nsCOMPtr<calITimezone> tz;
+        aStartTime->GetTimezone(getter_AddRefs(tz));
+        icaltimezone const* const icaltz = cal::getIcalTimezone(tz);
+        dateArray = static_cast<calIDateTime **>(
+            moz_xmalloc(sizeof(calIDateTime*) * count));
+
+        for (uint32_t i = 0; i < count; i++) {
+            calIDateTime * const cdt = new calDateTime(&occurrences[i], tz, icaltz);
+            NS_ADDREF(dateArray[i] = cdt);
+#ifdef DEBUG_dbo
+            {
+                nsAutoCString str;
+                cdt->ToString(str);
+                printf("  occ: %s\n", str.get());
+            }
+#endif
         }
-        *aDates = dateArray;
-    } else {
-        *aDates = nullptr;
     }
 
+    *aDates = dateArray;
     *aCount = count;
 
     return NS_OK;
 }
 
+NS_IMETHODIMP
+calRecurrenceRule::GetOccurrenceTimes(calIDateTime *aStartTime,
+                                      calIDateTime *aRangeStart,
+                                      calIDateTime *aRangeEnd,
+                                      uint32_t aMaxCount,
+                                      calITimezone **aTimezone,
+                                      bool *aIsDate,
+                                      JSContext *cx,
+                                      JS::MutableHandleValue _retval)
+{
+    NS_ENSURE_ARG_POINTER(aTimezone);
+    NS_ENSURE_ARG_POINTER(aIsDate);
+
+    nsTArray<icaltimetype> occurrences;
+    nsresult rv = ExpandOccurrences(aStartTime, aRangeStart, aRangeEnd,
+                                    aMaxCount, occurrences);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    uint32_t const count = occurrences.Length();
+    JS::RootedObject times(cx, JS_NewFloat64Array(cx, count));
+    if (!times)
+        return NS_ERROR_OUT_OF_MEMORY;
+
+    {
+        // nothing may run the GC while the array's data is written
+        JS::AutoCheckCannotGC nogc;
+        bool isShared;
+        double * const data = JS_GetFloat64ArrayData(times, &isShared, nogc);
+        for (uint32_t i = 0; i < count; i++) {
+            data[i] = static_cast<double>(calDateTime::NativeTimeOf(&occurrences[i]));
+        }
+    }
+
+    rv = aStartTime->GetTimezone(aTimezone);
+    NS_ENSURE_SUCCESS(rv, rv);
+    rv = aStartTime->GetIsDate(aIsDate);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    _retval.setObject(*times);
+    return NS_OK;
+}
+
 /**
  ** ical property getting/setting
  **/
@@ -580,6 +728,7 @@ calRecurrenceRule::SetIcalProperty(calIIcalProperty *aProp)
 
     mIcalRecur = icalrecur;
 
+    ClearIterators();
     return NS_OK;
 }
 
@@ -6,12 +6,13 @@
 
 #include "calIRecurrenceRule.h"
 #include "calUtils.h"
+#include "nsTArray.h"
 
 extern "C" {
 #include "ical.h"
 }
 
-class calRecurrenceRule : public calIRecurrenceRule,
+class calRecurrenceRule : public calIRecurrenceRuleLibical,
                           public cal::XpcomBase
 {
 public:
@@ -20,10 +21,61 @@ public:
     NS_DECL_ISUPPORTS
     NS_DECL_CALIRECURRENCEITEM
     NS_DECL_CALIRECURRENCERULE
+    NS_DECL_CALIRECURRENCERULELIBICAL
 protected:
-    virtual ~calRecurrenceRule() {}
+    virtual ~calRecurrenceRule() { ClearIterators(); }
+
+    /**
+     * An iterator that GetNextOccurrence left standing at an occurrence,
+     * so that a later call for the same start date can go on from there
+     * instead of iterating from the start again.
+     */
+    struct CachedIterator {
+        CachedIterator() : mIter(nullptr), mLastUse(0) {}
+        ~CachedIterator() { Reset(); }
+        void Reset();
+
+        icalrecur_iterator * mIter;
+        // keeps the libical timezone of mStart alive for the iterator
+        nsCOMPtr<calITimezone> mTimezone;
+        icaltimetype mStart;
+        // no occurrence before mNext is later than this, null if none
+        icaltimetype mPassed;
+        // the occurrence the iterator stopped at, null at the end
+        icaltimetype mNext;
+        uint32_t mLastUse;
+    };
+    struct IteratorCache {
+        IteratorCache() : mUse(0) {}
+        CachedIterator mIterators[2];
+        uint32_t mUse;
+    };
+
+    /**
+     * Drops the plan and the cached iterators, which any change of the
+     * rule outdates.
+     */
+    void ClearIterators();
+
+    /**
+     * Creates an iterator of the rule from its plan, which is shared with
+     * the equal rules of other items.
+     */
+    icalrecur_iterator * NewIterator(icaltimetype const& dtstart);
+
+    /**
+     * Appends the occurrences GetOccurrences returns to aOccurrences, in
+     * the timezone of aStartTime.
+     */
+    nsresult ExpandOccurrences(calIDateTime *aStartTime,
+                               calIDateTime *aRangeStart,
+                               calIDateTime *aRangeEnd,
+                               uint32_t aMaxCount,
+                               nsTArray<icaltimetype> &aOccurrences);
 
     icalrecurrencetype mIcalRecur;
+    icalrecur_plan * mPlan;
+    nsAutoPtr<IteratorCache> mIteratorCache;
 
     bool mImmutable;
     bool mIsNegative;
@@ -0,0 +1,720 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "calRecurrenceSet.h"
+
+#include "calDateTime.h"
+#include "calIDuration.h"
+#include "calIRecurrenceDate.h"
+#include "calIRecurrenceRule.h"
+
+#include "nsAutoPtr.h"
+#include "nsCOMArray.h"
+#include "nsIClassInfoImpl.h"
+#include "nsString.h"
+#include "nsTArray.h"
+
+#include <algorithm>
+
+extern "C" {
+#include "ical.h"
+}
+
+NS_IMPL_CLASSINFO(calRecurrenceSet, nullptr, nsIClassInfo::SINGLETON, CAL_RECURRENCESET_CID)
+NS_IMPL_ISUPPORTS_CI(calRecurrenceSet, calIRecurrenceSet)
+
+namespace {
+
+/**
+ * The occurrences of the recurrence items are merged as streams ordered by
+ * their times, so that the negative items and the overrides can be taken
+ * out going through each stream once, and no more occurrences are worked
+ * out than are returned.
+ *
+ * An occurrence is ordered by its time in UTC, or as it is if it is
+ * floating or a date. Two occurrences with the same time and kind have the
+ * same recurrence id key in calRecurrenceInfo.js. As calIDateTime::compare
+ * does, a floating time matches a time in a timezone by its wall clock
+ * time, and a date taken out of a recurrence set takes out the occurrences
+ * on that day in their own timezones.
+ */
+int64_t const kHour = int64_t(3600) * PR_USEC_PER_SEC;
+int64_t const kDay = 24 * kHour;
+
+// How far the time of day in a timezone may be off that in UTC.
+int64_t const kMaxOffset = kDay;
+
+// Without an end of the range, an infinite EXRULE may take out all the
+// occurrences left; the search gives up after this many in a row.
+uint32_t const kMaxTakenOut = 100000;
+
+enum {
+    kDateTime = 0,
+    kFloating = 1,
+    kDate = 2
+};
+
+struct Occurrence {
+    icaltimetype mTime;
+    PRTime mKey;
+    // the wall clock time, as if it were in UTC
+    PRTime mLocalKey;
+    int mKind;
+    // the date-time of an RDATE or override, weak
+    calIDateTime * mDate;
+};
+
+Occurrence MakeOccurrence(icaltimetype const& t, calIDateTime * date)
+{
+    Occurrence occ;
+    occ.mTime = t;
+    occ.mDate = date;
+    if (t.is_date) {
+        icaltimetype day = t;
+        day.zone = nullptr;
+        day.is_utc = 0;
+        occ.mKey = calDateTime::NativeTimeOf(&day);
+        occ.mLocalKey = occ.mKey;
+        occ.mKind = kDate;
+    } else {
+        icaltimetype wall = t;
+        wall.zone = nullptr;
+        wall.is_utc = 0;
+        occ.mKey = calDateTime::NativeTimeOf(&t);
+        occ.mLocalKey = calDateTime::NativeTimeOf(&wall);
+        occ.mKind = (t.zone || t.is_utc ? kDateTime : kFloating);
+    }
+    return occ;
+}
+
+inline bool IsBefore(Occurrence const& a, Occurrence const& b)
+{
+    return a.mKey < b.mKey || (a.mKey == b.mKey && a.mKind < b.mKind);
+}
+
+inline bool IsSame(Occurrence const& a, Occurrence const& b)
+{
+    return a.mKey == b.mKey && a.mKind == b.mKind;
+}
+
+// Whether a negative item or recurrence id takes out an occurrence. With
+// aByDay, a date takes out all the occurrences on that day.
+bool Matches(Occurrence const& aMember, Occurrence const& aOcc, bool aByDay)
+{
+    if (aMember.mKind == kDate || aOcc.mKind == kDate) {
+        if (aByDay && aMember.mKind == kDate) {
+            return aOcc.mLocalKey >= aMember.mKey &&
+                   aOcc.mLocalKey < aMember.mKey + kDay;
+        }
+        return IsSame(aMember, aOcc);
+    }
+    if (aMember.mKind == kFloating || aOcc.mKind == kFloating) {
+        return aMember.mLocalKey == aOcc.mLocalKey;
+    }
+    return aMember.mKey == aOcc.mKey;
+}
+
+inline icaltimetype ensureDateTime(icaltimetype const& icalt)
+{
+    icaltimetype ret = icalt;
+    if (ret.is_date) {
+        ret.is_date = 0;
+        ret.hour = 0;
+        ret.minute = 0;
+        ret.second = 0;
+    }
+    return ret;
+}
+
+icaltimetype AddDays(icaltimetype const& t, int days)
+{
+    icaldurationtype d = icaldurationtype_null_duration();
+    d.is_neg = (days < 0);
+    d.days = (days < 0 ? -days : days);
+    return icaltime_add(t, d);
+}
+
+class Stream
+{
+public:
+    virtual ~Stream() {}
+    // Gets the next occurrence, returns false at the end.
+    virtual bool Next(Occurrence & aNext) = 0;
+};
+
+/**
+ * libical expands the values of a BY list in the order they are given, so
+ * a rule may give its occurrences out of order, though never by more than
+ * the period the list is expanded in, plus an hour when the clocks change.
+ * The occurrences are then held back until no earlier one can come.
+ */
+class RuleStream : public Stream
+{
+public:
+    RuleStream(icalrecur_iterator * aIter, int64_t aSpan)
+        : mIter(aIter), mSpan(aSpan), mLatest(0), mAtEnd(false) {}
+    virtual ~RuleStream() { icalrecur_iterator_free(mIter); }
+
+    virtual bool Next(Occurrence & aNext) override {
+        if (!mSpan) {
+            return NextOfRule(aNext);
+        }
+        while (!mAtEnd && (mHeld.IsEmpty() || mHeld[0].mKey + mSpan >= mLatest)) {
+            Occurrence occ;
+            if (!NextOfRule(occ)) {
+                mAtEnd = true;
+                break;
+            }
+            mLatest = occ.mKey;
+            mHeld.AppendElement(occ);
+            std::push_heap(mHeld.Elements(), mHeld.Elements() + mHeld.Length(),
+                           IsAfter);
+        }
+        if (mHeld.IsEmpty()) {
+            return false;
+        }
+        std::pop_heap(mHeld.Elements(), mHeld.Elements() + mHeld.Length(), IsAfter);
+        aNext = mHeld.LastElement();
+        mHeld.RemoveElementAt(mHeld.Length() - 1);
+        return true;
+    }
+private:
+    bool NextOfRule(Occurrence & aNext) {
+        icaltimetype const next = icalrecur_iterator_next(mIter);
+        if (icaltime_is_null_time(next)) {
+            return false;
+        }
+        aNext = MakeOccurrence(next, nullptr);
+        return true;
+    }
+    static bool IsAfter(Occurrence const& a, Occurrence const& b) {
+        return IsBefore(b, a);
+    }
+
+    icalrecur_iterator * mIter;
+    int64_t mSpan;
+    nsTArray<Occurrence> mHeld;
+    PRTime mLatest;
+    bool mAtEnd;
+};
+
+// the list has to be sorted and outlive the stream
+class ListStream : public Stream
+{
+public:
+    explicit ListStream(nsTArray<Occurrence> const& aList)
+        : mList(aList), mIndex(0) {}
+
+    virtual bool Next(Occurrence & aNext) override {
+        if (mIndex == mList.Length()) {
+            return false;
+        }
+        aNext = mList[mIndex++];
+        return true;
+    }
+private:
+    nsTArray<Occurrence> const& mList;
+    uint32_t mIndex;
+};
+
+/**
+ * Merges streams through a min-heap of their next occurrences.
+ */
+class MergeStream : public Stream
+{
+public:
+    MergeStream() {}
+    virtual ~MergeStream() {
+        for (Stream * stream : mStreams) {
+            delete stream;
+        }
+    }
+
+    // takes over aStream
+    void Add(Stream * aStream) {
+        mStreams.AppendElement(aStream);
+        Head head;
+        head.mStream = aStream;
+        if (aStream->Next(head.mNext)) {
+            mHeap.AppendElement(head);
+            std::push_heap(mHeap.Elements(), mHeap.Elements() + mHeap.Length(),
+                           IsLater);
+        }
+    }
+
+    virtual bool Next(Occurrence & aNext) override {
+        if (mHeap.IsEmpty()) {
+            return false;
+        }
+        std::pop_heap(mHeap.Elements(), mHeap.Elements() + mHeap.Length(),
+                      IsLater);
+        Head & head = mHeap.LastElement();
+        aNext = head.mNext;
+        if (head.mStream->Next(head.mNext)) {
+            std::push_heap(mHeap.Elements(), mHeap.Elements() + mHeap.Length(),
+                           IsLater);
+        } else {
+            mHeap.RemoveElementAt(mHeap.Length() - 1);
+        }
+        return true;
+    }
+private:
+    struct Head {
+        Occurrence mNext;
+        Stream * mStream;
+    };
+    static bool IsLater(Head const& a, Head const& b) {
+        return IsBefore(b.mNext, a.mNext);
+    }
+
+    nsTArray<Stream *> mStreams;
+    nsTArray<Head> mHeap;
+};
+
+/**
+ * Tells whether the occurrences of an ordered stream are in a set, given
+ * by another ordered stream, going through both once, see Matches(). The
+ * members that may match are kept in a window, which spans the offsets of
+ * the timezones, as floating times and dates are ordered by wall clock.
+ */
+class Subtraction
+{
+public:
+    // takes over aSet
+    Subtraction(Stream * aSet, bool aByDay)
+        : mSet(aSet), mByDay(aByDay), mHasPeek(false), mAtEnd(false) {}
+
+    // aOcc must not be before the occurrences asked for before
+    bool Contains(Occurrence const& aOcc) {
+        while (!mAtEnd) {
+            if (!mHasPeek) {
+                if (!mSet->Next(mPeek)) {
+                    mAtEnd = true;
+                    break;
+                }
+                mHasPeek = true;
+            }
+            if (mPeek.mKey > aOcc.mKey + kMaxOffset) {
+                break;
+            }
+            mWindow.AppendElement(mPeek);
+            mHasPeek = false;
+        }
+
+        bool found = false;
+        for (uint32_t i = 0; i < mWindow.Length(); ) {
+            Occurrence const& member = mWindow[i];
+            int64_t const span = (mByDay && member.mKind == kDate ? kDay : 0);
+            // no later occurrence can be matched by a member this early
+            if (member.mKey + span + kMaxOffset < aOcc.mKey) {
+                mWindow.RemoveElementAt(i);
+                continue;
+            }
+            if (Matches(member, aOcc, mByDay)) {
+                found = true;
+            }
+            ++i;
+        }
+        return found;
+    }
+private:
+    nsAutoPtr<Stream> mSet;
+    bool mByDay;
+    nsTArray<Occurrence> mWindow;
+    Occurrence mPeek;
+    bool mHasPeek;
+    bool mAtEnd;
+};
+
+/**
+ * The occurrences of the positive items in a range, without duplicates and
+ * without those that are overridden or taken out by a negative item.
+ */
+class PositiveStream : public Stream
+{
+public:
+    // takes over the streams
+    PositiveStream(Stream * aPositives, Stream * aOverridden,
+                   Stream * aNegatives, icaltimetype const& aSearchStart,
+                   icaltimetype const& aRangeStart, icaltimetype const* aRangeEnd,
+                   icaldurationtype const* aDuration)
+        : mPositives(aPositives),
+          mOverridden(aOverridden, false),
+          mNegatives(aNegatives, true),
+          mSearchStart(aSearchStart),
+          mRangeStart(aRangeStart),
+          mHasRangeEnd(aRangeEnd != nullptr),
+          mHasDuration(aDuration != nullptr),
+          mHasLast(false),
+          mTakenOut(0)
+    {
+        if (aRangeEnd) {
+            mRangeEnd = *aRangeEnd;
+            // dates are ordered as they are, which may be up to a day
+            // off their time in UTC
+            mEndKey = calDateTime::NativeTimeOf(aRangeEnd) + kDay;
+        }
+        if (aDuration) {
+            mDuration = *aDuration;
+        }
+    }
+
+    virtual bool Next(Occurrence & aNext) override {
+        Occurrence occ;
+        while (mPositives->Next(occ)) {
+            if (mHasRangeEnd && occ.mKey >= mEndKey) {
+                return false;
+            }
+            if (mHasLast && IsSame(occ, mLast)) {
+                continue;
+            }
+            mLast = occ;
+            mHasLast = true;
+
+            icaltimetype const dt(ensureDateTime(occ.mTime));
+            if (icaltime_compare(dt, mSearchStart) < 0) {
+                continue;
+            }
+            if (mHasRangeEnd && icaltime_compare(dt, mRangeEnd) >= 0) {
+                continue;
+            }
+            // only the occurrences that end after the start of the range
+            if (mHasDuration &&
+                icaltime_compare(ensureDateTime(icaltime_add(occ.mTime, mDuration)),
+                                 mRangeStart) <= 0) {
+                continue;
+            }
+
+            if (mOverridden.Contains(occ)) {
+                continue;
+            }
+            if (mNegatives.Contains(occ)) {
+                if (!mHasRangeEnd && ++mTakenOut > kMaxTakenOut) {
+                    NS_WARNING("Negative recurrence items take out all occurrences");
+                    return false;
+                }
+                continue;
+            }
+            mTakenOut = 0;
+            aNext = occ;
+            return true;
+        }
+        return false;
+    }
+private:
+    nsAutoPtr<Stream> mPositives;
+    Subtraction mOverridden;
+    Subtraction mNegatives;
+    icaltimetype mSearchStart;
+    icaltimetype mRangeStart;
+    icaltimetype mRangeEnd;
+    PRTime mEndKey;
+    icaldurationtype mDuration;
+    bool mHasRangeEnd;
+    bool mHasDuration;
+    Occurrence mLast;
+    bool mHasLast;
+    uint32_t mTakenOut;
+};
+
+struct Override {
+    Occurrence mId;
+    Occurrence mStart;
+};
+
+bool IsOverrideIdBefore(Override const& a, Override const& b)
+{
+    return IsBefore(a.mId, b.mId);
+}
+
+bool IsOverrideStartBefore(Override const& a, Override const& b)
+{
+    return IsBefore(a.mStart, b.mStart);
+}
+
+nsresult ToIcalTime(calIDateTime * aDate, icaltimetype * aTime)
+{
+    nsresult rv;
+    nsCOMPtr<calIDateTimeLibical> icaldt = do_QueryInterface(aDate, &rv);
+    NS_ENSURE_SUCCESS(rv, rv);
+    icaldt->ToIcalTime(aTime);
+    return NS_OK;
+}
+
+/**
+ * How far the occurrences of a rule may come out of order, see RuleStream.
+ * libical sorts the days of BYDAY, which keeps them in order unless they
+ * have positions.
+ */
+int64_t DisorderSpanOf(calIRecurrenceRule * aRule)
+{
+    static struct {
+        char const* mName;
+        int64_t mSpan;
+        bool mIsDay;
+    } const kParts[] = {
+        { "BYSETPOS", 367 * kDay, false },
+        { "BYMONTH", 367 * kDay, false },
+        { "BYWEEKNO", 367 * kDay, false },
+        { "BYYEARDAY", 367 * kDay, false },
+        { "BYDAY", 367 * kDay, true },
+        { "BYMONTHDAY", 32 * kDay, false },
+        { "BYHOUR", kDay + kHour, false },
+        { "BYMINUTE", 2 * kHour, false },
+        { "BYSECOND", kHour + kHour / 60, false }
+    };
+
+    for (auto const& part : kParts) {
+        uint32_t count = 0;
+        int16_t * values = nullptr;
+        if (NS_FAILED(aRule->GetComponent(nsDependentCString(part.mName),
+                                          &count, &values))) {
+            return kParts[0].mSpan;
+        }
+        bool inOrder = true;
+        for (uint32_t i = 0; i < count && inOrder; ++i) {
+            if (part.mIsDay) {
+                // and the days are sorted, but not made unique
+                inOrder = (icalrecurrencetype_day_position(values[i]) == 0);
+                for (uint32_t j = 0; j < i && inOrder; ++j) {
+                    inOrder = (values[j] != values[i]);
+                }
+            } else {
+                inOrder = (count == 1 ||
+                           (values[i] > 0 && (i == 0 || values[i - 1] < values[i])));
+            }
+        }
+        free(values);
+        if (!inOrder) {
+            return part.mSpan;
+        }
+    }
+    return 0;
+}
+
+typedef nsTArray<nsCOMPtr<calIRecurrenceRuleLibical> > RuleArray;
+
+/**
+ * Merges the occurrences of rules and dates, those of the rules from
+ * about aFrom on.
+ */
+nsresult NewMergeStream(RuleArray const& aRules, icaltimetype * aDtstart,
+                        icaltimetype const& aFrom,
+                        nsTArray<Occurrence> const& aDates,
+                        MergeStream ** aResult)
+{
+    nsAutoPtr<MergeStream> merge(new MergeStream());
+    for (calIRecurrenceRuleLibical * rule : aRules) {
+        icalrecur_iterator * const iter = rule->CreateIterator(aDtstart);
+        if (!iter) {
+            return NS_ERROR_OUT_OF_MEMORY;
+        }
+        icalrecur_iterator_set_start(iter, aFrom);
+        merge->Add(new RuleStream(iter, DisorderSpanOf(rule)));
+    }
+    merge->Add(new ListStream(aDates));
+    *aResult = merge.forget();
+    return NS_OK;
+}
+
+} // anonymous namespace
+
+NS_IMETHODIMP
+calRecurrenceSet::Expand(calIDateTime *aStartDate,
+                         uint32_t aItemCount,
+                         calIRecurrenceItem **aItems,
+                         calIDateTime *aRangeStart,
+                         calIDateTime *aRangeEnd,
+                         calIDuration *aDuration,
+                         uint32_t aMaxCount,
+                         uint32_t aOverrideCount,
+                         calIDateTime **aOverrideIds,
+                         calIDateTime **aOverrideStarts,
+                         uint32_t *aCount,
+                         calIDateTime ***aRecurrenceIds,
+                         calIDateTime ***aStartDates)
+{
+    NS_ENSURE_ARG_POINTER(aStartDate);
+    NS_ENSURE_ARG_POINTER(aRangeStart);
+    NS_ENSURE_ARG_POINTER(aCount);
+    NS_ENSURE_ARG_POINTER(aRecurrenceIds);
+    NS_ENSURE_ARG_POINTER(aStartDates);
+
+    nsresult rv;
+    icaltimetype dtstart, rangestart, rangeend;
+    rv = ToIcalTime(aStartDate, &dtstart);
+    NS_ENSURE_SUCCESS(rv, rv);
+    rv = ToIcalTime(aRangeStart, &rangestart);
+    NS_ENSURE_SUCCESS(rv, rv);
+    rangestart = ensureDateTime(rangestart);
+    if (aRangeEnd) {
+        rv = ToIcalTime(aRangeEnd, &rangeend);
+        NS_ENSURE_SUCCESS(rv, rv);
+        rangeend = ensureDateTime(rangeend);
+    }
+
+    // Occurrences that start before the range but end in it are in it, so
+    // the search starts a duration earlier.
+    icaldurationtype duration;
+    icaltimetype searchstart = rangestart;
+    if (aDuration) {
+        nsCOMPtr<calIDurationLibical> icaldur = do_QueryInterface(aDuration, &rv);
+        NS_ENSURE_SUCCESS(rv, rv);
+        icaldur->ToIcalDuration(&duration);
+        icaldurationtype back = duration;
+        back.is_neg = !back.is_neg;
+        searchstart = icaltime_add(rangestart, back);
+    }
+
+    // Sort the recurrence items. The dates are held here for as long as
+    // their occurrences are.
+    nsCOMArray<calIDateTime> dateHolder;
+    nsTArray<Occurrence> dates, negativeDates;
+    RuleArray rules, negativeRules;
+    bool infinite = false;
+    for (uint32_t i = 0; i < aItemCount; ++i) {
+        calIRecurrenceItem * const item = aItems[i];
+        NS_ENSURE_ARG_POINTER(item);
+        bool isNegative = false;
+        item->GetIsNegative(&isNegative);
+
+        nsCOMPtr<calIRecurrenceDate> rdate = do_QueryInterface(item);
+        if (rdate) {
+            nsCOMPtr<calIDateTime> date;
+            rdate->GetDate(getter_AddRefs(date));
+            if (!date) {
+                continue;
+            }
+            icaltimetype t;
+            rv = ToIcalTime(date, &t);
+            NS_ENSURE_SUCCESS(rv, rv);
+            dateHolder.AppendObject(date);
+            (isNegative ? negativeDates : dates).AppendElement(MakeOccurrence(t, date));
+            continue;
+        }
+
+        nsCOMPtr<calIRecurrenceRuleLibical> rule = do_QueryInterface(item, &rv);
+        NS_ENSURE_SUCCESS(rv, rv);
+        if (isNegative) {
+            negativeRules.AppendElement(rule);
+        } else {
+            bool isFinite = true;
+            rule->GetIsFinite(&isFinite);
+            infinite = infinite || !isFinite;
+            rules.AppendElement(rule);
+        }
+    }
+    std::sort(dates.Elements(), dates.Elements() + dates.Length(), IsBefore);
+    std::sort(negativeDates.Elements(),
+              negativeDates.Elements() + negativeDates.Length(), IsBefore);
+
+    // make sure the request is sane; infinite recurrence
+    // with no end time is bad times.
+    if (!aMaxCount && !aRangeEnd && infinite) {
+        return NS_ERROR_INVALID_ARG;
+    }
+
+    // The overrides take the occurrences of their recurrence ids out,
+    // those in the range are put in at their start dates unless a
+    // negative item takes them out as well.
+    nsTArray<Occurrence> overridden;
+    nsTArray<Override> overrides;
+    for (uint32_t i = 0; i < aOverrideCount; ++i) {
+        NS_ENSURE_ARG_POINTER(aOverrideIds[i]);
+        icaltimetype t;
+        rv = ToIcalTime(aOverrideIds[i], &t);
+        NS_ENSURE_SUCCESS(rv, rv);
+        Occurrence const id(MakeOccurrence(t, aOverrideIds[i]));
+        overridden.AppendElement(id);
+
+        if (aOverrideStarts[i]) {
+            rv = ToIcalTime(aOverrideStarts[i], &t);
+            NS_ENSURE_SUCCESS(rv, rv);
+            Override * const entry = overrides.AppendElement();
+            entry->mId = id;
+            entry->mStart = MakeOccurrence(t, aOverrideStarts[i]);
+        }
+    }
+    std::sort(overridden.Elements(),
+              overridden.Elements() + overridden.Length(), IsBefore);
+
+    if (!overrides.IsEmpty()) {
+        std::sort(overrides.Elements(), overrides.Elements() + overrides.Length(),
+                  IsOverrideIdBefore);
+        // A negative date may take out occurrences up to a day and the
+        // offset of a timezone after it, see Subtraction.
+        MergeStream * negatives;
+        rv = NewMergeStream(negativeRules, &dtstart,
+                            AddDays(overrides[0].mId.mTime, -2),
+                            negativeDates, &negatives);
+        NS_ENSURE_SUCCESS(rv, rv);
+        Subtraction removed(negatives, true);
+        for (uint32_t i = 0; i < overrides.Length(); ) {
+            if (removed.Contains(overrides[i].mId)) {
+                overrides.RemoveElementAt(i);
+            } else {
+                ++i;
+            }
+        }
+        std::stable_sort(overrides.Elements(), overrides.Elements() + overrides.Length(),
+                         IsOverrideStartBefore);
+    }
+
+    MergeStream * positives;
+    rv = NewMergeStream(rules, &dtstart, searchstart, dates, &positives);
+    NS_ENSURE_SUCCESS(rv, rv);
+    nsAutoPtr<Stream> positivesHolder(positives);
+    MergeStream * negatives;
+    rv = NewMergeStream(negativeRules, &dtstart, AddDays(searchstart, -2),
+                        negativeDates, &negatives);
+    NS_ENSURE_SUCCESS(rv, rv);
+    PositiveStream occurrences(positivesHolder.forget(),
+                               new ListStream(overridden), negatives,
+                               searchstart, rangestart,
+                               aRangeEnd ? &rangeend : nullptr,
+                               aDuration ? &duration : nullptr);
+
+    // Merge the overrides in at their start dates.
+    nsTArray<Override> results;
+    Occurrence next;
+    bool hasNext = occurrences.Next(next);
+    uint32_t ov = 0;
+    while (!aMaxCount || results.Length() < aMaxCount) {
+        if (hasNext && (ov == overrides.Length() ||
+                        !IsBefore(overrides[ov].mStart, next))) {
+            Override * const result = results.AppendElement();
+            result->mId = next;
+            result->mStart = next;
+            hasNext = occurrences.Next(next);
+        } else if (ov < overrides.Length()) {
+            results.AppendElement(overrides[ov++]);
+        } else {
+            break;
+        }
+    }
+
+    uint32_t const count = results.Length();
+    calIDateTime ** ids = nullptr;
+    calIDateTime ** starts = nullptr;
+    if (count) {
+        // The occurrences of the rules share the timezone of the start date.
+        nsCOMPtr<calITimezone> tz;
+        aStartDate->GetTimezone(getter_AddRefs(tz));
+        icaltimezone const* const icaltz = cal::getIcalTimezone(tz);
+        ids = static_cast<calIDateTime **>(moz_xmalloc(sizeof(calIDateTime*) * count));
+        starts = static_cast<calIDateTime **>(moz_xmalloc(sizeof(calIDateTime*) * count));
+        for (uint32_t i = 0; i < count; ++i) {
+            Override const& result = results[i];
+            calIDateTime * const start = (result.mStart.mDate ? result.mStart.mDate :
+                                          new calDateTime(&result.mStart.mTime, tz, icaltz));
+            NS_ADDREF(starts[i] = start);
+            NS_ADDREF(ids[i] = (result.mId.mDate ? result.mId.mDate : start));
+        }
+    }
+
+    *aRecurrenceIds = ids;
+    *aStartDates = starts;
+    *aCount = count;
+    return NS_OK;
+}
@@ -0,0 +1,26 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+#if !defined(INCLUDED_CAL_RECURRENCESET_H)
+#define INCLUDED_CAL_RECURRENCESET_H
+
+#include "calIRecurrenceSet.h"
+#include "calUtils.h"
+
+/**
+ * Expands recurrence sets by merging the occurrences of their recurrence
+ * items as they are iterated, see calRecurrenceSet.cpp.
+ */
+class calRecurrenceSet : public calIRecurrenceSet,
+                         public cal::XpcomBase
+{
+public:
+    calRecurrenceSet() {}
+
+    NS_DECL_ISUPPORTS
+    NS_DECL_CALIRECURRENCESET
+protected:
+    virtual ~calRecurrenceSet() {}
+};
+
+#endif // INCLUDED_CAL_RECURRENCESET_H
@@ -0,0 +1,187 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+#include "nsIFile.h"
+#include "nsStringEnumerator.h"
+#include "nsThreadUtils.h"
+#include "nsTArray.h"
+#include "prio.h"
+
+#include "calTimezoneDatabase.h"
+#include "calICSService.h"
+
+namespace {
+
+// The one mapped database of the process. It is never unmapped.
+struct MappedDatabase
+{
+    nsCString   mPath;
+    PRFileDesc *mFd;
+    PRFileMap  *mMap;
+    void       *mData;
+    icaltzdb   *mDatabase;
+};
+
+MappedDatabase *sMappedDatabase = nullptr;
+
+nsresult
+MapDatabase(nsIFile *aFile, nsACString const& aPath)
+{
+    int64_t size;
+    nsresult rv = aFile->GetFileSize(&size);
+    NS_ENSURE_SUCCESS(rv, rv);
+    if (size <= 0 || size > INT32_MAX) {
+        return NS_ERROR_FILE_CORRUPTED;
+    }
+
+    PRFileDesc *fd;
+    rv = aFile->OpenNSPRFileDesc(PR_RDONLY, 0, &fd);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    PRFileMap * const map = PR_CreateFileMap(fd, size, PR_PROT_READONLY);
+    if (!map) {
+        PR_Close(fd);
+        return NS_ERROR_FAILURE;
+    }
+    void * const data = PR_MemMap(map, 0, uint32_t(size));
+    if (!data) {
+        PR_CloseFileMap(map);
+        PR_Close(fd);
+        return NS_ERROR_FAILURE;
+    }
+
+    icaltzdb * const db = icaltzdb_new_from_data(data, size_t(size));
+    if (!db || !icaltimezone_set_builtin_database(data, size_t(size))) {
+        if (db) {
+            icaltzdb_free(db);
+        }
+        PR_MemUnmap(data, uint32_t(size));
+        PR_CloseFileMap(map);
+        PR_Close(fd);
+        return NS_ERROR_FILE_CORRUPTED;
+    }
+
+    sMappedDatabase = new MappedDatabase;
+    sMappedDatabase->mPath = aPath;
+    sMappedDatabase->mFd = fd;
+    sMappedDatabase->mMap = map;
+    sMappedDatabase->mData = data;
+    sMappedDatabase->mDatabase = db;
+    return NS_OK;
+}
+
+}
+
+NS_IMPL_ISUPPORTS(calTimezoneDatabase, calITimezoneDatabase)
+
+nsresult
+calTimezoneDatabase::Open(nsIFile *aFile, calITimezoneDatabase **aResult)
+{
+    NS_ENSURE_ARG_POINTER(aFile);
+    NS_ENSURE_ARG_POINTER(aResult);
+    NS_ENSURE_TRUE(NS_IsMainThread(), NS_ERROR_NOT_SAME_THREAD);
+
+    nsAutoCString path;
+    nsresult rv = aFile->GetNativePath(path);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    if (!sMappedDatabase) {
+        rv = MapDatabase(aFile, path);
+        NS_ENSURE_SUCCESS(rv, rv);
+    } else if (!sMappedDatabase->mPath.Equals(path)) {
+        return NS_ERROR_ALREADY_INITIALIZED;
+    }
+
+    calITimezoneDatabase * const db = new calTimezoneDatabase(sMappedDatabase->mDatabase);
+    CAL_ENSURE_MEMORY(db);
+    NS_ADDREF(*aResult = db);
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+calTimezoneDatabase::GetVersion(nsACString &aVersion)
+{
+    aVersion.Assign(icaltzdb_get_version(mDatabase));
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+calTimezoneDatabase::GetTimezoneIds(nsIUTF8StringEnumerator **aTimezoneIds)
+{
+    NS_ENSURE_ARG_POINTER(aTimezoneIds);
+    int const count = icaltzdb_count_zones(mDatabase);
+    nsTArray<nsCString> * const ids = new nsTArray<nsCString>(count);
+    for (int i = 0; i < count; ++i) {
+        ids->AppendElement(nsDependentCString(icaltzdb_get_zone_tzid(mDatabase, i)));
+    }
+    return NS_NewAdoptingUTF8StringEnumerator(aTimezoneIds, ids);
+}
+
+NS_IMETHODIMP
+calTimezoneDatabase::GetAliasIds(nsIUTF8StringEnumerator **aAliasIds)
+{
+    NS_ENSURE_ARG_POINTER(aAliasIds);
+    int const count = icaltzdb_count_aliases(mDatabase);
+    nsTArray<nsCString> * const ids = new nsTArray<nsCString>(count);
+    for (int i = 0; i < count; ++i) {
+        ids->AppendElement(nsDependentCString(icaltzdb_get_alias_tzid(mDatabase, i)));
+    }
+    return NS_NewAdoptingUTF8StringEnumerator(aAliasIds, ids);
+}
+
+NS_IMETHODIMP
+calTimezoneDatabase::GetAliasTarget(nsACString const& tzid, nsACString &_retval)
+{
+    int const alias = icaltzdb_find_alias(mDatabase, PromiseFlatCString(tzid).get());
+    if (alias < 0) {
+        _retval.Truncate();
+    } else {
+        _retval.Assign(icaltzdb_get_alias_target(mDatabase, alias));
+    }
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+calTimezoneDatabase::GetZone(nsACString const& tzid,
+                             nsACString &ics,
+                             nsACString &latitude,
+                             nsACString &longitude,
+                             bool *_retval)
+{
+    NS_ENSURE_ARG_POINTER(_retval);
+    int const zone = icaltzdb_find_zone(mDatabase, PromiseFlatCString(tzid).get());
+    *_retval = (zone >= 0);
+    if (zone < 0) {
+        ics.Truncate();
+        latitude.Truncate();
+        longitude.Truncate();
+        return NS_OK;
+    }
+    ics.Assign(icaltzdb_get_zone_vtimezone(mDatabase, zone));
+    latitude.Assign(icaltzdb_get_zone_latitude(mDatabase, zone));
+    longitude.Assign(icaltzdb_get_zone_longitude(mDatabase, zone));
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+calTimezoneDatabase::GetZoneComponent(nsACString const& tzid, calIIcalComponent **_retval)
+{
+    NS_ENSURE_ARG_POINTER(_retval);
+    PromiseFlatCString const flatTzid(tzid);
+    if (icaltzdb_find_zone(mDatabase, flatTzid.get()) < 0) {
+        *_retval = nullptr;
+        return NS_OK;
+    }
+
+    // Owns a copy of the VTIMEZONE, the changes are those of the builtin
+    // timezone, as loaded from the database.
+    icaltimezone * const zone = icaltimezone_new_from_builtin(flatTzid.get());
+    NS_ENSURE_TRUE(zone, NS_ERROR_FAILURE);
+    calIIcalComponent * const comp = new calIcalComponent(zone, icaltimezone_get_component(zone));
+    if (!comp) {
+        icaltimezone_free(zone, 1 /* free struct */);
+        CAL_ENSURE_MEMORY(comp);
+    }
+    NS_ADDREF(*_retval = comp);
+    return NS_OK;
+}
@@ -0,0 +1,36 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+#if !defined(INCLUDED_CAL_TIMEZONEDATABASE_H)
+#define INCLUDED_CAL_TIMEZONEDATABASE_H
+
+#include "calIICSService.h"
+#include "calUtils.h"
+
+class nsIFile;
+
+extern "C" {
+#include "ical.h"
+}
+
+// The timezone database of the process. The file stays mapped until the
+// process exits, since libical's builtin timezones, and the zones handed
+// out by GetZoneComponent, point into it. Main thread only, as libical
+// loads its builtin timezones when they are first used.
+class calTimezoneDatabase : public calITimezoneDatabase,
+                            public cal::XpcomBase
+{
+public:
+    static nsresult Open(nsIFile *aFile, calITimezoneDatabase **aResult);
+
+    NS_DECL_ISUPPORTS
+    NS_DECL_CALITIMEZONEDATABASE
+
+protected:
+    explicit calTimezoneDatabase(icaltzdb *db) : mDatabase(db) {}
+    virtual ~calTimezoneDatabase() {}
+
+    icaltzdb * const mDatabase;
+};
+
+#endif // INCLUDED_CAL_TIMEZONEDATABASE_H
@@ -2,6 +2,15 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 #include "nsComponentManagerUtils.h"
+#include "nsDataHashtable.h"
+#include "nsInterfaceHashtable.h"
+#include "nsIObserver.h"
+#include "nsIObserverService.h"
+#include "nsThreadUtils.h"
+#include "mozilla/Mutex.h"
+#include "mozilla/Services.h"
+#include "mozilla/StaticMutex.h"
+#include "mozilla/StaticPtr.h"
 
 #include "calUtils.h"
 #include "nsIScriptError.h"
@@ -10,6 +19,151 @@ extern "C" {
 #include "ical.h"
 }
 
+namespace {
+
+// notified by the timezone service when it has (re)loaded its zones
+char const kTimezonesUpdatedTopic[] = "calendar-timezones-updated";
+
+/**
+ * Caches the zones of the timezone service by TZID, and the libical
+ * timezones of the zones, to save the calls into the JS service.
+ * Every update of the service starts a new generation of the cache;
+ * a zone resolved during an older generation isn't added.
+ */
+class TimezoneCache final : public nsIObserver
+{
+public:
+    NS_DECL_THREADSAFE_ISUPPORTS
+    NS_DECL_NSIOBSERVER
+
+    // creates the cache on the main thread, may return null elsewhere
+    static already_AddRefed<TimezoneCache> Get();
+
+    bool Lookup(nsACString const& tzid, calITimezone ** tz, uint32_t * generation);
+    bool LookupIcalTimezone(calITimezone * tz, icaltimezone ** icaltz);
+    void Put(nsACString const& tzid, calITimezone * tz, icaltimezone * icaltz,
+             uint32_t generation);
+    bool IsService(calITimezoneProvider * tzProvider) const {
+        return tzProvider && tzProvider == mService;
+    }
+
+private:
+    explicit TimezoneCache(calITimezoneProvider * service)
+        : mMutex("TimezoneCache::mMutex"), mService(service), mGeneration(0) {}
+    ~TimezoneCache() {}
+    void Flush();
+
+    static mozilla::StaticMutex sMutex;
+    static mozilla::StaticRefPtr<TimezoneCache> sCache;
+    static bool sShutdown;
+
+    mozilla::Mutex mMutex; // guards everything below
+    nsCOMPtr<calITimezoneProvider> const mService;
+    nsInterfaceHashtable<nsCStringHashKey, calITimezone> mTimezones;
+    nsDataHashtable<nsISupportsHashKey, icaltimezone *> mIcalTimezones;
+    uint32_t mGeneration;
+};
+
+mozilla::StaticMutex TimezoneCache::sMutex;
+mozilla::StaticRefPtr<TimezoneCache> TimezoneCache::sCache;
+bool TimezoneCache::sShutdown = false;
+
+NS_IMPL_ISUPPORTS(TimezoneCache, nsIObserver)
+
+already_AddRefed<TimezoneCache>
+TimezoneCache::Get()
+{
+    {
+        mozilla::StaticMutexAutoLock lock(sMutex);
+        if (sCache || sShutdown || !NS_IsMainThread()) {
+            RefPtr<TimezoneCache> cache = sCache.get();
+            return cache.forget();
+        }
+    }
+
+    // only the main thread gets here, so nobody else creates a cache meanwhile
+    nsCOMPtr<nsIObserverService> const observerService =
+        mozilla::services::GetObserverService();
+    nsCOMPtr<calITimezoneProvider> const service =
+        do_QueryInterface(cal::getTimezoneService());
+    if (!observerService || !service) {
+        return nullptr;
+    }
+    RefPtr<TimezoneCache> cache = new TimezoneCache(service);
+    if (NS_FAILED(observerService->AddObserver(cache, kTimezonesUpdatedTopic, false))) {
+        return nullptr;
+    }
+    if (NS_FAILED(observerService->AddObserver(cache, "xpcom-shutdown", false))) {
+        observerService->RemoveObserver(cache, kTimezonesUpdatedTopic);
+        return nullptr;
+    }
+
+    mozilla::StaticMutexAutoLock lock(sMutex);
+    sCache = cache;
+    return cache.forget();
+}
+
+bool
+TimezoneCache::Lookup(nsACString const& tzid, calITimezone ** tz, uint32_t * generation)
+{
+    mozilla::MutexAutoLock lock(mMutex);
+    *generation = mGeneration;
+    return mTimezones.Get(tzid, tz);
+}
+
+bool
+TimezoneCache::LookupIcalTimezone(calITimezone * tz, icaltimezone ** icaltz)
+{
+    mozilla::MutexAutoLock lock(mMutex);
+    return mIcalTimezones.Get(tz, icaltz);
+}
+
+void
+TimezoneCache::Put(nsACString const& tzid, calITimezone * tz, icaltimezone * icaltz,
+                   uint32_t generation)
+{
+    mozilla::MutexAutoLock lock(mMutex);
+    if (generation == mGeneration) {
+        mTimezones.Put(tzid, tz);
+        mIcalTimezones.Put(tz, icaltz);
+    }
+}
+
+void
+TimezoneCache::Flush()
+{
+    // the zones are released outside of the lock
+    nsInterfaceHashtable<nsCStringHashKey, calITimezone> timezones;
+    nsDataHashtable<nsISupportsHashKey, icaltimezone *> icalTimezones;
+    {
+        mozilla::MutexAutoLock lock(mMutex);
+        ++mGeneration;
+        mTimezones.SwapElements(timezones);
+        mIcalTimezones.SwapElements(icalTimezones);
+    }
+}
+
+NS_IMETHODIMP
+TimezoneCache::Observe(nsISupports *aSubject, const char *aTopic,
+                       const char16_t *aData)
+{
+    if (!strcmp(aTopic, "xpcom-shutdown")) {
+        nsCOMPtr<nsIObserverService> const observerService =
+            mozilla::services::GetObserverService();
+        if (observerService) {
+            observerService->RemoveObserver(this, kTimezonesUpdatedTopic);
+            observerService->RemoveObserver(this, "xpcom-shutdown");
+        }
+        mozilla::StaticMutexAutoLock lock(sMutex);
+        sCache = nullptr;
+        sShutdown = true;
+    }
+    Flush();
+    return NS_OK;
+}
+
+}
+
 namespace cal {
 
 nsresult logError(const nsAString& msg) {
@@ -42,10 +196,10 @@ nsCOMPtr<calITimezone> detectTimezone(icaltimetype const& icalt,
         char const* const tzid = icaltimezone_get_tzid(const_cast<icaltimezone *>(icalt.zone));
         if (tzid) {
             nsCOMPtr<calITimezone> tz;
-            if (tzProvider) {
+            if (tzProvider && !isTimezoneService(tzProvider)) {
                 tzProvider->GetTimezone(nsDependentCString(tzid), getter_AddRefs(tz));
             } else {
-                getTimezoneService()->GetTimezone(nsDependentCString(tzid), getter_AddRefs(tz));
+                tz = getTimezone(nsDependentCString(tzid));
             }
             if (tz) {
                 return tz;
@@ -65,6 +219,37 @@ void logMissingTimezone(char const* tzid) {
     logError(msg);
 }
 
+nsCOMPtr<calITimezone> getTimezone(nsACString const& tzid, icaltimezone ** icaltz) {
+    RefPtr<TimezoneCache> const cache = TimezoneCache::Get();
+    nsCOMPtr<calITimezone> tz;
+    uint32_t generation = 0;
+    if (cache && cache->Lookup(tzid, getter_AddRefs(tz), &generation)) {
+        if (icaltz) {
+            cache->LookupIcalTimezone(tz, icaltz);
+        }
+        return tz;
+    }
+
+    // Unknown zones aren't cached, the service may just not have started.
+    nsresult const rv = getTimezoneService()->GetTimezone(tzid, getter_AddRefs(tz));
+    if (NS_FAILED(rv) || !tz) {
+        return nullptr;
+    }
+    icaltimezone * const zone = getIcalTimezone(tz);
+    if (cache) {
+        cache->Put(tzid, tz, zone, generation);
+    }
+    if (icaltz) {
+        *icaltz = zone;
+    }
+    return tz;
+}
+
+bool isTimezoneService(calITimezoneProvider * tzProvider) {
+    RefPtr<TimezoneCache> const cache = TimezoneCache::Get();
+    return cache && cache->IsService(tzProvider);
+}
+
 icaltimezone * getIcalTimezone(calITimezone * tz) {
     icaltimezone * icaltz = nullptr;
     if (!tz) {
@@ -72,6 +257,12 @@ icaltimezone * getIcalTimezone(calITimezone * tz) {
         return nullptr;
     }
 
+    // zones of the timezone service are known once they have been looked up
+    RefPtr<TimezoneCache> const cache = TimezoneCache::Get();
+    if (cache && cache->LookupIcalTimezone(tz, &icaltz)) {
+        return icaltz;
+    }
+
     bool b;
     tz->GetIsUTC(&b);
     if (b) {
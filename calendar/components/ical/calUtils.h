@@ -138,6 +138,24 @@ inline nsCOMPtr<calITimezone> floating() {
  */    
 icaltimezone * getIcalTimezone(calITimezone * tz);
 
+/**
+ * Gets a timezone of the global timezone service. The zones and their
+ * libical timezones are cached, so a TZID is resolved through the
+ * service only once until it notifies an update of its zones.
+ *
+ * @param tzid       the timezone id
+ * @param icaltz     if not null, gets the libical timezone of the result
+ * @return           the timezone or null if the service doesn't know tzid
+ */
+nsCOMPtr<calITimezone> getTimezone(nsACString const& tzid,
+                                   icaltimezone ** icaltz = nullptr);
+
+/**
+ * Returns whether tzProvider is the global timezone service, whose
+ * timezones may be looked up through getTimezone().
+ */
+bool isTimezoneService(calITimezoneProvider * tzProvider);
+
 /**
  * Detects the timezone icalt refers to, either using the
  * passed timezone provider or the global timezone service.
@@ -3,7 +3,8 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
 /**
- * ChromeWorker for parseICSAsync method in calICSService.js
+ * ChromeWorker for the parseICSAsync and parseICSBatchAsync methods in
+ * calICSService.js. A batch is passed as an array of strings.
  */
 
 var NS_OK = 0;
@@ -11,12 +12,19 @@ var NS_ERROR_FAILURE = 2147500037;
 
 importScripts("resource://calendar/modules/ical.js");
 
-onmessage = function(event) {
+function parse(serialized) {
     try {
-        let comp = ICAL.parse(event.data);
-        postMessage({ rc: NS_OK, data: comp });
+        return { rc: NS_OK, data: ICAL.parse(serialized) };
     } catch (e) {
-        postMessage({ rc: NS_ERROR_FAILURE, data: "Exception occurred: " + e });
+        return { rc: NS_ERROR_FAILURE, data: "Exception occurred: " + e };
+    }
+}
+
+onmessage = function(event) {
+    if (Array.isArray(event.data)) {
+        postMessage({ rc: NS_OK, data: event.data.map(parse) });
+    } else {
+        postMessage(parse(event.data));
     }
     close();
 };
@@ -4,6 +4,7 @@
 
 Components.utils.import("resource://calendar/modules/ical.js");
 Components.utils.import("resource://gre/modules/XPCOMUtils.jsm");
+Components.utils.import("resource://gre/modules/NetUtil.jsm");
 Components.utils.import("resource://calendar/modules/calUtils.jsm");
 
 function calIcalProperty(innerObject) {
@@ -448,6 +449,132 @@ calIcalComponent.prototype = {
                                          .createInstance(Components.interfaces.nsIScriptableUnicodeConverter);
         unicodeConverter.charset = "UTF-8";
         return unicodeConverter.convertToInputStream(this.innerObject.toString());
+    },
+
+    serializeToICSOutputStream: function(aStream) {
+        // ical.js only serializes to a string, which is written at once
+        let convStream = Components.classes["@mozilla.org/intl/converter-output-stream;1"]
+                                   .createInstance(Components.interfaces.nsIConverterOutputStream);
+        convStream.init(aStream, "UTF-8", 0, 0x0000);
+        convStream.writeString(this.serializeToICS());
+        convStream.flush();
+    }
+};
+
+function calIcsStreamParser(tzProvider, listener) {
+    this.mListener = listener;
+    this.mChunks = [];
+}
+
+calIcsStreamParser.prototype = {
+    QueryInterface: XPCOMUtils.generateQI([
+        Components.interfaces.calIIcsStreamParser,
+        Components.interfaces.nsIStreamListener,
+        Components.interfaces.nsIRequestObserver
+    ]),
+
+    mListener: null,
+    mChunks: null,
+    mBytes: "",
+
+    // ical.js can only parse the complete string, so the chunks are
+    // collected until finish() is called.
+    appendData: function(chunk) {
+        this._checkOpen();
+        this._flushBytes();
+        this.mChunks.push(chunk);
+    },
+
+    appendStream: function(stream) {
+        this._checkOpen();
+        let count;
+        while ((count = this._available(stream)) > 0) {
+            this.mBytes += NetUtil.readInputStreamToString(stream, count);
+        }
+    },
+
+    finish: function() {
+        this._checkOpen();
+        this._complete(Components.results.NS_OK);
+    },
+
+    onStartRequest: function(request, context) {},
+
+    onDataAvailable: function(request, context, stream, offset, count) {
+        this._checkOpen();
+        this.mBytes += NetUtil.readInputStreamToString(stream, count);
+    },
+
+    onStopRequest: function(request, context, status) {
+        if (this.mChunks) {
+            this._complete(status);
+        }
+    },
+
+    _checkOpen: function() {
+        if (!this.mChunks) {
+            throw Components.results.NS_ERROR_NOT_AVAILABLE;
+        }
+    },
+
+    _available: function(stream) {
+        try {
+            return stream.available();
+        } catch (e) {
+            if (e.result == Components.results.NS_BASE_STREAM_CLOSED) {
+                return 0;
+            }
+            throw e;
+        }
+    },
+
+    // Stream data is kept as bytes until it is needed as a string, so that
+    // characters split between two reads are decoded correctly.
+    _flushBytes: function() {
+        if (this.mBytes) {
+            let unicodeConverter = Components.classes["@mozilla.org/intl/scriptableunicodeconverter"]
+                                             .createInstance(Components.interfaces.nsIScriptableUnicodeConverter);
+            unicodeConverter.charset = "UTF-8";
+            this.mChunks.push(unicodeConverter.ConvertToUnicode(this.mBytes) +
+                              unicodeConverter.Finish());
+            this.mBytes = "";
+        }
+    },
+
+    _complete: function(rc) {
+        this._flushBytes();
+        let serialized = this.mChunks.join("");
+        this.mChunks = null;
+
+        let rootComp = null;
+        try {
+            let comp = new ICAL.Component(ICAL.parse(serialized));
+            if (comp.name == "vcalendar") {
+                // The components are passed on while still in the calendar,
+                // so that ical.js can resolve their timezones.
+                let jCal = comp.jCal;
+                rootComp = new calIcalComponent(new ICAL.Component([
+                    jCal[0],
+                    ICAL.helpers.clone(jCal[1], true),
+                    jCal[2].filter(sub => sub[0] == "vtimezone")
+                           .map(sub => ICAL.helpers.clone(sub, true))
+                ]));
+                for (let subcomp of comp.getAllSubcomponents()) {
+                    if (Components.isSuccessCode(rc) && subcomp.name != "vtimezone") {
+                        this.mListener.onComponent(new calIcalComponent(subcomp));
+                    }
+                }
+            } else {
+                rootComp = new calIcalComponent(comp);
+            }
+        } catch (e) {
+            cal.ERROR("[calICSService] Error parsing stream: " + e);
+            if (Components.isSuccessCode(rc)) {
+                rc = e.result || Components.results.NS_ERROR_FAILURE;
+            }
+        }
+
+        this.mListener.onStreamComplete(rc, rootComp);
     }
 };
 
@@ -474,12 +601,25 @@ calICSService.prototype = {
         return new calIcalComponent(new ICAL.Component(comp));
     },
 
-    parseICSAsync: function(serialized, tzProvider, listener) {
+    parseICSAsync: function(serialized, tzProvider, listener, priority) {
+        // Every call gets its own worker here, so the priority doesn't matter.
+        let worker = null;
+        let operation = new cal.calOperationGroup(() => {
+            if (worker) {
+                worker.terminate();
+                worker = null;
+            }
+            cal.postPone(() => listener.onParsingComplete(operation.status, null));
+        });
+
         // There are way too many error checking messages here, but I had so
         // much pain with this method that I don't want it to break again.
         try {
-            let worker = new ChromeWorker("resource://calendar/calendar-js/calICSService-worker.js");
+            worker = new ChromeWorker("resource://calendar/calendar-js/calICSService-worker.js");
             worker.onmessage = function(event) {
+                if (!operation.isPending) {
+                    return;
+                }
                 let rc = Components.results.NS_ERROR_FAILURE;
                 let icalComp = null;
                 try {
@@ -492,18 +632,147 @@ calICSService.prototype = {
                     cal.ERROR("[calICSService] Exception parsing item: " + e);
                 }
 
+                worker = null;
+                operation.notifyCompleted(rc);
                 listener.onParsingComplete(rc, icalComp);
             };
             worker.onerror = function(event) {
+                if (!operation.isPending) {
+                    return;
+                }
                 cal.ERROR("[calICSService] Error in parser worker: " + event.message);
+                worker = null;
+                operation.notifyCompleted(Components.results.NS_ERROR_FAILURE);
                 listener.onParsingComplete(Components.results.NS_ERROR_FAILURE, null);
             };
             worker.postMessage(serialized);
         } catch (e) {
             // If an error occurs above, the calling code will hang. Catch the exception just in case
             cal.ERROR("[calICSService] Error starting parsing worker: " + e);
+            operation.notifyCompleted(Components.results.NS_ERROR_FAILURE);
             listener.onParsingComplete(Components.results.NS_ERROR_FAILURE, null);
         }
+        return operation;
+    },
+
+    parseICSBatch: function(count, serialized, tzProvider, resultCount, statuses) {
+        let components = [];
+        statuses.value = [];
+        for (let ics of serialized) {
+            try {
+                components.push(this.parseICS(ics, tzProvider));
+                statuses.value.push(Components.results.NS_OK);
+            } catch (e) {
+                cal.ERROR("[calICSService] Error parsing batch item: " + e);
+                components.push(null);
+                statuses.value.push(e.result || Components.results.NS_ERROR_FAILURE);
+            }
+        }
+        resultCount.value = components.length;
+        return components;
+    },
+
+    parseICSBatchAsync: function(count, serialized, tzProvider, listener, priority) {
+        // Like parseICSAsync, one worker parses the whole batch.
+        let worker = null;
+        let operation = new cal.calOperationGroup(() => {
+            if (worker) {
+                worker.terminate();
+                worker = null;
+            }
+            cal.postPone(() => listener.onBatchParsingComplete(operation.status, 0, [], []));
+        });
+
+        try {
+            worker = new ChromeWorker("resource://calendar/calendar-js/calICSService-worker.js");
+            worker.onmessage = function(event) {
+                if (!operation.isPending) {
+                    return;
+                }
+                let statuses = [];
+                let components = [];
+                for (let result of event.data.data) {
+                    let icalComp = null;
+                    if (Components.isSuccessCode(result.rc)) {
+                        try {
+                            icalComp = new calIcalComponent(new ICAL.Component(result.data));
+                        } catch (e) {
+                            cal.ERROR("[calICSService] Exception parsing batch item: " + e);
+                            result.rc = Components.results.NS_ERROR_FAILURE;
+                        }
+                    }
+                    statuses.push(result.rc);
+                    components.push(icalComp);
+                }
+
+                worker = null;
+                operation.notifyCompleted(Components.results.NS_OK);
+                listener.onBatchParsingComplete(Components.results.NS_OK, components.length,
+                                                statuses, components);
+            };
+            worker.onerror = function(event) {
+                if (!operation.isPending) {
+                    return;
+                }
+                cal.ERROR("[calICSService] Error in parser worker: " + event.message);
+                worker = null;
+                operation.notifyCompleted(Components.results.NS_ERROR_FAILURE);
+                listener.onBatchParsingComplete(Components.results.NS_ERROR_FAILURE, 0, [], []);
+            };
+            worker.postMessage(serialized);
+        } catch (e) {
+            cal.ERROR("[calICSService] Error starting parsing worker: " + e);
+            operation.notifyCompleted(Components.results.NS_ERROR_FAILURE);
+            listener.onBatchParsingComplete(Components.results.NS_ERROR_FAILURE, 0, [], []);
+        }
+        return operation;
+    },
+
+    createStreamParser: function(tzProvider, listener) {
+        // TODO ical.js doesn't support tz providers, see parseICS.
+        return new calIcsStreamParser(tzProvider, listener);
+    },
+
+    openTimezoneDatabase: function(aFile) {
+        // The database is for libical, the timezone service reads
+        // zones.json instead.
+        throw Components.results.NS_ERROR_NOT_IMPLEMENTED;
+    },
+
+    sortDateTimes: function(count, dateTimes, resultCount) {
+        // By native time, dates first, as calICSService.cpp does. Ties are
+        // broken by the original position to keep the sort stable.
+        let entries = dateTimes.map((dateTime, index) => ({
+            dateTime: dateTime,
+            key: dateTime.nativeTime,
+            isDate: dateTime.isDate,
+            index: index
+        }));
+        entries.sort((a, b) => a.key - b.key || b.isDate - a.isDate || a.index - b.index);
+        resultCount.value = entries.length;
+        return entries.map(entry => entry.dateTime);
+    },
+
+    convertTimes: function(count, times, fromTimezone, toTimezone, resultCount) {
+        let fromZone = unwrapSingle(ICAL.Timezone, fromTimezone);
+        let toZone = unwrapSingle(ICAL.Timezone, toTimezone);
+        let floating = ICAL.Timezone.localTimezone;
+        resultCount.value = times.length;
+        if (fromZone == floating || toZone == floating) {
+            return times.slice();
+        }
+
+        // The times are clock times counted as if they were UTC, of which
+        // only the whole seconds are converted.
+        return times.map((nativeTime) => {
+            let seconds = Math.floor(nativeTime / 1000000);
+            let time = ICAL.Time.epochTime.clone();
+            time.adjust(0, 0, 0, seconds);
+            time.zone = fromZone;
+            time = time.convertToZone(toZone);
+            time.zone = ICAL.Timezone.utcTimezone;
+            return nativeTime + (time.toUnixTime() - seconds) * 1000000;
+        });
     },
 
     createIcalComponent: function(kind) {
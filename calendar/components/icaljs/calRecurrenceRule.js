@@ -38,11 +38,11 @@ calRecurrenceRule.prototype = {
         return wrapGetter(calDateTime, this.innerObject.getNextOccurrence(aStartTime, aRecId));
     },
 
-    getOccurrences: function(aStartTime, aRangeStart, aRangeEnd, aMaxCount, aCount) {
-        aStartTime = unwrapSingle(ICAL.Time, aStartTime);
-        aRangeStart = unwrapSingle(ICAL.Time, aRangeStart);
-        aRangeEnd = unwrapSingle(ICAL.Time, aRangeEnd);
-
+    /**
+     * The occurrences of the rule starting at aStartTime in the range, as
+     * ICAL.Time objects in the timezone of aStartTime.
+     */
+    expandOccurrences: function(aStartTime, aRangeStart, aRangeEnd, aMaxCount) {
         if (!aMaxCount && !aRangeEnd && this.count == 0 && this.until == null) {
             throw Components.results.NS_ERROR_INVALID_ARG;
         }
@@ -59,8 +59,7 @@ calRecurrenceRule.prototype = {
 
             // If the start of the recurrence is past the end, we have no dates
             if (aStartTime.compare(dtend) >= 0) {
-                aCount.value = 0;
-                return [];
+                return occurrences;
             }
         }
 
@@ -84,17 +83,43 @@ calRecurrenceRule.prototype = {
                 next.zone = aStartTime.zone;
             }
 
-            occurrences.push(new calDateTime(next));
+            occurrences.push(next);
 
-            if (aMaxCount && aMaxCount >= occurrences.length) {
+            if (aMaxCount && aMaxCount <= occurrences.length) {
                 break;
             }
         }
 
+        return occurrences;
+    },
+
+    getOccurrences: function(aStartTime, aRangeStart, aRangeEnd, aMaxCount, aCount) {
+        aStartTime = unwrapSingle(ICAL.Time, aStartTime);
+        aRangeStart = unwrapSingle(ICAL.Time, aRangeStart);
+        aRangeEnd = unwrapSingle(ICAL.Time, aRangeEnd);
+
+        let occurrences = this.expandOccurrences(aStartTime, aRangeStart, aRangeEnd, aMaxCount)
+                              .map(next => new calDateTime(next));
         aCount.value = occurrences.length;
         return occurrences;
     },
 
+    getOccurrenceTimes: function(aStartTime, aRangeStart, aRangeEnd, aMaxCount, aTimezone, aIsDate) {
+        aStartTime = unwrapSingle(ICAL.Time, aStartTime);
+        aRangeStart = unwrapSingle(ICAL.Time, aRangeStart);
+        aRangeEnd = unwrapSingle(ICAL.Time, aRangeEnd);
+
+        let occurrences = this.expandOccurrences(aStartTime, aRangeStart, aRangeEnd, aMaxCount);
+        let times = new Float64Array(occurrences.length);
+        for (let i = 0; i < occurrences.length; i++) {
+            times[i] = occurrences[i].toUnixTime() * UNIX_TIME_TO_PRTIME;
+        }
+
+        aTimezone.value = new calICALJSTimezone(aStartTime.zone);
+        aIsDate.value = aStartTime.isDate;
+        return times;
+    },
+
     get icalString() { return "RRULE:" + this.innerObject.toString() + ICAL.newLineChar; },
     set icalString(val) { this.innerObject = ICAL.Recur.fromString(val.replace(/^RRULE:/i, "")); },
 
@@ -253,7 +253,7 @@ foreach $param  (sort keys %params){
 
      $charorenum = "    icalerror_check_arg_rz( (param!=0), \"param\");\n    return param->string;";
     
-     $set_code = "((struct icalparameter_impl*)param)->string = icalmemory_strdup(v);";
+     $set_code = "((struct icalparameter_impl*)param)->string = icalarena_strdup(v);";
 
      $pointer_check = "icalerror_check_arg_rz( (v!=0),\"v\");"; 
      $pointer_check_v = "icalerror_check_arg_rv( (v!=0),\"v\");"; 
@@ -310,7 +310,7 @@ void icalparameter_set_${lc}(icalparameter* param, ${type} v)
    icalerror_clear_errno();
    
    if (param->string != NULL)
-      free ((void*)param->string);
+      icalarena_free (param->arena, (void*)param->string);
    $set_code
 }
 
@@ -223,7 +223,7 @@ foreach $value  (sort keys %h) {
   my $assign;
   
   if ($type =~ /char/){
-    $assign = "icalmemory_strdup(v);\n\n    if (impl->data.v_string == 0){\n      errno = ENOMEM;\n    }\n";
+    $assign = "icalarena_strdup(v);\n\n    if (impl->data.v_string == 0){\n      errno = ENOMEM;\n    }\n";
   } else {
     $assign = "v;";
   }
@@ -258,7 +258,7 @@ void icalvalue_set_${lc}(icalvalue* value, $type v) {\
     
     if( $union_data eq 'string') {
       
-      print "    if(impl->data.v_${union_data}!=0) {free((void*)impl->data.v_${union_data});}\n";
+      print "    if(impl->data.v_${union_data}!=0) {icalarena_free(impl->arena, (void*)impl->data.v_${union_data});}\n";
     }
     
 
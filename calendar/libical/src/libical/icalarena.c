@@ -0,0 +1,254 @@
+/* -*- Mode: C -*-
+  ======================================================================
+  FILE: icalarena.c
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of either:
+
+    The LGPL as published by the Free Software Foundation, version
+    2.1, available at: http://www.fsf.org/copyleft/lesser.html
+
+  Or:
+
+    The Mozilla Public License Version 1.0. You may obtain a copy of
+    the License at http://www.mozilla.org/MPL/
+
+ ======================================================================*/
+
+/**
+ * @file icalarena.c
+ * @brief Block allocation for the components of one parse.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "icalarena.h"
+#include "icalerror.h"
+#include "icalmemory.h"
+
+#if defined(HAVE_PTHREAD)
+#include <pthread.h>
+#elif defined(WIN32)
+#include <windows.h>
+#endif
+
+/* The first block is small enough for a single event, each following one
+   twice the size of the last, up to a limit. */
+#define ARENA_FIRST_BLOCK_SIZE 4096
+#define ARENA_MAX_BLOCK_SIZE (8 * 1024 * 1024)
+#define ARENA_ALIGN 8
+
+struct arena_block {
+    struct arena_block *next;
+    char *data;
+    size_t size;
+    size_t used;
+};
+
+struct icalarena_impl {
+    struct arena_block *blocks; /* the newest first */
+    size_t next_size;
+    long refcount;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t mutex;
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+static pthread_key_t  current_key;
+static pthread_once_t current_key_once = PTHREAD_ONCE_INIT;
+
+static void current_key_alloc(void) {
+    pthread_key_create(&current_key, NULL);
+}
+#elif defined(WIN32)
+static __declspec(thread) icalarena* current_arena = 0;
+#else
+static icalarena* current_arena = 0;
+#endif
+
+
+icalarena* icalarena_new(void)
+{
+    icalarena *arena;
+
+    if ((arena = (icalarena*)malloc(sizeof(icalarena))) == 0) {
+	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+	return 0;
+    }
+
+    arena->blocks = 0;
+    arena->next_size = ARENA_FIRST_BLOCK_SIZE;
+    arena->refcount = 1;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&arena->mutex, NULL);
+#endif
+
+    return arena;
+}
+
+void icalarena_ref(icalarena* arena)
+{
+    icalerror_check_arg_rv((arena != 0), "arena");
+
+#if defined(HAVE_PTHREAD)
+    pthread_mutex_lock(&arena->mutex);
+    arena->refcount++;
+    pthread_mutex_unlock(&arena->mutex);
+#elif defined(WIN32)
+    InterlockedIncrement(&arena->refcount);
+#else
+    arena->refcount++;
+#endif
+}
+
+void icalarena_unref(icalarena* arena)
+{
+    struct arena_block *block;
+    long refcount;
+
+    icalerror_check_arg_rv((arena != 0), "arena");
+
+#if defined(HAVE_PTHREAD)
+    pthread_mutex_lock(&arena->mutex);
+    refcount = --arena->refcount;
+    pthread_mutex_unlock(&arena->mutex);
+#elif defined(WIN32)
+    refcount = InterlockedDecrement(&arena->refcount);
+#else
+    refcount = --arena->refcount;
+#endif
+
+    if (refcount > 0) {
+	return;
+    }
+
+    while ((block = arena->blocks) != 0) {
+	arena->blocks = block->next;
+	free(block);
+    }
+#ifdef HAVE_PTHREAD
+    pthread_mutex_destroy(&arena->mutex);
+#endif
+    free(arena);
+}
+
+icalarena* icalarena_set_current(icalarena* arena)
+{
+    icalarena *prev;
+
+#ifdef HAVE_PTHREAD
+    pthread_once(&current_key_once, current_key_alloc);
+    prev = (icalarena*)pthread_getspecific(current_key);
+    pthread_setspecific(current_key, arena);
+#else
+    prev = current_arena;
+    current_arena = arena;
+#endif
+
+    return prev;
+}
+
+icalarena* icalarena_get_current(void)
+{
+#ifdef HAVE_PTHREAD
+    pthread_once(&current_key_once, current_key_alloc);
+    return (icalarena*)pthread_getspecific(current_key);
+#else
+    return current_arena;
+#endif
+}
+
+/** Allocate 'size' bytes with the given alignment, which is 1 for strings */
+static void* arena_alloc(icalarena* arena, size_t size, size_t align)
+{
+    struct arena_block *block = arena->blocks;
+    size_t offset = 0;
+
+    if (block != 0) {
+	offset = (block->used + align - 1) & ~(align - 1);
+    }
+
+    if (block == 0 || offset + size > block->size) {
+	size_t block_size = arena->next_size;
+	size_t header = (sizeof(struct arena_block) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	while (block_size < size) {
+	    block_size *= 2;
+	}
+	if (arena->next_size < ARENA_MAX_BLOCK_SIZE) {
+	    arena->next_size *= 2;
+	}
+
+	if ((block = (struct arena_block*)malloc(header + block_size)) == 0) {
+	    icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+	    return 0;
+	}
+	block->data = (char*)block + header;
+	block->size = block_size;
+	block->used = 0;
+	block->next = arena->blocks;
+	arena->blocks = block;
+	offset = 0;
+    }
+
+    block->used = offset + size;
+    return block->data + offset;
+}
+
+void* icalarena_alloc(size_t size, icalarena** arena)
+{
+    icalarena *current = icalarena_get_current();
+    void *p;
+
+    *arena = current;
+    if (current != 0) {
+	return arena_alloc(current, size, ARENA_ALIGN);
+    }
+
+    if ((p = malloc(size)) == 0) {
+	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+    }
+    return p;
+}
+
+char* icalarena_strdup(const char* s)
+{
+    icalarena *current = icalarena_get_current();
+    size_t size;
+    char *p;
+
+    if (current == 0) {
+	return icalmemory_strdup(s);
+    }
+
+    size = strlen(s) + 1;
+    if ((p = (char*)arena_alloc(current, size, 1)) != 0) {
+	memcpy(p, s, size);
+    }
+    return p;
+}
+
+void icalarena_free(icalarena* arena, void* p)
+{
+    struct arena_block *block;
+
+    if (p == 0) {
+	return;
+    }
+
+    if (arena != 0) {
+	for (block = arena->blocks; block != 0; block = block->next) {
+	    if ((char*)p >= block->data && (char*)p < block->data + block->used) {
+		return;
+	    }
+	}
+    }
+
+    free(p);
+}
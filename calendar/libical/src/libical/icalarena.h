@@ -0,0 +1,63 @@
+/* -*- Mode: C -*- */
+/*======================================================================
+ FILE: icalarena.h
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of either:
+
+    The LGPL as published by the Free Software Foundation, version
+    2.1, available at: http://www.fsf.org/copyleft/lesser.html
+
+  Or:
+
+    The Mozilla Public License Version 1.0. You may obtain a copy of
+    the License at http://www.mozilla.org/MPL/
+
+======================================================================*/
+
+#ifndef ICALARENA_H
+#define ICALARENA_H
+
+#ifndef WIN32
+#include <sys/types.h> /* for size_t */
+#else
+#include <stddef.h>
+#endif
+
+/**
+ * @file icalarena.h
+ * @brief Block allocation for the components of one parse.
+ *
+ * A parser in arena mode (see icalparser_use_arena()) allocates the
+ * components, properties, parameters and values it creates, with their
+ * lists and strings, from large blocks instead of one malloc() each.
+ * Freeing such a node does not free its memory; the blocks are released
+ * all at once when the last reference to the arena goes away. The
+ * parser holds one, as does every top-level component it returns and
+ * every component or property that is removed from its parent, until
+ * they are freed. Nodes created outside of a parse are never put into
+ * an arena, so icalcomponent_new_clone() copies a subtree out of it.
+ */
+
+typedef struct icalarena_impl icalarena;
+
+icalarena* icalarena_new(void);
+void icalarena_ref(icalarena* arena);
+void icalarena_unref(icalarena* arena);
+
+/** Make 'arena' the one the calling thread allocates from, returning
+    the previous one. Pass 0 to allocate with malloc() again. */
+icalarena* icalarena_set_current(icalarena* arena);
+icalarena* icalarena_get_current(void);
+
+/** Allocate from the calling thread's current arena, or with malloc()
+    if there is none. '*arena' is set to the arena used, or 0. */
+void* icalarena_alloc(size_t size, icalarena** arena);
+
+/** Like icalmemory_strdup(), but from the current arena if there is one */
+char* icalarena_strdup(const char* s);
+
+/** free() 'p' unless it lies within 'arena'. 'arena' may be 0. */
+void icalarena_free(icalarena* arena, void* p);
+
+#endif /* !ICALARENA_H */
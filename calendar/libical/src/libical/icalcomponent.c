@@ -30,6 +30,7 @@
 #include "pvl.h" /* "Pointer-to-void list" */
 #include "icalerror.h"
 #include "icalmemory.h"
+#include "icalarena.h"
 #include "icalenums.h"
 #include "icaltime.h"
 #include "icalarray.h"
@@ -38,6 +39,7 @@
 #include "icalperiod.h"
 #include "icalparser.h"
 #include "icalrestriction.h"
+#include "icalwriter.h"
 
 #include <stdlib.h>  /* for malloc */
 #include <stdarg.h> /* for va_list, etc */
@@ -54,15 +56,34 @@
 #endif
 #endif
 
+/** The properties or the child components of a component, in order.
+    Their kinds are kept in an array of their own, so that looking for
+    one kind does not touch the nodes, and once something has looked for
+    a kind, 'first' maps every kind to the index of its first node. */
+struct icalnodelist
+{
+	void **nodes;		/* the kinds follow in the same block */
+	unsigned short *kinds;
+	int count;
+	int size;
+	unsigned short *first;
+	int first_size;		/* 0 while 'first' has to be rebuilt */
+};
+
+#define NODELIST_NONE 0xffff
+
+/* Shorter lists are scanned rather than indexed */
+#define NODELIST_MIN_INDEXED 8
+
 struct icalcomponent_impl 
 {
 	char id[5];
 	icalcomponent_kind kind;
 	char* x_name;
-	pvl_list properties;
-	pvl_elem property_iterator;
-	pvl_list components;
-	pvl_elem component_iterator;
+	struct icalnodelist properties;
+	int property_iterator;	/* index into properties, or -1 */
+	struct icalnodelist components;
+	int component_iterator;	/* index into components, or -1 */
 	icalcomponent* parent;
 
 	/** An array of icaltimezone structs. We use this so we can do fast
@@ -71,12 +92,19 @@ struct icalcomponent_impl
 	   array before doing a binary search. */
 	icalarray* timezones;
 	int timezones_sorted;
+
+	/** The arena this component was allocated from, or 0; see
+	   icalarena.h. arena_ref is set while it holds a reference. */
+	icalarena* arena;
+	int arena_ref;
 };
 
 /* icalproperty functions that only components get to use */
 void icalproperty_set_parent(icalproperty* property,
 			     icalcomponent* component);
 icalcomponent* icalproperty_get_parent(icalproperty* property);
+void icalproperty_hold_arena(icalproperty* property);
+int icalproperty_write(icalproperty* prop, icalwriter* w);
 void icalcomponent_add_children(icalcomponent *impl,va_list args);
 static icalcomponent* icalcomponent_new_impl (icalcomponent_kind kind);
 
@@ -95,12 +123,215 @@ static void icalcomponent_rename_tzids_callback(icalparameter *param,
 						void *data);
 static int icalcomponent_compare_vtimezones (icalcomponent	*vtimezone1,
 					     icalcomponent	*vtimezone2);
+static int icalcomponent_compare_vtimezone_hash (icalcomponent	*vtimezone,
+						 icalcomponent	*vtimezone2,
+						 uint64_t	hash2);
 static int icalcomponent_compare_timezone_fn	(const void	*elem1,
 						 const void	*elem2);
 static struct icaltimetype
 icalcomponent_get_datetime(icalcomponent *comp, icalproperty *prop);
 
 
+/** Allocate memory for the lists of a component, from its arena while
+    the parser that created it is filling it in. */
+static void* icalcomponent_alloc_list(icalcomponent *comp, size_t size)
+{
+    icalarena *arena;
+    void *p;
+
+    if (comp->arena != 0 && comp->arena == icalarena_get_current()) {
+	return icalarena_alloc(size, &arena);
+    }
+
+    if ((p = malloc(size)) == 0) {
+	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+    }
+    return p;
+}
+
+static void nodelist_drop_index(icalcomponent *comp, struct icalnodelist *l)
+{
+    icalarena_free(comp->arena, l->first);
+    l->first = 0;
+    l->first_size = 0;
+}
+
+static void nodelist_free(icalcomponent *comp, struct icalnodelist *l)
+{
+    nodelist_drop_index(comp, l);
+    icalarena_free(comp->arena, l->nodes);
+    l->nodes = 0;
+    l->kinds = 0;
+    l->count = 0;
+    l->size = 0;
+}
+
+static int nodelist_insert(icalcomponent *comp, struct icalnodelist *l,
+			   int index, void *node, int kind)
+{
+    if (l->count == l->size) {
+	int size = l->size ? 2 * l->size : 4;
+	void **nodes;
+	unsigned short *kinds;
+
+	nodes = (void**)icalcomponent_alloc_list(comp,
+	    size * (sizeof(void*) + sizeof(unsigned short)));
+	if (nodes == 0) {
+	    return 0;
+	}
+	kinds = (unsigned short*)(nodes + size);
+
+	if (l->count != 0) {
+	    memcpy(nodes, l->nodes, l->count * sizeof(void*));
+	    memcpy(kinds, l->kinds, l->count * sizeof(unsigned short));
+	}
+	icalarena_free(comp->arena, l->nodes);
+
+	l->nodes = nodes;
+	l->kinds = kinds;
+	l->size = size;
+    }
+
+    if (index < l->count) {
+	memmove(l->nodes + index + 1, l->nodes + index,
+		(l->count - index) * sizeof(void*));
+	memmove(l->kinds + index + 1, l->kinds + index,
+		(l->count - index) * sizeof(unsigned short));
+    }
+    l->nodes[index] = node;
+    l->kinds[index] = (unsigned short)kind;
+    l->count++;
+
+    /* Appending at most adds the first node of a kind to the index */
+    if (l->first_size != 0) {
+	if (index == l->count - 1 && kind < l->first_size &&
+	    l->count < NODELIST_NONE) {
+	    if (l->first[kind] == NODELIST_NONE) {
+		l->first[kind] = (unsigned short)index;
+	    }
+	} else {
+	    nodelist_drop_index(comp, l);
+	}
+    }
+
+    return 1;
+}
+
+static void nodelist_remove(icalcomponent *comp, struct icalnodelist *l,
+			    int index)
+{
+    l->count--;
+    memmove(l->nodes + index, l->nodes + index + 1,
+	    (l->count - index) * sizeof(void*));
+    memmove(l->kinds + index, l->kinds + index + 1,
+	    (l->count - index) * sizeof(unsigned short));
+
+    nodelist_drop_index(comp, l);
+}
+
+/** Index of the first node of 'kind' at or after 'from', or -1. 'any'
+    is the kind that matches every node. */
+static int nodelist_find(const struct icalnodelist *l, int kind, int any,
+			 int from)
+{
+    int i;
+
+    if (kind == any) {
+	return from < l->count ? from : -1;
+    }
+
+    for (i = from; i < l->count; i++) {
+	if (l->kinds[i] == kind) {
+	    return i;
+	}
+    }
+
+    return -1;
+}
+
+static int nodelist_find_first(icalcomponent *comp, struct icalnodelist *l,
+			       int kind, int any)
+{
+    int i;
+
+    if (kind == any || l->count < NODELIST_MIN_INDEXED ||
+	l->count >= NODELIST_NONE) {
+	return nodelist_find(l, kind, any, 0);
+    }
+
+    if (l->first_size == 0) {
+	int size = 0;
+
+	for (i = 0; i < l->count; i++) {
+	    if (l->kinds[i] >= size) {
+		size = l->kinds[i] + 1;
+	    }
+	}
+
+	l->first = (unsigned short*)icalcomponent_alloc_list(comp,
+	    size * sizeof(unsigned short));
+	if (l->first == 0) {
+	    return nodelist_find(l, kind, any, 0);
+	}
+
+	for (i = 0; i < size; i++) {
+	    l->first[i] = NODELIST_NONE;
+	}
+	for (i = l->count - 1; i >= 0; i--) {
+	    l->first[l->kinds[i]] = (unsigned short)i;
+	}
+	l->first_size = size;
+    }
+
+    if (kind < 0 || kind >= l->first_size || l->first[kind] == NODELIST_NONE) {
+	return -1;
+    }
+
+    return l->first[kind];
+}
+
+/** Index of 'node', which is of 'kind', or -1 */
+static int nodelist_index_of(icalcomponent *comp, struct icalnodelist *l,
+			     void *node, int kind)
+{
+    int i;
+
+    /* Most often the node that was added last */
+    if (l->count != 0 && l->nodes[l->count - 1] == node) {
+	return l->count - 1;
+    }
+
+    for (i = nodelist_find_first(comp, l, kind, -1);
+	 i >= 0;
+	 i = nodelist_find(l, kind, -1, i + 1)) {
+	if (l->nodes[i] == node) {
+	    return i;
+	}
+    }
+
+    return -1;
+}
+
+/** Keep an iterator on the same node when one is inserted at 'index' */
+static void nodelist_inserted(int *iterator, int index)
+{
+    if (*iterator >= index) {
+	(*iterator)++;
+    }
+}
+
+/** Move an iterator on the node removed from 'index' to the next one */
+static void nodelist_removed(const struct icalnodelist *l, int *iterator,
+			     int index)
+{
+    if (*iterator > index) {
+	(*iterator)--;
+    } else if (*iterator == index && index >= l->count) {
+	*iterator = -1;
+    }
+}
+
+
 void icalcomponent_add_children(icalcomponent *impl, va_list args)
 {
     void* vp;
@@ -123,22 +354,25 @@ static icalcomponent*
 icalcomponent_new_impl (icalcomponent_kind kind)
 {
     icalcomponent* comp;
+    icalarena* arena;
 
     if (!icalcomponent_kind_is_valid(kind))
 	return NULL;
 
-    if ( ( comp = (icalcomponent*) malloc(sizeof(icalcomponent))) == 0) {
-	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+    if ( ( comp = (icalcomponent*) icalarena_alloc(sizeof(icalcomponent), &arena)) == 0) {
 	return 0;
     }
     
     strcpy(comp->id,"comp");
 
+    comp->arena = arena;
+    comp->arena_ref = 0;
+
     comp->kind = kind;
-    comp->properties = pvl_newlist();
-    comp->property_iterator = 0;
-    comp->components = pvl_newlist();
-    comp->component_iterator = 0;
+    memset(&comp->properties, 0, sizeof(comp->properties));
+    comp->property_iterator = -1;
+    memset(&comp->components, 0, sizeof(comp->components));
+    comp->component_iterator = -1;
     comp->x_name = 0;
     comp->parent = 0;
     comp->timezones = NULL;
@@ -189,7 +423,7 @@ icalcomponent* icalcomponent_new_clone(icalcomponent* old)
     icalcomponent *new;
     icalproperty *p;
     icalcomponent *c;
-    pvl_elem itr;
+    int i;
 
     icalerror_check_arg_rz( (old!=0), "component");
 
@@ -200,20 +434,16 @@ icalcomponent* icalcomponent_new_clone(icalcomponent* old)
     }
 
     
-    for( itr = pvl_head(old->properties);
-	 itr != 0;
-	 itr = pvl_next(itr))
+    for (i = 0; i < old->properties.count; i++)
     {	
-	p = (icalproperty*)pvl_data(itr);
+	p = (icalproperty*)old->properties.nodes[i];
 	icalcomponent_add_property(new,icalproperty_new_clone(p));
     }
    
    
-    for( itr = pvl_head(old->components);
-	 itr != 0;
-	 itr = pvl_next(itr))
+    for (i = 0; i < old->components.count; i++)
     {	
-	c = (icalcomponent*)pvl_data(itr);
+	c = (icalcomponent*)old->components.nodes[i];
 	icalcomponent_add_component(new,icalcomponent_new_clone(c));
     }
 
@@ -230,10 +460,20 @@ icalcomponent_new_x (const char* x_name)
     if (!comp) {
        return 0;
     }
-    comp->x_name = icalmemory_strdup(x_name);
+    comp->x_name = icalarena_strdup(x_name);
     return comp;
 }
 
+/** Keep the arena of a component alive while it has no parent */
+void
+icalcomponent_hold_arena (icalcomponent* comp)
+{
+    if (comp->arena != 0 && !comp->arena_ref) {
+	icalarena_ref(comp->arena);
+	comp->arena_ref = 1;
+    }
+}
+
 /*** @brief Destructor
  */
 void
@@ -241,6 +481,8 @@ icalcomponent_free (icalcomponent* c)
 {
     icalproperty* prop;
     icalcomponent* comp;
+    icalarena* arena;
+    int i;
 
     icalerror_check_arg_rv( (c!=0), "component");
 
@@ -254,42 +496,43 @@ icalcomponent_free (icalcomponent* c)
 
     if(c != 0 ){
        
-		if ( c->properties != 0 )
-		{
-		   while( (prop=pvl_pop(c->properties)) != 0){
-		   assert(prop != 0);
-			   icalproperty_set_parent(prop,0);
-		   icalproperty_free(prop);
-		   }
-	        pvl_free(c->properties);
-		}
-      
-
-       while( (comp=pvl_data(pvl_head(c->components))) != 0){
-	   assert(comp!=0);
-	   icalcomponent_remove_component(c,comp);
-	   icalcomponent_free(comp);
-       }
-       
-       pvl_free(c->components);
-
-	if (c->x_name != 0) {
-	    free(c->x_name);
+	for (i = c->properties.count - 1; i >= 0; i--) {
+	    prop = (icalproperty*)c->properties.nodes[i];
+	    icalproperty_set_parent(prop,0);
+	    icalproperty_free(prop);
 	}
+	nodelist_free(c, &c->properties);
 
+	/* The zones refer to the VTIMEZONEs, which are still attached and
+	   therefore not freed with them */
 	if (c->timezones)
 	    icaltimezone_array_free (c->timezones);
 
+	for (i = 0; i < c->components.count; i++) {
+	    comp = (icalcomponent*)c->components.nodes[i];
+	    comp->parent = 0;
+	    icalcomponent_free(comp);
+	}
+	nodelist_free(c, &c->components);
+
+	if (c->x_name != 0) {
+	    icalarena_free(c->arena, c->x_name);
+	}
+
 	c->kind = ICAL_NO_COMPONENT;
-	c->properties = 0;
-	c->property_iterator = 0;
-	c->components = 0;
-	c->component_iterator = 0;
+	c->property_iterator = -1;
+	c->component_iterator = -1;
 	c->x_name = 0;	
 	c->id[0] = 'X';
 	c->timezones = NULL;
 
-	free(c);
+	/* The arena goes last, it might hold the component itself */
+	arena = c->arena;
+	if (arena == 0) {
+	    free(c);
+	} else if (c->arena_ref) {
+	    icalarena_unref(arena);
+	}
     }
 }
 
@@ -304,19 +547,15 @@ icalcomponent_as_ical_string (icalcomponent* impl)
 }
 
 
-char*
-icalcomponent_as_ical_string_r (icalcomponent* impl)
+/* Writes the component and everything in it. Returns 0 if it could not
+   be written at all, which leaves nothing in the writer. */
+static int
+icalcomponent_write_impl (icalcomponent* impl, icalwriter* w)
 {
-   char* buf;
-   char* tmp_buf;
-   size_t buf_size = 1024;
-   char* buf_ptr = 0;
-    pvl_elem itr;
+   int i;
    /* RFC 2445 explicitly says that the newline is *ALWAYS* a \r\n (CRLF)!!!! */
    const char newline[] = "\r\n";
    
-   icalcomponent *c;
-   icalproperty *p;
    icalcomponent_kind kind = icalcomponent_isa(impl);
 
    const char* kind_string;
@@ -332,48 +571,64 @@ icalcomponent_as_ical_string_r (icalcomponent* impl)
 
    icalerror_check_arg_rz( (kind_string!=0),"Unknown kind of component");
 
-   buf = icalmemory_new_buffer(buf_size);
-   buf_ptr = buf; 
+   icalwriter_write_string(w, "BEGIN:");
+   icalwriter_write_string(w, kind_string);
+   icalwriter_write_string(w, newline);
 
-   icalmemory_append_string(&buf, &buf_ptr, &buf_size, "BEGIN:");
-   icalmemory_append_string(&buf, &buf_ptr, &buf_size, kind_string);
-   icalmemory_append_string(&buf, &buf_ptr, &buf_size, newline);
-   
-
-
-   for( itr = pvl_head(impl->properties);
-	 itr != 0;
-	 itr = pvl_next(itr))
+   for (i = 0; i < impl->properties.count; i++)
     {	
-	p = (icalproperty*)pvl_data(itr);
+	icalproperty *p = (icalproperty*)impl->properties.nodes[i];
 	
 	icalerror_assert((p!=0),"Got a null property");
-	tmp_buf = icalproperty_as_ical_string_r(p);
-	
-	icalmemory_append_string(&buf, &buf_ptr, &buf_size, tmp_buf);
-	free(tmp_buf);
+	icalproperty_write(p, w);
     }
    
-   
-   for( itr = pvl_head(impl->components);
-	itr != 0;
-	itr = pvl_next(itr))
+   for (i = 0; i < impl->components.count; i++)
    {	
-       c = (icalcomponent*)pvl_data(itr);
-       
-       tmp_buf = icalcomponent_as_ical_string_r(c);
-       
-       icalmemory_append_string(&buf, &buf_ptr, &buf_size, tmp_buf);
-       free(tmp_buf);
-       
+       icalcomponent_write_impl((icalcomponent*)impl->components.nodes[i], w);
    }
    
-   icalmemory_append_string(&buf, &buf_ptr, &buf_size, "END:");
-   icalmemory_append_string(&buf, &buf_ptr, &buf_size, 
-			    icalcomponent_kind_to_string(kind));
-   icalmemory_append_string(&buf, &buf_ptr, &buf_size, newline);
+   icalwriter_write_string(w, "END:");
+   icalwriter_write_string(w, icalcomponent_kind_to_string(kind));
+   icalwriter_write_string(w, newline);
+
+   return 1;
+}
+
+char*
+icalcomponent_as_ical_string_r (icalcomponent* impl)
+{
+   icalwriter w;
+
+   /* The whole text goes into one buffer, which grows as needed */
+   if (!icalwriter_init_buffer(&w, 4096)) {
+       return 0;
+   }
+
+   if (!icalcomponent_write_impl(impl, &w)) {
+       icalwriter_free(&w);
+       return 0;
+   }
+
+   return icalwriter_steal_buffer(&w);
+}
+
+int
+icalcomponent_write (icalcomponent* impl, icalcomponent_write_func func,
+		     void* user_data)
+{
+   icalwriter w;
+   int ok;
+
+   icalerror_check_arg_rz( (func!=0), "func");
 
-   return buf;
+   if (!icalwriter_init_func(&w, func, user_data)) {
+       return 0;
+   }
+
+   ok = icalcomponent_write_impl(impl, &w) && icalwriter_flush(&w);
+   icalwriter_free(&w);
+   return ok;
 }
 
 
@@ -426,39 +681,36 @@ icalcomponent_add_property (icalcomponent* component, icalproperty* property)
 
     icalerror_assert( (!icalproperty_get_parent(property)),"The property has already been added to a component. Remove the property with icalcomponent_remove_property before calling icalcomponent_add_property");
 
-    icalproperty_set_parent(property,component);
+    if (!nodelist_insert(component, &component->properties,
+			 component->properties.count, property,
+			 icalproperty_isa(property))) {
+	return;
+    }
 
-    pvl_push(component->properties,property);
+    icalproperty_set_parent(property,component);
 }
 
 
 void
 icalcomponent_remove_property (icalcomponent* component, icalproperty* property)
 {
-    pvl_elem itr, next_itr;
+    int i;
 
     icalerror_check_arg_rv( (component!=0), "component");
     icalerror_check_arg_rv( (property!=0), "property");
     
     icalerror_assert( (icalproperty_get_parent(property)),"The property is not a member of a component");
 
-    
-    for( itr = pvl_head(component->properties);
-	 itr != 0;
-	 itr = next_itr)
-    {
-	next_itr = pvl_next(itr);
-	
-	if( pvl_data(itr) == (void*)property ){
-
-	   if (component->property_iterator == itr){
-	       component->property_iterator = pvl_next(itr);
-	   }
+    i = nodelist_index_of(component, &component->properties, property,
+			  icalproperty_isa(property));
+    if (i >= 0) {
+	nodelist_remove(component, &component->properties, i);
+	nodelist_removed(&component->properties,
+			 &component->property_iterator, i);
 
-	   pvl_remove( component->properties, itr); 
-	  icalproperty_set_parent(property,0);
-	}
-    }	
+	icalproperty_set_parent(property,0);
+	icalproperty_hold_arena(property);
+    }
 }
 
 int
@@ -466,18 +718,17 @@ icalcomponent_count_properties (icalcomponent* component,
 				icalproperty_kind kind)
 {
     int count=0;
-    pvl_elem itr;
+    int i;
 
     icalerror_check_arg_rz( (component!=0), "component");
 
-    for( itr = pvl_head(component->properties);
-	 itr != 0;
-	 itr = pvl_next(itr))
+    for (i = nodelist_find_first(component, &component->properties,
+				 kind, ICAL_ANY_PROPERTY);
+	 i >= 0;
+	 i = nodelist_find(&component->properties, kind, ICAL_ANY_PROPERTY,
+			   i + 1))
     {	
-	if(kind == icalproperty_isa((icalproperty*)pvl_data(itr)) ||
-	    kind == ICAL_ANY_PROPERTY){
-	    count++;
-	}
+	count++;
     }
 
 
@@ -489,11 +740,11 @@ icalproperty* icalcomponent_get_current_property (icalcomponent* component)
 {
    icalerror_check_arg_rz( (component!=0),"component");
 
-   if ((component->property_iterator==0)){
+   if (component->property_iterator < 0){
        return 0;
    }
 
-   return (icalproperty*) pvl_data(component->property_iterator);
+   return (icalproperty*) component->properties.nodes[component->property_iterator];
 }
 
 icalproperty*
@@ -501,18 +752,13 @@ icalcomponent_get_first_property (icalcomponent* c, icalproperty_kind kind)
 {
    icalerror_check_arg_rz( (c!=0),"component");
   
-   for( c->property_iterator = pvl_head(c->properties);
-	c->property_iterator != 0;
-	c->property_iterator = pvl_next(c->property_iterator)) {
-	    
-       icalproperty *p =  (icalproperty*) pvl_data(c->property_iterator);
-	
-	   if (icalproperty_isa(p) == kind || kind == ICAL_ANY_PROPERTY) {
-	       
-	       return p;
-	   }
+   c->property_iterator = nodelist_find_first(c, &c->properties, kind,
+					      ICAL_ANY_PROPERTY);
+   if (c->property_iterator < 0) {
+       return 0;
    }
-   return 0;
+
+   return (icalproperty*) c->properties.nodes[c->property_iterator];
 }
 
 icalproperty*
@@ -520,23 +766,18 @@ icalcomponent_get_next_property (icalcomponent* c, icalproperty_kind kind)
 {
    icalerror_check_arg_rz( (c!=0),"component");
 
-   if (c->property_iterator == 0){
+   if (c->property_iterator < 0){
        return 0;
    }
 
-   for( c->property_iterator = pvl_next(c->property_iterator);
-	c->property_iterator != 0;
-	c->property_iterator = pvl_next(c->property_iterator)) {
-	    
-       icalproperty *p =  (icalproperty*) pvl_data(c->property_iterator);
-	   
-       if (icalproperty_isa(p) == kind || kind == ICAL_ANY_PROPERTY) {
-	   
-	   return p;
-       }
+   c->property_iterator = nodelist_find(&c->properties, kind,
+					ICAL_ANY_PROPERTY,
+					c->property_iterator + 1);
+   if (c->property_iterator < 0) {
+       return 0;
    }
 
-   return 0;
+   return (icalproperty*) c->properties.nodes[c->property_iterator];
 }
 
 
@@ -554,14 +795,21 @@ icalcomponent_add_component (icalcomponent* parent, icalcomponent* child)
         icalerror_set_errno(ICAL_USAGE_ERROR);
     }
 
-    child->parent = parent;
-
     /* Fix for Mozilla - bug 327602 */
     if (child->kind != ICAL_VTIMEZONE_COMPONENT) {
-        pvl_push(parent->components, child);
+        if (!nodelist_insert(parent, &parent->components,
+                             parent->components.count, child, child->kind)) {
+            return;
+        }
+        child->parent = parent;
     } else {
         /* VTIMEZONES should be first in the resulting VCALENDAR. */
-        pvl_unshift(parent->components, child);
+        if (!nodelist_insert(parent, &parent->components, 0, child,
+                             child->kind)) {
+            return;
+        }
+        nodelist_inserted(&parent->component_iterator, 0);
+        child->parent = parent;
 
     /* Add the VTIMEZONE to our array. */
 	/* FIXME: Currently we are also creating this array when loading in
@@ -580,7 +828,7 @@ icalcomponent_add_component (icalcomponent* parent, icalcomponent* child)
 void
 icalcomponent_remove_component (icalcomponent* parent, icalcomponent* child)
 {
-   pvl_elem itr, next_itr;
+   int i;
 
    icalerror_check_arg_rv( (parent!=0), "parent");
    icalerror_check_arg_rv( (child!=0), "child");
@@ -601,27 +849,17 @@ icalcomponent_remove_component (icalcomponent* parent, icalcomponent* child)
 	}
     }
 
-   for( itr = pvl_head(parent->components);
-	itr != 0;
-	itr = next_itr)
-   {
-       next_itr = pvl_next(itr);
-       
-       if( pvl_data(itr) == (void*)child ){
+   i = nodelist_index_of(parent, &parent->components, child, child->kind);
+   if (i >= 0) {
+       nodelist_remove(parent, &parent->components, i);
 
-	   if (parent->component_iterator == itr){
-	       /* Don't let the current iterator become invalid */
+       /* Don't let the current iterator become invalid */
+       /* HACK. The semantics for this are troubling. */
+       nodelist_removed(&parent->components, &parent->component_iterator, i);
 
-	       /* HACK. The semantics for this are troubling. */
-	       parent->component_iterator = 
-		   pvl_next(parent->component_iterator);
-	          
-	   }
-	   pvl_remove( parent->components, itr); 
-	   child->parent = 0;
-	   break;
-       }
-   }	
+       child->parent = 0;
+       icalcomponent_hold_arena(child);
+   }
 }
 
 
@@ -630,18 +868,17 @@ icalcomponent_count_components (icalcomponent* component,
 				icalcomponent_kind kind)
 {
     int count=0;
-    pvl_elem itr;
+    int i;
 
     icalerror_check_arg_rz( (component!=0), "component");
 
-    for( itr = pvl_head(component->components);
-	 itr != 0;
-	 itr = pvl_next(itr))
+    for (i = nodelist_find_first(component, &component->components,
+				 kind, ICAL_ANY_COMPONENT);
+	 i >= 0;
+	 i = nodelist_find(&component->components, kind, ICAL_ANY_COMPONENT,
+			   i + 1))
     {
-	if(kind == icalcomponent_isa((icalcomponent*)pvl_data(itr)) ||
-	    kind == ICAL_ANY_COMPONENT){
-	    count++;
-	}
+	count++;
     }
 
     return count;
@@ -652,11 +889,11 @@ icalcomponent_get_current_component(icalcomponent* component)
 {
    icalerror_check_arg_rz( (component!=0),"component");
 
-   if (component->component_iterator == 0){
+   if (component->component_iterator < 0){
        return 0;
    }
 
-   return (icalcomponent*) pvl_data(component->component_iterator);
+   return (icalcomponent*) component->components.nodes[component->component_iterator];
 }
 
 icalcomponent*
@@ -665,19 +902,13 @@ icalcomponent_get_first_component (icalcomponent* c,
 {
    icalerror_check_arg_rz( (c!=0),"component");
   
-   for( c->component_iterator = pvl_head(c->components);
-	c->component_iterator != 0;
-	c->component_iterator = pvl_next(c->component_iterator)) {
-	    
-       icalcomponent *p =  (icalcomponent*) pvl_data(c->component_iterator);
-	
-	   if (icalcomponent_isa(p) == kind || kind == ICAL_ANY_COMPONENT) {
-	       
-	       return p;
-	   }
+   c->component_iterator = nodelist_find_first(c, &c->components, kind,
+					       ICAL_ANY_COMPONENT);
+   if (c->component_iterator < 0) {
+       return 0;
    }
 
-   return 0;
+   return (icalcomponent*) c->components.nodes[c->component_iterator];
 }
 
 
@@ -686,23 +917,18 @@ icalcomponent_get_next_component (icalcomponent* c, icalcomponent_kind kind)
 {
    icalerror_check_arg_rz( (c!=0),"component");
   
-   if (c->component_iterator == 0){
+   if (c->component_iterator < 0){
        return 0;
    }
 
-   for( c->component_iterator = pvl_next(c->component_iterator);
-	c->component_iterator != 0;
-	c->component_iterator = pvl_next(c->component_iterator)) {
-	    
-       icalcomponent *p =  (icalcomponent*) pvl_data(c->component_iterator);
-	
-	   if (icalcomponent_isa(p) == kind || kind == ICAL_ANY_COMPONENT) {
-	       
-	       return p;
-	   }
+   c->component_iterator = nodelist_find(&c->components, kind,
+					 ICAL_ANY_COMPONENT,
+					 c->component_iterator + 1);
+   if (c->component_iterator < 0) {
+       return 0;
    }
 
-   return 0;
+   return (icalcomponent*) c->components.nodes[c->component_iterator];
 }
 
 icalcomponent* icalcomponent_get_first_real_component(icalcomponent *c)
@@ -855,7 +1081,7 @@ int icalproperty_recurrence_is_excluded(icalcomponent *comp,
 				       struct icaltimetype *dtstart,
 				       struct icaltimetype *recurtime) {
   icalproperty *exdate, *exrule;
-  pvl_elem property_iterator;
+  int property_iterator;
 
   if (comp == NULL || 
       dtstart == NULL || 
@@ -1001,7 +1227,7 @@ void icalcomponent_foreach_recurrence(icalcomponent* comp,
   int dtduration;
   icalproperty *rrule, *rdate;
   struct icaldurationtype dur;
-  pvl_elem property_iterator;	/* for saving the iterator */
+  int property_iterator;	/* for saving the iterator */
   
   if (comp == NULL || callback == NULL)
     return;
@@ -1133,13 +1359,11 @@ int icalcomponent_count_errors(icalcomponent* component)
     int errors = 0;
     icalproperty *p;
     icalcomponent *c;
-    pvl_elem itr;
+    int i;
 
-    for( itr = pvl_head(component->properties);
-	 itr != 0;
-	 itr = pvl_next(itr))
+    for (i = 0; i < component->properties.count; i++)
     {	
-	p = (icalproperty*)pvl_data(itr);
+	p = (icalproperty*)component->properties.nodes[i];
 	
 	if(icalproperty_isa(p) == ICAL_XLICERROR_PROPERTY)
 	{
@@ -1148,11 +1372,9 @@ int icalcomponent_count_errors(icalcomponent* component)
     }
 
 
-    for( itr = pvl_head(component->components);
-	 itr != 0;
-	 itr = pvl_next(itr))
+    for (i = 0; i < component->components.count; i++)
     {	
-	c = (icalcomponent*)pvl_data(itr);
+	c = (icalcomponent*)component->components.nodes[i];
 	
 	errors += icalcomponent_count_errors(c);
 	
@@ -1166,28 +1388,25 @@ void icalcomponent_strip_errors(icalcomponent* component)
 {
     icalproperty *p;
     icalcomponent *c;
-    pvl_elem itr, next_itr;
+    int i;
 
-   for( itr = pvl_head(component->properties);
-	 itr != 0;
-	 itr = next_itr)
+   for (i = 0; i < component->properties.count; )
     {	
-	p = (icalproperty*)pvl_data(itr);
-	next_itr = pvl_next(itr);
+	p = (icalproperty*)component->properties.nodes[i];
 
 	if(icalproperty_isa(p) == ICAL_XLICERROR_PROPERTY)
 	{
 	    icalcomponent_remove_property(component,p);
 	    icalproperty_free(p);
 	    p = NULL;
+	} else {
+	    i++;
 	}
     }
     
-    for( itr = pvl_head(component->components);
-	 itr != 0;
-	 itr = pvl_next(itr))
+    for (i = 0; i < component->components.count; i++)
     {	
-	c = (icalcomponent*)pvl_data(itr);
+	c = (icalcomponent*)component->components.nodes[i];
 	icalcomponent_strip_errors(c);
     }
 }
@@ -1272,7 +1491,7 @@ void icalcomponent_set_parent(icalcomponent* component, icalcomponent* parent)
    component->parent = parent;
 }
 
-icalcompiter icalcompiter_null = {ICAL_NO_COMPONENT,0};
+icalcompiter icalcompiter_null = {ICAL_NO_COMPONENT,0,-1};
 
 
 struct icalcomponent_kind_map {
@@ -1362,23 +1581,16 @@ icalcompiter
 icalcomponent_begin_component(icalcomponent* component,icalcomponent_kind kind)
 {
     icalcompiter itr;
-    pvl_elem i;
 
     itr.kind = kind;
-    itr.iter = NULL;
+    itr.component = component;
 
     icalerror_check_arg_re(component!=0,"component",icalcompiter_null);
 
-    for( i = pvl_head(component->components); i != 0; i = pvl_next(i)) {
-	
-	icalcomponent *c =  (icalcomponent*) pvl_data(i);
-	
-	if (icalcomponent_isa(c) == kind || kind == ICAL_ANY_COMPONENT) {
-	    
-	    itr.iter = i;
-
-	    return itr;
-	}
+    itr.iter = nodelist_find_first(component, &component->components, kind,
+				   ICAL_ANY_COMPONENT);
+    if (itr.iter >= 0) {
+	return itr;
     }
 
     return icalcompiter_null;
@@ -1388,19 +1600,20 @@ icalcompiter
 icalcomponent_end_component(icalcomponent* component,icalcomponent_kind kind)
 {
     icalcompiter itr; 
-    pvl_elem i;
+    int i;
 
     itr.kind = kind;
+    itr.component = component;
 
     icalerror_check_arg_re(component!=0,"component",icalcompiter_null);
 
-    for( i = pvl_tail(component->components); i != 0; i = pvl_prior(i)) {
-	
-	icalcomponent *c =  (icalcomponent*) pvl_data(i);
+    for (i = component->components.count - 1; i >= 0; i--) {
 	
-	if (icalcomponent_isa(c) == kind || kind == ICAL_ANY_COMPONENT) {
+	if (component->components.kinds[i] == kind ||
+	    kind == ICAL_ANY_COMPONENT) {
 	    
-	    itr.iter = pvl_next(i);
+	    /* One past the last match, like the end of a list */
+	    itr.iter = i + 1 < component->components.count ? i + 1 : -1;
 
 	    return itr;
 	}
@@ -1412,45 +1625,31 @@ icalcomponent_end_component(icalcomponent* component,icalcomponent_kind kind)
 
 icalcomponent* icalcompiter_next(icalcompiter* i)
 {
-   if (i->iter == 0){
+   if (i->iter < 0){
        return 0;
    }
 
    icalerror_check_arg_rz( (i!=0),"i");
 
-   for( i->iter = pvl_next(i->iter);
-	i->iter != 0;
-	i->iter = pvl_next(i->iter)) {
-	    
-       icalcomponent *c =  (icalcomponent*) pvl_data(i->iter);
-	
-	   if (icalcomponent_isa(c) == i->kind 
-	       || i->kind == ICAL_ANY_COMPONENT) {
-	       
-	       return icalcompiter_deref(i);;
-	   }
-   }
+   i->iter = nodelist_find(&i->component->components, i->kind,
+			   ICAL_ANY_COMPONENT, i->iter + 1);
 
-   return 0;
+   return icalcompiter_deref(i);
 
 }
 
 icalcomponent* icalcompiter_prior(icalcompiter* i)
 {
-   if (i->iter == 0){
+   if (i->iter < 0){
        return 0;
    }
 
-   for( i->iter = pvl_prior(i->iter);
-	i->iter != 0;
-	i->iter = pvl_prior(i->iter)) {
-	    
-       icalcomponent *c =  (icalcomponent*) pvl_data(i->iter);
+   for( i->iter = i->iter - 1; i->iter >= 0; i->iter--) {
 	
-	   if (icalcomponent_isa(c) == i->kind 
+	   if (i->component->components.kinds[i->iter] == i->kind 
 	       || i->kind == ICAL_ANY_COMPONENT) {
 	       
-	       return icalcompiter_deref(i);;
+	       return icalcompiter_deref(i);
 	   }
    }
 
@@ -1459,11 +1658,11 @@ icalcomponent* icalcompiter_prior(icalcompiter* i)
 }
 icalcomponent* icalcompiter_deref(icalcompiter* i)
 {
-    if(i->iter ==0){
+    if(i->iter < 0 || i->iter >= i->component->components.count){
 	return 0;
     }
 
-    return pvl_data(i->iter);
+    return i->component->components.nodes[i->iter];
 }
 
 icalcomponent* icalcomponent_get_inner(icalcomponent* comp)
@@ -2225,12 +2424,16 @@ icalcomponent_handle_conflicting_vtimezones (icalcomponent *comp,
 {
   int i, suffix, max_suffix = 0, num_elements;
   unsigned int tzid_len;
+  uint64_t hash;
   char *tzid_copy, *new_tzid, suffix_buf[32];
   (void)tzid_prop; /* hack to stop unused variable warning */
 
   /* Find the length of the TZID without any trailing digits. */
   tzid_len = icalcomponent_get_tzid_prefix_len (tzid);
 
+  /* The new VTIMEZONE is hashed only once for all the comparisons. */
+  hash = icalcomponent_get_vtimezone_hash (vtimezone);
+
   /* Step through each of the VTIMEZONEs in comp. We may already have the
      clashing VTIMEZONE in the calendar, but it may have been renamed
      (i.e. a unique number added on the end of the TZID, e.g. 'London2').
@@ -2255,8 +2458,8 @@ icalcomponent_handle_conflicting_vtimezones (icalcomponent *comp,
     if (tzid_len == existing_tzid_len
 	&& !strncmp (tzid, existing_tzid, tzid_len)) {
       /* Compare the VTIMEZONEs. */
-      if (icalcomponent_compare_vtimezones (icaltimezone_get_component (zone),
-					    vtimezone)) {
+      if (icalcomponent_compare_vtimezone_hash (icaltimezone_get_component (zone),
+						vtimezone, hash)) {
 	/* The VTIMEZONEs match, so we can use the existing VTIMEZONE. But
 	   we have to rename TZIDs to this TZID. */
 	tzid_copy = strdup (tzid);
@@ -2463,70 +2666,186 @@ static int icalcomponent_compare_timezone_fn	(const void	*elem1,
 }
 
 
-/**
- * Compares 2 VTIMEZONE components to see if they match, ignoring their TZIDs.
- * It returns 1 if they match, 0 if they don't, or -1 on error.
- */
-static int icalcomponent_compare_vtimezones (icalcomponent	*vtimezone1,
-					     icalcomponent	*vtimezone2)
+/* FNV-1a over the text of a VTIMEZONE, see
+   icalcomponent_get_vtimezone_hash() */
+static int icalcomponent_hash_func (const char *data, size_t len,
+				    void *user_data)
 {
-    icalproperty *prop1, *prop2;
-    const char *tzid1, *tzid2;
-    char *tzid2_copy, *string1, *string2;
-    int cmp;
+    uint64_t *hash = (uint64_t *) user_data;
+    size_t i;
 
-    /* Get the TZID property of the first VTIMEZONE. */
-    prop1 = icalcomponent_get_first_property (vtimezone1, ICAL_TZID_PROPERTY);
-    if (!prop1)
-	return -1;
+    for (i = 0; i < len; i++) {
+	*hash ^= (unsigned char) data[i];
+	*hash *= 0x100000001b3ULL;
+    }
+    return 1;
+}
 
-    tzid1 = icalproperty_get_tzid (prop1);
-    if (!tzid1)
-	return -1;
+static int icalcomponent_has_tzid (icalcomponent *vtimezone)
+{
+    int i;
 
-    /* Get the TZID property of the second VTIMEZONE. */
-    prop2 = icalcomponent_get_first_property (vtimezone2, ICAL_TZID_PROPERTY);
-    if (!prop2)
-	return -1;
+    for (i = 0; i < vtimezone->properties.count; i++) {
+	icalproperty *p = (icalproperty*)vtimezone->properties.nodes[i];
+	if (icalproperty_isa (p) == ICAL_TZID_PROPERTY
+	    && icalproperty_get_tzid (p)) {
+	    return 1;
+	}
+    }
+    return 0;
+}
 
-    tzid2 = icalproperty_get_tzid (prop2);
-    if (!tzid2)
-	return -1;
+/* Writes the text of a VTIMEZONE as icalcomponent_as_ical_string_r() has
+   it, without the TZID. The properties are walked directly, so that the
+   iterators of the component aren't touched and several threads may
+   write it. Returns 0 on failure. */
+static int icalcomponent_write_vtimezone_text (icalcomponent *vtimezone,
+					       icalwriter *w)
+{
+    int i, ok = 1;
 
-    /* Copy the second TZID, and set the property to the same as the first
-       TZID, since we don't care if these match of not. */
-    tzid2_copy = strdup (tzid2);
-    if (!tzid2_copy) {
-      icalerror_set_errno (ICAL_NEWFAILED_ERROR);
-      return 0;
+    icalwriter_write_string (w, "BEGIN:VTIMEZONE\r\n");
+    for (i = 0; i < vtimezone->properties.count; i++) {
+	icalproperty *p = (icalproperty*)vtimezone->properties.nodes[i];
+	if (icalproperty_isa (p) != ICAL_TZID_PROPERTY)
+	    icalproperty_write (p, w);
+    }
+    for (i = 0; i < vtimezone->components.count; i++) {
+	ok = ok && icalcomponent_write_impl (
+	    (icalcomponent*)vtimezone->components.nodes[i], w);
     }
+    icalwriter_write_string (w, "END:VTIMEZONE\r\n");
 
-    icalproperty_set_tzid (prop2, tzid1);
+    return icalwriter_flush (w) && ok;
+}
+
+uint64_t
+icalcomponent_get_vtimezone_hash (icalcomponent *vtimezone)
+{
+    icalwriter w;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    int ok;
 
-    /* Now convert both VTIMEZONEs to strings and compare them. */
-    string1 = icalcomponent_as_ical_string_r (vtimezone1);
-    if (!string1) {
-	free (tzid2_copy);
+    icalerror_check_arg_rz( (vtimezone!=0), "vtimezone");
+
+    if (!icalcomponent_has_tzid (vtimezone))
+	return 0;
+
+    if (!icalwriter_init_func (&w, icalcomponent_hash_func, &hash))
+	return 0;
+    ok = icalcomponent_write_vtimezone_text (vtimezone, &w);
+    icalwriter_free (&w);
+    if (!ok)
+	return 0;
+
+    /* 0 is the error value */
+    return hash ? hash : 1;
+}
+
+
+/* Checks the text of a second VTIMEZONE against that of the first, see
+   icalcomponent_compare_vtimezone_text() */
+struct icalcomponent_text_cmp {
+    const char *text;
+    size_t len;
+    int differs;
+};
+
+static int icalcomponent_text_cmp_func (const char *data, size_t len,
+					void *user_data)
+{
+    struct icalcomponent_text_cmp *cmp =
+	(struct icalcomponent_text_cmp *) user_data;
+
+    if (len > cmp->len || memcmp (cmp->text, data, len) != 0) {
+	cmp->differs = 1;
+	return 0;
+    }
+    cmp->text += len;
+    cmp->len -= len;
+    return 1;
+}
+
+int
+icalcomponent_compare_vtimezone_text (icalcomponent *vtimezone1,
+				      icalcomponent *vtimezone2)
+{
+    struct icalcomponent_text_cmp cmp;
+    icalwriter w;
+    char *text1;
+    int ok;
+
+    icalerror_check_arg_re( (vtimezone1!=0), "vtimezone1", -1);
+    icalerror_check_arg_re( (vtimezone2!=0), "vtimezone2", -1);
+
+    if (!icalcomponent_has_tzid (vtimezone1)
+	|| !icalcomponent_has_tzid (vtimezone2))
+	return -1;
+
+    if (!icalwriter_init_buffer (&w, 4096))
+	return -1;
+    ok = icalcomponent_write_vtimezone_text (vtimezone1, &w);
+    text1 = icalwriter_steal_buffer (&w);
+    icalwriter_free (&w);
+    if (!ok || !text1) {
+	free (text1);
 	return -1;
     }
 
-    string2 = icalcomponent_as_ical_string_r (vtimezone2);
-    if (!string2) {
-	free (string1);
-	free (tzid2_copy);
+    /* The second text is compared while it is written, it stops at the
+       first difference */
+    cmp.text = text1;
+    cmp.len = strlen (text1);
+    cmp.differs = 0;
+    if (!icalwriter_init_func (&w, icalcomponent_text_cmp_func, &cmp)) {
+	free (text1);
 	return -1;
     }
+    ok = icalcomponent_write_vtimezone_text (vtimezone2, &w);
+    icalwriter_free (&w);
+    free (text1);
+
+    if (cmp.differs)
+	return 0;
+    if (!ok)
+	return -1;
+    return (cmp.len == 0) ? 1 : 0;
+}
 
-    cmp = strcmp (string1, string2);
 
-    free (string1);
-    free (string2);
+/**
+ * Compares a VTIMEZONE component with another one and its hash from
+ * icalcomponent_get_vtimezone_hash(), ignoring their TZIDs. The hash
+ * rules most of the mismatches out, equal hashes are confirmed on the
+ * text. It returns 1 if they match, 0 if they don't, or -1 on error.
+ */
+static int icalcomponent_compare_vtimezone_hash (icalcomponent	*vtimezone,
+						 icalcomponent	*vtimezone2,
+						 uint64_t	hash2)
+{
+    uint64_t hash;
+
+    if (!hash2)
+	return -1;
 
-    /* Now reset the second TZID. */
-    icalproperty_set_tzid (prop2, tzid2_copy);
-    free (tzid2_copy);
+    hash = icalcomponent_get_vtimezone_hash (vtimezone);
+    if (!hash)
+	return -1;
+
+    if (hash != hash2)
+	return 0;
+    return icalcomponent_compare_vtimezone_text (vtimezone, vtimezone2);
+}
 
-    return (cmp == 0) ? 1 : 0;
+
+/**
+ * Compares 2 VTIMEZONE components to see if they match, ignoring their TZIDs.
+ * It returns 1 if they match, 0 if they don't, or -1 on error.
+ */
+static int icalcomponent_compare_vtimezones (icalcomponent	*vtimezone1,
+					     icalcomponent	*vtimezone2)
+{
+    return icalcomponent_compare_vtimezone_text (vtimezone1, vtimezone2);
 }
 
 
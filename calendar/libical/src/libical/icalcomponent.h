@@ -30,6 +30,8 @@
 #include "icalenums.h" /* defines icalcomponent_kind */
 #include "pvl.h"
 
+#include <stdint.h> /* for uint64_t */
+
 typedef struct icalcomponent_impl icalcomponent;
 
 #ifndef ICALTIMEZONE_DEFINED
@@ -46,7 +48,8 @@ typedef struct _icaltimezone		icaltimezone;
 typedef struct icalcompiter
 {
 	icalcomponent_kind kind;
-	pvl_elem iter;
+	icalcomponent* component;
+	int iter;
 
 } icalcompiter;
 
@@ -60,6 +63,35 @@ void icalcomponent_free(icalcomponent* component);
 char* icalcomponent_as_ical_string(icalcomponent* component);
 char* icalcomponent_as_ical_string_r(icalcomponent* component);
 
+/** Receives a chunk of the text icalcomponent_write() produces; returns 0
+    to stop serializing. */
+typedef int (*icalcomponent_write_func)(const char* data, size_t len,
+                                        void* user_data);
+
+/**
+ * Serialize the component like icalcomponent_as_ical_string_r(), but
+ * pass the text to 'func' in chunks as it is produced instead of keeping
+ * all of it in memory. Returns 0 if the component could not be
+ * serialized or 'func' failed.
+ */
+int icalcomponent_write(icalcomponent* component,
+                        icalcomponent_write_func func, void* user_data);
+
+/**
+ * A hash of the text of a VTIMEZONE without its TZID. VTIMEZONEs that
+ * only differ in their TZIDs get the same hash. Returns 0 if the
+ * VTIMEZONE has no TZID or could not be hashed.
+ */
+uint64_t icalcomponent_get_vtimezone_hash(icalcomponent* vtimezone);
+
+/**
+ * Compares the texts of 2 VTIMEZONEs without their TZIDs, for when their
+ * hashes are equal. Returns 1 if they match, 0 if they don't, or -1 if
+ * either has no TZID or could not be serialized.
+ */
+int icalcomponent_compare_vtimezone_text(icalcomponent* vtimezone1,
+                                         icalcomponent* vtimezone2);
+
 int icalcomponent_is_valid(icalcomponent* component);
 
 icalcomponent_kind icalcomponent_isa(const icalcomponent* component);
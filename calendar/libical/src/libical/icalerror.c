@@ -70,7 +70,11 @@ icalerrorenum *icalerrno_return(void) {
 
 #else
 
+#ifdef WIN32
+static __declspec(thread) icalerrorenum icalerrno_storage = ICAL_NO_ERROR;
+#else
 static icalerrorenum icalerrno_storage = ICAL_NO_ERROR;
+#endif
 
 icalerrorenum *icalerrno_return(void) {
    return &icalerrno_storage;
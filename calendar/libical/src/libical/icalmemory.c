@@ -73,10 +73,11 @@
 #define MIN_BUFFER_SIZE 200
 
 
-/* HACK. Not threadsafe */
+/* Every thread has a ring of its own, see get_buffer_ring() */
 
 typedef struct {
 	int pos;
+	size_t added; /* buffers added so far, for the ring scopes */
 	void *ring[BUFFER_RING_SIZE];
 } buffer_ring;
 
@@ -84,8 +85,13 @@ void icalmemory_free_tmp_buffer (void* buf);
 void icalmemory_free_ring_byval(buffer_ring *br);
 
 #ifndef HAVE_PTHREAD
+#ifdef WIN32
+/* Still one per thread, but not freed when the thread exits */
+static __declspec(thread) buffer_ring* global_buffer_ring = 0;
+#else
 static buffer_ring* global_buffer_ring = 0;
 #endif
+#endif
 
 #ifdef HAVE_PTHREAD
 #include <pthread.h>
@@ -109,11 +115,15 @@ static buffer_ring * buffer_ring_new(void) {
 	int i;
 
 	br = (buffer_ring *)malloc(sizeof(buffer_ring));
+	if (br == 0) {
+	    return 0;
+	}
 
 	for(i=0; i<BUFFER_RING_SIZE; i++){
 	    br->ring[i]  = 0;
 	}
 	br->pos = 0;
+	br->added = 0;
         return(br);
 }
 
@@ -156,6 +166,12 @@ void  icalmemory_add_tmp_buffer(void* buf)
 {
     buffer_ring *br = get_buffer_ring();
 
+    if (br == 0) {
+	free(buf);
+	return;
+    }
+
+    br->added++;
 
     /* Wrap around the ring */
     if(++(br->pos) == BUFFER_RING_SIZE){
@@ -211,10 +227,48 @@ void icalmemory_free_ring_byval(buffer_ring *br) {
    free(br);
 }
 
+size_t icalmemory_open_ring_scope(void)
+{
+    buffer_ring *br = get_buffer_ring();
+
+    return br != 0 ? br->added : 0;
+}
+
+void icalmemory_close_ring_scope(size_t scope)
+{
+    buffer_ring *br = get_buffer_ring();
+    size_t count;
+
+    /* Nothing to do if the ring was freed while the scope was open */
+    if (br == 0 || br->added < scope) {
+	return;
+    }
+
+    /* Free the newest buffers, each of which was added after the scope
+       was opened, and hand out their slots again */
+    count = br->added - scope;
+    if (count > BUFFER_RING_SIZE) {
+	count = BUFFER_RING_SIZE;
+    }
+    while (count-- > 0) {
+	if (br->ring[br->pos] != 0) {
+	    free(br->ring[br->pos]);
+	    br->ring[br->pos] = 0;
+	}
+	if (br->pos-- == 0) {
+	    br->pos = BUFFER_RING_SIZE - 1;
+	}
+    }
+    br->added = scope;
+}
+
 void icalmemory_free_ring()
 {
    buffer_ring *br;
    br = get_buffer_ring();
+   if (br == 0) {
+       return;
+   }
 
    icalmemory_free_ring_byval(br);
 #ifdef HAVE_PTHREAD
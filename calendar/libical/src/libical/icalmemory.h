@@ -46,6 +46,14 @@ void  icalmemory_add_tmp_buffer(void*);
 /** Free all memory used in the ring */
 void icalmemory_free_ring(void);
 
+/** The ring belongs to the calling thread. Closing a scope frees every
+    buffer that was put on the ring since the scope was opened, so a
+    caller can release what a series of calls left behind without
+    freeing the buffers of its own callers. Scopes must be closed in
+    the reverse order they were opened in. */
+size_t icalmemory_open_ring_scope(void);
+void icalmemory_close_ring_scope(size_t scope);
+
 /* Non-tmp buffers must be freed. These are mostly wrappers around
  * malloc, etc, but are used so the caller can change the memory
  * allocators in a future version of the library */
@@ -57,15 +57,17 @@ icalparameter* icalparameter_new_from_value_string(icalparameter_kind kind,const
 struct icalparameter_impl* icalparameter_new_impl(icalparameter_kind kind)
 {
     struct icalparameter_impl* v;
+    icalarena* arena;
 
     if ( ( v = (struct icalparameter_impl*)
-	   malloc(sizeof(struct icalparameter_impl))) == 0) {
-	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+	   icalarena_alloc(sizeof(struct icalparameter_impl), &arena)) == 0) {
 	return 0;
     }
     
     strcpy(v->id,"para");
 
+    v->arena = arena;
+
     v->kind = kind;
     v->size = 0;
     v->string = 0;
@@ -104,18 +106,20 @@ icalparameter_free (icalparameter* param)
 
     
     if (param->string != 0){
-	free ((void*)param->string);
+	icalarena_free (param->arena, (void*)param->string);
     }
     
     if (param->x_name != 0){
-	free ((void*)param->x_name);
+	icalarena_free (param->arena, (void*)param->x_name);
     }
     
     memset(param,0,sizeof(param));
 
     param->parent = 0;
     param->id[0] = 'X';
-    free(param);
+    if (param->arena == 0) {
+	free(param);
+    }
 }
 
 
@@ -124,6 +128,7 @@ icalparameter*
 icalparameter_new_clone(icalparameter* old)
 {
     struct icalparameter_impl *new;
+    icalarena* arena;
 
     new = icalparameter_new_impl(old->kind);
 
@@ -133,10 +138,12 @@ icalparameter_new_clone(icalparameter* old)
 	return 0;
     }
 
+    arena = new->arena;
     memcpy(new,old,sizeof(struct icalparameter_impl));
+    new->arena = arena;
 
     if (old->string != 0){
-	new->string = icalmemory_strdup(old->string);
+	new->string = icalarena_strdup(old->string);
 	if (new->string == 0){
 	    icalparameter_free(new);
 	    return 0;
@@ -144,7 +151,7 @@ icalparameter_new_clone(icalparameter* old)
     }
 
     if (old->x_name != 0){
-	new->x_name = icalmemory_strdup(old->x_name);
+	new->x_name = icalarena_strdup(old->x_name);
 	if (new->x_name == 0){
 	    icalparameter_free(new);
 	    return 0;
@@ -333,10 +340,10 @@ icalparameter_set_xname (icalparameter* param, const char* v)
     icalerror_check_arg_rv( (v!=0),"v");
 
     if (param->x_name != 0){
-	free((void*)param->x_name);
+	icalarena_free(param->arena, (void*)param->x_name);
     }
 
-    param->x_name = icalmemory_strdup(v);
+    param->x_name = icalarena_strdup(v);
 
     if (param->x_name == 0){
 	errno = ENOMEM;
@@ -359,10 +366,10 @@ icalparameter_set_xvalue (icalparameter* param, const char* v)
     icalerror_check_arg_rv( (v!=0),"v");
 
     if (param->string != 0){
-	free((void*)param->string);
+	icalarena_free(param->arena, (void*)param->string);
     }
 
-    param->string = icalmemory_strdup(v);
+    param->string = icalarena_strdup(v);
 
     if (param->string == 0){
 	errno = ENOMEM;
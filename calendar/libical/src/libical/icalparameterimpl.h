@@ -36,6 +36,7 @@
 
 #include "icalparameter.h"
 #include "icalproperty.h"
+#include "icalarena.h"
 
 struct icalparameter_impl
 {
@@ -45,6 +46,7 @@ struct icalparameter_impl
 	const char* string;
 	const char* x_name;
 	icalproperty* parent;
+	icalarena* arena;
 
 	int data;
 };
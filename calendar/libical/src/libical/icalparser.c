@@ -53,6 +53,7 @@
 #include <ctype.h>
 
 #include "icalmemory.h"
+#include "icalarena.h"
 #include "icalparser.h"
 
 #ifdef HAVE_WCTYPE_H
@@ -75,11 +76,140 @@
 #define strcasecmp    stricmp
 #endif
 
+/*
+ * Content line scanning. parser_scan() returns the first byte in
+ * [p, end) that is equal to a, b or c, or 0. It is picked at runtime
+ * from an AVX2, an SSE2 and a plain C version; all callers look for a
+ * few delimiters in lines that are mostly plain text or base64, so
+ * skipping 16 or 32 bytes per compare is what matters here.
+ */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ICALPARSER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(ICALPARSER_SSE2) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define ICALPARSER_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static int parser_ctz(unsigned int mask)
+{
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+}
+#else
+#define parser_ctz(mask) __builtin_ctz(mask)
+#endif
+
+typedef const char* (*parser_scan_func)(const char *p, const char *end,
+                                        char a, char b, char c);
+
+static const char* parser_scan_c(const char *p, const char *end,
+                                 char a, char b, char c)
+{
+    for (; p < end; p++) {
+        if (*p == a || *p == b || *p == c) {
+            return p;
+        }
+    }
+    return 0;
+}
+
+#ifdef ICALPARSER_SSE2
+static const char* parser_scan_sse2(const char *p, const char *end,
+                                    char a, char b, char c)
+{
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    const __m128i vc = _mm_set1_epi8(c);
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va),
+                                                _mm_cmpeq_epi8(v, vb)),
+                                   _mm_cmpeq_epi8(v, vc));
+        int mask = _mm_movemask_epi8(hit);
+
+        if (mask != 0) {
+            return p + parser_ctz((unsigned int)mask);
+        }
+        p += 16;
+    }
+    return parser_scan_c(p, end, a, b, c);
+}
+#endif
+
+#ifdef ICALPARSER_AVX2
+__attribute__((target("avx2")))
+static const char* parser_scan_avx2(const char *p, const char *end,
+                                    char a, char b, char c)
+{
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    const __m256i vc = _mm256_set1_epi8(c);
+
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+                                                      _mm256_cmpeq_epi8(v, vb)),
+                                      _mm256_cmpeq_epi8(v, vc));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+
+        if (mask != 0) {
+            _mm256_zeroupper();
+            return p + parser_ctz(mask);
+        }
+        p += 32;
+    }
+
+    /* Not every compiler does this for us, and leaving the upper halves
+       dirty slows down all SSE code that runs afterwards */
+    _mm256_zeroupper();
+    return parser_scan_sse2(p, end, a, b, c);
+}
+#endif
+
+static const char* parser_scan_init(const char *p, const char *end,
+                                    char a, char b, char c);
+
+/* Racing threads all store the same function, so no locking is needed */
+static parser_scan_func parser_scan = parser_scan_init;
+
+static const char* parser_scan_init(const char *p, const char *end,
+                                    char a, char b, char c)
+{
+    parser_scan_func scan = parser_scan_c;
+
+#ifdef ICALPARSER_SSE2
+    scan = parser_scan_sse2;
+#endif
+#ifdef ICALPARSER_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scan = parser_scan_avx2;
+    }
+#endif
+
+    parser_scan = scan;
+    return scan(p, end, a, b, c);
+}
+
 static char* parser_get_next_char(char c, char *str, int qm);
-static char* parser_get_next_parameter(char* line,char** end);
-static char* parser_get_next_value(char* line, char **end, icalvalue_kind kind);
-static char* parser_get_prop_name(char* line, char** end);
+static char* parser_find_char(char c, const char *str, const char *end, int qm);
+static char* parser_get_next_parameter(char* line, const char *colon, char** end);
+static char* parser_get_next_value(char* line, const char *line_end, char **end, icalvalue_kind kind);
 static char* parser_get_param_name(char* line, char **end, char **buf_value);
+static icalcomponent* parser_add_contentline(icalparser* parser,
+                                             const icalparser_contentline* cl);
+static void parser_split_contentline(const char *line, size_t len,
+                                     icalparser_contentline *cl);
 
 #define TMP_BUF_SIZE 80
 
@@ -99,8 +229,23 @@ struct icalparser_impl
     
     void *line_gen_data;
 
+    char *unfold_buf; /* scratch for folded lines in icalparser_next_contentline */
+    size_t unfold_buf_size;
+
+    icalparser_child_func child_func;
+    void *child_data;
+
+    char *push_buf; /* the line icalparser_push_data holds for the next chunk */
+    size_t push_len;
+    size_t push_size;
+    icalcomponent *push_root;
+
+    icalarena *arena; /* see icalparser_use_arena */
 };
 
+/* icalcomponent functions that only the parser gets to use */
+void icalcomponent_hold_arena(icalcomponent* comp);
+
 
 /*
  * New version of strstrip() that does not move the pointer.
@@ -153,6 +298,16 @@ icalparser* icalparser_new(void)
     impl->lineno = 0;
     impl->continuation_line = 0;
     memset(impl->temp,0, TMP_BUF_SIZE);
+    impl->line_gen_data = 0;
+    impl->unfold_buf = 0;
+    impl->unfold_buf_size = 0;
+    impl->child_func = 0;
+    impl->child_data = 0;
+    impl->push_buf = 0;
+    impl->push_len = 0;
+    impl->push_size = 0;
+    impl->push_root = 0;
+    impl->arena = 0;
 
     return (icalparser*)impl;
 }
@@ -171,51 +326,129 @@ void icalparser_free(icalparser* parser)
     }
     
     pvl_free(parser->components);
+
+    if (parser->unfold_buf != 0) {
+	icalmemory_free_buffer(parser->unfold_buf);
+    }
+
+    if (parser->push_buf != 0) {
+	icalmemory_free_buffer(parser->push_buf);
+    }
+
+    if (parser->push_root != 0) {
+	icalcomponent_free(parser->push_root);
+    }
+
+    /* After everything that may still be allocated from it */
+    if (parser->arena != 0) {
+	icalarena_unref(parser->arena);
+    }
     
     free(parser);
 }
 
+void icalparser_reset(icalparser* parser)
+{
+    icalcomponent *c;
+
+    icalerror_check_arg_rv((parser != 0),"parser");
+
+    if (parser->root_component != 0){
+	icalcomponent_free(parser->root_component);
+	parser->root_component = 0;
+    }
+
+    while( (c=pvl_pop(parser->components)) != 0){
+	icalcomponent_free(c);
+    }
+
+    if (parser->push_root != 0) {
+	icalcomponent_free(parser->push_root);
+	parser->push_root = 0;
+    }
+    parser->push_len = 0;
+
+    parser->level = 0;
+    parser->lineno = 0;
+    parser->state = ICALPARSER_SUCCESS;
+    parser->buffer_full = 0;
+    parser->continuation_line = 0;
+
+    if (parser->arena != 0) {
+	icalarena_unref(parser->arena);
+	parser->arena = icalarena_new();
+    }
+}
+
 void icalparser_set_gen_data(icalparser* parser, void* data)
 {
 		parser->line_gen_data  = data;
 }
 
+void icalparser_set_child_func(icalparser* parser,
+                               icalparser_child_func func, void* data)
+{
+    parser->child_func = func;
+    parser->child_data = data;
+}
+
+void icalparser_use_arena(icalparser* parser, int use)
+{
+    icalerror_check_arg_rv((parser != 0),"parser");
+
+    if (use && parser->arena == 0) {
+	parser->arena = icalarena_new();
+    } else if (!use && parser->arena != 0) {
+	icalarena_unref(parser->arena);
+	parser->arena = 0;
+    }
+}
+
 
 icalvalue* icalvalue_new_From_string_with_error(icalvalue_kind kind, 
                                                 char* str, 
                                                 icalproperty **error);
 
 
+/**
+ * Find the first occurrence of 'c' in [str, end). A character preceded
+ * by a backslash never matches, and if 'qm' is set, characters between
+ * double quotes are skipped.
+ */
 static
-char* parser_get_next_char(char c, char *str, int qm)
+char* parser_find_char(char c, const char *str, const char *end, int qm)
 {
     int quote_mode = 0;
-    char *p = str;
-    char next_char = *p;
-    char prev_char = 0;
-
-    while (next_char != '\0') {
-        if (prev_char != '\\') {
-            if (qm == 1 && next_char == '"') {
-                /* Encountered a quote, toggle quote mode */
-                quote_mode = !quote_mode;
-            } else if (quote_mode == 0 && next_char == c) {
-                /* Found a matching character out of quote mode, return it */
-                return p;
-            }
+    const char *p;
+    char quote = qm == 1 ? '"' : c;
+
+    /* Only 'c' and quotes change anything, so jump from one to the next */
+    for (p = str; (p = parser_scan(p, end, c, quote, c)) != 0; p++) {
+        if (p > str && *(p-1) == '\\') {
+            /* Escaped by the previous character */
+            continue;
+        }
+        if (qm == 1 && *p == '"') {
+            /* Encountered a quote, toggle quote mode */
+            quote_mode = !quote_mode;
+        } else if (quote_mode == 0 && *p == c) {
+            /* Found a matching character out of quote mode, return it */
+            return (char*)p;
         }
-
-        /* Save the previous character so we can check if it's a backslash in the next iteration */
-        prev_char = next_char;
-        next_char = *(++p);
     }
 
     return 0;
 }
 
+static
+char* parser_get_next_char(char c, char *str, int qm)
+{
+    return parser_find_char(c, str, str + strlen(str), qm);
+}
+
 
 /** make a new tmp buffer out of a substring */
-static char* make_segment(char* start, char* end)
+static char* make_segment(const char* start, const char* end)
 {
     char *buf, *tmp;
     size_t size = (size_t)end - (size_t)start;
@@ -235,32 +468,6 @@ static char* make_segment(char* start, char* end)
     return buf;
 }
 
-static
-char* parser_get_prop_name(char* line, char** end)
-{
-    char* p;
-    char* v;
-    char *str;
-
-    p = parser_get_next_char(';',line,1); 
-    v = parser_get_next_char(':',line,1); 
-    if (p== 0 && v == 0) {
-	return 0;
-    }
-
-    /* There is no ';' or, it is after the ';' that marks the beginning of
-       the value */
-    if (v!=0 && ( p == 0 || p > v)){
-	str = make_segment(line,v);
-	*end = v+1;
-    } else {
-	str = make_segment(line,p);
-	*end = p+1;
-    }
-
-    return str;
-}
-
 static
 char* parser_get_param_name(char* line, char **end, char **buf)
 {
@@ -313,10 +520,11 @@ char* parser_get_next_paramvalue(char* line, char **end)
 }
 #endif
 
-char* icalparser_get_value(char* line, char **end, icalvalue_kind kind)
+static
+char* parser_get_value(char* line, const char *line_end, char **end)
 {
     char *str;
-    size_t length = strlen(line);
+    size_t length = (size_t)(line_end - line);
 
     if (length == 0){
         return 0;
@@ -328,25 +536,31 @@ char* icalparser_get_value(char* line, char **end, icalvalue_kind kind)
     return str;
 }
 
+char* icalparser_get_value(char* line, char **end, icalvalue_kind kind)
+{
+    return parser_get_value(line, line + strlen(line), end);
+}
+
 /**
    A property may have multiple values, if the values are seperated by
    commas in the content line. This routine will look for the next
    comma after line and will set the next place to start searching in
-   end. */
+   end. The value never extends past line_end. */
 
 static 
-char* parser_get_next_value(char* line, char **end, icalvalue_kind kind)
+char* parser_get_next_value(char* line, const char *line_end, char **end,
+                            icalvalue_kind kind)
 {
     
     char* next;
     char *p;
     char *str;
-    size_t length = strlen(line);
+    size_t length = (size_t)(line_end - line);
 
     p = line;
     while(1){
 
-	next = parser_get_next_char(',',p,1);
+	next = parser_find_char(',',p,line_end,1);
 
 	/* Unforunately, RFC2445 says that for the RECUR value, COMMA
 	   can both separate digits in a list, and it can separate
@@ -409,21 +623,30 @@ char* parser_get_next_value(char* line, char **end, icalvalue_kind kind)
    
 }
 
+/**
+   Return the next parameter of a content line. 'colon' is the ':' that
+   marks the beginning of the value, so there is no need to look any
+   further than that for a ';'. */
+
 static 
-char* parser_get_next_parameter(char* line,char** end)
+char* parser_get_next_parameter(char* line, const char *colon, char** end)
 {
     char *next;
-    char *v;
     char *str;
 
-    v = parser_get_next_char(':',line,1); 
-    next = parser_get_next_char(';', line,1);
+    if (colon == 0) {
+	/* No value, so there can be no parameters either */
+	*end = line;
+	return 0;
+    }
+
+    next = parser_find_char(';', line, colon, 1);
     
     /* There is no ';' or, it is after the ':' that marks the beginning of
        the value */
 
-    if (next == 0 || next > v) {
-	next = parser_get_next_char(':', line,1);
+    if (next == 0) {
+	next = (char*)colon;
     }
 
     if (next != 0) {
@@ -437,6 +660,61 @@ char* parser_get_next_parameter(char* line,char** end)
 }
 
 
+/**
+ * Locate the name, parameters and value of a single unfolded content
+ * line without copying it. The name ends at the first ';' or ':'
+ * outside of double quotes, and the value starts after the first such
+ * ':'. A line that has parameters but no ':' at all gets everything
+ * after the name as its value.
+ */
+static void parser_split_contentline(const char *line, size_t len,
+                                     icalparser_contentline *cl)
+{
+    const char *p;
+    const char *line_end = line + len;
+    const char *name_end = 0;
+    const char *colon = 0;
+    int quote_mode = 0;
+
+    for (p = line; (p = parser_scan(p, line_end, '"', ';', ':')) != 0; p++) {
+        if (p > line && *(p-1) == '\\') {
+            continue;
+        }
+        if (*p == '"') {
+            quote_mode = !quote_mode;
+        } else if (quote_mode == 0 && (*p == ';' || *p == ':')) {
+            if (name_end == 0) {
+                name_end = p;
+            }
+            if (*p == ':') {
+                colon = p;
+                break;
+            }
+        }
+    }
+
+    memset(cl, 0, sizeof(*cl));
+    cl->line = line;
+    cl->line_len = len;
+
+    if (name_end == 0) {
+        return;
+    }
+
+    cl->name = line;
+    cl->name_len = (size_t)(name_end - line);
+
+    if (colon != 0 && colon != name_end) {
+        cl->params = name_end + 1;
+        cl->params_len = (size_t)(colon - cl->params);
+        cl->value = colon + 1;
+    } else {
+        cl->value = name_end + 1;
+    }
+    cl->value_len = (size_t)(line_end - cl->value);
+}
+
+
 /**
  * Get a single property line, from the property name through the
  * final new line, and include any continuation lines
@@ -566,6 +844,134 @@ char* icalparser_get_line(icalparser *parser,
 
 }
 
+/** Make room for 'need' bytes in a buffer that grows by doubling */
+static int parser_reserve(char **buf, size_t *buf_size, size_t need)
+{
+    if (need > *buf_size) {
+        size_t new_size = *buf_size ? *buf_size : TMP_BUF_SIZE;
+        char *new_buf;
+
+        while (need > new_size) {
+            new_size *= 2;
+        }
+        new_buf = icalmemory_resize_buffer(*buf, new_size);
+        if (new_buf == 0) {
+            icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+            return 0;
+        }
+        *buf = new_buf;
+        *buf_size = new_size;
+    }
+
+    return 1;
+}
+
+/** Append [start, end) to the parser's unfold buffer at offset 'len' */
+static int parser_append_unfolded(icalparser *parser, size_t len,
+                                  const char *start, const char *end)
+{
+    size_t size = (size_t)(end - start);
+
+    if (!parser_reserve(&parser->unfold_buf, &parser->unfold_buf_size,
+                        len + size + 1)) {
+        return 0;
+    }
+
+    memcpy(parser->unfold_buf + len, start, size);
+    return 1;
+}
+
+/** Find the next content line. Unless 'final' is set, a line only counts
+    as complete once the first character of the line after it is known,
+    since that one might still continue it. */
+static int parser_next_contentline(icalparser *parser, const char **pos,
+                                   const char *end, icalparser_contentline *cl,
+                                   int final)
+{
+    const char *start;
+    const char *eol;
+    const char *next;
+    const char *line;
+    const char *line_end;
+
+    icalerror_check_arg_rz((parser != 0),"parser");
+    icalerror_check_arg_rz((pos != 0 && *pos != 0),"pos");
+    icalerror_check_arg_rz((cl != 0),"cl");
+
+    start = *pos;
+    if (start >= end) {
+        return 0;
+    }
+
+    eol = memchr(start, '\n', (size_t)(end - start));
+    next = eol ? eol + 1 : end;
+    if (!final && (eol == 0 || next == end)) {
+        return 0;
+    }
+
+    /* If the next line begins with a ' ' or tab, it is a continuation
+       of this one (RFC 2445, section 4.1). Only then does the line have
+       to be copied, so that the folds can be taken out. */
+    if (eol != 0 && eol > start && next < end && (*next == ' ' || *next == '\t')) {
+        size_t len = 0;
+        const char *piece = start;
+
+        do {
+            const char *piece_end = eol;
+
+            if (piece_end > piece && *(piece_end-1) == '\r') {
+                piece_end--;
+            }
+            if (!parser_append_unfolded(parser, len, piece, piece_end)) {
+                *pos = end;
+                return 0;
+            }
+            len += (size_t)(piece_end - piece);
+
+            /* skip the leading space of the continuation line */
+            piece = next + 1;
+            eol = memchr(piece, '\n', (size_t)(end - piece));
+            next = eol ? eol + 1 : end;
+            if (!final && (eol == 0 || next == end)) {
+                return 0;
+            }
+        } while (eol != 0 && next < end && (*next == ' ' || *next == '\t'));
+
+        line_end = eol ? eol : end;
+        if (!parser_append_unfolded(parser, len, piece, line_end)) {
+            *pos = end;
+            return 0;
+        }
+        len += (size_t)(line_end - piece);
+
+        line = parser->unfold_buf;
+        line_end = line + len;
+    } else {
+        line = start;
+        line_end = eol ? eol : end;
+    }
+
+    *pos = next;
+
+    /* Erase the final carriage return and any trailing white space, but
+       always leave the first character in place like icalparser_get_line */
+    if (eol != 0 && line_end > line && *(line_end-1) == '\r') {
+        line_end--;
+    }
+    while (line_end > line + 1 && iswspace(*(line_end-1))) {
+        line_end--;
+    }
+
+    parser_split_contentline(line, (size_t)(line_end - line), cl);
+    return 1;
+}
+
+int icalparser_next_contentline(icalparser *parser, const char **pos,
+                                const char *end, icalparser_contentline *cl)
+{
+    return parser_next_contentline(parser, pos, end, cl, 1);
+}
+
 static void insert_error(icalcomponent* comp, const char* text,
 		  const char* message, icalparameter_xlicerrortype type)
 {
@@ -586,11 +992,10 @@ static void insert_error(icalcomponent* comp, const char* text,
 }
 
 
-static int line_is_blank(char* line){
-    int i=0;
+static int line_is_blank(const char* line, const char* line_end){
 
-    for(i=0; *(line+i)!=0; i++){
-	char c = *(line+i);
+    for(; line < line_end && *line != 0; line++){
+	char c = *line;
 
 	if(c != ' ' && c != '\n' && c != '\t'){
 	    return 0;
@@ -600,6 +1005,53 @@ static int line_is_blank(char* line){
     return 1;
 }
 
+/** Add a complete top-level component to the result of a parse. A
+    second component moves both under an XROOT container. */
+static icalcomponent* parser_add_root_component(icalcomponent *root,
+                                                icalcomponent *c)
+{
+    if (root == 0){
+	/* Just one component */
+	root = c;
+    } else if(icalcomponent_isa(root) != ICAL_XROOT_COMPONENT) {
+	/*Got a second component, so move the two components under
+	  an XROOT container */
+	icalcomponent *tempc = icalcomponent_new(ICAL_XROOT_COMPONENT);
+	icalcomponent_add_component(tempc, root);
+	icalcomponent_add_component(tempc, c);
+	root = tempc;
+    } else {
+	/* Already have an XROOT container, so add the component
+	   to it*/
+	icalcomponent_add_component(root, c);
+    }
+
+    return root;
+}
+
+/** Add a line from a buffer, and hand every child of the top-level
+    component to the parser's child_func as soon as it is complete.
+    Returns a finished top-level component like icalparser_add_line. */
+static icalcomponent* parser_add_buffered_line(icalparser *parser,
+                                               const icalparser_contentline *cl)
+{
+    icalcomponent *c = icalparser_add_contentline(parser, cl);
+
+    if (c == 0 && parser->child_func != 0 &&
+        parser->state == ICALPARSER_END_COMP && parser->level == 1 &&
+        parser->root_component != 0) {
+	/* The callback may remove the child from its parent and keep it,
+	   so the parser must not hold on to it any more */
+	icalcomponent *child = parser->root_component;
+	parser->root_component = 0;
+
+	(*parser->child_func)(icalcomponent_get_parent(child), child,
+			      parser->child_data);
+    }
+
+    return c;
+}
+
 icalcomponent* icalparser_parse(icalparser *parser,
 				char* (*line_gen_func)(char *s, size_t size, 
 						       void* d))
@@ -627,26 +1079,7 @@ icalcomponent* icalparser_parse(icalparser *parser,
 	    assert(parser->root_component == 0);
 	    assert(pvl_count(parser->components) ==0);
 
-	    if (root == 0){
-		/* Just one component */
-		root = c;
-	    } else if(icalcomponent_isa(root) != ICAL_XROOT_COMPONENT) {
-		/*Got a second component, so move the two components under
-		  an XROOT container */
-		icalcomponent *tempc = icalcomponent_new(ICAL_XROOT_COMPONENT);
-		icalcomponent_add_component(tempc, root);
-		icalcomponent_add_component(tempc, c);
-		root = tempc;
-	    } else if(icalcomponent_isa(root) == ICAL_XROOT_COMPONENT) {
-		/* Already have an XROOT container, so add the component
-		   to it*/
-		icalcomponent_add_component(root, c);
-		
-	    } else {
-		/* Badness */
-		assert(0);
-	    }
-
+	    root = parser_add_root_component(root, c);
 	    c = 0;
 
         }
@@ -667,8 +1100,46 @@ icalcomponent* icalparser_parse(icalparser *parser,
 icalcomponent* icalparser_add_line(icalparser* parser,
                                        char* line)
 { 
+    icalparser_contentline cl;
+
+    icalerror_check_arg_rz((parser != 0),"parser");
+
+
+    if (line == 0)
+    {
+	parser->state = ICALPARSER_ERROR;
+	return 0;
+    }
+
+    parser_split_contentline(line, strlen(line), &cl);
+
+    return icalparser_add_contentline(parser, &cl);
+}
+
+icalcomponent* icalparser_add_contentline(icalparser* parser,
+                                          const icalparser_contentline* cl)
+{
+    icalarena *prev;
+    icalcomponent *c;
+
+    if (parser->arena == 0) {
+	return parser_add_contentline(parser, cl);
+    }
+
+    prev = icalarena_set_current(parser->arena);
+    c = parser_add_contentline(parser, cl);
+    icalarena_set_current(prev);
+
+    return c;
+}
+
+static icalcomponent* parser_add_contentline(icalparser* parser,
+                                             const icalparser_contentline* cl)
+{
     char *str;
     char *end;
+    char *line_end;
+    const char *colon;
     int vcount = 0;
     icalproperty *prop;
     icalproperty_kind prop_kind;
@@ -677,15 +1148,11 @@ icalcomponent* icalparser_add_line(icalparser* parser,
 
 
     icalerror_check_arg_rz((parser != 0),"parser");
+    icalerror_check_arg_rz((cl != 0),"cl");
 
+    line_end = (char*)cl->line + cl->line_len;
 
-    if (line == 0)
-    {
-	parser->state = ICALPARSER_ERROR;
-	return 0;
-    }
-
-    if(line_is_blank(line) == 1){
+    if(line_is_blank(cl->line, line_end) == 1){
 	return 0;
     }
 
@@ -695,16 +1162,28 @@ icalcomponent* icalparser_add_line(icalparser* parser,
        a component */
 
     end = 0;
-    str = parser_get_prop_name(line, &end);
+    str = 0;
+    colon = 0;
+    if (cl->name != 0) {
+	str = make_segment(cl->name, cl->name + cl->name_len);
+	end = (char*)cl->name + cl->name_len + 1;
+	if (*(cl->value-1) == ':') {
+	    colon = cl->value-1;
+	}
+    }
 
     if (str == 0 || *str == '\0' ){
 	/* Could not get a property name */
 	icalcomponent *tail = pvl_data(pvl_tail(parser->components));
 
 	if (tail){
+	    char *line = icalmemory_new_buffer(cl->line_len + 1);
+	    memcpy(line, cl->line, cl->line_len);
+	    line[cl->line_len] = '\0';
 	    insert_error(tail,line,
 			 "Got a data line, but could not find a property name or component begin tag",
 			 ICAL_XLICERRORTYPE_COMPONENTPARSEERROR);
+	    icalmemory_free_buffer(line);
 	}
 	tail = 0;
 	parser->state = ICALPARSER_ERROR;
@@ -728,7 +1207,7 @@ icalcomponent* icalparser_add_line(icalparser* parser,
 	str = NULL;
 
 	parser->level++;
-	str = parser_get_next_value(end,&end, value_kind);
+	str = parser_get_next_value(end,line_end,&end, value_kind);
 
     comp_kind = icalenum_string_to_component_kind(str);
 
@@ -755,7 +1234,7 @@ icalcomponent* icalparser_add_line(icalparser* parser,
 	str = NULL;
 	parser->level--;
 
-	str = parser_get_next_value(end,&end, value_kind);
+	str = parser_get_next_value(end,line_end,&end, value_kind);
 
 	/* Pop last component off of list and add it to the second-to-last*/
 	parser->root_component = pvl_pop(parser->components);
@@ -786,6 +1265,10 @@ icalcomponent* icalparser_add_line(icalparser* parser,
 	    parser->state = ICALPARSER_SUCCESS;
 	    rtrn = parser->root_component;
 	    parser->root_component = 0;
+	    if (rtrn != 0) {
+		/* The caller owns it now, and it may outlive the parser */
+		icalcomponent_hold_arena(rtrn);
+	    }
 	    return rtrn;
 
 	} else {
@@ -856,14 +1339,14 @@ icalcomponent* icalparser_add_line(icalparser* parser,
 
     while(1) {
 
-	if (*(end-1) == ':'){
+	if (colon == 0 || end > colon){
 	    /* if the last separator was a ":" and the value is a
 	       URL, icalparser_get_next_parameter will find the
 	       ':' in the URL, so better break now. */
 	    break;
 	}
 
-	str = parser_get_next_parameter(end,&end);
+	str = parser_get_next_parameter(end,colon,&end);
 	strstriplt(str);
 	if (str != 0){
 	    char* name = 0;
@@ -1114,11 +1597,11 @@ icalcomponent* icalparser_add_line(icalparser* parser,
                the COMMA character (US-ASCII decimal 44).
             */
             case ICAL_FREEBUSY_PROPERTY:
-                 str = parser_get_next_value(end,&end, value_kind);
+                 str = parser_get_next_value(end,line_end,&end, value_kind);
 		 strstriplt (str);
                  break;
             default:
-                 str = icalparser_get_value(end, &end, value_kind);
+                 str = parser_get_value(end, line_end, &end);
 		 strstriplt (str);
                  break;
         }
@@ -1280,26 +1763,151 @@ char* icalparser_string_line_generator(char *out, size_t buf_size, void *d)
     return out;    
 }
 
-icalcomponent* icalparser_parse_string(const char* str)
+icalcomponent* icalparser_parse_buffer(icalparser *parser,
+                                      const char* buf, size_t len)
 {
+    icalparser_contentline cl;
     icalcomponent *c;
-    struct slg_data d;
-    icalparser *p;
-
+    icalcomponent *root = 0;
+    const char *pos = buf;
+    const char *end;
+    const char *nul;
     icalerrorstate es = icalerror_get_error_state(ICAL_MALFORMEDDATA_ERROR);
 
-    d.pos = 0;
-    d.str = str;
+    icalerror_check_arg_rz((parser != 0),"parser");
+    icalerror_check_arg_rz((buf != 0),"buf");
 
-    p = icalparser_new();
-    icalparser_set_gen_data(p,&d);
+    /* Stop at an embedded NUL, as the string based parser would */
+    nul = memchr(buf, '\0', len);
+    end = nul ? nul : buf + len;
 
     icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR,ICAL_ERROR_NONFATAL);
 
-    c = icalparser_parse(p,icalparser_string_line_generator);
+    while (parser_next_contentline(parser, &pos, end, &cl, 1)) {
+	if ((c = parser_add_buffered_line(parser, &cl)) != 0) {
+	    assert(parser->root_component == 0);
+	    assert(pvl_count(parser->components) ==0);
+
+	    root = parser_add_root_component(root, c);
+	}
+    }
 
     icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR,es);
 
+    return root;
+}
+
+/** Parse the complete lines in [*pos, end) into the result of
+    icalparser_push_data(), leaving *pos at the first incomplete one */
+static void parser_push_lines(icalparser *parser, const char **pos,
+                              const char *end, int final)
+{
+    icalparser_contentline cl;
+    icalcomponent *c;
+
+    while (parser_next_contentline(parser, pos, end, &cl, final)) {
+	if ((c = parser_add_buffered_line(parser, &cl)) != 0) {
+	    assert(parser->root_component == 0);
+	    assert(pvl_count(parser->components) ==0);
+
+	    parser->push_root = parser_add_root_component(parser->push_root, c);
+	}
+    }
+}
+
+/** Append [start, end) to the line held by icalparser_push_data() */
+static int parser_hold(icalparser *parser, const char *start, const char *end)
+{
+    size_t size = (size_t)(end - start);
+
+    if (size == 0) {
+	return 1;
+    }
+    if (!parser_reserve(&parser->push_buf, &parser->push_size,
+			parser->push_len + size)) {
+	return 0;
+    }
+    memcpy(parser->push_buf + parser->push_len, start, size);
+    parser->push_len += size;
+    return 1;
+}
+
+/* A line that the end of a chunk cuts off, or that the next chunk could
+   still continue by folding, is held in push_buf. Only as much of the
+   next chunk as that line takes is appended to it; once the chunk shows
+   where the line ends, it is parsed from push_buf and the rest of the
+   chunk in place. Only the held line gets copied, and none of it is
+   scanned twice. The final call flushes the held line as it is; it
+   usually has no data left, NULL and 0. */
+icalcomponent* icalparser_push_data(icalparser *parser,
+                                   const char* buf, size_t len, int final)
+{
+    icalcomponent *root;
+    const char *pos = buf;
+    const char *end = buf + len;
+    const char *held;
+    const char *eol;
+    icalerrorstate es;
+    int ok = 1;
+
+    icalerror_check_arg_rz((parser != 0),"parser");
+    icalerror_check_arg_rz((buf != 0 || len == 0),"buf");
+
+    es = icalerror_get_error_state(ICAL_MALFORMEDDATA_ERROR);
+    icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR,ICAL_ERROR_NONFATAL);
+
+    /* Complete the held line. It ends before the first line of the chunk
+       that doesn't start with a space or a tab. */
+    while (parser->push_len != 0 && pos < end) {
+	if (parser->push_buf[parser->push_len-1] == '\n'
+	    && *pos != ' ' && *pos != '\t') {
+	    break;
+	}
+	eol = memchr(pos, '\n', (size_t)(end - pos));
+	if (!parser_hold(parser, pos, eol ? eol + 1 : end)) {
+	    ok = 0;
+	    break;
+	}
+	pos = eol ? eol + 1 : end;
+    }
+    if (ok && parser->push_len != 0 && (pos < end || final)) {
+	held = parser->push_buf;
+	parser_push_lines(parser, &held, parser->push_buf + parser->push_len, 1);
+	parser->push_len = 0;
+    }
+
+    /* Everything after it is parsed straight from the caller's buffer,
+       and only an incomplete last line is held */
+    if (ok && parser->push_len == 0) {
+	parser_push_lines(parser, &pos, end, final);
+	ok = parser_hold(parser, pos, end);
+    }
+
+    icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR,es);
+
+    if (!ok || !final) {
+	return 0;
+    }
+
+    root = parser->push_root;
+    parser->push_root = 0;
+    return root;
+}
+
+icalcomponent* icalparser_parse_string(const char* str)
+{
+    icalcomponent *c;
+    icalparser *p;
+
+    icalerror_check_arg_rz((str != 0),"str");
+
+    p = icalparser_new();
+    if (p == 0) {
+	return 0;
+    }
+
+    c = icalparser_parse_buffer(p, str, strlen(str));
+
     icalparser_free(p);
 
     return c;
@@ -81,6 +81,89 @@ void icalparser_set_gen_data(icalparser* parser, void* data);
 icalcomponent* icalparser_parse_string(const char* str);
 
 
+/***********************************************************************
+ * Buffer oriented parsing
+ ***********************************************************************/
+
+/**
+ * One content line, as found by icalparser_next_contentline(). The
+ * spans are not NUL-terminated. They point into the caller's buffer,
+ * or into a buffer owned by the parser if the line had to be unfolded,
+ * and are only valid until the next call. 'name' is 0 if the line has
+ * no ';' or ':' at all, 'params' is 0 if there are no parameters.
+ */
+typedef struct icalparser_contentline {
+    const char *line;
+    size_t line_len;
+    const char *name;
+    size_t name_len;
+    const char *params;
+    size_t params_len;
+    const char *value;
+    size_t value_len;
+} icalparser_contentline;
+
+/**
+ * Find the next content line in [*pos, end) and advance *pos past it,
+ * without allocating anything unless the line is folded. Returns 0 at
+ * the end of the input.
+ */
+int icalparser_next_contentline(icalparser *parser, const char **pos,
+                                const char *end, icalparser_contentline *line);
+
+/** Like icalparser_add_line(), for a line from icalparser_next_contentline() */
+icalcomponent* icalparser_add_contentline(icalparser *parser,
+                                          const icalparser_contentline *line);
+
+/**
+ * Parse 'len' bytes of RFC 2445 text in place. This is what
+ * icalparser_parse_string() uses; the buffer need not be NUL-terminated.
+ * The caller owns the returned component.
+ */
+icalcomponent* icalparser_parse_buffer(icalparser *parser,
+                                      const char *buf, size_t len);
+
+/**
+ * Parse RFC 2445 text that arrives in chunks. Lines may be split
+ * anywhere between two calls; the incomplete last line of a chunk is
+ * held by the parser and joined to the next chunk. Pass a non-zero
+ * 'final' with the last chunk (which may be NULL and empty) to flush
+ * that line and get the parsed top-level components, owned by the
+ * caller. Returns 0 for every other chunk.
+ */
+icalcomponent* icalparser_push_data(icalparser *parser,
+                                   const char *buf, size_t len, int final);
+
+/**
+ * Called by icalparser_parse_buffer() and icalparser_push_data() for
+ * each child of a top-level component (a VEVENT in a VCALENDAR, say) as
+ * soon as its END line has been parsed. The child is still attached to
+ * 'parent'; the callback may remove it and take ownership.
+ */
+typedef void (*icalparser_child_func)(icalcomponent *parent,
+                                      icalcomponent *child, void *data);
+
+void icalparser_set_child_func(icalparser* parser,
+                               icalparser_child_func func, void* data);
+
+/**
+ * Allocate the components the parser creates from one icalarena (see
+ * icalarena.h) instead of one malloc() per node, which makes parsing
+ * and freeing large inputs much cheaper. Turn this on before the
+ * first line; the child_func always runs outside of the arena.
+ */
+void icalparser_use_arena(icalparser* parser, int use);
+
+/**
+ * Make the parser ready for another, unrelated input, so that one parser
+ * can be used for many small ones. Whatever is left of the last input,
+ * such as a component without an END line, is freed. A parser in arena
+ * mode starts a new arena, so the components parsed from different
+ * inputs do not keep each other's memory alive.
+ */
+void icalparser_reset(icalparser* parser);
+
+
 /***********************************************************************
  * Parser support functions
  ***********************************************************************/
@@ -36,7 +36,9 @@
 #include "icalenums.h"
 #include "icalerror.h"
 #include "icalmemory.h"
+#include "icalarena.h"
 #include "icalparser.h"
+#include "icalwriter.h"
 
 #include <string.h> /* For icalmemory_strdup, rindex */
 #include <assert.h>
@@ -44,6 +46,8 @@
 #include <errno.h>
 #include <stdio.h> /* for printf */
 #include <stdarg.h> /* for va_list, va_start, etc. */
+
+int icalproperty_write(icalproperty* prop, icalwriter* w);
                                                
 #ifdef WIN32
 #if defined(_MSC_VER) && (_MSC_VER < 1900)
@@ -73,6 +77,8 @@ struct icalproperty_impl
 	pvl_elem parameter_iterator;
 	icalvalue* value;
 	icalcomponent *parent;
+	icalarena* arena;
+	int arena_ref;
 };
 
 void icalproperty_add_parameters(icalproperty* prop, va_list args)
@@ -98,17 +104,20 @@ icalproperty*
 icalproperty_new_impl(icalproperty_kind kind)
 {
     icalproperty* prop;
+    icalarena* arena;
 
     if (!icalproperty_kind_is_valid(kind))
       return NULL;
 
-    if ( ( prop = (icalproperty*) malloc(sizeof(icalproperty))) == 0) {
-	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+    if ( ( prop = (icalproperty*) icalarena_alloc(sizeof(icalproperty), &arena)) == 0) {
 	return 0;
     }
     
     strcpy(prop->id,"prop");
 
+    prop->arena = arena;
+    prop->arena_ref = 0;
+
     prop->kind = kind;
     prop->parameters = pvl_newlist();
     prop->parameter_iterator = 0;
@@ -148,7 +157,7 @@ icalproperty_new_clone(icalproperty* old)
 
     if (old->x_name != 0) {
 
-	new->x_name = icalmemory_strdup(old->x_name);
+	new->x_name = icalarena_strdup(old->x_name);
 	
 	if (new->x_name == 0) {
 	    icalproperty_free(new);
@@ -226,6 +235,7 @@ void
 icalproperty_free (icalproperty* p)
 {
     icalparameter* param;
+    icalarena* arena;
     
     icalerror_check_arg_rv((p!=0),"prop");
 
@@ -250,7 +260,7 @@ icalproperty_free (icalproperty* p)
     pvl_free(p->parameters);
     
     if (p->x_name != 0) {
-	free(p->x_name);
+	icalarena_free(p->arena, p->x_name);
     }
     
     p->kind = ICAL_NO_PROPERTY;
@@ -260,103 +270,13 @@ icalproperty_free (icalproperty* p)
     p->x_name = 0;
     p->id[0] = 'X';
     
-    free(p);
-
-}
-
-
-/* This returns where the start of the next line should be. chars_left does
-   not include the trailing '\0'. */
-#define MAX_LINE_LEN 75
-/*#define MAX_LINE_LEN 120*/
-
-static char*
-get_next_line_start (char *line_start, int chars_left)
-{
-    char *pos;
-
-    /* If we have 74 chars or less left, we can output all of them. 
-       we return a pointer to the '\0' at the end of the string. */
-    if (chars_left < MAX_LINE_LEN) {
-        return line_start + chars_left;
-    } 
-
-    /* Now try to split on a UTF-8 boundary defined as a 7-bit
-       value or as a byte with the two high-most bits set:
-       11xxxxxx.  See http://czyborra.com/utf/ */
-
-    pos = line_start + MAX_LINE_LEN - 1;
-    while (pos > line_start) {
-        /* plain ascii */
-        if ((*pos & 128) == 0)
-            return pos;
-
-        /* utf8 escape byte */
-        if ((*pos & 192) == 192)
-            return pos;
-
-        pos--;
+    arena = p->arena;
+    if (arena == 0) {
+	free(p);
+    } else if (p->arena_ref) {
+	icalarena_unref(arena);
     }
 
-    /* Give up, just break at 74 chars (the 75th char is the space at
-       the start of the line).  */
-
-    return line_start + MAX_LINE_LEN - 1;
-}
-
-
-/** This splits the property into lines less than 75 octects long (as
- *  specified in RFC2445). It tries to split after a ';' if it can.
- *  It returns a tmp buffer.  NOTE: I'm not sure if it matters if we
- *  split a line in the middle of a UTF-8 character. It probably won't
- *  look nice in a text editor. 
- */
-static char*
-fold_property_line (char *text)
-{
-    size_t buf_size;
-    char *buf, *buf_ptr, *line_start, *next_line_start;
-    int len, chars_left, first_line;
-    char ch;
-
-    /* Start with a buffer twice the size of our property line, so we almost
-       certainly won't overflow it. */
-    len = strlen (text);
-    buf_size = len * 2;
-    buf = icalmemory_new_buffer (buf_size);
-    buf_ptr = buf;
-
-    /* Step through the text, finding each line to add to the output. */
-    line_start = text;
-    chars_left = len;
-    first_line = 1;
-    for (;;) {
-        if (chars_left <= 0)
-	    break;
-
-        /* This returns the first character for the next line. */
-        next_line_start = get_next_line_start (line_start, chars_left);
-
-	/* If this isn't the first line, we need to output a newline and space
-	   first. */
-	if (!first_line) {
-	    icalmemory_append_string (&buf, &buf_ptr, &buf_size, "\r\n ");
-	}
-	first_line = 0;
-
-	/* This adds the line to our tmp buffer. We temporarily place a '\0'
-	   in text, so we can copy the line in one go. */
-	ch = *next_line_start;
-	*next_line_start = '\0';
-	icalmemory_append_string (&buf, &buf_ptr, &buf_size, line_start);
-	*next_line_start = ch;
-
-	/* Now we move on to the next line. */
-	chars_left -= (next_line_start - line_start);
-	line_start = next_line_start;
-    }
-
-    return buf;
 }
 
 
@@ -422,26 +342,32 @@ icalproperty_as_ical_string (icalproperty* prop)
 char*
 icalproperty_as_ical_string_r(icalproperty* prop)
 {   
-    icalparameter *param;
+    icalwriter w;
+
+    icalerror_check_arg_rz( (prop!=0),"prop");
+
+    if (!icalwriter_init_buffer(&w, 1024)) {
+	return 0;
+    }
 
-    /* Create new buffer that we can append names, parameters and a
-     * value to, and reallocate as needed.
-     */
+    if (!icalproperty_write(prop, &w)) {
+	icalwriter_free(&w);
+	return 0;
+    }
 
+    return icalwriter_steal_buffer(&w);
+}
+
+
+/** Write the property as one folded content line. Returns 0 if the
+    property could not be written at all, e.g. for an unknown kind. */
+int
+icalproperty_write(icalproperty* prop, icalwriter* w)
+{
+    icalparameter *param;
     const char* property_name = 0; 
-    size_t buf_size = 1024;
-    char* buf;
-    char* buf_ptr;
     icalvalue* value;
-    char *out_buf;
     const char* kind_string = 0;
-    const char newline[] = "\r\n";
-
-    
-    icalerror_check_arg_rz( (prop!=0),"prop");
-
-    buf = icalmemory_new_buffer(buf_size);
-    buf_ptr = buf;
 
     /* Append property name */
 
@@ -453,17 +379,15 @@ icalproperty_as_ical_string_r(icalproperty* prop)
 
     if (property_name == 0 ) {
 	icalerror_warn("Got a property of an unknown kind.");
-	icalmemory_free_buffer(buf);
 	return 0;
-	
     }
 
-    icalmemory_append_string(&buf, &buf_ptr, &buf_size, property_name);
+    icalwriter_fold_string(w, property_name);
 
     kind_string = icalproperty_get_value_kind(prop);
     if(kind_string!=0){
-	icalmemory_append_string(&buf, &buf_ptr, &buf_size, ";VALUE=");
-	icalmemory_append_string(&buf, &buf_ptr, &buf_size, kind_string);
+	icalwriter_fold_string(w, ";VALUE=");
+	icalwriter_fold_string(w, kind_string);
     }
 
     /* Append parameters */
@@ -472,52 +396,47 @@ icalproperty_as_ical_string_r(icalproperty* prop)
 	param = icalproperty_get_next_parameter(prop,ICAL_ANY_PARAMETER)) {
 
 	icalparameter_kind kind = icalparameter_isa(param);
-	kind_string = icalparameter_as_ical_string_r(param); 
+	char *str;
 
-	if (kind_string == 0 ) {
+	if (kind==ICAL_VALUE_PARAMETER) {
+		continue;
+	}
+
+	str = icalparameter_as_ical_string_r(param);
+	if (str == 0 ) {
 	  icalerror_warn("Got a parameter of unknown kind for the following property");
 
 	  icalerror_warn((property_name) ? property_name : "(NULL)");
 	    continue;
 	}
 
-	if (kind==ICAL_VALUE_PARAMETER) {
-		free ((char *) kind_string);
-		continue;
-	}
-
-	icalmemory_append_string(&buf, &buf_ptr, &buf_size, ";");
-    	icalmemory_append_string(&buf, &buf_ptr, &buf_size, kind_string);
-	free((char *)kind_string);
+	icalwriter_fold(w, ";", 1);
+	icalwriter_fold_string(w, str);
+	free(str);
     }    
 
     /* Append value */
 
-    icalmemory_append_string(&buf, &buf_ptr, &buf_size, ":");
+    icalwriter_fold(w, ":", 1);
 
     value = icalproperty_get_value(prop);
 
     if (value != 0){
 	char *str = icalvalue_as_ical_string_r(value);
 	if (str != 0)
-	    icalmemory_append_string(&buf, &buf_ptr, &buf_size, str);
+	    icalwriter_fold_string(w, str);
 	else
-	    icalmemory_append_string(&buf, &buf_ptr, &buf_size,"ERROR: No Value"); 
+	    icalwriter_fold_string(w, "ERROR: No Value"); 
 	free(str);
     } else {
-	icalmemory_append_string(&buf, &buf_ptr, &buf_size,"ERROR: No Value"); 
+	icalwriter_fold_string(w, "ERROR: No Value"); 
 	
     }
     
-    icalmemory_append_string(&buf, &buf_ptr, &buf_size, newline);
+    /* RFC 2445 explicitly says that the newline is *ALWAYS* a \r\n (CRLF)!!!! */
+    icalwriter_end_line(w);
 
-    /* We now use a function to fold the line properly every 75 characters.
-       That function also adds the newline for us. */
-    out_buf = fold_property_line (buf);
-
-    icalmemory_free_buffer(buf);
-
-    return out_buf;
+    return !w->failed;
 }
 
 
@@ -976,10 +895,10 @@ void icalproperty_set_x_name(icalproperty* prop, const char* name)
     icalerror_check_arg_rv( (prop!=0),"prop");
 
     if (prop->x_name != 0) {
-        free(prop->x_name);
+        icalarena_free(prop->arena, prop->x_name);
     }
 
-    prop->x_name = icalmemory_strdup(name);
+    prop->x_name = icalarena_strdup(name);
 
     if(prop->x_name == 0){
 	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
@@ -1052,3 +971,14 @@ icalcomponent* icalproperty_get_parent(const icalproperty* property)
 
     return property->parent;
 }
+
+/** Keep the arena of a property alive while it has no parent */
+void icalproperty_hold_arena(icalproperty* property)
+{
+    icalerror_check_arg_rv( (property!=0),"property");
+
+    if (property->arena != 0 && !property->arena_ref) {
+	icalarena_ref(property->arena);
+	property->arena_ref = 1;
+    }
+}
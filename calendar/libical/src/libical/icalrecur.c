@@ -30,9 +30,11 @@
 
   Processing starts when the caller generates a new recurrence
   iterator via icalrecur_iterator_new(). This routine copies the
-  recurrence rule into the iterator and extracts things like start and
-  end dates. Then, it checks if the rule is legal, using some logic
-  from RFC2445 and some logic that probably should be in RFC2445.
+  recurrence rule into a plan and checks if the rule is legal, using
+  some logic from RFC2445 and some logic that probably should be in
+  RFC2445. The plan keeps the BY arrays, and can be shared by the
+  iterators of equal rules ( see icalrecur_plan_get() ). The iterator
+  copies things like the end date from the plan.
 
   Then, icalrecur_iterator_new() re-writes some of the BY*
   arrays. This involves ( via a call to setup_defaults() ) :
@@ -162,6 +164,7 @@ typedef long intptr_t;
 
 #include "icalerror.h"
 #include "icalmemory.h"
+#include "icaltimezone.h"
 
 #include <stdlib.h> /* for malloc */
 #include <errno.h> /* for errno */
@@ -171,8 +174,26 @@ typedef long intptr_t;
 #ifdef HAVE_INTTYPES_H
 #include <inttypes.h>
 #endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
-#include "pvl.h"
+/* The table of interned plans and the reference counts of the plans
+   are changed under a lock. */
+#if defined(HAVE_PTHREAD)
+static pthread_mutex_t plans_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define ICALRECUR_LOCK()		pthread_mutex_lock (&plans_mutex)
+#define ICALRECUR_UNLOCK()		pthread_mutex_unlock (&plans_mutex)
+#elif defined(WIN32)
+#include <windows.h>
+static volatile LONG plans_lock = 0;
+#define ICALRECUR_LOCK()		\
+    while (InterlockedCompareExchange (&plans_lock, 1, 0) != 0) Sleep (0)
+#define ICALRECUR_UNLOCK()		InterlockedExchange (&plans_lock, 0)
+#else
+#define ICALRECUR_LOCK()
+#define ICALRECUR_UNLOCK()
+#endif
 
 /** This is the last year we will go up to, since 32-bit time_t values
    only go up to the start of 2038. */
@@ -652,14 +673,38 @@ enum byrule {
 
 
 
+/** A rule checked once for all iterators of it. Its BY arrays are
+    only read, so that iterators of equal rules can share one plan. */
+struct icalrecur_plan_impl {
+    struct icalrecurrencetype rule; /**< Padded, with BYDAY sorted */
+    short orig_data[9]; /**< 1 if there was data in the byrule */
+    short *by_ptrs[9]; /**< Pointers into the by_* arrays of the rule */
+
+    unsigned int hash;
+    int refcount;
+    int interned; /**< 1 if the plan is in the plan table */
+    struct icalrecur_plan_impl *next; /**< Next plan in the same bucket */
+};
+
+/** The parts of the rule besides the BY arrays, which an iterator
+    keeps a copy of */
+struct icalrecur_iterator_rule {
+    icalrecurrencetype_frequency freq;
+    struct icaltimetype until;
+    int count;
+    short interval;
+    icalrecurrencetype_weekday week_start;
+};
+
 struct icalrecur_iterator_impl {
 	
     struct icaltimetype dtstart; /* Hack. Make into time_t */
     struct icaltimetype last; /* last time return from _iterator_next*/
     int occurrence_no; /* number of step made on t iterator */
-    struct icalrecurrencetype rule;
+    struct icalrecur_iterator_rule rule;
+    icalrecur_plan *plan;
     
-    short days[366];
+    short days[367]; /* a leap year's days and the end marker */
     short days_index;
     
     enum byrule byrule;
@@ -667,7 +712,9 @@ struct icalrecur_iterator_impl {
     short orig_data[9]; /**< 1 if there was data in the byrule */
     
     
-    short *by_ptrs[9]; /**< Pointers into the by_* array elements of the rule */
+    short *by_ptrs[9]; /**< Pointers into the by_* arrays of the plan, or
+                          into by_defaults for the empty ones */
+    short by_defaults[9][2]; /**< The DTSTART values of empty by rules */
     
 };
 
@@ -726,7 +773,7 @@ static const struct expand_split_map_struct expand_map[] =
 
 /** Check that the rule has only the two given interday byrule parts. */
 static
-int icalrecur_two_byrule(icalrecur_iterator* impl,
+int icalrecur_two_byrule(icalrecur_plan* plan,
 			 enum byrule one,enum byrule two)
 {
     short test_array[9];
@@ -741,10 +788,10 @@ int icalrecur_two_byrule(icalrecur_iterator* impl,
     for(itr = BY_DAY; itr != BY_SET_POS; itr++){
 
 	if( (test_array[itr] == 0  &&
-	     impl->by_ptrs[itr][0] != ICAL_RECURRENCE_ARRAY_MAX
+	     plan->by_ptrs[itr][0] != ICAL_RECURRENCE_ARRAY_MAX
 	    ) ||
 	    (test_array[itr] == 1  &&
-	     impl->by_ptrs[itr][0] == ICAL_RECURRENCE_ARRAY_MAX
+	     plan->by_ptrs[itr][0] == ICAL_RECURRENCE_ARRAY_MAX
 		) 
 	    ) {
 	    /* test failed */
@@ -757,15 +804,15 @@ int icalrecur_two_byrule(icalrecur_iterator* impl,
 } 
 
 /** Check that the rule has only the one given interdat byrule parts. */
-static int icalrecur_one_byrule(icalrecur_iterator* impl,enum byrule one)
+static int icalrecur_one_byrule(icalrecur_plan* plan,enum byrule one)
 {
     int passes = 1;
     enum byrule itr;
 
     for(itr = BY_DAY; itr != BY_SET_POS; itr++){
 	
-	if ((itr==one && impl->by_ptrs[itr][0] == ICAL_RECURRENCE_ARRAY_MAX) ||
-	    (itr!=one && impl->by_ptrs[itr][0] != ICAL_RECURRENCE_ARRAY_MAX)) {
+	if ((itr==one && plan->by_ptrs[itr][0] == ICAL_RECURRENCE_ARRAY_MAX) ||
+	    (itr!=one && plan->by_ptrs[itr][0] != ICAL_RECURRENCE_ARRAY_MAX)) {
 	    passes = 0;
 	}
     }
@@ -824,80 +871,133 @@ static void increment_month(icalrecur_iterator* impl);
 static int next_month(icalrecur_iterator* impl);
 
 
-icalrecur_iterator* icalrecur_iterator_new(struct icalrecurrencetype rule, 
-					   struct icaltimetype dtstart)
+/* Copy a rule into a cleared one, so that equal rules are equal byte
+   for byte, with the days of BYDAY sorted as the iterators need them */
+static void canonical_rule(const struct icalrecurrencetype *rule,
+			   struct icalrecurrencetype *canon)
 {
-    icalrecur_iterator* impl;
-    icalrecurrencetype_frequency freq;
+    icalrecurrencetype_clear(canon);
+
+    canon->freq = rule->freq;
+    canon->count = rule->count;
+    canon->interval = rule->interval;
+    canon->week_start = rule->week_start;
+
+    canon->until.year = rule->until.year;
+    canon->until.month = rule->until.month;
+    canon->until.day = rule->until.day;
+    canon->until.hour = rule->until.hour;
+    canon->until.minute = rule->until.minute;
+    canon->until.second = rule->until.second;
+    canon->until.is_utc = rule->until.is_utc;
+    canon->until.is_date = rule->until.is_date;
+    canon->until.is_daylight = rule->until.is_daylight;
+    canon->until.zone = rule->until.zone;
+
+#define COPY_BYARRAY(array, size) { \
+	int i; \
+	for (i = 0; i < size && rule->array[i] != ICAL_RECURRENCE_ARRAY_MAX; i++) \
+	    canon->array[i] = rule->array[i]; \
+    }
+    COPY_BYARRAY(by_second, ICAL_BY_SECOND_SIZE);
+    COPY_BYARRAY(by_minute, ICAL_BY_MINUTE_SIZE);
+    COPY_BYARRAY(by_hour, ICAL_BY_HOUR_SIZE);
+    COPY_BYARRAY(by_day, ICAL_BY_DAY_SIZE);
+    COPY_BYARRAY(by_month_day, ICAL_BY_MONTHDAY_SIZE);
+    COPY_BYARRAY(by_year_day, ICAL_BY_YEARDAY_SIZE);
+    COPY_BYARRAY(by_week_no, ICAL_BY_WEEKNO_SIZE);
+    COPY_BYARRAY(by_month, ICAL_BY_MONTH_SIZE);
+    COPY_BYARRAY(by_set_pos, ICAL_BY_SETPOS_SIZE);
+#undef COPY_BYARRAY
+
+    sort_bydayrules(canon->by_day, canon->week_start);
+}
 
-    icalerror_clear_errno();
+/* FNV-1a over the bytes of a canonical rule */
+static unsigned int hash_rule(const struct icalrecurrencetype *canon)
+{
+    const unsigned char *p = (const unsigned char*)canon;
+    unsigned int hash = 2166136261u;
+    size_t i;
 
-    if ( ( impl = (icalrecur_iterator*)
-	   malloc(sizeof(icalrecur_iterator))) == 0) {
+    for (i = 0; i < sizeof(*canon); i++) {
+	hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* Make a plan of a rule, with one reference. Returns 0 if the rule is
+   not legal. */
+static icalrecur_plan* plan_new(const struct icalrecurrencetype *rule,
+				unsigned int hash)
+{
+    icalrecur_plan* plan;
+    icalrecurrencetype_frequency freq;
+
+    if ( ( plan = (icalrecur_plan*)
+	   malloc(sizeof(icalrecur_plan))) == 0) {
 	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
 	return 0;
     }
 
-    memset(impl,0,sizeof(icalrecur_iterator));
+    memset(plan,0,sizeof(icalrecur_plan));
 
-    impl->rule = rule;
-    impl->last = dtstart;
-    impl->dtstart = dtstart;
-    impl->days_index =0;
-    impl->occurrence_no = 0;
-    freq = impl->rule.freq;
+    plan->rule = *rule;
+    plan->hash = hash;
+    plan->refcount = 1;
+    freq = plan->rule.freq;
+
+    sort_bydayrules(plan->rule.by_day, plan->rule.week_start);
 
     /* Set up convienience pointers to make the code simpler. Allows
        us to iterate through all of the BY* arrays in the rule. */
 
-    impl->by_ptrs[BY_MONTH]=impl->rule.by_month;
-    impl->by_ptrs[BY_WEEK_NO]=impl->rule.by_week_no;
-    impl->by_ptrs[BY_YEAR_DAY]=impl->rule.by_year_day;
-    impl->by_ptrs[BY_MONTH_DAY]=impl->rule.by_month_day;
-    impl->by_ptrs[BY_DAY]=impl->rule.by_day;
-    impl->by_ptrs[BY_HOUR]=impl->rule.by_hour;
-    impl->by_ptrs[BY_MINUTE]=impl->rule.by_minute;
-    impl->by_ptrs[BY_SECOND]=impl->rule.by_second;
-    impl->by_ptrs[BY_SET_POS]=impl->rule.by_set_pos;
-
-    memset(impl->orig_data,0,9*sizeof(short));
-
-    /* Note which by rules had data in them when the iterator was
-       created. We can't use the actuall by_x arrays, because the
-       empty ones will be given default values later in this
-       routine. The orig_data array will be used later in has_by_data */
-
-    impl->orig_data[BY_MONTH]
-	= (short)(impl->rule.by_month[0]!=ICAL_RECURRENCE_ARRAY_MAX);
-    impl->orig_data[BY_WEEK_NO]
-      =(short)(impl->rule.by_week_no[0]!=ICAL_RECURRENCE_ARRAY_MAX);
-    impl->orig_data[BY_YEAR_DAY]
-    =(short)(impl->rule.by_year_day[0]!=ICAL_RECURRENCE_ARRAY_MAX);
-    impl->orig_data[BY_MONTH_DAY]
-    =(short)(impl->rule.by_month_day[0]!=ICAL_RECURRENCE_ARRAY_MAX);
-    impl->orig_data[BY_DAY]
-	= (short)(impl->rule.by_day[0]!=ICAL_RECURRENCE_ARRAY_MAX);
-    impl->orig_data[BY_HOUR]
-	= (short)(impl->rule.by_hour[0]!=ICAL_RECURRENCE_ARRAY_MAX);
-    impl->orig_data[BY_MINUTE]
-     = (short)(impl->rule.by_minute[0]!=ICAL_RECURRENCE_ARRAY_MAX);
-    impl->orig_data[BY_SECOND]
-     = (short)(impl->rule.by_second[0]!=ICAL_RECURRENCE_ARRAY_MAX);
-    impl->orig_data[BY_SET_POS]
-     = (short)(impl->rule.by_set_pos[0]!=ICAL_RECURRENCE_ARRAY_MAX);
+    plan->by_ptrs[BY_MONTH]=plan->rule.by_month;
+    plan->by_ptrs[BY_WEEK_NO]=plan->rule.by_week_no;
+    plan->by_ptrs[BY_YEAR_DAY]=plan->rule.by_year_day;
+    plan->by_ptrs[BY_MONTH_DAY]=plan->rule.by_month_day;
+    plan->by_ptrs[BY_DAY]=plan->rule.by_day;
+    plan->by_ptrs[BY_HOUR]=plan->rule.by_hour;
+    plan->by_ptrs[BY_MINUTE]=plan->rule.by_minute;
+    plan->by_ptrs[BY_SECOND]=plan->rule.by_second;
+    plan->by_ptrs[BY_SET_POS]=plan->rule.by_set_pos;
+
+    /* Note which by rules had data in them. The iterators can't use
+       the by_x arrays for this, because the empty ones will be given
+       default values. The orig_data array will be used later in
+       has_by_data */
+
+    plan->orig_data[BY_MONTH]
+	= (short)(plan->rule.by_month[0]!=ICAL_RECURRENCE_ARRAY_MAX);
+    plan->orig_data[BY_WEEK_NO]
+      =(short)(plan->rule.by_week_no[0]!=ICAL_RECURRENCE_ARRAY_MAX);
+    plan->orig_data[BY_YEAR_DAY]
+    =(short)(plan->rule.by_year_day[0]!=ICAL_RECURRENCE_ARRAY_MAX);
+    plan->orig_data[BY_MONTH_DAY]
+    =(short)(plan->rule.by_month_day[0]!=ICAL_RECURRENCE_ARRAY_MAX);
+    plan->orig_data[BY_DAY]
+	= (short)(plan->rule.by_day[0]!=ICAL_RECURRENCE_ARRAY_MAX);
+    plan->orig_data[BY_HOUR]
+	= (short)(plan->rule.by_hour[0]!=ICAL_RECURRENCE_ARRAY_MAX);
+    plan->orig_data[BY_MINUTE]
+     = (short)(plan->rule.by_minute[0]!=ICAL_RECURRENCE_ARRAY_MAX);
+    plan->orig_data[BY_SECOND]
+     = (short)(plan->rule.by_second[0]!=ICAL_RECURRENCE_ARRAY_MAX);
+    plan->orig_data[BY_SET_POS]
+     = (short)(plan->rule.by_set_pos[0]!=ICAL_RECURRENCE_ARRAY_MAX);
 
 
     /* Check if the recurrence rule is legal */
 
     /* If the BYYEARDAY appears, no other date rule part may appear.   */
 
-    if(icalrecur_two_byrule(impl,BY_YEAR_DAY,BY_MONTH) ||
-       icalrecur_two_byrule(impl,BY_YEAR_DAY,BY_WEEK_NO) ||
-       icalrecur_two_byrule(impl,BY_YEAR_DAY,BY_MONTH_DAY) ||
-       icalrecur_two_byrule(impl,BY_YEAR_DAY,BY_DAY) ){
+    if(icalrecur_two_byrule(plan,BY_YEAR_DAY,BY_MONTH) ||
+       icalrecur_two_byrule(plan,BY_YEAR_DAY,BY_WEEK_NO) ||
+       icalrecur_two_byrule(plan,BY_YEAR_DAY,BY_MONTH_DAY) ||
+       icalrecur_two_byrule(plan,BY_YEAR_DAY,BY_DAY) ){
 
 	icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
-        free(impl);
+        free(plan);
 	return 0;
     }
 
@@ -905,9 +1005,9 @@ icalrecur_iterator* icalrecur_iterator_new(struct icalrecurrencetype rule,
 
     /* BYWEEKNO and BYMONTHDAY rule parts may not both appear.*/
 
-    if(icalrecur_two_byrule(impl,BY_WEEK_NO,BY_MONTH_DAY)){
+    if(icalrecur_two_byrule(plan,BY_WEEK_NO,BY_MONTH_DAY)){
 	icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
-        free(impl);
+        free(plan);
         return 0;
     }
 
@@ -916,9 +1016,9 @@ icalrecur_iterator* icalrecur_iterator_new(struct icalrecurrencetype rule,
       BYWEEKNO may appear. */
 
     if(freq == ICAL_MONTHLY_RECURRENCE && 
-       icalrecur_one_byrule(impl,BY_WEEK_NO)){
+       icalrecur_one_byrule(plan,BY_WEEK_NO)){
 	icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
-        free(impl);
+        free(plan);
         return 0;
     }
 
@@ -927,20 +1027,165 @@ icalrecur_iterator* icalrecur_iterator_new(struct icalrecurrencetype rule,
       BYYEARDAY may appear. */
 
     if(freq == ICAL_WEEKLY_RECURRENCE && 
-       icalrecur_one_byrule(impl,BY_MONTH_DAY )) {
+       icalrecur_one_byrule(plan,BY_MONTH_DAY )) {
 	icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
-	free(impl);
+	free(plan);
         return 0;
     }
 
     /* BYYEARDAY may only appear in YEARLY rules */
     if(freq != ICAL_YEARLY_RECURRENCE && 
-       icalrecur_one_byrule(impl,BY_YEAR_DAY )) {
+       icalrecur_one_byrule(plan,BY_YEAR_DAY )) {
 	icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
-        free(impl);
+        free(plan);
+	return 0;
+    }
+
+    return plan;
+}
+
+/* Interned plans, hashed by their rule */
+#define PLAN_TABLE_SIZE 256
+static icalrecur_plan* plan_table[PLAN_TABLE_SIZE];
+
+icalrecur_plan* icalrecur_plan_get(const struct icalrecurrencetype *rule)
+{
+    struct icalrecurrencetype canon;
+    icalrecur_plan* plan;
+    unsigned int hash;
+
+    icalerror_check_arg_rz((rule!=0),"rule");
+
+    canonical_rule(rule, &canon);
+    hash = hash_rule(&canon);
+
+    ICALRECUR_LOCK();
+    for (plan = plan_table[hash % PLAN_TABLE_SIZE]; plan != 0; plan = plan->next) {
+	if (plan->hash == hash &&
+	    memcmp(&plan->rule, &canon, sizeof(canon)) == 0) {
+	    plan->refcount++;
+	    break;
+	}
+    }
+    ICALRECUR_UNLOCK();
+
+    if (plan != 0) {
+	return plan;
+    }
+
+    if ((plan = plan_new(&canon, hash)) == 0) {
+	return 0;
+    }
+
+    /* Another thread may have added an equal plan in the meantime. Both
+       work, and later lookups find just one of them. */
+    ICALRECUR_LOCK();
+    plan->interned = 1;
+    plan->next = plan_table[hash % PLAN_TABLE_SIZE];
+    plan_table[hash % PLAN_TABLE_SIZE] = plan;
+    ICALRECUR_UNLOCK();
+
+    return plan;
+}
+
+void icalrecur_plan_unref(icalrecur_plan *plan)
+{
+    int last;
+
+    icalerror_check_arg_rv((plan!=0),"plan");
+
+    ICALRECUR_LOCK();
+    last = (--plan->refcount == 0);
+    if (last && plan->interned) {
+	icalrecur_plan **p = &plan_table[plan->hash % PLAN_TABLE_SIZE];
+
+	while (*p != plan) {
+	    p = &(*p)->next;
+	}
+	*p = plan->next;
+    }
+    ICALRECUR_UNLOCK();
+
+    if (last) {
+	free(plan);
+    }
+}
+
+static icalrecur_iterator* iterator_new(icalrecur_plan *plan,
+					struct icaltimetype dtstart);
+
+icalrecur_iterator* icalrecur_iterator_new(struct icalrecurrencetype rule, 
+					   struct icaltimetype dtstart)
+{
+    icalrecur_plan* plan;
+
+    icalerror_clear_errno();
+
+    /* A plan of the iterator's own, not put in the plan table */
+    if ((plan = plan_new(&rule, 0)) == 0) {
+	return 0;
+    }
+
+    return iterator_new(plan, dtstart);
+}
+
+icalrecur_iterator* icalrecur_iterator_new_from_plan(icalrecur_plan *plan,
+						     struct icaltimetype dtstart)
+{
+    icalerror_check_arg_rz((plan!=0),"plan");
+
+    icalerror_clear_errno();
+
+    ICALRECUR_LOCK();
+    plan->refcount++;
+    ICALRECUR_UNLOCK();
+
+    return iterator_new(plan, dtstart);
+}
+
+/* Create an iterator that takes over a reference to the plan */
+static icalrecur_iterator* iterator_new(icalrecur_plan *plan,
+					struct icaltimetype dtstart)
+{
+    icalrecur_iterator* impl;
+    enum byrule byrule;
+
+    if ( ( impl = (icalrecur_iterator*)
+	   malloc(sizeof(icalrecur_iterator))) == 0) {
+	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+	icalrecur_plan_unref(plan);
 	return 0;
     }
 
+    memset(impl,0,sizeof(icalrecur_iterator));
+
+    impl->plan = plan;
+
+    impl->rule.freq = plan->rule.freq;
+    impl->rule.until = plan->rule.until;
+    impl->rule.count = plan->rule.count;
+    impl->rule.interval = plan->rule.interval;
+    impl->rule.week_start = plan->rule.week_start;
+    impl->last = dtstart;
+    impl->dtstart = dtstart;
+    impl->days_index =0;
+    impl->occurrence_no = 0;
+
+    /* The BY rule parts with data are read from the plan. The empty
+       ones get an array of the iterator's own, for setup_defaults() to
+       put the DTSTART value into. */
+
+    for(byrule = BY_SECOND; byrule <= BY_SET_POS; byrule++){
+	impl->orig_data[byrule] = plan->orig_data[byrule];
+	if (plan->orig_data[byrule]) {
+	    impl->by_ptrs[byrule] = plan->by_ptrs[byrule];
+	} else {
+	    impl->by_defaults[byrule][0] = ICAL_RECURRENCE_ARRAY_MAX;
+	    impl->by_defaults[byrule][1] = ICAL_RECURRENCE_ARRAY_MAX;
+	    impl->by_ptrs[byrule] = impl->by_defaults[byrule];
+	}
+    }
+
     /* Rewrite some of the rules and set up defaults to make later
        processing easier. Primarily, t involves copying an element
        from the start time into the corresponding BY_* array when the
@@ -1007,13 +1252,20 @@ icalrecur_iterator* icalrecur_iterator_new(struct icalrecurrencetype rule,
 
     if(impl->rule.freq == ICAL_YEARLY_RECURRENCE){
         struct icaltimetype next;
+        int years = 0;
 	icalerror_clear_errno();
 
 	for (;;) {
             expand_year_days(impl, impl->last.year);
+            /* The calendar repeats itself every 400 years, so a rule
+               without days in that many (BYMONTH=2;BYMONTHDAY=30) has
+               none at all */
+            if (impl->days[0] == ICAL_RECURRENCE_ARRAY_MAX && ++years > 400) {
+                icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
+            }
         if( icalerrno != ICAL_NO_ERROR) {
             icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
-            free(impl);
+            icalrecur_iterator_free(impl);
             return 0;
         }
 	    if (impl->days[0] != ICAL_RECURRENCE_ARRAY_MAX)
@@ -1051,7 +1303,7 @@ icalrecur_iterator* icalrecur_iterator_new(struct icalrecurrencetype rule,
             /* If |pos| >= 6, the byday is invalid for a monthly rule */
             if (pos >= 6 || pos <= -6) {
                 icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
-                free(impl);
+                icalrecur_iterator_free(impl);
                 return 0;
             }
 
@@ -1083,7 +1335,7 @@ icalrecur_iterator* icalrecur_iterator_new(struct icalrecurrencetype rule,
 
         if (impl->last.day > days_in_month || impl->last.day == 0) {
             icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
-            free(impl);
+            icalrecur_iterator_free(impl);
             return 0;
         }
 
@@ -1104,7 +1356,7 @@ icalrecur_iterator* icalrecur_iterator_new(struct icalrecurrencetype rule,
             }
             if (months_counter <= 0) {
                 icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
-                free(impl);
+                icalrecur_iterator_free(impl);
                 return 0;
             }
         }
@@ -1130,6 +1382,7 @@ void icalrecur_iterator_free(icalrecur_iterator* i)
 {
     icalerror_check_arg_rv((i!=0),"impl");
     
+    icalrecur_plan_unref(i->plan);
     free(i);
 
 }
@@ -1557,9 +1810,9 @@ int check_set_position(icalrecur_iterator* impl, int set_pos)
 {
     int i;
     int found = 0;
-    for (i = 0; impl->rule.by_set_pos[i] != ICAL_RECURRENCE_ARRAY_MAX && 
+    for (i = 0; impl->by_ptrs[BY_SET_POS][i] != ICAL_RECURRENCE_ARRAY_MAX && 
               i != ICAL_BY_SETPOS_SIZE; i++){
-        if (impl->rule.by_set_pos[i] == set_pos) {
+        if (impl->by_ptrs[BY_SET_POS][i] == set_pos) {
               found = 1;
               break;
         }
@@ -1782,9 +2035,8 @@ static int next_weekday_by_week(icalrecur_iterator* impl)
       return 1;
   }
 
-  /* this call to 'sort_bydayrules' assures that the occurrences for
-     weekly recurrences will be generated in a strict linear order. */
-  sort_bydayrules(BYDAYPTR, impl->rule.week_start);
+  /* The plan has the days of BYDAY sorted from the week start, so
+     the occurrences of weekly recurrences come in a strict linear order. */
 
   /* If we get here, we need to step to tne next day */
 
@@ -1881,84 +2133,240 @@ static int next_week(icalrecur_iterator* impl)
   
 }
 
-/** Expand the BYDAY rule part and return a pointer to a newly allocated list of days. */
-static pvl_list expand_by_day(icalrecur_iterator* impl, int year)
+/* The days of one year as a bit set, bit n-1 standing for day n. Each
+   BY rule part is expanded to such a set and the parts are combined a
+   word at a time, so the days come out sorted and each only once. */
+#define YEAR_DAYS_WORDS 12
+
+struct year_days {
+    uint32_t w[YEAR_DAYS_WORDS];
+};
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static int year_days_ctz(uint32_t mask)
+{
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+}
+#else
+#define year_days_ctz(mask) __builtin_ctz(mask)
+#endif
+
+static void year_days_add(struct year_days *m, int doy, int days_in_year)
+{
+    if (doy >= 1 && doy <= days_in_year) {
+        m->w[(doy - 1) >> 5] |= (uint32_t)1 << ((doy - 1) & 31);
+    }
+}
+
+static void year_days_and(struct year_days *m, const struct year_days *other)
+{
+    int i;
+    for (i = 0; i < YEAR_DAYS_WORDS; i++) {
+        m->w[i] &= other->w[i];
+    }
+}
+
+/* Write the days of the set in order to days[], returning how many */
+static int year_days_list(const struct year_days *m, short *days)
+{
+    int i, n = 0;
+    for (i = 0; i < YEAR_DAYS_WORDS; i++) {
+        uint32_t w = m->w[i];
+        while (w != 0) {
+            days[n++] = (short)(i * 32 + year_days_ctz(w) + 1);
+            w &= w - 1;
+        }
+    }
+    return n;
+}
+
+/* True if month is 1-12 and, when the rule has BYMONTH, one of its months */
+static int is_expanded_month(icalrecur_iterator* impl, int month)
 {
-    /* Try to calculate each of the occurrences. */
     int i;
-    pvl_list days_list = pvl_newlist();
 
+    if (month < 1 || month > 12) {
+        return 0;
+    }
+    if (!has_by_data(impl, BY_MONTH)) {
+        return 1;
+    }
+    for (i = 0; BYMONPTR[i] != ICAL_RECURRENCE_ARRAY_MAX; i++) {
+        if (BYMONPTR[i] == month) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/** Add the days of the BYDAY rule part to the set, counting the
+    positions (20MO, -1FR) within the year. */
+static void expand_by_day(icalrecur_iterator* impl, int year,
+                          struct year_days *m)
+{
+    int i;
     int start_dow, end_dow, end_year_day;
-    struct icaltimetype tmp = impl->last;
-    
-    tmp.year= year;
+    struct icaltimetype tmp = icaltime_null_date();
+
+    tmp.year = year;
     tmp.month = 1;
     tmp.day = 1;
-    tmp.is_date = 1;
-    
+
     /* Find the day that 1st Jan falls on, 1 (Sun) to 7 (Sat). */
     start_dow = icaltime_day_of_week(tmp);
-    
+
     /* Get the last day of the year*/
-    tmp.year= year;
     tmp.month = 12;
     tmp.day = 31;
-    tmp.is_date = 1;
-    
-    end_dow =  icaltime_day_of_week(tmp);
+
+    end_dow = icaltime_day_of_week(tmp);
     end_year_day = icaltime_day_of_year(tmp);
-    
-    for(i = 0; BYDAYPTR[i] != ICAL_RECURRENCE_ARRAY_MAX; i++){
+
+    for (i = 0; BYDAYPTR[i] != ICAL_RECURRENCE_ARRAY_MAX; i++) {
         /* This is 1 (Sun) to 7 (Sat). */
-        int dow = 
-            icalrecurrencetype_day_day_of_week(BYDAYPTR[i]);  
-        int pos =  icalrecurrencetype_day_position(BYDAYPTR[i]);
-        
-        if(pos == 0){
-            /* The day was specified without a position -- it is just
-               a bare day of the week ( BYDAY=SU) so add all of the
-               days of the year with this day-of-week*/
-            int doy, tmp_start_doy;
-                
-	    tmp_start_doy = ((dow + 7 - start_dow) % 7) + 1;
-
-            for (doy = tmp_start_doy; doy <= end_year_day; doy += 7)
-                    pvl_push(days_list,(void*)(ptrdiff_t)doy);
-            
-        } else if ( pos > 0) {
-            int first;
-            /* First occurrence of dow in year */
-            if( dow >= start_dow) {
-                first = dow - start_dow + 1;
-            } else {
-                first = dow - start_dow + 8;
+        int dow = icalrecurrencetype_day_day_of_week(BYDAYPTR[i]);
+        int pos = icalrecurrencetype_day_position(BYDAYPTR[i]);
+
+        if (pos == 0) {
+            /* A bare day of the week (BYDAY=SU), so add all of the days
+               of the year with this day-of-week */
+            int doy;
+
+            for (doy = ((dow + 7 - start_dow) % 7) + 1; doy <= end_year_day; doy += 7) {
+                year_days_add(m, doy, end_year_day);
             }
+        } else if (pos > 0) {
+            /* First occurrence of dow in year, then pos-1 weeks later */
+            int first = ((dow + 7 - start_dow) % 7) + 1;
 
-            /* Then just multiple the position times 7 to get the pos'th day in the year */
-            pvl_push(days_list,(void*)(ptrdiff_t)(first + (pos-1) * 7));
-            
-        } else { /* pos < 0 */ 
-            int last;
-            pos = -pos;
+            year_days_add(m, first + (pos - 1) * 7, end_year_day);
+        } else {
+            /* Last occurrence of dow in year, then -pos-1 weeks earlier */
+            int last = end_year_day - ((end_dow + 7 - dow) % 7);
 
-            /* last occurrence of dow in year */
-            if( dow <= end_dow) {
-                last = end_year_day - end_dow + dow;
-            } else {
-                last = end_year_day - end_dow + dow - 7;
+            year_days_add(m, last + (pos + 1) * 7, end_year_day);
+        }
+    }
+}
+
+/** Add the days of the BYDAY rule part in the given month to the set,
+    counting the positions within the month. */
+static void expand_by_day_in_month(icalrecur_iterator* impl, int year,
+                                   int month, struct year_days *m)
+{
+    int i;
+    int days_in_month = icaltime_days_in_month(month, year);
+    int days_in_year = 365 + icaltime_is_leap_year(year);
+    int first_dow, last_dow, doy_offset;
+    struct year_days month_days;
+    struct icaltimetype t = icaltime_null_date();
+
+    t.year = year;
+    t.month = month;
+    t.day = 1;
+
+    first_dow = icaltime_day_of_week(t);
+
+    /* This holds the day offset used to calculate the day of the year
+       from the month day. Just add the month day to this. */
+    doy_offset = icaltime_day_of_year(t) - 1;
+
+    t.day = days_in_month;
+    last_dow = icaltime_day_of_week(t);
+
+    memset(&month_days, 0, sizeof(month_days));
+
+    for (i = 0; BYDAYPTR[i] != ICAL_RECURRENCE_ARRAY_MAX; i++) {
+        int dow = icalrecurrencetype_day_day_of_week(BYDAYPTR[i]);
+        int pos = icalrecurrencetype_day_position(BYDAYPTR[i]);
+        int first_matching_day, last_matching_day, day;
+
+        /* The first day in the month with the given weekday, and the last */
+        first_matching_day = ((dow + 7 - first_dow) % 7) + 1;
+        last_matching_day = days_in_month - ((last_dow + 7 - dow) % 7);
+
+        if (pos == 0) {
+            for (day = first_matching_day; day <= days_in_month; day += 7) {
+                year_days_add(&month_days, doy_offset + day, days_in_year);
+            }
+        } else if (pos > 0) {
+            day = first_matching_day + (pos - 1) * 7;
+            if (day <= days_in_month) {
+                year_days_add(&month_days, doy_offset + day, days_in_year);
+            }
+        } else {
+            day = last_matching_day + (pos + 1) * 7;
+            if (day > 0) {
+                year_days_add(&month_days, doy_offset + day, days_in_year);
             }
+        }
+    }
 
-            pvl_push(days_list,(void*)(ptrdiff_t)(last - (pos-1) * 7));
+    for (i = 0; i < YEAR_DAYS_WORDS; i++) {
+        m->w[i] |= month_days.w[i];
+    }
+}
+
+/** Add the days of the BYMONTHDAY rule part in the given month to the
+    set. Days that the month does not have are skipped. */
+static void expand_by_month_day(icalrecur_iterator* impl, int year,
+                                int month, struct year_days *m)
+{
+    int i;
+    int days_in_month = icaltime_days_in_month(month, year);
+    int days_in_year = 365 + icaltime_is_leap_year(year);
+    int doy_offset;
+    struct icaltimetype t = icaltime_null_date();
+
+    t.year = year;
+    t.month = month;
+    t.day = 1;
+    doy_offset = icaltime_day_of_year(t) - 1;
+
+    for (i = 0; BYMDPTR[i] != ICAL_RECURRENCE_ARRAY_MAX; i++) {
+        int month_day = BYMDPTR[i];
+
+        if (month_day < 0) {
+            month_day = days_in_month + month_day + 1;
+        }
+        if (month_day >= 1 && month_day <= days_in_month) {
+            year_days_add(m, doy_offset + month_day, days_in_year);
         }
     }
-    return days_list;
 }
 
-/* A compare function to be used with qsort() in order to get
-   a sorted array of days of the year */
-int daysOfYear_compare(const void * a, const void * b)
+/** Add the days of the weeks in the BYWEEKNO rule part to the set, with
+    the weeks numbered as icaltime_week_number() does. */
+static void expand_by_week_no(icalrecur_iterator* impl, int year,
+                              struct year_days *m)
 {
-    return ( *(short*)a - *(short*)b );
+    char weeks[ICAL_BY_WEEKNO_SIZE];
+    int i, doy, weekday;
+    int days_in_year = 365 + icaltime_is_leap_year(year);
+    struct icaltimetype t = icaltime_null_date();
+
+    memset(weeks, 0, sizeof(weeks));
+    for (i = 0; BYWEEKPTR[i] != ICAL_RECURRENCE_ARRAY_MAX; i++) {
+        if (BYWEEKPTR[i] >= 0 && BYWEEKPTR[i] < ICAL_BY_WEEKNO_SIZE) {
+            weeks[BYWEEKPTR[i]] = 1;
+        }
+    }
+
+    t.year = year;
+    t.month = 1;
+    t.day = 1;
+
+    /* 0 (Sun) to 6 (Sat) for 1st Jan, then one day further for each day */
+    weekday = icaltime_day_of_week(t) - 1;
+    for (doy = 1; doy <= days_in_year; doy++) {
+        if (weeks[(doy - weekday) / 7]) {
+            year_days_add(m, doy, days_in_year);
+        }
+        weekday = (weekday + 1) % 7;
+    }
 }
 
 /* For INTERVAL=YEARLY, set up the days[] array in the iterator to
@@ -1971,8 +2379,11 @@ static int expand_year_days(icalrecur_iterator* impl, int year)
     int days_index=0;
     struct icaltimetype t;
     int flags;
+    struct year_days days, rule_days;
 
     t = icaltime_null_date();
+    memset(&days, 0, sizeof(days));
+    memset(&rule_days, 0, sizeof(rule_days));
 
 #define HBD(x) has_by_data(impl,x)
 
@@ -2042,75 +2453,36 @@ static int expand_year_days(icalrecur_iterator* impl, int year)
     }
     case 1<<BY_MONTH: {
         /* FREQ=YEARLY; BYMONTH=3,11*/
-	
-        for(j=0;impl->by_ptrs[BY_MONTH][j]!=ICAL_RECURRENCE_ARRAY_MAX;j++){
-	    int month = impl->by_ptrs[BY_MONTH][j];	    
-            int doy;
+        int days_in_year = 365 + icaltime_is_leap_year(year);
 
-	    t = impl->dtstart;
-	    t.year = year;
-	    t.month = month;
-	    t.is_date = 1;
-
-	    doy = icaltime_day_of_year(t);
-	    
-            impl->days[days_index++] = (short)doy;
+        for(j=1;j<=12;j++){
+            if(!is_expanded_month(impl,j) ||
+               impl->dtstart.day > icaltime_days_in_month(j,year))
+                continue;
 
+            t.year = year;
+            t.month = j;
+            t.day = impl->dtstart.day;
+            year_days_add(&days,icaltime_day_of_year(t),days_in_year);
         }
+        days_index = year_days_list(&days,impl->days);
         break;
     }
 
     case 1<<BY_MONTH_DAY:  {
         /* FREQ=YEARLY; BYMONTHDAY=1,15*/
-        for(k=0;impl->by_ptrs[BY_MONTH_DAY][k]!=ICAL_RECURRENCE_ARRAY_MAX;k++)
-            {
-                int month_day = impl->by_ptrs[BY_MONTH_DAY][k];
-                int doy;
-
-                t = impl->dtstart;
-                if (month_day < 0) {
-                    int days_in_month = icaltime_days_in_month(t.month, year);
-                    month_day = days_in_month + month_day + 1;
-                }
-                t.day = month_day;
-                t.year = year;
-                t.is_date = 1;
-
-                doy = icaltime_day_of_year(t);
-
-                impl->days[days_index++] = (short)doy;
-
-            }
+        expand_by_month_day(impl,year,impl->dtstart.month,&days);
+        days_index = year_days_list(&days,impl->days);
         break;
     }
 
     case (1<<BY_MONTH_DAY) + (1<<BY_MONTH): {
         /* FREQ=YEARLY; BYMONTHDAY=1,15; BYMONTH=10 */
-
-        for(j=0;impl->by_ptrs[BY_MONTH][j]!=ICAL_RECURRENCE_ARRAY_MAX;j++){
-            int month = impl->by_ptrs[BY_MONTH][j];
-            int days_in_month = icaltime_days_in_month(month, year);
-            for(k=0;impl->by_ptrs[BY_MONTH_DAY][k]!=ICAL_RECURRENCE_ARRAY_MAX;k++)
-           {
-                int month_day = impl->by_ptrs[BY_MONTH_DAY][k];
-                int doy;
-
-                if (month_day < 0) {
-                    month_day = days_in_month + month_day + 1;
-                }
-
-                t.day = month_day;
-                t.month = month;
-                t.year = year;
-                t.is_date = 1;
-
-                doy = icaltime_day_of_year(t);
-
-                impl->days[days_index++] = (short)doy;
-
-            }
+        for(j=1;j<=12;j++){
+            if(is_expanded_month(impl,j))
+                expand_by_month_day(impl,year,j,&days);
         }
-
+        days_index = year_days_list(&days,impl->days);
         break;
     }
 
@@ -2140,181 +2512,69 @@ static int expand_year_days(icalrecur_iterator* impl, int year)
 
     case 1<<BY_DAY: {
         /*FREQ=YEARLY; BYDAY=TH,20MO,-10FR*/
-        pvl_elem i;
-        pvl_list days = expand_by_day(impl,year);
-
-
-        for(i=pvl_head(days);i!=0;i=pvl_next(i)){
-            short day = (short)(intptr_t)pvl_data(i);
-            impl->days[days_index++] = day;
-        }
-
-        pvl_free(days);
-
+        expand_by_day(impl,year,&days);
+        days_index = year_days_list(&days,impl->days);
         break;
     }
 
     case (1<<BY_DAY)+(1<<BY_MONTH): {
         /*FREQ=YEARLY; BYDAY=TH,20MO,-10FR; BYMONTH = 12*/
-
-
-        for(j=0;impl->by_ptrs[BY_MONTH][j]!=ICAL_RECURRENCE_ARRAY_MAX;j++){
-	    int month = impl->by_ptrs[BY_MONTH][j];
-	    int days_in_month = icaltime_days_in_month(month,year);
-	    int first_dow, last_dow, doy_offset;
-            
-	    t.year = year;
-	    t.month = month;
-	    t.day = 1;
-	    t.is_date = 1;
-              
-	    first_dow = icaltime_day_of_week(t);
-
-	    /* This holds the day offset used to calculate the day of the year
-	       from the month day. Just add the month day to this. */
-	    doy_offset = icaltime_day_of_year(t) - 1;
-
-	    t.day = days_in_month;
-	    last_dow = icaltime_day_of_week(t);
-
-	    if(has_by_data(impl,BY_SET_POS)) {
-	        /*FREQ=YEARLY; BYDAY=TH,20MO,-10FR; BYMONTH = 12; BYSETPOS=1*/
-	        int day;
-	        int set_pos_counter = 0;
-	        int set_pos_total = 0;
-	        int by_month_day[ICAL_BY_MONTHDAY_SIZE];
-	        for(day = 1; day <= days_in_month; day++){
-	            t.day = day;
-	            if(is_day_in_byday(impl,t))
-	                by_month_day[set_pos_total++] = day;
-	        }
-	        for(set_pos_counter = 0; set_pos_counter < set_pos_total; set_pos_counter++){
-	            if(check_set_position(impl, set_pos_counter+1) ||
-	                	check_set_position(impl, set_pos_counter-set_pos_total))
-	                impl->days[days_index++] = doy_offset + by_month_day[set_pos_counter];
-	        }
-	    }
-	    else for(k=0;impl->by_ptrs[BY_DAY][k]!=ICAL_RECURRENCE_ARRAY_MAX;k++){
-	        short day_coded = impl->by_ptrs[BY_DAY][k];
-		enum icalrecurrencetype_weekday dow =
-		  icalrecurrencetype_day_day_of_week(day_coded);
-		int pos = icalrecurrencetype_day_position(day_coded);  
-		int first_matching_day, last_matching_day, day, month_day;
-
-		/* Calculate the first day in the month with the given weekday,
-		   and the last day. */
-		first_matching_day = ((dow + 7 - first_dow) % 7) + 1;
-		last_matching_day = days_in_month - ((last_dow + 7 - dow) % 7);
-
-		if (pos == 0) {
-		    /* Add all of instances of the weekday within the month. */
-		  for (day = first_matching_day; day <= days_in_month; day += 7)
-		      impl->days[days_index++] = (short)(doy_offset + day);
-
-		} else if (pos > 0) {
-		    /* Add the nth instance of the weekday within the month. */
-		    month_day = first_matching_day + (pos - 1) * 7;
-
-		    if (month_day <= days_in_month)
-		        impl->days[days_index++] = (short)(doy_offset + month_day);
-
-		} else {
-		    /* Add the -nth instance of the weekday within the month.*/
-		    month_day = last_matching_day + (pos + 1) * 7;
-
-		    if (month_day > 0)
-		        impl->days[days_index++] = (short)(doy_offset + month_day);
-		}
-	    }
+        for(j=1;j<=12;j++){
+            if(!is_expanded_month(impl,j))
+                continue;
+
+            if(has_by_data(impl,BY_SET_POS)) {
+                /*FREQ=YEARLY; BYDAY=TH,20MO,-10FR; BYMONTH = 12; BYSETPOS=1*/
+                short month_days[ICAL_BY_MONTHDAY_SIZE];
+                int set_pos_total;
+                int days_in_year = 365 + icaltime_is_leap_year(year);
+
+                memset(&rule_days, 0, sizeof(rule_days));
+                expand_by_day_in_month(impl,year,j,&rule_days);
+                set_pos_total = year_days_list(&rule_days,month_days);
+
+                for(k=0;k<set_pos_total;k++){
+                    if(check_set_position(impl,k+1) ||
+                       check_set_position(impl,k-set_pos_total))
+                        year_days_add(&days,month_days[k],days_in_year);
+                }
+            } else {
+                expand_by_day_in_month(impl,year,j,&days);
+            }
         }
-        /* Sort the days according to the Bymonthday order (1,2,3,...). */
-        qsort(impl->days, days_index, sizeof(short), daysOfYear_compare);
+        days_index = year_days_list(&days,impl->days);
         break;
     }
 
     case (1<<BY_DAY) + (1<<BY_MONTH_DAY) : {
         /*FREQ=YEARLY; BYDAY=TH,20MO,-10FR; BYMONTHDAY=1,15*/
-
-        pvl_elem itr;
-        pvl_list days = expand_by_day(impl,year);
-
-        for(itr=pvl_head(days);itr!=0;itr=pvl_next(itr)){
-            short day = (short)(intptr_t)pvl_data(itr);
-            struct icaltimetype tt; 
-            
-            tt = icaltime_from_day_of_year(day,year);
-            
-            for(j = 0; BYMDPTR[j]!=ICAL_RECURRENCE_ARRAY_MAX; j++){
-                    int mday = BYMDPTR[j];
-                    
-                    if(tt.day == mday){
-                        impl->days[days_index++] = day;
-                    }
-            }
-            
-        }
-
-        pvl_free(days);
-       
+        expand_by_day(impl,year,&days);
+        for(j=1;j<=12;j++)
+            expand_by_month_day(impl,year,j,&rule_days);
+        year_days_and(&days,&rule_days);
+        days_index = year_days_list(&days,impl->days);
         break;
     }
 
     case (1<<BY_DAY) + (1<<BY_MONTH_DAY) + (1<<BY_MONTH): {
         /*FREQ=YEARLY; BYDAY=TH,20MO,-10FR; BYMONTHDAY=10; MYMONTH=6,11*/
-
-        pvl_elem itr;
-        pvl_list days = expand_by_day(impl,year);
-
-        for(itr=pvl_head(days);itr!=0;itr=pvl_next(itr)){
-            short day = (short)(intptr_t)pvl_data(itr);
-            struct icaltimetype tt; 
-            int i;
-            
-            tt = icaltime_from_day_of_year(day,year);
-            
-            for(i = 0; BYMONPTR[i] != ICAL_RECURRENCE_ARRAY_MAX; i++){
-                for(j = 0; BYMDPTR[j]!=ICAL_RECURRENCE_ARRAY_MAX; j++){
-                    int mday = BYMDPTR[j];
-                    int month = BYMONPTR[i];
-                    
-                    if(tt.month == month  && tt.day == mday){
-                        impl->days[days_index++] = day;
-                    }
-                }
+        for(j=1;j<=12;j++){
+            if(is_expanded_month(impl,j)){
+                expand_by_day_in_month(impl,year,j,&days);
+                expand_by_month_day(impl,year,j,&rule_days);
             }
-
         }
-
-        pvl_free(days);
-
-       break;
-
+        year_days_and(&days,&rule_days);
+        days_index = year_days_list(&days,impl->days);
+        break;
     }
 
     case (1<<BY_DAY) + (1<<BY_WEEK_NO) : {
         /*FREQ=YEARLY; BYDAY=TH,20MO,-10FR;  WEEKNO=20,50*/
-       
-        pvl_elem itr;
-        pvl_list days = expand_by_day(impl,year);
-
-        for(itr=pvl_head(days);itr!=0;itr=pvl_next(itr)){
-            short day = (short)(intptr_t)pvl_data(itr);
-            struct icaltimetype tt; 
-            int i;
-            
-            tt = icaltime_from_day_of_year(day,year);
-            
-            for(i = 0; BYWEEKPTR[i] != ICAL_RECURRENCE_ARRAY_MAX; i++){
-                    int weekno = BYWEEKPTR[i];
-                    int this_weekno = icaltime_week_number(tt);
-                    if(weekno== this_weekno){
-                        impl->days[days_index++] = day;
-                    }
-            }
-                    
-        }
-
-        pvl_free(days);
+        expand_by_day(impl,year,&days);
+        expand_by_week_no(impl,year,&rule_days);
+        year_days_and(&days,&rule_days);
+        days_index = year_days_list(&days,impl->days);
         break;
     }
 
@@ -2325,9 +2585,18 @@ static int expand_year_days(icalrecur_iterator* impl, int year)
     }
 
     case 1<<BY_YEAR_DAY: {
-	for(j=0;impl->by_ptrs[BY_YEAR_DAY][j]!=ICAL_RECURRENCE_ARRAY_MAX;j++){
-	    impl->days[days_index++] = impl->by_ptrs[BY_YEAR_DAY][j];
+        /* FREQ=YEARLY; BYYEARDAY=1,100,-1 */
+        int days_in_year = 365 + icaltime_is_leap_year(year);
+
+        for(j=0;impl->by_ptrs[BY_YEAR_DAY][j]!=ICAL_RECURRENCE_ARRAY_MAX;j++){
+            int doy = impl->by_ptrs[BY_YEAR_DAY][j];
+
+            if (doy < 0) {
+                doy = days_in_year + doy + 1;
+            }
+            year_days_add(&days,doy,days_in_year);
         }
+        days_index = year_days_list(&days,impl->days);
         break;
     }
 
@@ -2505,6 +2774,285 @@ struct icaltimetype icalrecur_iterator_next(icalrecur_iterator *impl)
     return impl->last;
 }
 
+/* Floor division, for counting periods back from dates before the
+   iterator's first period. */
+static int64_t floor_div(int64_t a, int64_t b)
+{
+    int64_t q = a / b;
+
+    if ((a % b != 0) && ((a < 0) != (b < 0))) {
+	q--;
+    }
+
+    return q;
+}
+
+/* Moves a BY list of times within a period to its last entry, as it is
+   when the iterator has gone through the whole period. */
+static void seek_by_end(icalrecur_iterator* impl, enum byrule byrule,
+			int *timepart)
+{
+    int n = icalrecur_iterator_sizeof_byarray(impl->by_ptrs[byrule]);
+
+    if (n > 0) {
+	impl->by_indices[byrule] = (short)(n-1);
+	*timepart = impl->by_ptrs[byrule][n-1];
+    }
+}
+
+int icalrecur_iterator_set_start(icalrecur_iterator *impl,
+				 struct icaltimetype start)
+{
+    icaltimezone *utc = icaltimezone_get_utc_timezone();
+    icalrecurrencetype_frequency freq;
+    struct icaltimetype last;
+    int interval, margin = 0;
+    int start_day, start_secs, last_day = 0, year, month, day;
+    int64_t target, anchor, unit, period;
+
+    icalerror_check_arg_rz((impl!=0),"impl");
+
+    freq = impl->rule.freq;
+    interval = impl->rule.interval;
+    last = impl->last;
+
+    /* Only fresh iterators are moved, and only for rules whose periods
+       follow each other by plain date arithmetic. BYSETPOS and COUNT
+       need every occurrence counted, a BY list at the level of the
+       frequency is stepped through instead of the interval, BYMONTH
+       makes the day and week steps jump between its months, and the
+       lengths of the months before 1753 are not those of the proleptic
+       Gregorian calendar. */
+    if (impl->occurrence_no != 0 || impl->rule.count != 0 || interval < 1 ||
+	has_by_data(impl,BY_SET_POS) || last.year <= 1752 ||
+	last.month < 1 || last.month > 12) {
+	return 0;
+    }
+
+    switch (freq) {
+	case ICAL_SECONDLY_RECURRENCE:
+	    if (has_by_data(impl,BY_SECOND)) return 0;
+	    break;
+	case ICAL_MINUTELY_RECURRENCE:
+	    if (has_by_data(impl,BY_MINUTE)) return 0;
+	    break;
+	case ICAL_HOURLY_RECURRENCE:
+	    if (has_by_data(impl,BY_HOUR)) return 0;
+	    break;
+	case ICAL_DAILY_RECURRENCE:
+	    break;
+	case ICAL_WEEKLY_RECURRENCE:
+	    if (has_by_data(impl,BY_WEEK_NO)) return 0;
+	    break;
+	case ICAL_MONTHLY_RECURRENCE:
+	case ICAL_YEARLY_RECURRENCE:
+	    break;
+	default:
+	    return 0;
+    }
+
+    if (freq != ICAL_YEARLY_RECURRENCE && has_by_data(impl,BY_MONTH)) {
+	return 0;
+    }
+
+    if (freq <= ICAL_WEEKLY_RECURRENCE) {
+	if (last.day < 1 ||
+	    last.day > icaltime_days_in_month(last.month, last.year) ||
+	    last.hour < 0 || last.hour > 23 || last.minute < 0 ||
+	    last.minute > 59 || last.second < 0 || last.second > 59) {
+	    return 0;
+	}
+	last_day = icaltime_days_from_civil(last.year, last.month, last.day);
+    }
+
+    /* Occurrences are compared in UTC, but counted on the clock of
+       dtstart. Around changes of the UTC offset the two orders may
+       differ, so a zoned dtstart starts looking two days early. */
+    if (!impl->dtstart.is_date && impl->dtstart.zone != 0 &&
+	impl->dtstart.zone != utc) {
+	margin = 2;
+    }
+
+    if (!start.is_date) {
+	start = icaltime_convert_to_zone(start, utc);
+	if (margin) {
+	    start = icaltime_convert_to_zone(start,
+					     (icaltimezone *)impl->dtstart.zone);
+	}
+    }
+
+    start_day = icaltime_days_from_civil(start.year, start.month, start.day)
+	- margin;
+    start_secs = start.is_date ? 0 :
+	start.hour*3600 + start.minute*60 + start.second;
+
+    switch (freq) {
+	case ICAL_SECONDLY_RECURRENCE:
+	    unit = 1;
+	    target = (int64_t)start_day*86400 + start_secs;
+	    anchor = (int64_t)last_day*86400 +
+		last.hour*3600 + last.minute*60 + last.second;
+	    break;
+	case ICAL_MINUTELY_RECURRENCE:
+	    unit = 1;
+	    target = (int64_t)start_day*1440 + start_secs/60;
+	    anchor = (int64_t)last_day*1440 + last.hour*60 + last.minute;
+	    break;
+	case ICAL_HOURLY_RECURRENCE:
+	    unit = 1;
+	    target = (int64_t)start_day*24 + start_secs/3600;
+	    anchor = (int64_t)last_day*24 + last.hour;
+	    break;
+	case ICAL_DAILY_RECURRENCE:
+	    unit = 1;
+	    target = start_day;
+	    anchor = last_day;
+	    break;
+	case ICAL_WEEKLY_RECURRENCE:
+	    unit = 7;
+	    target = start_day;
+	    anchor = last_day;
+	    if (has_by_data(impl,BY_DAY)) {
+		/* The weeks run from the start of the week of dtstart */
+		int dow = ((last_day % 7 + 7 + 4) % 7) + 1;
+		anchor -= ((dow - (int)impl->rule.week_start) % 7 + 7) % 7;
+	    }
+	    break;
+	case ICAL_MONTHLY_RECURRENCE:
+	    unit = 1;
+	    icaltime_civil_from_days(start_day, &year, &month, &day);
+	    target = (int64_t)year*12 + month - 1;
+	    anchor = (int64_t)last.year*12 + last.month - 1;
+	    break;
+	default:
+	    unit = 1;
+	    icaltime_civil_from_days(start_day, &year, &month, &day);
+	    target = year;
+	    anchor = last.year;
+	    break;
+    }
+
+    /* Stop at the end of the period before the one holding start, with
+       one more to spare for occurrences that spill over into the next
+       period. */
+    period = floor_div(target - anchor, unit*interval) - 2;
+    if (period < 0) {
+	return 0;
+    }
+
+    if (freq >= ICAL_DAILY_RECURRENCE) {
+	seek_by_end(impl, BY_HOUR, &impl->last.hour);
+    }
+    if (freq >= ICAL_HOURLY_RECURRENCE) {
+	seek_by_end(impl, BY_MINUTE, &impl->last.minute);
+    }
+    if (freq >= ICAL_MINUTELY_RECURRENCE) {
+	seek_by_end(impl, BY_SECOND, &impl->last.second);
+    }
+
+    switch (freq) {
+	case ICAL_SECONDLY_RECURRENCE:
+	case ICAL_MINUTELY_RECURRENCE:
+	case ICAL_HOURLY_RECURRENCE:
+	case ICAL_DAILY_RECURRENCE: {
+	    static const int units_per_day[] = {86400, 1440, 24, 1};
+	    int64_t t = anchor + period*interval;
+	    int64_t days = floor_div(t, units_per_day[freq]);
+	    int rest = (int)(t - days*units_per_day[freq]);
+
+	    if (freq == ICAL_SECONDLY_RECURRENCE) {
+		impl->last.hour = rest/3600;
+		impl->last.minute = rest/60 % 60;
+		impl->last.second = rest % 60;
+	    } else if (freq == ICAL_MINUTELY_RECURRENCE) {
+		impl->last.hour = rest/60;
+		impl->last.minute = rest % 60;
+	    } else if (freq == ICAL_HOURLY_RECURRENCE) {
+		impl->last.hour = rest;
+	    }
+	    icaltime_civil_from_days((int)days, &impl->last.year,
+				     &impl->last.month, &impl->last.day);
+	    break;
+	}
+	case ICAL_WEEKLY_RECURRENCE: {
+	    int64_t days = anchor + period*7*interval;
+
+	    if (has_by_data(impl,BY_DAY)) {
+		int n, dow;
+
+		/* Go to the last day of the week, in the order
+		   next_weekday_by_week() steps through them */
+		n = icalrecur_iterator_sizeof_byarray(BYDAYPTR);
+		BYDAYIDX = (short)(n-1);
+
+		dow = icalrecurrencetype_day_day_of_week(BYDAYPTR[n-1]) -
+		    impl->rule.week_start;
+		if (dow < 0) {
+		    dow += 7;
+		}
+		days += dow;
+	    }
+	    icaltime_civil_from_days((int)days, &impl->last.year,
+				     &impl->last.month, &impl->last.day);
+	    break;
+	}
+	case ICAL_MONTHLY_RECURRENCE: {
+	    int64_t months = anchor + period*interval;
+	    int days_in_month;
+
+	    impl->last.year = (int)floor_div(months, 12);
+	    impl->last.month = (int)(months - impl->last.year*12) + 1;
+	    days_in_month = icaltime_days_in_month(impl->last.month,
+						   impl->last.year);
+
+	    if (has_by_data(impl,BY_DAY)) {
+		/* next_month() searches on from the day after last */
+		impl->last.day = days_in_month;
+	    } else if (has_by_data(impl,BY_MONTH_DAY)) {
+		int n = icalrecur_iterator_sizeof_byarray(BYMDPTR);
+
+		BYMDIDX = (short)(n-1);
+		impl->last.day = BYMDPTR[n-1];
+		if (impl->last.day < 0) {
+		    impl->last.day = days_in_month + impl->last.day + 1;
+		}
+	    } else {
+		impl->last.day = BYMDPTR[0];
+	    }
+	    break;
+	}
+	default: {
+	    int n = 0;
+
+	    impl->last.year = (int)(anchor + period*interval);
+	    expand_year_days(impl, impl->last.year);
+	    while (n < 366 && impl->days[n] != ICAL_RECURRENCE_ARRAY_MAX) {
+		n++;
+	    }
+
+	    /* With no days in the year, next_year() goes on to the next
+	       one straight away */
+	    impl->days_index = (short)(n-1);
+	    if (n > 0) {
+		struct icaltimetype next =
+		    icaltime_from_day_of_year(impl->days[n-1], impl->last.year);
+
+		impl->last.month = next.month;
+		impl->last.day = next.day;
+	    } else {
+		impl->last.month = 1;
+		impl->last.day = 1;
+	    }
+	    break;
+	}
+    }
+
+    /* The iterator now stands on an occurrence it has returned */
+    impl->occurrence_no = 1;
+
+    return 1;
+}
+
 
 /************************** Type Routines **********************/
 
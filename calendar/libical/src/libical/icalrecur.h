@@ -198,9 +198,35 @@ typedef struct icalrecur_iterator_impl  icalrecur_iterator;
 icalrecur_iterator* icalrecur_iterator_new(struct icalrecurrencetype rule, 
                                            struct icaltimetype dtstart);
 
+/** A recurrence rule that has been checked and prepared for iteration
+    once, for all the iterators of equal rules */
+typedef struct icalrecur_plan_impl icalrecur_plan;
+
+/** Get the plan of a rule. Equal rules get the same plan for as long
+    as any reference to it is held. Returns 0 and sets the error if the
+    rule is not legal. */
+icalrecur_plan* icalrecur_plan_get(const struct icalrecurrencetype *rule);
+
+/** Release a reference to a plan from icalrecur_plan_get */
+void icalrecur_plan_unref(icalrecur_plan *plan);
+
+/** Create a new iterator of a plan, which holds on to the plan until
+    it is freed */
+icalrecur_iterator* icalrecur_iterator_new_from_plan(icalrecur_plan *plan,
+                                                     struct icaltimetype dtstart);
+
 /** Get the next occurrence from an iterator */
 struct icaltimetype icalrecur_iterator_next(icalrecur_iterator*);
 
+/** Move a new iterator close before the first occurrence at or after
+    start, so that icalrecur_iterator_next does not have to go through
+    all the occurrences before it. Some occurrences before start may
+    still be returned. Returns 1 if the iterator was moved, or 0 if the
+    rule (e.g. one with COUNT or BYSETPOS) has to be iterated from
+    dtstart and the iterator was left as it is. */
+int icalrecur_iterator_set_start(icalrecur_iterator*,
+                                 struct icaltimetype start);
+
 void icalrecur_iterator_decrement_count(icalrecur_iterator*);
 
 /** Free the iterator */
@@ -54,99 +54,6 @@
 #define strcasecmp    stricmp
 #endif
 
-#ifdef WIN32
-/* Undef the similar macro from pthread.h, it doesn't check if
- * gmtime() returns NULL.
- */
-#undef gmtime_r
-
-/* The gmtime() in Microsoft's C library is MT-safe */
-#define gmtime_r(tp,tmp) (gmtime(tp)?(*(tmp)=*gmtime(tp),(tmp)):0)
-#endif
-
-#ifdef HAVE_PTHREAD
- #include <pthread.h>    
-    static pthread_mutex_t tzid_mutex = PTHREAD_MUTEX_INITIALIZER;
-#endif
-
-/*
- *  Function to convert a struct tm time specification
- *  to an ANSI time_t using the specified time zone.
- *  This is different from the standard mktime() function
- *  in that we don't want the automatic adjustments for
- *  local daylight savings time applied to the result.
- *  This function expects well-formed input.
- */
-static time_t make_time(struct tm *tm, int tzm)
-{
-  time_t tim;
-
-  static int days[] = { -1, 30, 58, 89, 119, 150, 180, 211, 242, 272, 303, 333, 364 };
-
-  /* check that year specification within range */
-
-  if (tm->tm_year < 70 || tm->tm_year > 138)
-    return((time_t) -1);
-
-  /* check that month specification within range */
-
-  if (tm->tm_mon < 0 || tm->tm_mon > 11)
-    return((time_t) -1);
-
-  /* check for upper bound of Jan 17, 2038 (to avoid possibility of
-     32-bit arithmetic overflow) */
-  
-  if (tm->tm_year == 138) {
-    if (tm->tm_mon > 0)
-      return((time_t) -1);
-    else if (tm->tm_mday > 17)
-      return((time_t) -1);
-  }
-
-  /*
-   *  calculate elapsed days since start of the epoch (midnight Jan
-   *  1st, 1970 UTC) 17 = number of leap years between 1900 and 1970
-   *  (number of leap days to subtract)
-   */
-
-  tim = (tm->tm_year - 70) * 365 + ((tm->tm_year - 1) / 4) - 17;
-
-  /* add number of days elapsed in the current year */
-
-  tim += days[tm->tm_mon];
-
-  /* check and adjust for leap years (the leap year check only valid
-     during the 32-bit era */
-
-  if ((tm->tm_year & 3) == 0 && tm->tm_mon > 1)
-    tim += 1;
-
-  /* elapsed days to current date */
-
-  tim += tm->tm_mday;
-
-
-  /* calculate elapsed hours since start of the epoch */
-
-  tim = tim * 24 + tm->tm_hour;
-
-  /* calculate elapsed minutes since start of the epoch */
-
-  tim = tim * 60 + tm->tm_min;
-  
-  /* adjust per time zone specification */
-  
-  tim -= tzm;
-  
-  /* calculate elapsed seconds since start of the epoch */
-  
-  tim = tim * 60 + tm->tm_sec;
-  
-  /* return number of seconds since start of the epoch */
-  
-  return(tim);
-}
-
 /**	@brief Constructor (deprecated).
  *
  * Convert seconds past UNIX epoch to a timetype.
@@ -198,25 +105,24 @@ icaltime_from_timet_with_zone(const time_t tm, const int is_date,
 	const icaltimezone *zone)
 {
     struct icaltimetype tt;
-    struct tm t;
     icaltimezone *utc_zone;
+    time_t days, seconds;
 
     utc_zone = icaltimezone_get_utc_timezone ();
 
-    /* Convert the time_t to a struct tm in UTC time. We can trust gmtime
-       for this. */
-#ifdef HAVE_PTHREAD
-    gmtime_r (&tm, &t);
-#else
-    t = *(gmtime (&tm));
-#endif
-     
-    tt.year   = t.tm_year + 1900;
-    tt.month  = t.tm_mon + 1;
-    tt.day    = t.tm_mday;
-    tt.hour   = t.tm_hour;
-    tt.minute = t.tm_min;
-    tt.second = t.tm_sec;
+    /* Split the time_t into days and seconds in the day, in UTC, rounding
+       down for times before the epoch like gmtime() does. */
+    days = tm / 86400;
+    seconds = tm % 86400;
+    if (seconds < 0) {
+	seconds += 86400;
+	days--;
+    }
+
+    icaltime_civil_from_days ((int) days, &tt.year, &tt.month, &tt.day);
+    tt.hour   = (int) seconds / 3600;
+    tt.minute = (int) seconds / 60 % 60;
+    tt.second = (int) seconds % 60;
     tt.is_date = 0; 
     tt.is_utc = (zone == utc_zone) ? 1 : 0;
     tt.is_daylight = 0;
@@ -265,7 +171,6 @@ struct icaltimetype icaltime_today(void)
  */
 time_t icaltime_as_timet(const struct icaltimetype tt)
 {
-    struct tm stm;
     time_t t;
 
     /* If the time is the special null time, return 0. */
@@ -273,111 +178,22 @@ time_t icaltime_as_timet(const struct icaltimetype tt)
 	return 0;
     }
 
-    /* Copy the icaltimetype to a struct tm. */
-    memset (&stm, 0, sizeof (struct tm));
+    /* Only times from 1970 up to Jan 17, 2038 are handled, to avoid the
+       possibility of 32-bit arithmetic overflow. */
+    if (tt.year < 1970 || tt.year > 2038 || tt.month < 1 || tt.month > 12)
+	return (time_t) -1;
+    if (tt.year == 2038 && (tt.month > 1 || tt.day > 17))
+	return (time_t) -1;
 
-    if (icaltime_is_date(tt)) {
-	stm.tm_sec = stm.tm_min = stm.tm_hour = 0;
-    } else {
-	stm.tm_sec = tt.second;
-	stm.tm_min = tt.minute;
-	stm.tm_hour = tt.hour;
+    t = (time_t) icaltime_days_from_civil (tt.year, tt.month, tt.day) * 86400;
+    if (!icaltime_is_date(tt)) {
+	t += tt.hour * 3600 + tt.minute * 60 + tt.second;
     }
 
-    stm.tm_mday = tt.day;
-    stm.tm_mon = tt.month-1;
-    stm.tm_year = tt.year-1900;
-    stm.tm_isdst = -1;
-
-    t = make_time(&stm, 0);
-
     return t;
-
 }
 
 
-/* Structure used by set_tz to hold an old value of TZ, and the new
-   value, which is in memory we will have to free in unset_tz */
-/* This will hold the last "TZ=XXX" string we used with putenv(). After we
-   call putenv() again to set a new TZ string, we can free the previous one.
-   As far as I know, no libc implementations actually free the memory used in
-   the environment variables (how could they know if it is a static string or
-   a malloc'ed string?), so we have to free it ourselves. */
-static char* saved_tz = NULL;
-
-/* If you use set_tz(), you must call unset_tz() some time later to restore the
-   original TZ. Pass unset_tz() the string that set_tz() returns. Call both the functions
-   locking the tzid mutex as in icaltime_as_timet_with_zone */
-char* set_tz(const char* tzid)
-{
-    char *old_tz, *old_tz_copy = NULL, *new_tz;
-
-    /* Get the old TZ setting and save a copy of it to return. */
-    old_tz = getenv("TZ");
-    if(old_tz){
-	old_tz_copy = (char*)malloc(strlen (old_tz) + 4);
-
-	if(old_tz_copy == 0){
-	    icalerror_set_errno(ICAL_NEWFAILED_ERROR);
-	    return 0;
-	}
-
-	strcpy (old_tz_copy, "TZ=");
-	strcpy (old_tz_copy + 3, old_tz);
-    }
-
-    /* Create the new TZ string. */
-    new_tz = (char*)malloc(strlen (tzid) + 4);
-
-    if(new_tz == 0){
-	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
-	free(old_tz_copy);
-	return 0;
-    }
-
-    strcpy (new_tz, "TZ=");
-    strcpy (new_tz + 3, tzid);
-
-    /* Add the new TZ to the environment. */
-    putenv(new_tz); 
-
-    /* Free any previous TZ environment string we have used in a synchronized manner. */
-
-    free (saved_tz);
-
-    /* Save a pointer to the TZ string we just set, so we can free it later. */
-    saved_tz = new_tz;
-
-    return old_tz_copy; /* This will be zero if the TZ env var was not set */
-}
-
-void unset_tz(char *tzstr)
-{
-    /* restore the original environment */
-
-    if(tzstr!=0){
-	putenv(tzstr);
-    } else {
-	/* Delete from environment.  We prefer unsetenv(3) over putenv(3)
-	   because the former is POSIX and behaves consistently.  The later
-	   does not unset the variable in some systems (like NetBSD), leaving
-	   it with an empty value.  This causes problems later because further
-	   calls to time related functions in libc will treat times in UTC. */
-#ifdef HAVE_UNSETENV
-	unsetenv("TZ");
-#else
-	putenv("TZ");
-#endif
-    } 
-
-    /* Free any previous TZ environment string we have used in a synchronized manner */
-    free (saved_tz);
-
-    /* Save a pointer to the TZ string we just set, so we can free it later.
-       (This can possibly be NULL if there was no TZ to restore.) */
-    saved_tz = tzstr;
-}
-
 /**	Return the time as seconds past the UNIX epoch, using the
  *	given timezone.
  *
@@ -390,9 +206,6 @@ time_t icaltime_as_timet_with_zone(const struct icaltimetype tt,
 	const icaltimezone *zone)
 {
     icaltimezone *utc_zone;
-    struct tm stm;
-    time_t t;
-    char *old_tz;
     struct icaltimetype local_tt;
     
     utc_zone = icaltimezone_get_utc_timezone ();
@@ -410,39 +223,11 @@ time_t icaltime_as_timet_with_zone(const struct icaltimetype tt,
     /* Use our timezone functions to convert to UTC. */
     icaltimezone_convert_time (&local_tt, (icaltimezone *)zone, utc_zone);
 
-    /* Copy the icaltimetype to a struct tm. */
-    memset (&stm, 0, sizeof (struct tm));
-
-    stm.tm_sec = local_tt.second;
-    stm.tm_min = local_tt.minute;
-    stm.tm_hour = local_tt.hour;
-    stm.tm_mday = local_tt.day;
-    stm.tm_mon = local_tt.month-1;
-    stm.tm_year = local_tt.year-1900;
-    stm.tm_isdst = -1;
-/* The functions putenv and mktime are not thread safe, inserting a lock
-to prevent any crashes */
-
-#ifdef HAVE_PTHREAD
-    pthread_mutex_lock (&tzid_mutex);
-#endif
-    
-    /* Set TZ to UTC and use mktime to convert to a time_t. */
-    old_tz = set_tz ("UTC");
-#ifdef WIN32
-    tzset ();
-#endif
-
-    t = mktime (&stm);
-    unset_tz (old_tz);
-#ifdef WIN32
-    tzset ();
-#endif
-
-#ifdef HAVE_PTHREAD
-    pthread_mutex_unlock (&tzid_mutex);
-#endif
-    return t;
+    /* Fields out of range carry over, as they would with mktime(). */
+    return (time_t) icaltime_days_from_civil (local_tt.year, local_tt.month,
+					      local_tt.day) * 86400
+	+ (time_t) local_tt.hour * 3600 + local_tt.minute * 60
+	+ local_tt.second;
 }
 
 const char* icaltime_as_ical_string(const struct icaltimetype tt)
@@ -593,6 +378,59 @@ ycaltime_days_in_year (const int year)
 	else return 365;
 }
 
+/* Returns the number of days from 1970-01-01 to the given date of the
+   proleptic Gregorian calendar. A month or day out of range carries over
+   into the year or month, as with mktime(). */
+int
+icaltime_days_from_civil (int year, int month, int day)
+{
+    int era, year_of_era, day_of_year;
+
+    /* Carry the month over into the year. */
+    month--;
+    year += month / 12;
+    month %= 12;
+    if (month < 0) {
+	month += 12;
+	year--;
+    }
+    month++;
+
+    /* Count the years from March, so that a leap day is the last day of
+       its year, and the years in 400 year eras. */
+    if (month <= 2)
+	year--;
+    era = (year >= 0 ? year : year - 399) / 400;
+    year_of_era = year - era * 400;
+    day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+
+    return era * 146097 + year_of_era * 365 + year_of_era / 4
+	- year_of_era / 100 + day_of_year - 719468;
+}
+
+
+/* Gets the date of the proleptic Gregorian calendar that is the given
+   number of days from 1970-01-01. */
+void
+icaltime_civil_from_days (int days, int *year, int *month, int *day)
+{
+    int era, day_of_era, year_of_era, day_of_year, month_from_march;
+
+    /* Count from 0000-03-01 in 400 year eras, as above. */
+    days += 719468;
+    era = (days >= 0 ? days : days - 146096) / 146097;
+    day_of_era = days - era * 146097;
+    year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524
+		   - day_of_era / 146096) / 365;
+    day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4
+				- year_of_era / 100);
+    month_from_march = (5 * day_of_year + 2) / 153;
+
+    *day = day_of_year - (153 * month_from_march + 2) / 5 + 1;
+    *month = month_from_march < 10 ? month_from_march + 3 : month_from_march - 9;
+    *year = year_of_era + era * 400 + (*month <= 2 ? 1 : 0);
+}
+
 static int _days_in_month[] = {0,31,28,31,30,31,30,31,31,30,31,30,31};
 
 int icaltime_days_in_month(const int month, const int year)
@@ -266,6 +266,15 @@ int icaltime_is_leap_year (const int year);
 /** Return the number of days in this year */
 int icaltime_days_in_year (const int year);
 
+/** Return the number of days from 1970-01-01 to the given date of the
+    proleptic Gregorian calendar. A month or day out of range carries over
+    into the year or month. */
+int icaltime_days_from_civil (int year, int month, int day);
+
+/** Get the date of the proleptic Gregorian calendar that is the given
+    number of days from 1970-01-01. */
+void icaltime_civil_from_days (int days, int *year, int *month, int *day);
+
 /** @brief calculate an icaltimespan given a start and end time. */
 struct icaltime_span icaltime_span_new(struct icaltimetype dtstart,
 				       struct icaltimetype dtend,
@@ -41,6 +41,8 @@
 #include "icalparser.h"
 #include "icaltimezone.h"
 #include "icaltimezoneimpl.h"
+#include "icaltzdb.h"
+#include "icalarena.h"
 #ifndef NO_ZONES_TAB
 #include "icaltz-util.h"
 #endif
@@ -68,6 +70,46 @@
 #define strcasecmp      stricmp
 #endif
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/* Builtin timezones are loaded, and the changes of timezones expanded,
+   under a lock, then published with a release store. Readers check for
+   them with an acquire load, so they see them complete without locking. */
+#if defined(HAVE_PTHREAD)
+static pthread_mutex_t changes_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define ICALTIMEZONE_LOCK()		pthread_mutex_lock (&changes_mutex)
+#define ICALTIMEZONE_UNLOCK()		pthread_mutex_unlock (&changes_mutex)
+#elif defined(WIN32)
+static volatile LONG changes_lock = 0;
+#define ICALTIMEZONE_LOCK()		\
+    while (InterlockedCompareExchange (&changes_lock, 1, 0) != 0) Sleep (0)
+#define ICALTIMEZONE_UNLOCK()		InterlockedExchange (&changes_lock, 0)
+#else
+#define ICALTIMEZONE_LOCK()
+#define ICALTIMEZONE_UNLOCK()
+#endif
+
+#if defined(__GNUC__)
+#define ICALTIMEZONE_LOAD(type, p)	__atomic_load_n (&(p), __ATOMIC_ACQUIRE)
+#define ICALTIMEZONE_PUBLISH(p, v)	__atomic_store_n (&(p), (v), __ATOMIC_RELEASE)
+#define ICALTIMEZONE_LOAD_HINT(p)	__atomic_load_n (&(p), __ATOMIC_RELAXED)
+#define ICALTIMEZONE_STORE_HINT(p, v)	__atomic_store_n (&(p), (v), __ATOMIC_RELAXED)
+#elif defined(WIN32)
+#define ICALTIMEZONE_LOAD(type, p)	\
+    ((type) InterlockedCompareExchangePointer ((PVOID volatile*) &(p), NULL, NULL))
+#define ICALTIMEZONE_PUBLISH(p, v)	\
+    ((void) InterlockedExchangePointer ((PVOID volatile*) &(p), (PVOID) (v)))
+#define ICALTIMEZONE_LOAD_HINT(p)	(*(volatile int*) &(p))
+#define ICALTIMEZONE_STORE_HINT(p, v)	(*(volatile int*) &(p) = (v))
+#else
+#define ICALTIMEZONE_LOAD(type, p)	(p)
+#define ICALTIMEZONE_PUBLISH(p, v)	((p) = (v))
+#define ICALTIMEZONE_LOAD_HINT(p)	(p)
+#define ICALTIMEZONE_STORE_HINT(p, v)	((p) = (v))
+#endif
+
 /** This is the toplevel directory where the timezone data is installed in. */
 #define ZONEINFO_DIRECTORY	PACKAGE_DATA_DIR "/zoneinfo"
 
@@ -88,6 +130,11 @@ const char *ical_tzid_prefix =	"/freeassociation.sourceforge.net/";
     somewhere around 2037. */
 #define ICALTIMEZONE_MAX_YEAR		2035
 
+/** This is the largest number of days from 1970 that
+    icaltimezone_convert_times() converts, which keeps day numbers well
+    within an int. */
+#define ICALTIMEZONE_MAX_DAYS		268435456
+
 typedef struct _icaltimezonechange	icaltimezonechange;
 
 struct _icaltimezonechange {
@@ -111,19 +158,98 @@ struct _icaltimezonechange {
     /**< Whether this is STANDARD or DAYLIGHT time. */
 };
 
+typedef struct _icaltimezonetransition	icaltimezonetransition;
+
+/** A timezone change in the compact form the UTC offset lookups use. Times
+    are counted in days since 1970-01-01 and seconds into the day. */
+struct _icaltimezonetransition {
+    int		 utc_day;
+    int		 utc_second;
+    /**< The time that the change came into effect, in UTC. */
+
+    int		 local_day;
+    int		 local_second;
+    /**< The first local time that the change applies to. This is the earlier
+       of the local times before and after the change, so the hour that is
+       skipped when clocks go forward and the hour that is used twice when
+       they go back both belong to this change. */
+
+    int		 utc_offset;
+    int		 prev_utc_offset;
+    int		 is_daylight;
+};
+
+/** The changes of a timezone, expanded up to end_year. Unless they can't
+    be indexed, they are also kept as icaltimezonetransitions with an index
+    of the first change in each year, so that a lookup only has to look at
+    the few changes of one year. A table is never changed once it has been
+    set in its icaltimezone, except for the hints of the last lookups. */
+struct _icaltimezonetransitions {
+    icalarray	*changes;
+    /**< The changes, sorted by the time of the change in UTC, so we can
+       do binary-searches on them. */
+
+    int		 end_year;
+    /**< This is the last year for which we have expanded the data to. */
+
+    icaltimezonetransitions *retired;
+    /**< The table this one replaced, kept until the timezone is freed. */
+
+    int		 num_transitions;
+    icaltimezonetransition *transitions;
+    /**< The changes in compact form, or NULL if they aren't indexed. */
+
+    int		 first_year;
+    int		 num_years;
+    int		*utc_year_start;
+    int		*local_year_start;
+    /**< These have num_years + 1 elements, the index of the first change on
+       or after 1st January of first_year + n, in UTC or in local time. */
+
+    int		 last_utc;
+    int		 last_local;
+    /**< The changes found by the last lookups, which are tried first since
+       we are usually asked about times close together. These are only
+       hints and are checked before they are used. */
+};
+
+typedef struct _icaltimezonecursor	icaltimezonecursor;
+
+/** The state of looking up the UTC offsets of a run of times in one zone,
+    which starts from the change found for the previous time. */
+struct _icaltimezonecursor {
+    icaltimezone *zone;
+    /**< The zone, or NULL for UTC offsets of 0. */
+
+    int		 local;
+    /**< Whether the times are local times or UTC. */
+
+    icaltimezonetransitions *transitions;
+    int		 end_day;
+    /**< The changes of the zone and the first day they don't cover. */
+
+    int		 index;
+    /**< The last change at or before the previous time, -1 if that was
+       before all the changes or -2 if we haven't looked one up yet. */
+};
+
 
 /** An array of icaltimezones for the builtin timezones. */
 static icalarray *s_builtin_timezones = NULL;
 
 /** This is the special UTC timezone, which isn't in s_builtin_timezones. */
-static icaltimezone utc_timezone = { (char *) "UTC", NULL, NULL, 0.0, 0.0, NULL, NULL, 0, NULL };
+static icaltimezone utc_timezone = { (char *) "UTC", NULL, NULL, 0.0, 0.0, NULL, NULL, NULL };
 
 static char* zone_files_directory = NULL;
 
+/** The compiled timezone database the builtin timezones come from, if
+    icaltimezone_set_builtin_database() was called. */
+static icaltzdb *s_builtin_database = NULL;
+
 static void  icaltimezone_reset			(icaltimezone *zone);
 static char* icaltimezone_get_location_from_vtimezone (icalcomponent *component);
 static char* icaltimezone_get_tznames_from_vtimezone (icalcomponent *component);
-static void  icaltimezone_expand_changes	(icaltimezone	*zone,
+static icaltimezonetransitions* icaltimezone_expand_changes (icaltimezone *zone,
 						 int		 end_year);
 static void  icaltimezone_expand_vtimezone	(icalcomponent	*comp,
 						 int		 end_year,
@@ -131,7 +257,7 @@ static void  icaltimezone_expand_vtimezone	(icalcomponent	*comp,
 static int   icaltimezone_compare_change_fn	(const void	*elem1,
 						 const void	*elem2);
 
-static int   icaltimezone_find_nearby_change	(icaltimezone *zone,
+static int   icaltimezone_find_nearby_change	(icalarray *changes,
 						 icaltimezonechange *change);
 
 static void  icaltimezone_adjust_change		(icaltimezonechange *tt,
@@ -140,6 +266,41 @@ static void  icaltimezone_adjust_change		(icaltimezonechange *tt,
 						 int		 minutes,
 						 int		 seconds);
 
+static icaltimezonetransitions* icaltimezone_new_transitions (icalarray *changes,
+						 int		 end_year);
+
+static void  icaltimezone_free_transitions	(icaltimezonetransitions *transitions);
+
+static void  icaltimezone_add_seconds		(int		*day,
+						 int		*second,
+						 int		 seconds);
+
+static int   icaltimezone_compare_transition	(const icaltimezonetransition *transition,
+						 int		 local,
+						 int		 day,
+						 int		 second);
+
+static int   icaltimezone_find_transition	(icaltimezonetransitions *transitions,
+						 int		 local,
+						 int		 year,
+						 int		 day,
+						 int		 second);
+
+static int   icaltimezone_get_indexed_utc_offset (icaltimezonetransitions *transitions,
+						 struct icaltimetype *tt,
+						 int		 local,
+						 int		*utc_offset,
+						 int		*is_daylight);
+
+static void  icaltimezone_init_cursor		(icaltimezonecursor *cursor,
+						 icaltimezone	*zone,
+						 int		 local);
+
+static int   icaltimezone_get_cursor_utc_offset	(icaltimezonecursor *cursor,
+						 int		 day,
+						 int		 second,
+						 int		*utc_offset);
+
 static void  icaltimezone_init			(icaltimezone *zone);
 
 /** Gets the TZID, LOCATION/X-LIC-LOCATION, and TZNAME properties from the
@@ -151,12 +312,17 @@ static int   icaltimezone_get_vtimezone_properties (icaltimezone *zone,
 
 static void  icaltimezone_load_builtin_timezone	(icaltimezone *zone);
 
-static void  icaltimezone_ensure_coverage	(icaltimezone *zone,
+static icaltimezonetransitions* icaltimezone_ensure_coverage (icaltimezone *zone,
 						 int		 end_year);
 
 
 static void  icaltimezone_parse_zone_tab	(void);
 
+static void  icaltimezone_parse_database_index	(void);
+static void  icaltimezone_load_from_database	(icaltimezone *zone);
+
+static void  icaltimezone_load_builtin_timezone_locked (icaltimezone *zone);
+
 #ifdef USE_BUILTIN_TZDATA
 static char* icaltimezone_load_get_line_fn	(char		*s,
 						 size_t		 size,
@@ -188,6 +354,8 @@ icaltimezone *
 icaltimezone_copy			(icaltimezone *originalzone)
 {
     icaltimezone *zone;
+    icaltimezonetransitions *transitions;
+    icalarray *changes;
 
     zone = (icaltimezone*) malloc (sizeof (icaltimezone));
     if (!zone) {
@@ -202,8 +370,15 @@ icaltimezone_copy			(icaltimezone *originalzone)
 	zone->location = strdup (zone->location);
     if (zone->tznames != NULL)
 	zone->tznames = strdup (zone->tznames);
-    if (zone->changes != NULL)
-        zone->changes = icalarray_copy(zone->changes);
+    transitions = ICALTIMEZONE_LOAD (icaltimezonetransitions*,
+				     originalzone->transitions);
+    zone->transitions = NULL;
+    if (transitions != NULL) {
+        changes = icalarray_copy(transitions->changes);
+        if (changes != NULL)
+            zone->transitions = icaltimezone_new_transitions (changes,
+							      transitions->end_year);
+    }
     
     /* Let the caller set the component because then they will
        know to be careful not to free this reference twice. */
@@ -235,8 +410,8 @@ icaltimezone_reset			(icaltimezone *zone)
 		free (zone->tznames);
     if (zone->component)
 		icalcomponent_free (zone->component);
-    if (zone->changes)
-		icalarray_free (zone->changes);
+    if (zone->transitions)
+		icaltimezone_free_transitions (zone->transitions);
 	
     icaltimezone_init (zone);
 }
@@ -253,8 +428,7 @@ icaltimezone_init			(icaltimezone	*zone)
     zone->longitude = 0.0;
     zone->component = NULL;
     zone->builtin_timezone = NULL;
-    zone->end_year = 0;
-    zone->changes = NULL;
+    zone->transitions = NULL;
 }
 
 
@@ -286,12 +460,16 @@ icaltimezone_get_vtimezone_properties	(icaltimezone *zone,
     } else
 	zone->tznames = NULL;
     
-    zone->tzid = strdup (tzid);
-    zone->component = component;
-	if ( zone->location != 0 ) free ( zone->location );
-    zone->location = icaltimezone_get_location_from_vtimezone (component);
+    ICALTIMEZONE_PUBLISH (zone->tzid, strdup (tzid));
+    /* A builtin timezone keeps the location it is looked up by, which
+       other threads may be reading. */
+    if (!zone->location)
+	zone->location = icaltimezone_get_location_from_vtimezone (component);
     zone->tznames = icaltimezone_get_tznames_from_vtimezone (component);
 
+    /* This is set last, as it tells other threads the zone is loaded. */
+    ICALTIMEZONE_PUBLISH (zone->component, component);
+
     return 1;
 }
 
@@ -442,7 +620,9 @@ icaltimezone_get_tznames_from_vtimezone (icalcomponent *component)
 }
 
 
-static void
+/** Returns the changes of the zone, expanded at least up to end_year, or
+   NULL if they can't be expanded. */
+static icaltimezonetransitions*
 icaltimezone_ensure_coverage		(icaltimezone *zone,
 					 int		 end_year)
 {
@@ -450,31 +630,55 @@ icaltimezone_ensure_coverage		(icaltimezone *zone,
        year, plus ICALTIMEZONE_EXTRA_COVERAGE. */
     static int icaltimezone_minimum_expansion_year = -1;
 
+    icaltimezonetransitions *transitions, *expanded;
     int changes_end_year;
 
-    if (!zone->component)
+    if (!ICALTIMEZONE_LOAD (icalcomponent*, zone->component))
 	icaltimezone_load_builtin_timezone (zone);
 
-    if (icaltimezone_minimum_expansion_year == -1) {
-	struct icaltimetype today = icaltime_today();
-	icaltimezone_minimum_expansion_year = today.year;
-    }
+    /* We never expand past ICALTIMEZONE_MAX_YEAR, so there is no point in
+       expanding again for a later year. */
+    if (end_year > ICALTIMEZONE_MAX_YEAR)
+	end_year = ICALTIMEZONE_MAX_YEAR;
+
+    transitions = ICALTIMEZONE_LOAD (icaltimezonetransitions*,
+				     zone->transitions);
+    if (transitions && transitions->end_year >= end_year)
+	return transitions;
+
+    /* Another thread may have expanded the changes while we waited. */
+    ICALTIMEZONE_LOCK ();
+    transitions = zone->transitions;
+    if (!transitions || transitions->end_year < end_year) {
+	if (icaltimezone_minimum_expansion_year == -1) {
+	    struct icaltimetype today = icaltime_today();
+	    icaltimezone_minimum_expansion_year = today.year;
+	}
 
-    changes_end_year = end_year;
-    if (changes_end_year < icaltimezone_minimum_expansion_year)
-	changes_end_year = icaltimezone_minimum_expansion_year;
+	changes_end_year = end_year;
+	if (changes_end_year < icaltimezone_minimum_expansion_year)
+	    changes_end_year = icaltimezone_minimum_expansion_year;
 
-    changes_end_year += ICALTIMEZONE_EXTRA_COVERAGE;
+	changes_end_year += ICALTIMEZONE_EXTRA_COVERAGE;
 
-    if (changes_end_year > ICALTIMEZONE_MAX_YEAR)
-	changes_end_year = ICALTIMEZONE_MAX_YEAR;
+	if (changes_end_year > ICALTIMEZONE_MAX_YEAR)
+	    changes_end_year = ICALTIMEZONE_MAX_YEAR;
 
-    if (!zone->changes || zone->end_year < end_year)
-	icaltimezone_expand_changes (zone, changes_end_year);
+	expanded = icaltimezone_expand_changes (zone, changes_end_year);
+	if (expanded) {
+	    expanded->retired = transitions;
+	    ICALTIMEZONE_PUBLISH (zone->transitions, expanded);
+	    transitions = expanded;
+	}
+    }
+    ICALTIMEZONE_UNLOCK ();
+
+    return transitions;
 }
 
 
-static void
+/** Expands the changes of the zone up to end_year into a new table. */
+static icaltimezonetransitions*
 icaltimezone_expand_changes		(icaltimezone *zone,
 					 int		 end_year)
 {
@@ -487,7 +691,7 @@ icaltimezone_expand_changes		(icaltimezone *zone,
 
     changes = icalarray_new (sizeof (icaltimezonechange), 32);
     if (!changes)
-	return;
+	return NULL;
 
     /* Scan the STANDARD and DAYLIGHT subcomponents. */
     comp = icalcomponent_get_first_component (zone->component,
@@ -502,11 +706,7 @@ icaltimezone_expand_changes		(icaltimezone *zone,
        matter. */
     icalarray_sort (changes, icaltimezone_compare_change_fn);
 
-    if (zone->changes)
-	icalarray_free (zone->changes);
-
-    zone->changes = changes;
-    zone->end_year = end_year;
+    return icaltimezone_new_transitions (changes, end_year);
 }
 
 
@@ -768,6 +968,201 @@ icaltimezone_convert_time		(struct icaltimetype *tt,
 }
 
 
+void
+icaltimezone_convert_times		(icaltimezone *from_zone,
+					 icaltimezone *to_zone,
+					 const int64_t *times,
+					 int64_t *results,
+					 size_t count)
+{
+    icaltimezonecursor from_cursor, to_cursor;
+    struct icaltimetype tt;
+    int64_t time, days;
+    int day, second, utc_offset;
+    size_t i;
+
+    icalerror_check_arg_rv ((times != 0 || count == 0), "times");
+    icalerror_check_arg_rv ((results != 0 || count == 0), "results");
+
+    /* If both timezones are the same, or we are converting floating times,
+       we don't need to do anything. */
+    if (from_zone == to_zone || from_zone == NULL) {
+	if (results != times && count > 0)
+	    memmove (results, times, count * sizeof (int64_t));
+	return;
+    }
+
+    icaltimezone_init_cursor (&from_cursor, from_zone, 1);
+    icaltimezone_init_cursor (&to_cursor, to_zone, 0);
+
+    for (i = 0; i < count; i++) {
+	/* Split the time into days and seconds in the day, rounding down for
+	   times before 1970. */
+	time = times[i];
+	days = time / 86400;
+	if (time % 86400 < 0)
+	    days--;
+
+	if (days < -ICALTIMEZONE_MAX_DAYS || days > ICALTIMEZONE_MAX_DAYS) {
+	    icalerror_set_errno (ICAL_BADARG_ERROR);
+	    results[i] = time;
+	    continue;
+	}
+
+	day = (int) days;
+	second = (int) (time - days * 86400);
+
+	/* Convert the time to UTC and then to the new timezone, as
+	   icaltimezone_convert_time() does, using the indexes of the
+	   changes. */
+	if (icaltimezone_get_cursor_utc_offset (&from_cursor, day, second,
+						&utc_offset)) {
+	    icaltimezone_add_seconds (&day, &second, -utc_offset);
+	    if (icaltimezone_get_cursor_utc_offset (&to_cursor, day, second,
+						    &utc_offset)) {
+		results[i] = (int64_t) day * 86400 + second + utc_offset;
+		continue;
+	    }
+	}
+
+	/* The changes of one of the zones have to be searched. */
+	tt = icaltime_null_time ();
+	icaltime_civil_from_days ((int) days, &tt.year, &tt.month, &tt.day);
+	second = (int) (time - days * 86400);
+	tt.hour = second / 3600;
+	tt.minute = second / 60 % 60;
+	tt.second = second % 60;
+
+	icaltimezone_convert_time (&tt, from_zone, to_zone);
+
+	results[i] = (int64_t) icaltime_days_from_civil (tt.year, tt.month,
+							 tt.day) * 86400
+	    + tt.hour * 3600 + tt.minute * 60 + tt.second;
+    }
+}
+
+
+/** Sets up a cursor for looking up the UTC offsets of local times (if
+   local is 1) or of UTC times in a zone. */
+static void
+icaltimezone_init_cursor		(icaltimezonecursor *cursor,
+					 icaltimezone	*zone,
+					 int		 local)
+{
+    /* Use the builtin icaltimezone if possible. */
+    if (zone == &utc_timezone)
+	zone = NULL;
+    else if (zone && zone->builtin_timezone)
+	zone = zone->builtin_timezone;
+
+    cursor->zone = zone;
+    cursor->local = local;
+    cursor->transitions = NULL;
+    cursor->end_day = 0;
+    cursor->index = -2;
+}
+
+
+/** Gets the UTC offset of a time, given as a day number and the seconds
+   into the day, as icaltimezone_get_indexed_utc_offset() does for a time
+   with is_daylight 0. The changes are looked at from the one found for the
+   previous time, so that times in order only step forward through them.
+   It returns 0 if the changes of the zone aren't indexed, in which case
+   the caller has to search them. */
+static int
+icaltimezone_get_cursor_utc_offset	(icaltimezonecursor *cursor,
+					 int		 day,
+					 int		 second,
+					 int		*utc_offset)
+{
+    icaltimezonetransitions *transitions;
+    icaltimezonetransition *transition, *prev_transition;
+    int year, month, mday, have_year, index, steps, end_day, end_second;
+
+    *utc_offset = 0;
+
+    /* For UTC, and floating times converted to it, the offset is 0. */
+    if (!cursor->zone)
+	return 1;
+
+    /* Make sure the changes are expanded up to the given time. */
+    have_year = 0;
+    if (!cursor->transitions || day >= cursor->end_day) {
+	icaltime_civil_from_days (day, &year, &month, &mday);
+	have_year = 1;
+	transitions = icaltimezone_ensure_coverage (cursor->zone, year);
+	if (transitions != cursor->transitions) {
+	    cursor->transitions = transitions;
+	    cursor->index = -2;
+	    if (transitions)
+		cursor->end_day =
+		    icaltime_days_from_civil (transitions->end_year + 1, 1, 1);
+	}
+    }
+
+    transitions = cursor->transitions;
+    if (!transitions || transitions->changes->num_elements == 0)
+	return 1;
+    if (!transitions->transitions)
+	return 0;
+
+    /* Step forward from the change found last time, unless the time is
+       before it or far after it. */
+    index = cursor->index;
+    if (index >= -1
+	&& (index < 0
+	    || icaltimezone_compare_transition (&transitions->transitions[index],
+						cursor->local, day, second) >= 0)) {
+	steps = 0;
+	while (index + 1 < transitions->num_transitions
+	       && steps < 4
+	       && icaltimezone_compare_transition (&transitions->transitions[index + 1],
+						   cursor->local, day,
+						   second) >= 0) {
+	    index++;
+	    steps++;
+	}
+	if (steps == 4)
+	    index = -2;
+    } else {
+	index = -2;
+    }
+
+    if (index == -2) {
+	if (!have_year)
+	    icaltime_civil_from_days (day, &year, &month, &mday);
+	index = icaltimezone_find_transition (transitions, cursor->local, year,
+					      day, second);
+    }
+    cursor->index = index;
+
+    /* If the time is before the first change we have no data for it, so we
+       use a UTC offset of 0. */
+    if (index < 0)
+	return 1;
+    transition = &transitions->transitions[index];
+
+    /* If the clocks went back, a local time may be in the region of time
+       that is used twice, and then we use standard time. */
+    if (cursor->local && transition->utc_offset < transition->prev_utc_offset
+	&& index > 0) {
+	end_day = transition->utc_day;
+	end_second = transition->utc_second;
+	icaltimezone_add_seconds (&end_day, &end_second,
+				  transition->prev_utc_offset);
+
+	if (day < end_day || (day == end_day && second < end_second)) {
+	    prev_transition = transition - 1;
+	    if (transition->is_daylight && !prev_transition->is_daylight)
+		transition = prev_transition;
+	}
+    }
+
+    *utc_offset = transition->utc_offset;
+    return 1;
+}
+
+
 
 
 /** @deprecated This API wasn't updated when we changed icaltimetype to contain its own
@@ -785,6 +1180,9 @@ icaltimezone_get_utc_offset		(icaltimezone	*zone,
     int change_num, step, utc_offset_change, cmp;
     int change_num_to_use;
     int want_daylight;
+    int utc_offset;
+    icaltimezonetransitions *transitions;
+    icalarray *changes;
 
     if (tt == NULL)
 	return 0;
@@ -801,11 +1199,19 @@ icaltimezone_get_utc_offset		(icaltimezone	*zone,
 	zone = zone->builtin_timezone;
 
     /* Make sure the changes array is expanded up to the given time. */
-    icaltimezone_ensure_coverage (zone, tt->year);
+    transitions = icaltimezone_ensure_coverage (zone, tt->year);
+    if (!transitions)
+	return 0;
 
-    if (!zone->changes || zone->changes->num_elements == 0)
+    changes = transitions->changes;
+    if (changes->num_elements == 0)
 	return 0;
 
+    /* Most lookups are answered by the index of the changes. */
+    if (icaltimezone_get_indexed_utc_offset (transitions, tt, 1, &utc_offset,
+					     is_daylight))
+	return utc_offset;
+
     /* Copy the time parts of the icaltimetype to an icaltimezonechange so we
        can use our comparison function on it. */
     tt_change.year   = tt->year;
@@ -817,17 +1223,17 @@ icaltimezone_get_utc_offset		(icaltimezone	*zone,
 
     /* This should find a change close to the time, either the change before
        it or the change after it. */
-    change_num = icaltimezone_find_nearby_change (zone, &tt_change);
+    change_num = icaltimezone_find_nearby_change (changes, &tt_change);
 
     /* Sanity check. */
     icalerror_assert (change_num >= 0,
 		      "Negative timezone change index");
-    icalerror_assert (change_num < zone->changes->num_elements,
+    icalerror_assert (change_num < changes->num_elements,
 		      "Timezone change index out of bounds");
 
     /* Now move backwards or forwards to find the timezone change that applies
        to tt. It should only have to do 1 or 2 steps. */
-    zone_change = icalarray_element_at (zone->changes, change_num);
+    zone_change = icalarray_element_at (changes, change_num);
     step = 1;
     change_num_to_use = -1;
     for (;;) {
@@ -873,10 +1279,10 @@ icaltimezone_get_utc_offset		(icaltimezone	*zone,
 	if (change_num < 0)
 	    return 0;
 
-	if ((unsigned int)change_num >= zone->changes->num_elements)
+	if ((unsigned int)change_num >= changes->num_elements)
 	    break;
 
-	zone_change = icalarray_element_at (zone->changes, change_num);
+	zone_change = icalarray_element_at (changes, change_num);
     }
 
     /* If we didn't find a change to use, then we have a bug! */
@@ -885,7 +1291,7 @@ icaltimezone_get_utc_offset		(icaltimezone	*zone,
 
     /* Now we just need to check if the time is in the overlapped region of
        time when clocks go back. */
-    zone_change = icalarray_element_at (zone->changes, change_num_to_use);
+    zone_change = icalarray_element_at (changes, change_num_to_use);
 
     utc_offset_change = zone_change->utc_offset - zone_change->prev_utc_offset;
     if (utc_offset_change < 0 && change_num_to_use > 0) {
@@ -898,7 +1304,7 @@ icaltimezone_get_utc_offset		(icaltimezone	*zone,
 	       either the current zone_change or the previous one. If the
 	       time has the is_daylight field set we use the matching change,
 	       else we use the change with standard time. */
-	    prev_zone_change = icalarray_element_at (zone->changes,
+	    prev_zone_change = icalarray_element_at (changes,
 						     change_num_to_use - 1);
 
 	    /* I was going to add an is_daylight flag to struct icaltimetype,
@@ -939,6 +1345,9 @@ icaltimezone_get_utc_offset_of_utc_time	(icaltimezone	*zone,
 {
     icaltimezonechange *zone_change, tt_change, tmp_change;
     int change_num, step, change_num_to_use;
+    int utc_offset;
+    icaltimezonetransitions *transitions;
+    icalarray *changes;
 
     if (is_daylight)
 	*is_daylight = 0;
@@ -952,11 +1361,19 @@ icaltimezone_get_utc_offset_of_utc_time	(icaltimezone	*zone,
 	zone = zone->builtin_timezone;
 
     /* Make sure the changes array is expanded up to the given time. */
-    icaltimezone_ensure_coverage (zone, tt->year);
+    transitions = icaltimezone_ensure_coverage (zone, tt->year);
+    if (!transitions)
+	return 0;
 
-    if (!zone->changes || zone->changes->num_elements == 0)
+    changes = transitions->changes;
+    if (changes->num_elements == 0)
 	return 0;
 
+    /* Most lookups are answered by the index of the changes. */
+    if (icaltimezone_get_indexed_utc_offset (transitions, tt, 0, &utc_offset,
+					     is_daylight))
+	return utc_offset;
+
     /* Copy the time parts of the icaltimetype to an icaltimezonechange so we
        can use our comparison function on it. */
     tt_change.year   = tt->year;
@@ -968,17 +1385,17 @@ icaltimezone_get_utc_offset_of_utc_time	(icaltimezone	*zone,
 
     /* This should find a change close to the time, either the change before
        it or the change after it. */
-    change_num = icaltimezone_find_nearby_change (zone, &tt_change);
+    change_num = icaltimezone_find_nearby_change (changes, &tt_change);
 
     /* Sanity check. */
     icalerror_assert (change_num >= 0,
 		      "Negative timezone change index");
-    icalerror_assert (change_num < zone->changes->num_elements,
+    icalerror_assert (change_num < changes->num_elements,
 		      "Timezone change index out of bounds");
 
     /* Now move backwards or forwards to find the timezone change that applies
        to tt. It should only have to do 1 or 2 steps. */
-    zone_change = icalarray_element_at (zone->changes, change_num);
+    zone_change = icalarray_element_at (changes, change_num);
     step = 1;
     change_num_to_use = -1;
     for (;;) {
@@ -1008,10 +1425,10 @@ icaltimezone_get_utc_offset_of_utc_time	(icaltimezone	*zone,
 	if (change_num < 0)
 	    return 0;
 
-	if ((unsigned int)change_num >= zone->changes->num_elements)
+	if ((unsigned int)change_num >= changes->num_elements)
 	    break;
 
-	zone_change = icalarray_element_at (zone->changes, change_num);
+	zone_change = icalarray_element_at (changes, change_num);
     }
 
     /* If we didn't find a change to use, then we have a bug! */
@@ -1020,7 +1437,7 @@ icaltimezone_get_utc_offset_of_utc_time	(icaltimezone	*zone,
 
     /* Now we know exactly which timezone change applies to the time, so
        we can return the UTC offset and whether it is a daylight time. */
-    zone_change = icalarray_element_at (zone->changes, change_num_to_use);
+    zone_change = icalarray_element_at (changes, change_num_to_use);
     if (is_daylight)
 	*is_daylight = zone_change->is_daylight;
 
@@ -1031,7 +1448,7 @@ icaltimezone_get_utc_offset_of_utc_time	(icaltimezone	*zone,
 /** Returns the index of a timezone change which is close to the time
    given in change. */
 static int
-icaltimezone_find_nearby_change		(icaltimezone	*zone,
+icaltimezone_find_nearby_change		(icalarray	*changes,
 					 icaltimezonechange	*change)
 {
     icaltimezonechange *zone_change;
@@ -1039,11 +1456,11 @@ icaltimezone_find_nearby_change		(icaltimezone	*zone,
 					 
     /* Do a simple binary search. */
     lower = middle = 0;
-    upper = zone->changes->num_elements;
+    upper = changes->num_elements;
 
     while (lower < upper) {
 	middle = (lower + upper) / 2;
-	zone_change = icalarray_element_at (zone->changes, middle);
+	zone_change = icalarray_element_at (changes, middle);
 	cmp = icaltimezone_compare_change_fn (change, zone_change);
 	if (cmp == 0)
 	    break;
@@ -1132,6 +1549,315 @@ icaltimezone_adjust_change		(icaltimezonechange *tt,
 }
 
 
+/** Returns 1 if all the fields of a time are in range, so that comparing
+   day numbers and seconds gives the same order as comparing the fields. */
+static int
+icaltimezone_is_normal_time		(int		 year,
+					 int		 month,
+					 int		 day,
+					 int		 hour,
+					 int		 minute,
+					 int		 second)
+{
+    /* icaltime_days_in_month() has the leap years of the Julian calendar
+       up to 1752, but day numbers are those of the Gregorian calendar. */
+    if (month == 2 && day == 29
+	&& !(year % 4 == 0 && (year % 100 != 0 || year % 400 == 0)))
+	return 0;
+
+    return month >= 1 && month <= 12
+	&& day >= 1 && day <= icaltime_days_in_month (month, year)
+	&& hour >= 0 && hour < 24
+	&& minute >= 0 && minute < 60
+	&& second >= 0 && second < 60;
+}
+
+
+/** Adds (or subtracts) seconds to a time given as a day number and the
+   seconds into the day. */
+static void
+icaltimezone_add_seconds		(int		*day,
+					 int		*second,
+					 int		 seconds)
+{
+    int days;
+
+    *second += seconds;
+    days = *second / 86400;
+    *second %= 86400;
+    if (*second < 0) {
+	*second += 86400;
+	days--;
+    }
+    *day += days;
+}
+
+
+/** Returns -1, 0 or 1 as a time, given as a day number and the seconds
+   into the day, is before, at or after the UTC or local time of a change. */
+static int
+icaltimezone_compare_transition		(const icaltimezonetransition *transition,
+					 int		 local,
+					 int		 day,
+					 int		 second)
+{
+    int transition_day, transition_second;
+
+    if (local) {
+	transition_day = transition->local_day;
+	transition_second = transition->local_second;
+    } else {
+	transition_day = transition->utc_day;
+	transition_second = transition->utc_second;
+    }
+
+    if (day != transition_day)
+	return day < transition_day ? -1 : 1;
+    if (second != transition_second)
+	return second < transition_second ? -1 : 1;
+    return 0;
+}
+
+
+/** Creates the table of a zone's changes, taking ownership of the sorted
+   array of changes. The changes are also indexed, unless they aren't
+   normalized or their local times aren't in order, in which case they
+   have to be searched. It returns NULL, and frees the changes, if it runs
+   out of memory. */
+static icaltimezonetransitions*
+icaltimezone_new_transitions		(icalarray	*changes,
+					 int		 end_year)
+{
+    icaltimezonetransitions *transitions;
+    icaltimezonetransition *transition;
+    icaltimezonechange *change;
+    int num_transitions, first_year, num_years;
+    int i, year, year_day, utc_index, local_index;
+
+    /* Leave a spare year at either end, since the local time of a change
+       may be in a different year to its UTC time. */
+    num_transitions = changes->num_elements;
+    if (num_transitions > 0) {
+	change = icalarray_element_at (changes, 0);
+	first_year = change->year - 1;
+	change = icalarray_element_at (changes, num_transitions - 1);
+	num_years = change->year + 2 - first_year;
+    } else {
+	first_year = num_years = 0;
+    }
+
+    /* The transitions and the year indexes follow the struct. */
+    transitions = (icaltimezonetransitions*)
+	malloc (sizeof (icaltimezonetransitions)
+		+ num_transitions * sizeof (icaltimezonetransition)
+		+ 2 * (num_years + 1) * sizeof (int));
+    if (!transitions) {
+	icalerror_set_errno (ICAL_NEWFAILED_ERROR);
+	icalarray_free (changes);
+	return NULL;
+    }
+
+    transitions->changes = changes;
+    transitions->end_year = end_year;
+    transitions->retired = NULL;
+    transitions->num_transitions = num_transitions;
+    transitions->transitions = (icaltimezonetransition*) (transitions + 1);
+    transitions->first_year = first_year;
+    transitions->num_years = num_years;
+    transitions->utc_year_start =
+	(int*) (transitions->transitions + num_transitions);
+    transitions->local_year_start =
+	transitions->utc_year_start + num_years + 1;
+    transitions->last_utc = -1;
+    transitions->last_local = -1;
+
+    if (num_transitions == 0) {
+	transitions->transitions = NULL;
+	return transitions;
+    }
+
+    for (i = 0; i < num_transitions; i++) {
+	change = icalarray_element_at (changes, i);
+	if (!icaltimezone_is_normal_time (change->year, change->month,
+					  change->day, change->hour,
+					  change->minute, change->second)) {
+	    transitions->transitions = NULL;
+	    return transitions;
+	}
+
+	transition = &transitions->transitions[i];
+	transition->utc_day = icaltime_days_from_civil (change->year,
+							    change->month,
+							    change->day);
+	transition->utc_second = change->hour * 3600 + change->minute * 60
+	    + change->second;
+	transition->local_day = transition->utc_day;
+	transition->local_second = transition->utc_second;
+	icaltimezone_add_seconds (&transition->local_day,
+				  &transition->local_second,
+				  change->utc_offset < change->prev_utc_offset
+				  ? change->utc_offset
+				  : change->prev_utc_offset);
+	transition->utc_offset = change->utc_offset;
+	transition->prev_utc_offset = change->prev_utc_offset;
+	transition->is_daylight = change->is_daylight;
+
+	/* For changes too close together for their local times to be in
+	   order, what the search finds depends on where it starts, so we
+	   leave those to it. */
+	if (i > 0
+	    && (icaltimezone_compare_transition (transition - 1, 0,
+						 transition->utc_day,
+						 transition->utc_second) < 0
+		|| icaltimezone_compare_transition (transition - 1, 1,
+						    transition->local_day,
+						    transition->local_second) < 0)) {
+	    transitions->transitions = NULL;
+	    return transitions;
+	}
+    }
+
+    utc_index = local_index = 0;
+    for (year = 0; year <= num_years; year++) {
+	year_day = icaltime_days_from_civil (first_year + year, 1, 1);
+	while (utc_index < num_transitions
+	       && transitions->transitions[utc_index].utc_day < year_day)
+	    utc_index++;
+	while (local_index < num_transitions
+	       && transitions->transitions[local_index].local_day < year_day)
+	    local_index++;
+	transitions->utc_year_start[year] = utc_index;
+	transitions->local_year_start[year] = local_index;
+    }
+
+    return transitions;
+}
+
+
+/** Frees a table of changes and the tables it replaced. */
+static void
+icaltimezone_free_transitions		(icaltimezonetransitions *transitions)
+{
+    icaltimezonetransitions *retired;
+
+    while (transitions) {
+	retired = transitions->retired;
+	icalarray_free (transitions->changes);
+	free (transitions);
+	transitions = retired;
+    }
+}
+
+
+/** Returns the index of the last change at or before a time, given in
+   local time or UTC as a day number and the seconds into the day, or -1 if
+   the time is before all the changes. */
+static int
+icaltimezone_find_transition		(icaltimezonetransitions *transitions,
+					 int		 local,
+					 int		 year,
+					 int		 day,
+					 int		 second)
+{
+    int *year_start, *last;
+    int index, end;
+
+    year_start = local ? transitions->local_year_start
+	: transitions->utc_year_start;
+    last = local ? &transitions->last_local : &transitions->last_utc;
+
+    /* Try the change we found last time first. */
+    index = ICALTIMEZONE_LOAD_HINT (*last);
+    if (index >= 0 && index < transitions->num_transitions
+	&& icaltimezone_compare_transition (&transitions->transitions[index],
+					    local, day, second) >= 0
+	&& (index + 1 == transitions->num_transitions
+	    || icaltimezone_compare_transition (&transitions->transitions[index + 1],
+						local, day, second) < 0))
+	return index;
+
+    if (year < transitions->first_year)
+	return -1;
+
+    /* The change we want is the last one before the year starts or one of
+       the changes in the year. */
+    if (year - transitions->first_year >= transitions->num_years) {
+	index = end = transitions->num_transitions;
+    } else {
+	index = year_start[year - transitions->first_year];
+	end = year_start[year - transitions->first_year + 1];
+    }
+    while (index < end
+	   && icaltimezone_compare_transition (&transitions->transitions[index],
+					       local, day, second) >= 0)
+	index++;
+    index--;
+
+    if (index >= 0)
+	ICALTIMEZONE_STORE_HINT (*last, index);
+    return index;
+}
+
+
+/** Gets the UTC offset of a local time (if local is 1) or of a UTC time
+   from the index of a timezone's changes. It returns 0 if the changes
+   aren't indexed or the time isn't normalized, in which case the caller has to
+   search the changes. The result is the same as that search gives. */
+static int
+icaltimezone_get_indexed_utc_offset	(icaltimezonetransitions *transitions,
+					 struct icaltimetype *tt,
+					 int		 local,
+					 int		*utc_offset,
+					 int		*is_daylight)
+{
+    icaltimezonetransition *transition, *prev_transition;
+    int day, second, end_day, end_second, index, want_daylight;
+
+    if (!transitions->transitions
+	|| !icaltimezone_is_normal_time (tt->year, tt->month, tt->day,
+					 tt->hour, tt->minute, tt->second))
+	return 0;
+
+    day = icaltime_days_from_civil (tt->year, tt->month, tt->day);
+    second = tt->hour * 3600 + tt->minute * 60 + tt->second;
+
+    /* If the time is before the first change we have no data for it, so we
+       use a UTC offset of 0. */
+    index = icaltimezone_find_transition (transitions, local, tt->year,
+					  day, second);
+    if (index < 0) {
+	*utc_offset = 0;
+	return 1;
+    }
+    transition = &transitions->transitions[index];
+
+    /* If the clocks went back, a local time may be in the region of time
+       that is used twice. If it is, use the change with the daylight
+       setting which matches tt, or use standard if we don't know. */
+    if (local && transition->utc_offset < transition->prev_utc_offset
+	&& index > 0) {
+	end_day = transition->utc_day;
+	end_second = transition->utc_second;
+	icaltimezone_add_seconds (&end_day, &end_second,
+				  transition->prev_utc_offset);
+
+	if (day < end_day || (day == end_day && second < end_second)) {
+	    prev_transition = transition - 1;
+	    want_daylight = (tt->is_daylight == 1) ? 1 : 0;
+
+	    if (transition->is_daylight != want_daylight
+		&& prev_transition->is_daylight == want_daylight)
+		transition = prev_transition;
+	}
+    }
+
+    if (is_daylight)
+	*is_daylight = transition->is_daylight;
+    *utc_offset = transition->utc_offset;
+    return 1;
+}
+
+
 const char*
 icaltimezone_get_tzid			(icaltimezone *zone)
 {
@@ -1139,10 +1865,10 @@ icaltimezone_get_tzid			(icaltimezone *zone)
     if (!zone)
 	return NULL;
 
-    if (!zone->tzid)
+    if (!ICALTIMEZONE_LOAD (char*, zone->tzid))
 	icaltimezone_load_builtin_timezone (zone);
 
-    return zone->tzid;
+    return ICALTIMEZONE_LOAD (char*, zone->tzid);
 }
 
 
@@ -1166,7 +1892,7 @@ icaltimezone_get_tznames		(icaltimezone *zone)
     if (!zone)
 	return NULL;
 
-    if (!zone->component)
+    if (!ICALTIMEZONE_LOAD (icalcomponent*, zone->component))
 	icaltimezone_load_builtin_timezone (zone);
 
     return zone->tznames;
@@ -1209,10 +1935,10 @@ icaltimezone_get_component		(icaltimezone *zone)
     if (!zone)
 	return NULL;
 
-    if (!zone->component)
+    if (!ICALTIMEZONE_LOAD (icalcomponent*, zone->component))
 	icaltimezone_load_builtin_timezone (zone);
 
-    return zone->component;
+    return ICALTIMEZONE_LOAD (icalcomponent*, zone->component);
 }
 
 
@@ -1313,12 +2039,26 @@ icaltimezone_array_free			(icalarray	*timezones)
 icalarray*
 icaltimezone_get_builtin_timezones	(void)
 {
+    icalarray *builtin_timezones;
+
+    builtin_timezones = ICALTIMEZONE_LOAD (icalarray*, s_builtin_timezones);
+    if (builtin_timezones)
+	return builtin_timezones;
+
+    /* Another thread may have created the array while we waited. */
+    ICALTIMEZONE_LOCK ();
+    if (!s_builtin_timezones && s_builtin_database) {
+	icaltimezone_parse_database_index ();
+    }
 #ifndef NO_ZONES_TAB
-    if (!s_builtin_timezones) {
+    else if (!s_builtin_timezones) {
 	icaltimezone_parse_zone_tab ();
     }
 #endif
-    return s_builtin_timezones;
+    builtin_timezones = s_builtin_timezones;
+    ICALTIMEZONE_UNLOCK ();
+
+    return builtin_timezones;
 }
 
 /** Release builtin timezone memory */
@@ -1352,6 +2092,23 @@ icaltimezone_get_builtin_timezone	(const char *location)
     if (!builtin_timezones) {
 	return NULL;
     }
+
+    /* The zones of the database are in its order, which is sorted. */
+    if (s_builtin_database) {
+	int index = icaltzdb_find_zone (s_builtin_database, location);
+	if (index < 0) {
+	    int alias = icaltzdb_find_alias (s_builtin_database, location);
+	    if (alias < 0)
+		return NULL;
+	    location = icaltzdb_get_alias_target (s_builtin_database, alias);
+	    if (!strcmp (location, "UTC"))
+		return &utc_timezone;
+	    index = icaltzdb_find_zone (s_builtin_database, location);
+	    if (index < 0)
+		return NULL;
+	}
+	return icalarray_element_at (builtin_timezones, index);
+    }
     
 #if 0
     /* Do a simple binary search. */
@@ -1460,7 +2217,7 @@ icaltimezone_get_builtin_timezone_from_offset	(int offset, const char *tzname)
     for (i=0; i<count; i++) {
 	int z_offset;
 	zone = icalarray_element_at (builtin_timezones, i);
-	if (!zone->component)
+	if (!ICALTIMEZONE_LOAD (icalcomponent*, zone->component))
 	    icaltimezone_load_builtin_timezone (zone);
 	
 	z_offset = get_offset(zone);
@@ -1518,6 +2275,62 @@ icaltimezone_get_builtin_timezone_from_tzid (const char *tzid)
 }
 
 
+int
+icaltimezone_set_builtin_database	(const void *data, size_t size)
+{
+    icaltzdb *db = NULL;
+
+    if (data) {
+	db = icaltzdb_new_from_data (data, size);
+	if (!db)
+	    return 0;
+    }
+
+    icaltimezone_free_builtin_timezones ();
+    if (s_builtin_database)
+	icaltzdb_free (s_builtin_database);
+    s_builtin_database = db;
+
+    return 1;
+}
+
+
+icaltimezone*
+icaltimezone_new_from_builtin		(const char *location)
+{
+    icaltimezone *builtin, *zone;
+    icalcomponent *comp;
+
+    builtin = icaltimezone_get_builtin_timezone (location);
+    if (!builtin || builtin == &utc_timezone)
+	return NULL;
+
+    comp = icaltimezone_get_component (builtin);
+    if (!comp)
+	return NULL;
+
+    zone = icaltimezone_new ();
+    if (!zone)
+	return NULL;
+
+    comp = icalcomponent_new_clone (comp);
+    if (!comp || !icaltimezone_set_component (zone, comp)) {
+	if (comp)
+	    icalcomponent_free (comp);
+	icaltimezone_free (zone, 1);
+	return NULL;
+    }
+
+    if (!zone->location && builtin->location)
+	zone->location = strdup (builtin->location);
+    zone->latitude = builtin->latitude;
+    zone->longitude = builtin->longitude;
+    zone->builtin_timezone = builtin;
+
+    return zone;
+}
+
+
 /** Returns the special UTC timezone. */
 icaltimezone*
 icaltimezone_get_utc_timezone		(void)
@@ -1609,6 +2422,108 @@ fetch_lat_long_from_string  (const char *str, int *latitude_degrees, int *latitu
 	return 0;
 }
 
+/** Converts a coordinate of the form "+DDDMMSS" as used in zones.tab */
+static double
+parse_database_coord			(const char	*coord)
+{
+    int degrees = 0, minutes = 0, seconds = 0;
+
+    if (sscanf (coord, "%4d%2d%2d", &degrees, &minutes, &seconds) < 1)
+	return 0.0;
+
+    if (coord[0] == '-')
+	return (double) degrees - (double) minutes / 60 - (double) seconds / 3600;
+    else
+	return (double) degrees + (double) minutes / 60 + (double) seconds / 3600;
+}
+
+/** Creates the builtin_timezones array from the index of the database,
+   in the same order. Like icaltimezone_parse_zone_tab() it only fills in
+   the location and the coordinates. */
+static void
+icaltimezone_parse_database_index	(void)
+{
+    icalarray *builtin_timezones;
+    icaltimezone zone;
+    int i, count;
+
+    count = icaltzdb_count_zones (s_builtin_database);
+    builtin_timezones = icalarray_new (sizeof (icaltimezone), count > 0 ? count : 1);
+    if (!builtin_timezones)
+	return;
+
+    for (i = 0; i < count; i++) {
+	icaltimezone_init (&zone);
+	zone.location = strdup (icaltzdb_get_zone_tzid (s_builtin_database, i));
+	zone.latitude = parse_database_coord (icaltzdb_get_zone_latitude (s_builtin_database, i));
+	zone.longitude = parse_database_coord (icaltzdb_get_zone_longitude (s_builtin_database, i));
+	icalarray_append (builtin_timezones, &zone);
+    }
+
+    ICALTIMEZONE_PUBLISH (s_builtin_timezones, builtin_timezones);
+}
+
+/** Loads the VTIMEZONE of a builtin timezone from the database, and takes
+   its changes from there as well if they have been expanded in advance. */
+static void
+icaltimezone_load_from_database		(icaltimezone *zone)
+{
+    struct icaltzdbchange dbchange;
+    icaltimezonechange change;
+    icalcomponent *comp;
+    icalarena *arena;
+    icalarray *changes;
+    int index, i, count;
+
+    index = icaltzdb_find_zone (s_builtin_database, zone->location);
+    if (index < 0) {
+	icalerror_set_errno(ICAL_PARSE_ERROR);
+	return;
+    }
+
+    /* The zone outlives whatever is being parsed on this thread. */
+    arena = icalarena_set_current (NULL);
+    comp = icalparser_parse_string (icaltzdb_get_zone_vtimezone (s_builtin_database, index));
+    icalarena_set_current (arena);
+
+    if (!comp || icalcomponent_isa (comp) != ICAL_VTIMEZONE_COMPONENT) {
+	if (comp)
+	    icalcomponent_free (comp);
+	icalerror_set_errno(ICAL_PARSE_ERROR);
+	return;
+    }
+
+    /* The changes go first, as setting the component tells other threads
+       that the zone is loaded. They may be left from an earlier attempt. */
+    count = icaltzdb_count_zone_changes (s_builtin_database, index);
+    if (count >= 0 && !zone->transitions) {
+	changes = icalarray_new (sizeof (icaltimezonechange), count > 0 ? count : 1);
+	if (changes) {
+	    for (i = 0; i < count; i++) {
+		icaltzdb_get_zone_change (s_builtin_database, index, i, &dbchange);
+		change.utc_offset = dbchange.utc_offset;
+		change.prev_utc_offset = dbchange.prev_utc_offset;
+		change.year = dbchange.year;
+		change.month = dbchange.month;
+		change.day = dbchange.day;
+		change.hour = dbchange.hour;
+		change.minute = dbchange.minute;
+		change.second = dbchange.second;
+		change.is_daylight = dbchange.is_daylight;
+		icalarray_append (changes, &change);
+	    }
+	    ICALTIMEZONE_PUBLISH (zone->transitions,
+				  icaltimezone_new_transitions (changes,
+								icaltzdb_get_end_year (s_builtin_database)));
+	}
+    }
+
+    /* Our VTIMEZONEs have no X-LIC-LOCATION, but the zone keeps its
+       location anyway. */
+    if (!icaltimezone_get_vtimezone_properties (zone, comp))
+	icalcomponent_free (comp);
+}
+
 /** This parses the zones.tab file containing the names and locations
    of the builtin timezones. It creates the builtin_timezones array
    which is an icalarray of icaltimezone structs. It only fills in the
@@ -1732,16 +2647,36 @@ icaltimezone_release_zone_tab		(void)
     icalarray_free (mybuiltin_timezones);
 }
 
-/** Loads the builtin VTIMEZONE data for the given timezone. */
+/** Loads the builtin VTIMEZONE data for the given timezone, unless another
+   thread has loaded it while we waited for the lock. */
 static void
 icaltimezone_load_builtin_timezone	(icaltimezone *zone)
+{
+	    /* If the location isn't set, it isn't a builtin timezone. */
+    if (!zone->location || !zone->location[0])
+	return;
+
+    ICALTIMEZONE_LOCK ();
+    if (!zone->component)
+	icaltimezone_load_builtin_timezone_locked (zone);
+    ICALTIMEZONE_UNLOCK ();
+}
+
+/** Loads the builtin VTIMEZONE data for the given timezone. The caller
+   holds the lock. */
+static void
+icaltimezone_load_builtin_timezone_locked (icaltimezone *zone)
 {
 #ifndef NO_ZONES_TAB
     icalcomponent *subcomp;
+#endif
 
-	    /* If the location isn't set, it isn't a builtin timezone. */
-    if (!zone->location || !zone->location[0])
+    if (s_builtin_database) {
+	icaltimezone_load_from_database (zone);
 	return;
+    }
+
+#ifndef NO_ZONES_TAB
 
 #ifdef USE_BUILTIN_TZDATA
     {
@@ -1843,20 +2778,23 @@ icaltimezone_dump_changes		(icaltimezone *zone,
 {
     static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
 			      "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+    icaltimezonetransitions *transitions;
     icaltimezonechange *zone_change;
     int change_num;
     char buffer[8];
 
     /* Make sure the changes array is expanded up to the given time. */
-    icaltimezone_ensure_coverage (zone, max_year);
+    transitions = icaltimezone_ensure_coverage (zone, max_year);
+    if (!transitions)
+	return 0;
 
 #if 0
-    printf ("Num changes: %i\n", zone->changes->num_elements);
+    printf ("Num changes: %i\n", transitions->changes->num_elements);
 #endif
 
     change_num = 0;
-    for (change_num = 0; (unsigned int)change_num < zone->changes->num_elements; change_num++) {
-	zone_change = icalarray_element_at (zone->changes, change_num);
+    for (change_num = 0; (unsigned int)change_num < transitions->changes->num_elements; change_num++) {
+	zone_change = icalarray_element_at (transitions->changes, change_num);
 
 	if (zone_change->year > max_year)
 	    break;
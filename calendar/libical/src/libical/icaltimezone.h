@@ -83,6 +83,19 @@ icaltimezone* icaltimezone_get_builtin_timezone_from_offset	(int offset, const c
 /** Returns a single builtin timezone, given its TZID. */
 icaltimezone* icaltimezone_get_builtin_timezone_from_tzid (const char *tzid);
 
+/** Takes the builtin timezones from the compiled timezone database in
+   'data' (see icaltzdb.h) instead of zones.tab and the zone files. 'data'
+   is not copied and must stay valid until this is called again; pass 0
+   to stop using it. The builtin timezones handed out before are freed, so
+   no other thread may be using them. Returns 1 on success, or 0 if 'data'
+   is not a valid database. */
+int icaltimezone_set_builtin_database	(const void *data, size_t size);
+
+/** Returns a new icaltimezone for the builtin timezone with the given
+   location, or an alias of it, that owns a copy of the VTIMEZONE but
+   shares the expanded changes with the builtin timezone. */
+icaltimezone* icaltimezone_new_from_builtin	(const char *location);
+
 /** Returns the UTC timezone. */
 icaltimezone* icaltimezone_get_utc_timezone	(void);
 
@@ -123,6 +136,18 @@ void	icaltimezone_convert_time		(struct icaltimetype *tt,
 						 icaltimezone *from_zone,
 						 icaltimezone *to_zone);
 
+/** Converts count times from from_zone to to_zone, as
+   icaltimezone_convert_time() converts them one by one. The times are
+   given and returned as the seconds since 1970-01-01 00:00:00 on the local
+   clock, and a local time that occurs twice is taken to be standard time.
+   times and results may be the same array. The changes of the zones are
+   looked up from the ones found for the previous time, so sorted times
+   are converted without searching the changes for each. */
+void	icaltimezone_convert_times		(icaltimezone *from_zone,
+						 icaltimezone *to_zone,
+						 const int64_t *times,
+						 int64_t *results,
+						 size_t count);
 
 /**
  * @par Getting offsets from UTC.
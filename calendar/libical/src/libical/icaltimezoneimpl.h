@@ -35,6 +35,8 @@
 #include "icalcomponent.h"
 #include "icalarray.h"
 
+typedef struct _icaltimezonetransitions	icaltimezonetransitions;
+
 struct _icaltimezone {
     char		*tzid;
     /**< The unique ID of this timezone,
@@ -72,15 +74,13 @@ struct _icaltimezone {
        expanded timezone changes data is shared between calendar
        components. */
 
-    int			 end_year;
-    /**< This is the last year for which we have expanded the data to.
-       If we need to calculate a date past this we need to expand the
-       timezone component data from scratch. */
-
-    icalarray		*changes;
-    /**< A dynamically-allocated array of time zone changes, sorted by the
-       time of the change in local time. So we can do fast binary-searches
-       to convert from local time to UTC. */
+    icaltimezonetransitions *transitions;
+    /**< The changes of the timezone, expanded up to some year. If we need
+       to calculate a date past that year we expand the timezone component
+       data from scratch into a new table, which replaces this one. Tables
+       don't change once they are set here, so they can be read by several
+       threads without locking, and a table that has been replaced is kept
+       until the timezone is freed, as other threads may still use it. */
 };
 
 
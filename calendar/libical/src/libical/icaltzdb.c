@@ -0,0 +1,311 @@
+/* -*- Mode: C -*-
+  ======================================================================
+  FILE: icaltzdb.c
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of either:
+
+    The LGPL as published by the Free Software Foundation, version
+    2.1, available at: http://www.fsf.org/copyleft/lesser.html
+
+  Or:
+
+    The Mozilla Public License Version 1.0. You may obtain a copy of
+    the License at http://www.mozilla.org/MPL/
+
+ ======================================================================*/
+
+/**
+ * @file icaltzdb.c
+ * @brief Read access to a compiled timezone database.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "icaltzdb.h"
+#include "icalerror.h"
+
+#define TZDB_MAGIC		"CALTZDB"
+#define TZDB_FORMAT		1
+#define TZDB_HEADER_SIZE	40
+#define TZDB_ZONE_SIZE		24
+#define TZDB_ALIAS_SIZE		8
+#define TZDB_CHANGE_SIZE	16
+#define TZDB_NO_CHANGES		0xffffffffUL
+
+struct icaltzdb_impl {
+    const unsigned char *data;
+    size_t size;
+    unsigned long version;
+    int end_year;
+    unsigned long zone_count;
+    unsigned long zones;
+    unsigned long alias_count;
+    unsigned long aliases;
+};
+
+static unsigned long get_u32(const unsigned char *p)
+{
+    return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+	((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static int get_s32(const unsigned char *p)
+{
+    unsigned long u = get_u32(p);
+    return (u & 0x80000000UL) ? -(int)(0xffffffffUL - u) - 1 : (int)u;
+}
+
+/** Whether 'count' records of 'record_size' bytes fit at 'offset' */
+static int table_fits(icaltzdb *db, unsigned long offset,
+		      unsigned long count, size_t record_size)
+{
+    return offset <= db->size &&
+	count <= (db->size - offset) / record_size;
+}
+
+/* As the last byte of the file is a NUL, a string at a valid offset
+   always ends within the file. */
+static int string_fits(icaltzdb *db, const unsigned char *p)
+{
+    return get_u32(p) < db->size;
+}
+
+icaltzdb* icaltzdb_new_from_data(const void* data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    const unsigned char *p;
+    unsigned long i, count;
+    icaltzdb *db;
+
+    icalerror_check_arg_rz((data != 0), "data");
+
+    if (size < TZDB_HEADER_SIZE || memcmp(bytes, TZDB_MAGIC, 8) != 0 ||
+	get_u32(bytes + 8) != TZDB_FORMAT || get_u32(bytes + 12) != size ||
+	bytes[size - 1] != 0) {
+	icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
+	return 0;
+    }
+
+    if ((db = (icaltzdb*)malloc(sizeof(icaltzdb))) == 0) {
+	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+	return 0;
+    }
+
+    db->data = bytes;
+    db->size = size;
+    db->version = get_u32(bytes + 16);
+    db->end_year = get_s32(bytes + 20);
+    db->zone_count = get_u32(bytes + 24);
+    db->zones = get_u32(bytes + 28);
+    db->alias_count = get_u32(bytes + 32);
+    db->aliases = get_u32(bytes + 36);
+
+    if (db->version >= size ||
+	db->zone_count > 0x7fffffffUL || db->alias_count > 0x7fffffffUL ||
+	!table_fits(db, db->zones, db->zone_count, TZDB_ZONE_SIZE) ||
+	!table_fits(db, db->aliases, db->alias_count, TZDB_ALIAS_SIZE)) {
+	goto malformed;
+    }
+
+    for (i = 0; i < db->zone_count; i++) {
+	p = bytes + db->zones + i * TZDB_ZONE_SIZE;
+	if (!string_fits(db, p) || !string_fits(db, p + 4) ||
+	    !string_fits(db, p + 8) || !string_fits(db, p + 12)) {
+	    goto malformed;
+	}
+	count = get_u32(p + 20);
+	if (count != TZDB_NO_CHANGES &&
+	    (count > 0x7fffffffUL ||
+	     !table_fits(db, get_u32(p + 16), count, TZDB_CHANGE_SIZE))) {
+	    goto malformed;
+	}
+    }
+
+    for (i = 0; i < db->alias_count; i++) {
+	p = bytes + db->aliases + i * TZDB_ALIAS_SIZE;
+	if (!string_fits(db, p) || !string_fits(db, p + 4)) {
+	    goto malformed;
+	}
+    }
+
+    return db;
+
+ malformed:
+    free(db);
+    icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
+    return 0;
+}
+
+void icaltzdb_free(icaltzdb* db)
+{
+    free(db);
+}
+
+const char* icaltzdb_get_version(icaltzdb* db)
+{
+    icalerror_check_arg_rz((db != 0), "db");
+    return (const char*)db->data + db->version;
+}
+
+int icaltzdb_get_end_year(icaltzdb* db)
+{
+    icalerror_check_arg_rz((db != 0), "db");
+    return db->end_year;
+}
+
+static const char* get_string(icaltzdb* db, const unsigned char* p)
+{
+    return (const char*)db->data + get_u32(p);
+}
+
+/** Binary search of a table whose records start with a tzid */
+static int find_record(icaltzdb* db, unsigned long table, unsigned long count,
+		       size_t record_size, const char* tzid)
+{
+    unsigned long lower = 0, upper = count, middle;
+    int cmp;
+
+    while (lower < upper) {
+	middle = (lower + upper) / 2;
+	cmp = strcmp(tzid, get_string(db, db->data + table + middle * record_size));
+	if (cmp == 0) {
+	    return (int)middle;
+	} else if (cmp < 0) {
+	    upper = middle;
+	} else {
+	    lower = middle + 1;
+	}
+    }
+    return -1;
+}
+
+static const unsigned char* get_zone(icaltzdb* db, int zone)
+{
+    if (zone < 0 || (unsigned long)zone >= db->zone_count) {
+	icalerror_set_errno(ICAL_BADARG_ERROR);
+	return 0;
+    }
+    return db->data + db->zones + (unsigned long)zone * TZDB_ZONE_SIZE;
+}
+
+static const unsigned char* get_alias(icaltzdb* db, int alias)
+{
+    if (alias < 0 || (unsigned long)alias >= db->alias_count) {
+	icalerror_set_errno(ICAL_BADARG_ERROR);
+	return 0;
+    }
+    return db->data + db->aliases + (unsigned long)alias * TZDB_ALIAS_SIZE;
+}
+
+int icaltzdb_count_zones(icaltzdb* db)
+{
+    icalerror_check_arg_rz((db != 0), "db");
+    return (int)db->zone_count;
+}
+
+int icaltzdb_find_zone(icaltzdb* db, const char* tzid)
+{
+    icalerror_check_arg_rx((db != 0), "db", -1);
+    icalerror_check_arg_rx((tzid != 0), "tzid", -1);
+    return find_record(db, db->zones, db->zone_count, TZDB_ZONE_SIZE, tzid);
+}
+
+const char* icaltzdb_get_zone_tzid(icaltzdb* db, int zone)
+{
+    const unsigned char *p;
+    icalerror_check_arg_rz((db != 0), "db");
+    return (p = get_zone(db, zone)) ? get_string(db, p) : 0;
+}
+
+const char* icaltzdb_get_zone_vtimezone(icaltzdb* db, int zone)
+{
+    const unsigned char *p;
+    icalerror_check_arg_rz((db != 0), "db");
+    return (p = get_zone(db, zone)) ? get_string(db, p + 4) : 0;
+}
+
+const char* icaltzdb_get_zone_latitude(icaltzdb* db, int zone)
+{
+    const unsigned char *p;
+    icalerror_check_arg_rz((db != 0), "db");
+    return (p = get_zone(db, zone)) ? get_string(db, p + 8) : 0;
+}
+
+const char* icaltzdb_get_zone_longitude(icaltzdb* db, int zone)
+{
+    const unsigned char *p;
+    icalerror_check_arg_rz((db != 0), "db");
+    return (p = get_zone(db, zone)) ? get_string(db, p + 12) : 0;
+}
+
+int icaltzdb_count_zone_changes(icaltzdb* db, int zone)
+{
+    const unsigned char *p;
+    unsigned long count;
+
+    icalerror_check_arg_rx((db != 0), "db", -1);
+    if ((p = get_zone(db, zone)) == 0) {
+	return -1;
+    }
+    count = get_u32(p + 20);
+    return count == TZDB_NO_CHANGES ? -1 : (int)count;
+}
+
+void icaltzdb_get_zone_change(icaltzdb* db, int zone, int i,
+			      struct icaltzdbchange* change)
+{
+    const unsigned char *p;
+    unsigned int year;
+
+    icalerror_check_arg_rv((db != 0), "db");
+    icalerror_check_arg_rv((change != 0), "change");
+    if (i < 0 || i >= icaltzdb_count_zone_changes(db, zone)) {
+	icalerror_set_errno(ICAL_BADARG_ERROR);
+	return;
+    }
+
+    p = db->data + get_u32(get_zone(db, zone) + 16) + (unsigned long)i * TZDB_CHANGE_SIZE;
+    year = (unsigned int)p[0] | ((unsigned int)p[1] << 8);
+    change->year = (year & 0x8000) ? (int)year - 0x10000 : (int)year;
+    change->month = p[2];
+    change->day = p[3];
+    change->hour = p[4];
+    change->minute = p[5];
+    change->second = p[6];
+    change->is_daylight = p[7];
+    change->utc_offset = get_s32(p + 8);
+    change->prev_utc_offset = get_s32(p + 12);
+}
+
+int icaltzdb_count_aliases(icaltzdb* db)
+{
+    icalerror_check_arg_rz((db != 0), "db");
+    return (int)db->alias_count;
+}
+
+int icaltzdb_find_alias(icaltzdb* db, const char* tzid)
+{
+    icalerror_check_arg_rx((db != 0), "db", -1);
+    icalerror_check_arg_rx((tzid != 0), "tzid", -1);
+    return find_record(db, db->aliases, db->alias_count, TZDB_ALIAS_SIZE, tzid);
+}
+
+const char* icaltzdb_get_alias_tzid(icaltzdb* db, int alias)
+{
+    const unsigned char *p;
+    icalerror_check_arg_rz((db != 0), "db");
+    return (p = get_alias(db, alias)) ? get_string(db, p) : 0;
+}
+
+const char* icaltzdb_get_alias_target(icaltzdb* db, int alias)
+{
+    const unsigned char *p;
+    icalerror_check_arg_rz((db != 0), "db");
+    return (p = get_alias(db, alias)) ? get_string(db, p + 4) : 0;
+}
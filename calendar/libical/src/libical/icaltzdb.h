@@ -0,0 +1,113 @@
+/* -*- Mode: C -*- */
+/*======================================================================
+ FILE: icaltzdb.h
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of either:
+
+    The LGPL as published by the Free Software Foundation, version
+    2.1, available at: http://www.fsf.org/copyleft/lesser.html
+
+  Or:
+
+    The Mozilla Public License Version 1.0. You may obtain a copy of
+    the License at http://www.mozilla.org/MPL/
+
+======================================================================*/
+
+#ifndef ICALTZDB_H
+#define ICALTZDB_H
+
+#ifndef WIN32
+#include <sys/types.h> /* for size_t */
+#else
+#include <stddef.h>
+#endif
+
+/**
+ * @file icaltzdb.h
+ * @brief Read access to a compiled timezone database.
+ *
+ * The database is a single file, usually mapped into memory, that holds
+ * the VTIMEZONE of each zone together with its coordinates, the aliases,
+ * and the changes of each zone expanded up to some year. It is read in
+ * place: nothing is copied or parsed when it is opened, and the strings
+ * returned point into the data. All integers are little-endian.
+ *
+ * @code
+ *   header     "CALTZDB\0", format (1), size of the file,
+ *              version, end year, zone count, zone table,
+ *              alias count, alias table            10 x 4 bytes
+ *   zone       tzid, VTIMEZONE, latitude, longitude,
+ *              changes, change count                6 x 4 bytes
+ *   alias      tzid, tzid of the zone it stands for 2 x 4 bytes
+ *   change     year (2 bytes), month, day, hour, minute, second,
+ *              is_daylight (1 byte each), utc_offset,
+ *              prev_utc_offset (4 bytes each)      16 bytes
+ * @endcode
+ *
+ * Strings are given by their offset into the file and are NUL-terminated.
+ * The zone and alias tables are sorted by tzid, bytewise. A zone's changes
+ * are in UTC and sorted, like those icaltimezone expands itself; a zone
+ * whose VTIMEZONE could not be expanded in advance has a change count of
+ * 0xffffffff.
+ */
+
+typedef struct icaltzdb_impl icaltzdb;
+
+/** A change of a zone, as stored in the database. */
+struct icaltzdbchange {
+    int year;
+    int month;
+    int day;
+    int hour;
+    int minute;
+    int second;
+    int is_daylight;
+    int utc_offset;
+    int prev_utc_offset;
+};
+
+/** Checks that 'data' holds a database and returns a reader for it, or 0
+    with icalerrno set. 'data' is not copied and must outlive the reader. */
+icaltzdb* icaltzdb_new_from_data(const void* data, size_t size);
+void icaltzdb_free(icaltzdb* db);
+
+/** The version of the timezone data, e.g. "2.2016j" */
+const char* icaltzdb_get_version(icaltzdb* db);
+
+/** The last year the changes of the zones are expanded to */
+int icaltzdb_get_end_year(icaltzdb* db);
+
+int icaltzdb_count_zones(icaltzdb* db);
+
+/** Returns the index of the zone with the given tzid, or -1 */
+int icaltzdb_find_zone(icaltzdb* db, const char* tzid);
+
+const char* icaltzdb_get_zone_tzid(icaltzdb* db, int zone);
+
+/** The VTIMEZONE of a zone, without a VCALENDAR around it */
+const char* icaltzdb_get_zone_vtimezone(icaltzdb* db, int zone);
+
+/** The coordinates of a zone as in zones.tab, e.g. "+0513030", or "" */
+const char* icaltzdb_get_zone_latitude(icaltzdb* db, int zone);
+const char* icaltzdb_get_zone_longitude(icaltzdb* db, int zone);
+
+/** Returns the number of changes of a zone, or -1 if the database does
+    not have them. */
+int icaltzdb_count_zone_changes(icaltzdb* db, int zone);
+void icaltzdb_get_zone_change(icaltzdb* db, int zone, int i,
+			      struct icaltzdbchange* change);
+
+int icaltzdb_count_aliases(icaltzdb* db);
+
+/** Returns the index of the alias with the given tzid, or -1 */
+int icaltzdb_find_alias(icaltzdb* db, const char* tzid);
+
+const char* icaltzdb_get_alias_tzid(icaltzdb* db, int alias);
+
+/** The tzid the alias stands for. It need not be a zone of the
+    database, e.g. for "UTC". */
+const char* icaltzdb_get_alias_target(icaltzdb* db, int alias);
+
+#endif /* !ICALTZDB_H */
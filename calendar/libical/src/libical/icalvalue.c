@@ -71,18 +71,20 @@ void print_time_to_string(char* str,  const struct icaltimetype *data);
 struct icalvalue_impl*  icalvalue_new_impl(icalvalue_kind kind){
 
     struct icalvalue_impl* v;
+    icalarena* arena;
 
     if (!icalvalue_kind_is_valid(kind))
       return NULL;
 
     if ( ( v = (struct icalvalue_impl*)
-	   malloc(sizeof(struct icalvalue_impl))) == 0) {
-	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+	   icalarena_alloc(sizeof(struct icalvalue_impl), &arena)) == 0) {
 	return 0;
     }
     
     strcpy(v->id,"val");
     
+    v->arena = arena;
+    
     v->kind = kind;
     v->size = 0;
     v->parent = 0;
@@ -135,7 +137,7 @@ icalvalue* icalvalue_new_clone(const icalvalue* old) {
 	case ICAL_URI_VALUE:
 	{
 	    if (old->data.v_string != 0) { 
-		new->data.v_string=icalmemory_strdup(old->data.v_string);
+		new->data.v_string=icalarena_strdup(old->data.v_string);
 
 		if ( new->data.v_string == 0 ) {
                     icalvalue_free(new);
@@ -164,7 +166,7 @@ icalvalue* icalvalue_new_clone(const icalvalue* old) {
 	case ICAL_X_VALUE: 
 	{
 	    if (old->x_value != 0) {
-		new->x_value=icalmemory_strdup(old->x_value);
+		new->x_value=icalarena_strdup(old->x_value);
 
 		if (new->x_value == 0) {
                     icalvalue_free(new);
@@ -766,7 +768,7 @@ icalvalue_free (icalvalue* v)
 #endif
 
     if(v->x_value != 0){
-        free(v->x_value);
+        icalarena_free(v->arena, v->x_value);
     }
 
     switch (v->kind){
@@ -786,7 +788,7 @@ icalvalue_free (icalvalue* v)
 	case ICAL_QUERY_VALUE:
 	{
 	    if (v->data.v_string != 0) { 
-		free((void*)v->data.v_string);
+		icalarena_free(v->arena, (void*)v->data.v_string);
 		v->data.v_string = 0;
 	    }
 	    break;
@@ -811,7 +813,9 @@ icalvalue_free (icalvalue* v)
     v->parent = 0;
     memset(&(v->data),0,sizeof(v->data));
     v->id[0] = 'X';
-    free(v);
+    if (v->arena == 0) {
+	free(v);
+    }
 }
 
 int
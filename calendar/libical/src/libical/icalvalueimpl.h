@@ -38,6 +38,7 @@
 #include "icalenums.h"
 #include "icalproperty.h"
 #include "icalderivedvalue.h"
+#include "icalarena.h"
 
 
 struct icalvalue_impl {
@@ -47,6 +48,7 @@ struct icalvalue_impl {
     int size;
     icalproperty* parent;
     char* x_value;
+    icalarena* arena;
 
     union data {
 	icalattach *v_attach;		
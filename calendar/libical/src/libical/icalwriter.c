@@ -0,0 +1,205 @@
+/* -*- Mode: C -*-
+  ======================================================================
+  FILE: icalwriter.c
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of either:
+
+    The LGPL as published by the Free Software Foundation, version
+    2.1, available at: http://www.fsf.org/copyleft/lesser.html
+
+  Or:
+
+    The Mozilla Public License Version 1.0. You may obtain a copy of
+    the License at http://www.mozilla.org/MPL/
+
+ ======================================================================*/
+
+/**
+ * @file icalwriter.c
+ * @brief Output of the serializers, private to libical.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "icalwriter.h"
+#include "icalerror.h"
+
+/* Size of the buffer of a writer with a func */
+#define WRITER_CHUNK_SIZE (64 * 1024)
+
+static int writer_init(icalwriter *w, size_t size)
+{
+    w->len = 0;
+    w->size = size;
+    w->failed = 0;
+    w->line_len = 0;
+    w->line_folded = 0;
+
+    if ((w->buf = (char*)malloc(size)) == 0) {
+	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+	w->size = 0;
+	w->failed = 1;
+	return 0;
+    }
+    return 1;
+}
+
+int icalwriter_init_buffer(icalwriter *w, size_t size)
+{
+    w->func = 0;
+    w->user_data = 0;
+    return writer_init(w, size < 64 ? 64 : size);
+}
+
+int icalwriter_init_func(icalwriter *w, icalwriter_func func, void *user_data)
+{
+    w->func = func;
+    w->user_data = user_data;
+    return writer_init(w, WRITER_CHUNK_SIZE);
+}
+
+int icalwriter_flush(icalwriter *w)
+{
+    if (w->failed) {
+	return 0;
+    }
+    if (w->func != 0 && w->len != 0) {
+	if (!w->func(w->buf, w->len, w->user_data)) {
+	    w->failed = 1;
+	    return 0;
+	}
+	w->len = 0;
+    }
+    return 1;
+}
+
+void icalwriter_write(icalwriter *w, const char *data, size_t len)
+{
+    if (w->failed) {
+	return;
+    }
+
+    if (w->func != 0) {
+	while (w->len + len > w->size) {
+	    size_t n = w->size - w->len;
+	    memcpy(w->buf + w->len, data, n);
+	    w->len += n;
+	    data += n;
+	    len -= n;
+	    if (!icalwriter_flush(w)) {
+		return;
+	    }
+	}
+    } else if (w->len + len >= w->size) {
+	/* one more for the NUL of icalwriter_steal_buffer() */
+	size_t size = w->size * 2 + len;
+	char *buf = (char*)realloc(w->buf, size);
+	if (buf == 0) {
+	    icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+	    w->failed = 1;
+	    return;
+	}
+	w->buf = buf;
+	w->size = size;
+    }
+
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+void icalwriter_write_string(icalwriter *w, const char *str)
+{
+    icalwriter_write(w, str, strlen(str));
+}
+
+/* Where to break a line of which at least ICALWRITER_LINE_LEN bytes are
+   left: at most 74 bytes in, but not within a UTF-8 sequence. The
+   continuation line starts with a space, which makes 75 again. */
+static size_t fold_point(const char *line)
+{
+    const char *pos = line + ICALWRITER_LINE_LEN - 1;
+
+    while (pos > line) {
+	/* plain ascii, or the first byte of a UTF-8 sequence */
+	if ((*pos & 128) == 0 || (*pos & 192) == 192) {
+	    return pos - line;
+	}
+	pos--;
+    }
+
+    return ICALWRITER_LINE_LEN - 1;
+}
+
+/* Writes the first 'len' bytes of the pending line as one segment */
+static void write_segment(icalwriter *w, size_t len)
+{
+    if (w->line_folded) {
+	icalwriter_write(w, "\r\n ", 3);
+    }
+    w->line_folded = 1;
+    icalwriter_write(w, w->line, len);
+    w->line_len -= len;
+    memmove(w->line, w->line + len, w->line_len);
+}
+
+void icalwriter_fold(icalwriter *w, const char *data, size_t len)
+{
+    /* A segment is only written once it is clear that the line goes on
+       for at least a full line length after its start, which is where
+       the old fold_property_line() broke lines as well. */
+    while (len != 0) {
+	size_t n = ICALWRITER_LINE_LEN - w->line_len;
+	if (n > len) {
+	    n = len;
+	}
+	memcpy(w->line + w->line_len, data, n);
+	w->line_len += n;
+	data += n;
+	len -= n;
+
+	if (w->line_len == ICALWRITER_LINE_LEN) {
+	    write_segment(w, fold_point(w->line));
+	}
+    }
+}
+
+void icalwriter_fold_string(icalwriter *w, const char *str)
+{
+    icalwriter_fold(w, str, strlen(str));
+}
+
+void icalwriter_end_line(icalwriter *w)
+{
+    /* The CRLF is part of the line when it comes to folding, so a long
+       line may be broken between the CR and the LF, as it always was. */
+    icalwriter_fold(w, "\r\n", 2);
+    if (w->line_len != 0) {
+	write_segment(w, w->line_len);
+    }
+    w->line_folded = 0;
+}
+
+char* icalwriter_steal_buffer(icalwriter *w)
+{
+    char *buf = w->buf;
+
+    w->buf = 0;
+    if (w->failed || buf == 0) {
+	free(buf);
+	return 0;
+    }
+    buf[w->len] = '\0';
+    return buf;
+}
+
+void icalwriter_free(icalwriter *w)
+{
+    free(w->buf);
+    w->buf = 0;
+}
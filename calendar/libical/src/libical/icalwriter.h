@@ -0,0 +1,83 @@
+/* -*- Mode: C -*- */
+/*======================================================================
+ FILE: icalwriter.h
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of either:
+
+    The LGPL as published by the Free Software Foundation, version
+    2.1, available at: http://www.fsf.org/copyleft/lesser.html
+
+  Or:
+
+    The Mozilla Public License Version 1.0. You may obtain a copy of
+    the License at http://www.mozilla.org/MPL/
+
+======================================================================*/
+
+#ifndef ICALWRITER_H
+#define ICALWRITER_H
+
+#ifndef WIN32
+#include <sys/types.h> /* for size_t */
+#else
+#include <stddef.h>
+#endif
+
+/**
+ * @file icalwriter.h
+ * @brief Output of the serializers, private to libical.
+ *
+ * The component and property serializers write into an icalwriter
+ * instead of returning a string per node, so the text is copied only
+ * once. A writer either collects everything in one growing buffer, or
+ * passes the text to a function whenever its buffer is full. Property
+ * lines are folded on their way in.
+ */
+
+/* The longest unfolded part of a property line; see icalwriter_fold() */
+#define ICALWRITER_LINE_LEN 75
+
+/** Receives 'len' bytes of output; returns 0 to stop the serializer */
+typedef int (*icalwriter_func)(const char *data, size_t len, void *user_data);
+
+typedef struct icalwriter {
+    char *buf;
+    size_t len;
+    size_t size;
+    icalwriter_func func;	/* 0 to grow the buffer instead */
+    void *user_data;
+    int failed;			/* out of memory, or func returned 0 */
+
+    /* the unwritten tail of the current property line */
+    char line[ICALWRITER_LINE_LEN];
+    size_t line_len;
+    int line_folded;
+} icalwriter;
+
+/** A writer that collects the whole output, starting with 'size' bytes */
+int icalwriter_init_buffer(icalwriter *w, size_t size);
+
+/** A writer that passes its output to 'func' in chunks */
+int icalwriter_init_func(icalwriter *w, icalwriter_func func, void *user_data);
+
+void icalwriter_write(icalwriter *w, const char *data, size_t len);
+void icalwriter_write_string(icalwriter *w, const char *str);
+
+/** Add to the current property line, folding it where it gets too long */
+void icalwriter_fold(icalwriter *w, const char *data, size_t len);
+void icalwriter_fold_string(icalwriter *w, const char *str);
+
+/** End the current property line with a CRLF */
+void icalwriter_end_line(icalwriter *w);
+
+/** Pass what is buffered to the writer's func. Returns 0 on failure. */
+int icalwriter_flush(icalwriter *w);
+
+/** The NUL-terminated output of a buffer writer, owned by the caller,
+    or 0 on failure. The writer must not be used afterwards. */
+char* icalwriter_steal_buffer(icalwriter *w);
+
+void icalwriter_free(icalwriter *w);
+
+#endif /* !ICALWRITER_H */
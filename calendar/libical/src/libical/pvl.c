@@ -24,6 +24,7 @@
 #endif
 
 #include "pvl.h"
+#include "icalarena.h"
 #include <errno.h>
 #include <assert.h>
 #include <stdlib.h>
@@ -40,6 +41,7 @@
 typedef struct pvl_list_t
 {
 	int MAGIC;		        /**< Magic Identifier */
+	int in_arena;			/**< Allocated from an icalarena */
 	struct pvl_elem_t *head;	/**< Head of list */
 	struct pvl_elem_t *tail;	/**< Tail of list */
 	int count;			/**< Number of items in the list */
@@ -68,14 +70,16 @@ pvl_list
 pvl_newlist()
 {
     struct pvl_list_t *L;
+    icalarena *arena;
 
-    if ( ( L = (struct pvl_list_t*)malloc(sizeof(struct pvl_list_t))) == 0)
+    if ( ( L = (struct pvl_list_t*)icalarena_alloc(sizeof(struct pvl_list_t), &arena)) == 0)
     {
 	errno = ENOMEM;
 	return 0;
     }
 
     L->MAGIC = pvl_list_count;
+    L->in_arena = (arena != 0);
     pvl_list_count++;
     L->head = 0;
     L->tail = 0;
@@ -92,7 +96,9 @@ pvl_free(pvl_list l)
 
    pvl_clear(l);
 
-   free(L);
+   if (!L->in_arena) {
+       free(L);
+   }
 }
 
 /**
@@ -114,14 +120,16 @@ pvl_elem
 pvl_new_element(void *d, pvl_elem next, pvl_elem prior)
 {
     struct pvl_elem_t *E;
+    icalarena *arena;
 
-    if ( ( E = (struct pvl_elem_t*)malloc(sizeof(struct pvl_elem_t))) == 0)
+    if ( ( E = (struct pvl_elem_t*)icalarena_alloc(sizeof(struct pvl_elem_t), &arena)) == 0)
     {
 	errno = ENOMEM;
 	return 0;
     }
 
     E->MAGIC = pvl_elem_count++;
+    E->in_arena = (arena != 0);
     E->d = d;
     E->next = next;
     E->prior = prior;
@@ -414,7 +422,9 @@ pvl_remove(pvl_list L,pvl_elem E)
     E->next = 0;
     E->d = 0;
 
-    free(E);
+    if (!E->in_arena) {
+	free(E);
+    }
 
     return data;
 
@@ -35,6 +35,7 @@ typedef struct pvl_elem_t* pvl_elem;
 typedef struct pvl_elem_t
 {
 	int MAGIC;			/**< Magic Identifier */
+	int in_arena;			/**< Allocated from an icalarena */
 	void *d;			/**< Pointer to data user is storing */
 	struct pvl_elem_t *next;	/**< Next element */
 	struct pvl_elem_t *prior;	/**< Prior element */
@@ -166,5 +166,9 @@ pref("calendar.icaljs", true);
 pref("calendar.icaljs", false);
 #endif
 
+// Number of threads parsing ICS data in the background, 0 for one per
+// processor up to 4
+pref("calendar.ics.parser.threads", 0);
+
 // Calendar integration notification
 pref("calendar.integration.notify", true);
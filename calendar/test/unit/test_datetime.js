@@ -97,4 +97,90 @@ function really_run_test() {
     // Comparing a date-time with a date of the same day should be 0
     equal(cal.createDateTime("20120101T120000").compare(cal.createDateTime("20120101")), 0);
     equal(cal.createDateTime("20120101").compare(cal.createDateTime("20120101T120000")), 0);
+
+    // Comparisons have to follow changes of the date-times
+    let berlin = getMozTimezone("Europe/Berlin");
+    let newYork = getMozTimezone("America/New_York");
+    let early = cal.createDateTime("20120101T120000");
+    early.timezone = berlin;
+    let late = cal.createDateTime("20120101T080000");
+    late.timezone = newYork;
+    equal(early.compare(late), -1);
+    late.hour = 5;
+    equal(early.compare(late), 1);
+    late.hour = 6;
+    equal(early.compare(late), 0);
+    late.timezone = berlin;
+    equal(early.compare(late), 1);
+    late.timezone = cal.floating();
+    equal(early.compare(late), 1);
+    equal(late.compare(early), -1);
+    late.isDate = true;
+    equal(early.compare(late), 0);
+
+    // A date-time of the day before in New York, but not in Berlin
+    let evening = cal.createDateTime("20120101T200000");
+    evening.timezone = newYork;
+    let day = cal.createDateTime("20120102");
+    day.timezone = berlin;
+    equal(evening.compare(day), -1);
+    equal(day.compare(evening), 0);
+
+    // Sorting date-times, equal ones keep their order
+    let unsorted = ["20120103", "20120102T100000Z", "20120102T120000", "20120101T230000Z",
+                    "20111231", "20120102T090000Z", "20120102T110000Z"].map(str => cal.createDateTime(str));
+    unsorted[2].timezone = berlin;
+    let sorted = cal.getIcsService().sortDateTimes(unsorted.length, unsorted, {});
+    deepEqual(sorted.map(dt => dt.icalString),
+              ["20111231", "20120101T230000Z", "20120102T090000Z", "20120102T100000Z",
+               "20120102T120000", "20120102T110000Z", "20120103"]);
+    for (let i = 1; i < sorted.length; i++) {
+        ok(sorted[i - 1].compare(sorted[i]) <= 0);
+    }
+
+    // Mixed dates and date-times: a date compares equal to all date-times
+    // of its day, but sorts at its start, before a date-time of that time.
+    // Every order of the input sorts the same.
+    let mixed = ["20120102T080000Z", "20120102", "20120102T000000Z", "20120101T230000Z",
+                 "20120102T120000", "20120102T060000Z", "20120101", "20120102T003000"];
+    let expected = ["20120101", "20120101T230000Z", "20120102", "20120102T000000Z",
+                    "20120102T003000", "20120102T060000Z", "20120102T080000Z", "20120102T120000"];
+    for (let order of [mixed, mixed.slice().reverse(), mixed.slice(3).concat(mixed.slice(0, 3))]) {
+        let dateTimes = order.map(str => cal.createDateTime(str));
+        dateTimes.find(dt => dt.icalString == "20120102T120000").timezone = berlin;
+        sorted = cal.getIcsService().sortDateTimes(dateTimes.length, dateTimes, {});
+        deepEqual(sorted.map(dt => dt.icalString), expected);
+    }
+
+    // Converting times in bulk gives the clock times of getInTimezone,
+    // across the changes to and from daylight saving time
+    function clockTime(dt) {
+        let clock = dt.clone();
+        clock.timezone = cal.floating();
+        return clock.nativeTime;
+    }
+    let utcTimes = [];
+    for (let start of ["20120324T220000Z", "20121027T220000Z"]) {
+        let dt = cal.createDateTime(start);
+        for (let i = 0; i < 12; i++) {
+            utcTimes.push(dt.clone());
+            dt.minute += 30;
+        }
+    }
+    let icsService = cal.getIcsService();
+    for (let order of [utcTimes, utcTimes.slice().reverse()]) {
+        let converted = icsService.convertTimes(order.length, order.map(dt => dt.nativeTime),
+                                                cal.UTC(), berlin, {});
+        deepEqual(converted, order.map(dt => clockTime(dt.getInTimezone(berlin))));
+
+        let clocks = order.map(dt => dt.getInTimezone(berlin));
+        converted = icsService.convertTimes(clocks.length, clocks.map(clockTime),
+                                            berlin, cal.UTC(), {});
+        deepEqual(converted, clocks.map(dt => dt.getInTimezone(cal.UTC()).nativeTime));
+    }
+    let newYear = cal.createDateTime("20120101T000000Z").nativeTime;
+    deepEqual(icsService.convertTimes(2, [newYear + 123, newYear - 123], cal.UTC(), berlin, {}),
+              [newYear + 3600000123, newYear + 3599999877]);
+    deepEqual(icsService.convertTimes(1, [newYear], cal.floating(), berlin, {}), [newYear]);
+    deepEqual(icsService.convertTimes(0, [], cal.UTC(), berlin, {}), []);
 }
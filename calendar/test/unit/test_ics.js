@@ -3,9 +3,16 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
 function run_test() {
+    // One thread parses for parseICSAsync, so that the order in which the
+    // waiting parses are started shows in test_asyncCancel. The pref is
+    // read when the first async parse creates the threads.
+    Preferences.set("calendar.ics.parser.threads", 1);
+
     test_folding();
     test_icalProps();
     test_roundtrip();
+    test_asyncCancel();
+    test_batch();
     test_duration();
     test_serialize();
 }
@@ -139,6 +146,103 @@ function test_roundtrip() {
     }
 }
 
+function test_asyncCancel() {
+    let icssrv = cal.getIcsService();
+
+    // Background parses of a large calendar, so that the thread is still
+    // busy with the first one while the interactive one is added
+    let events = [];
+    for (let i = 0; i < 2000; i++) {
+        events.push("BEGIN:VEVENT\n" +
+                    "UID:background-" + i + "\n" +
+                    "DTSTART:20120101T100000Z\n" +
+                    "SUMMARY:Background " + i + "\n" +
+                    "END:VEVENT\n");
+    }
+    let largeIcs = "BEGIN:VCALENDAR\n" + events.join("") + "END:VCALENDAR\n";
+    let backgroundCount = 8;
+
+    let completed = [];
+    function parse(name, ics, priority) {
+        do_test_pending();
+        return icssrv.parseICSAsync(ics, null, {
+            onParsingComplete: function(rc, rootComp) {
+                if (name == "cancelled") {
+                    equal(rc, Components.interfaces.calIErrors.OPERATION_CANCELLED);
+                    equal(rootComp, null);
+                } else {
+                    ok(Components.isSuccessCode(rc));
+                    ok(rootComp);
+                }
+                completed.push(name);
+                if (completed.length == backgroundCount + 2) {
+                    checkOrder();
+                }
+                do_test_finished();
+            }
+        }, priority);
+    }
+
+    // Waiting operations are started by priority: a background parse the
+    // thread has already taken finishes first, then the interactive one,
+    // then the other background parses. ical.js parses each one on a
+    // worker of its own, regardless of the priority.
+    function checkOrder() {
+        if (Preferences.get("calendar.icaljs", false)) {
+            return;
+        }
+        let order = completed.filter(name => name != "cancelled");
+        let expected = [];
+        for (let i = 0; i < backgroundCount; i++) {
+            expected.push("background");
+        }
+        expected.splice(order[0] == "background" ? 1 : 0, 0, "interactive");
+        deepEqual(order, expected);
+    }
+
+    for (let i = 0; i < backgroundCount; i++) {
+        parse("background", largeIcs, Components.interfaces.calIICSService.PARSE_PRIORITY_BACKGROUND);
+    }
+    let operation = parse("cancelled", test_data[0].ics);
+    parse("interactive", test_data[0].ics, Components.interfaces.calIICSService.PARSE_PRIORITY_INTERACTIVE);
+    ok(operation.isPending);
+    operation.cancel(null);
+    ok(!operation.isPending);
+    equal(operation.status, Components.interfaces.calIErrors.OPERATION_CANCELLED);
+}
+
+function test_batch() {
+    let icssrv = cal.getIcsService();
+    let strings = test_data.map(data => data.ics).concat(["BEGIN:VCALENDAR\nfoo"]);
+
+    function checkResults(statuses, components) {
+        equal(components.length, strings.length);
+        equal(statuses.length, strings.length);
+        for (let i = 0; i < test_data.length; i++) {
+            ok(Components.isSuccessCode(statuses[i]));
+            let event = cal.createEvent();
+            event.icalComponent = components[i];
+            checkRoundtrip(test_data[i].expectedProps, event);
+        }
+        ok(!Components.isSuccessCode(statuses[test_data.length]));
+        equal(components[test_data.length], null);
+    }
+
+    let statuses = {};
+    let components = icssrv.parseICSBatch(strings.length, strings, null, {}, statuses);
+    checkResults(statuses.value, components);
+
+    do_test_pending();
+    icssrv.parseICSBatchAsync(strings.length, strings, null, {
+        onBatchParsingComplete: function(rc, count, asyncStatuses, asyncComponents) {
+            ok(Components.isSuccessCode(rc));
+            equal(count, strings.length);
+            checkResults(asyncStatuses, asyncComponents);
+            do_test_finished();
+        }
+    });
+}
+
 function test_folding() {
     // check folding
     const id = "loooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooong-id-provoking-folding";
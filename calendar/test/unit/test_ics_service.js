@@ -10,12 +10,20 @@ function really_run_test() {
     test_iterator();
     test_icalcomponent();
     test_icsservice();
+    test_parse_folded();
+    test_stream_parser();
+    test_large_parse();
+    test_serialize_stream();
     test_icalstring();
     test_param();
 
     // Only supported with ical.js
     if (Preferences.get("calendar.icaljs", false)) {
         test_icalproperty();
+    } else {
+        // The timezones are looked up natively with libical only
+        test_timezone_lookup();
+        test_embedded_timezones();
     }
 }
 
@@ -139,6 +147,284 @@ function test_icsservice() {
     equal(attach2.icalString, "ATTACH:http://example.com/\r\n");
 }
 
+function test_parse_folded() {
+    let svc = cal.getIcsService();
+    let data = "QUJD".repeat(500);
+
+    for (let eol of ["\r\n", "\n"]) {
+        let str = [
+            "BEGIN:VCALENDAR",
+            "BEGIN:VEVENT",
+            "UID:folded",
+            "SUMMARY;LANGUAGE=en:Folded ",
+            "\tsummary",
+            "X-DATA;X-TYPE=base64:" + data.match(/.{1,74}/g).join(eol + " "),
+            "X-AFTER:value",
+            "END:VEVENT",
+            "END:VCALENDAR"].join(eol);
+
+        let event = svc.parseICS(str, null).getFirstSubcomponent("VEVENT");
+        equal(event.uid, "folded");
+        equal(event.summary, "Folded summary");
+        let prop = event.getFirstProperty("X-DATA");
+        equal(prop.getParameter("X-TYPE"), "base64");
+        equal(prop.value, data);
+        equal(event.getFirstProperty("X-AFTER").value, "value");
+    }
+}
+
+function test_timezone_lookup() {
+    let svc = cal.getIcsService();
+    let tzs = cal.getTimezoneService();
+    let berlin = tzs.getTimezone("Europe/Berlin");
+
+    function parseStart(aTzProvider) {
+        let str = ["BEGIN:VCALENDAR",
+                   "BEGIN:VEVENT",
+                   "UID:tzlookup",
+                   "DTSTART;TZID=Europe/Berlin:20160701T120000",
+                   "END:VEVENT",
+                   "END:VCALENDAR"].join("\r\n");
+        return svc.parseICS(str, aTzProvider).getFirstSubcomponent("VEVENT").startTime;
+    }
+
+    // The zones of the timezone service are cached natively, the same zone
+    // has to come back before and after the service reports an update.
+    for (let i = 0; i < 3; i++) {
+        for (let provider of [null, tzs]) {
+            let start = parseStart(provider);
+            equal(start.timezone, berlin);
+            equal(start.timezoneOffset, 7200);
+        }
+        Services.obs.notifyObservers(null, "calendar-timezones-updated", tzs.version);
+    }
+
+    // Any other provider still comes first.
+    let provider = {
+        QueryInterface: XPCOMUtils.generateQI([Components.interfaces.calITimezoneProvider]),
+        getTimezone: function(aTzid) {
+            return aTzid == "Europe/Berlin" ? tzs.getTimezone("Asia/Tokyo") : null;
+        }
+    };
+    equal(parseStart(provider).timezone.tzid, "Asia/Tokyo");
+}
+
+function test_embedded_timezones() {
+    let svc = cal.getIcsService();
+
+    function parseStart(aOffset, aUid) {
+        let str = ["BEGIN:VCALENDAR",
+                   "BEGIN:VTIMEZONE",
+                   "TZID:Customized Time Zone",
+                   "BEGIN:STANDARD",
+                   "DTSTART:16010101T000000",
+                   "TZOFFSETFROM:" + aOffset,
+                   "TZOFFSETTO:" + aOffset,
+                   "END:STANDARD",
+                   "END:VTIMEZONE",
+                   "BEGIN:VEVENT",
+                   "UID:" + aUid,
+                   "DTSTART;TZID=Customized Time Zone:20160701T120000",
+                   "END:VEVENT",
+                   "END:VCALENDAR"].join("\r\n");
+        return svc.parseICS(str, null).getFirstSubcomponent("VEVENT").startTime;
+    }
+
+    // Identical definitions share a timezone, others with the same TZID
+    // don't.
+    let first = parseStart("+0300", "first");
+    let second = parseStart("+0300", "second");
+    let other = parseStart("-0500", "other");
+    equal(first.timezone, second.timezone);
+    notEqual(first.timezone, other.timezone);
+    equal(first.timezone.tzid, "Customized Time Zone");
+    equal(other.timezone.tzid, "Customized Time Zone");
+    equal(first.timezoneOffset, 10800);
+    equal(second.timezoneOffset, 10800);
+    equal(other.timezoneOffset, -18000);
+}
+
+function test_stream_parser() {
+    let svc = cal.getIcsService();
+    let str = [
+        "BEGIN:VCALENDAR",
+        "X-WR-CALNAME:Stream",
+        "BEGIN:VTIMEZONE",
+        "TZID:Custom/Zone",
+        "BEGIN:STANDARD",
+        "DTSTART:19700101T000000",
+        "TZOFFSETFROM:+0300",
+        "TZOFFSETTO:+0300",
+        "END:STANDARD",
+        "END:VTIMEZONE",
+        "BEGIN:VEVENT",
+        "UID:event1",
+        "DTSTART;TZID=Custom/Zone:20150101T100000",
+        "BEGIN:VALARM",
+        "TRIGGER:-PT5M",
+        "ACTION:DISPLAY",
+        "END:VALARM",
+        "END:VEVENT",
+        "BEGIN:VTODO",
+        "UID:todo1",
+        "SUMMARY:Folded ",
+        " summary",
+        "END:VTODO",
+        "END:VCALENDAR"].join("\r\n");
+
+    for (let size of [1, 7, str.length]) {
+        let comps = [];
+        let rootComp = null;
+        let parser = svc.createStreamParser(null, {
+            onComponent: function(comp) {
+                comps.push(comp);
+            },
+            onStreamComplete: function(rc, comp) {
+                equal(rc, Components.results.NS_OK);
+                rootComp = comp;
+            }
+        });
+        for (let i = 0; i < str.length; i += size) {
+            parser.appendData(str.substr(i, size));
+        }
+        parser.finish();
+
+        equal(comps.map(comp => comp.componentType).join(","), "VEVENT,VTODO");
+        equal(comps[0].uid, "event1");
+        ok(comps[0].getFirstSubcomponent("VALARM"));
+        equal(comps[1].summary, "Folded summary");
+        if (!Preferences.get("calendar.icaljs", false)) {
+            equal(comps[0].startTime.timezone.tzid, "Custom/Zone");
+            equal(comps[0].startTime.timezoneOffset, 3 * 3600);
+        }
+
+        equal(rootComp.getFirstProperty("X-WR-CALNAME").value, "Stream");
+        ok(rootComp.getFirstSubcomponent("VTIMEZONE"));
+        equal(rootComp.getFirstSubcomponent("VEVENT"), null);
+        equal(rootComp.getFirstSubcomponent("VTODO"), null);
+    }
+}
+
+function test_large_parse() {
+    // Calendars of 1 MiB and more are parsed on several threads with
+    // libical. The result has to be the same as that of the stream parser,
+    // which parses one line after the other.
+    let svc = cal.getIcsService();
+    let lines = [
+        "BEGIN:VCALENDAR",
+        "X-WR-CALNAME:Large",
+        "BEGIN:VTIMEZONE",
+        "TZID:Custom/Zone",
+        "BEGIN:STANDARD",
+        "DTSTART:19700101T000000",
+        "TZOFFSETFROM:+0300",
+        "TZOFFSETTO:+0300",
+        "END:STANDARD",
+        "END:VTIMEZONE"
+    ];
+    for (let i = 0; i < 6000; i++) {
+        if (i % 7 == 3) {
+            lines.push("BEGIN:VTODO",
+                       "UID:todo" + i,
+                       "SUMMARY:Todo " + i,
+                       "END:VTODO");
+            continue;
+        }
+        lines.push("BEGIN:VEVENT",
+                   "UID:event" + i,
+                   "DTSTART;TZID=Custom/Zone:2015" + (10 + i % 3) + "01T100000",
+                   "SUMMARY;LANGUAGE=en:Event " + i,
+                   "DESCRIPTION:A description long enough to be folded when it is serialized ",
+                   " again, for event " + i);
+        if (i % 5 == 0) {
+            lines.push("RRULE:FREQ=WEEKLY;COUNT=" + (i % 11 + 1),
+                       "BEGIN:VALARM",
+                       "TRIGGER:-PT" + (i % 60) + "M",
+                       "ACTION:DISPLAY",
+                       "END:VALARM");
+        }
+        lines.push("END:VEVENT");
+    }
+    lines.push("END:VCALENDAR");
+    let str = lines.join("\r\n");
+    ok(str.length > 1024 * 1024);
+
+    let streamed = [];
+    let streamRoot = null;
+    let parser = svc.createStreamParser(null, {
+        onComponent: comp => streamed.push(comp),
+        onStreamComplete: function(rc, comp) {
+            equal(rc, Components.results.NS_OK);
+            streamRoot = comp;
+        }
+    });
+    parser.appendData(str);
+    parser.finish();
+
+    let root = svc.parseICS(str, null);
+    equal(root.getFirstProperty("X-WR-CALNAME").value, "Large");
+    equal(root.getFirstSubcomponent("VTIMEZONE").serializeToICS(),
+          streamRoot.getFirstSubcomponent("VTIMEZONE").serializeToICS());
+
+    let parsed = [];
+    for (let comp = root.getFirstSubcomponent("ANY"); comp; comp = root.getNextSubcomponent("ANY")) {
+        parsed.push(comp);
+    }
+    equal(parsed.shift().componentType, "VTIMEZONE");
+    equal(parsed.length, streamed.length);
+    for (let i = 0; i < parsed.length; i++) {
+        equal(parsed[i].serializeToICS(), streamed[i].serializeToICS());
+    }
+
+    if (!Preferences.get("calendar.icaljs", false)) {
+        let event = parsed[0];
+        equal(event.startTime.timezone.tzid, "Custom/Zone");
+        equal(event.startTime.timezoneOffset, 3 * 3600);
+    }
+}
+
+function test_serialize_stream() {
+    let svc = cal.getIcsService();
+
+    // Long values are folded among UTF-8 characters of 2, 3 and 4 bytes,
+    // which must not be split
+    let description = "";
+    for (let i = 0; i < 40; i++) {
+        description += "Caf\u00e9 \u65e5\u672c\u8a9e \ud83d\udcc5 " + i + " ";
+    }
+    let comp = svc.createIcalComponent("VCALENDAR");
+    let event = svc.createIcalComponent("VEVENT");
+    event.uid = "stream-serialize";
+    event.summary = "\u00dcberlange Zusammenfassung mit Umlauten: \u00e4\u00f6\u00fc\u00df ".repeat(4);
+    event.description = description;
+    comp.addSubcomponent(event);
+
+    let storage = Components.classes["@mozilla.org/storagestream;1"]
+                            .createInstance(Components.interfaces.nsIStorageStream);
+    storage.init(1024, 0xffffffff, null);
+    let outputStream = storage.getOutputStream(0);
+    comp.serializeToICSOutputStream(outputStream);
+    outputStream.close();
+
+    let inputStream = Components.classes["@mozilla.org/scriptableinputstream;1"]
+                                .createInstance(Components.interfaces.nsIScriptableInputStream);
+    inputStream.init(storage.newInputStream(0));
+    let bytes = inputStream.readBytes(inputStream.available());
+    inputStream.close();
+
+    let converter = Components.classes["@mozilla.org/intl/scriptableunicodeconverter"]
+                              .createInstance(Components.interfaces.nsIScriptableUnicodeConverter);
+    converter.charset = "UTF-8";
+    let ics = comp.serializeToICS();
+    let expected = converter.ConvertFromUnicode(ics) + converter.Finish();
+
+    ok(ics.includes("\r\n "));
+    ok(ics.includes("\ud83d\udcc5"));
+    equal(bytes, expected);
+    equal(svc.parseICS(converter.ConvertToUnicode(bytes), null)
+             .getFirstSubcomponent("VEVENT").description, description);
+}
+
 function test_icalproperty() {
     let svc = cal.getIcsService();
     let comp = svc.createIcalComponent("VEVENT");
@@ -16,6 +16,11 @@ function really_run_test() {
     test_rules();
     test_failures();
     test_limit();
+    test_range_start();
+    test_next_occurrence_walk();
+    test_shared_plans();
+    test_occurrence_times();
+    test_recurrence_set();
     test_startdate_change();
     test_idchange();
     test_rrule_icalstring();
@@ -263,6 +268,38 @@ function test_rules() {
                 expectedDates,
                 false);
 
+    // Yearly recurrence on the 31st of months that don't all have one.
+    // The days come out sorted and February is skipped.
+    check_recur(createEventFromIcalString("BEGIN:VCALENDAR\nBEGIN:VEVENT\n" +
+                                         "DESCRIPTION:Repeat Yearly the 31st of March, January and February\n" +
+                                         "RRULE:FREQ=YEARLY;COUNT=4;BYMONTH=3,1,2\n" +
+                                         "DTSTART:20150131T150000Z\n" +
+                                         "DTEND:20150131T160000Z\n" +
+                                         "END:VEVENT\nEND:VCALENDAR\n"),
+               ["20150131T150000Z", "20150331T150000Z", "20160131T150000Z", "20160331T150000Z"],
+               false);
+
+    // Yearly recurrence on the last day of the month, when it is a Friday.
+    check_recur(createEventFromIcalString("BEGIN:VCALENDAR\nBEGIN:VEVENT\n" +
+                                         "DESCRIPTION:Repeat Yearly every Friday that is the last day of a month\n" +
+                                         "RRULE:FREQ=YEARLY;COUNT=5;BYMONTHDAY=-1;BYDAY=FR\n" +
+                                         "DTSTART:20100430T150000Z\n" +
+                                         "DTEND:20100430T160000Z\n" +
+                                         "END:VEVENT\nEND:VCALENDAR\n"),
+               ["20100430T150000Z", "20101231T150000Z", "20110930T150000Z",
+                "20120831T150000Z", "20121130T150000Z"],
+               false);
+
+    // Yearly recurrence on the first and the last day of the year.
+    check_recur(createEventFromIcalString("BEGIN:VCALENDAR\nBEGIN:VEVENT\n" +
+                                         "DESCRIPTION:Repeat Yearly the first and the last day of the year\n" +
+                                         "RRULE:FREQ=YEARLY;COUNT=4;BYYEARDAY=-1,1\n" +
+                                         "DTSTART:20160101T150000Z\n" +
+                                         "DTEND:20160101T160000Z\n" +
+                                         "END:VEVENT\nEND:VCALENDAR\n"),
+               ["20160101T150000Z", "20161231T150000Z", "20170101T150000Z", "20171231T150000Z"],
+               false);
+
     // Bug 958974 - Monthly recurrence every WE, FR and the third MO (monthly with more bydays).
     // Check the occurrences in the first month until the week with the first monday of the rule.
     check_recur(createEventFromIcalString("BEGIN:VCALENDAR\nBEGIN:VEVENT\n" +
@@ -486,6 +523,202 @@ function test_limit() {
     equal(occurrences.length, 3);
 }
 
+function test_range_start() {
+    // Ranges long after the start of the rule give the same occurrences
+    // whether the rule is iterated from its start or skips to the range
+    function check(rule, dtstart, rangeStart, rangeEnd, expected) {
+        let item = makeEvent("RRULE:" + rule + "\n" +
+                             "DTSTART:" + dtstart + "\n");
+        let rrule = item.recurrenceInfo.getRecurrenceItemAt(0)
+                        .QueryInterface(Components.interfaces.calIRecurrenceRule);
+        let start = cal.createDateTime(rangeStart);
+        let end = cal.createDateTime(rangeEnd);
+        let dates = rrule.getOccurrences(item.startDate, start, end, 0, {});
+        deepEqual(dates.map(date => date.icalString), expected, rule);
+
+        equal(rrule.getNextOccurrence(item.startDate, start).icalString, expected[0]);
+        for (let i = 1; i < expected.length; i++) {
+            equal(rrule.getNextOccurrence(item.startDate, dates[i - 1]).icalString, expected[i]);
+        }
+    }
+
+    check("FREQ=HOURLY;INTERVAL=7", "20020401T114500Z", "20150101T000000Z", "20150103T000000Z",
+          ["20150101T024500Z", "20150101T094500Z", "20150101T164500Z", "20150101T234500Z",
+           "20150102T064500Z", "20150102T134500Z", "20150102T204500Z"]);
+    check("FREQ=DAILY;INTERVAL=3;BYHOUR=9,17", "20020401T114500Z", "20150101T000000Z", "20150110T000000Z",
+          ["20150102T094500Z", "20150102T174500Z", "20150105T094500Z", "20150105T174500Z",
+           "20150108T094500Z", "20150108T174500Z"]);
+    check("FREQ=WEEKLY;INTERVAL=2;WKST=SU;BYDAY=WE,SA,SU", "20081217T133000Z", "20150101T000000Z", "20150201T000000Z",
+          ["20150104T133000Z", "20150107T133000Z", "20150110T133000Z", "20150118T133000Z",
+           "20150121T133000Z", "20150124T133000Z"]);
+    check("FREQ=MONTHLY;BYDAY=-1FR", "20020401T114500Z", "20150101T000000Z", "20150501T000000Z",
+          ["20150130T114500Z", "20150227T114500Z", "20150327T114500Z", "20150424T114500Z"]);
+    check("FREQ=MONTHLY;INTERVAL=5;BYMONTHDAY=1,-1", "20020101T114500Z", "20150101T000000Z", "20160101T000000Z",
+          ["20150501T114500Z", "20150531T114500Z", "20151001T114500Z", "20151031T114500Z"]);
+    check("FREQ=YEARLY;BYMONTH=3;BYDAY=-1SU", "20020331T114500Z", "20150101T000000Z", "20180101T000000Z",
+          ["20150329T114500Z", "20160327T114500Z", "20170326T114500Z"]);
+}
+
+function test_next_occurrence_walk() {
+    // Walking forward goes on from the previous lookup, going back or
+    // changing the rule must not give stale occurrences
+    let item = makeEvent("RRULE:FREQ=WEEKLY;BYDAY=MO,TH\n" +
+                         "DTSTART:20120102T080000Z\n");
+    let rrule = item.recurrenceInfo.getRecurrenceItemAt(0)
+                    .QueryInterface(Components.interfaces.calIRecurrenceRule);
+    let start = item.startDate;
+
+    let occ = start;
+    let dates = [];
+    for (let i = 0; i < 6; i++) {
+        occ = rrule.getNextOccurrence(start, occ);
+        dates.push(occ.icalString);
+    }
+    deepEqual(dates, ["20120105T080000Z", "20120109T080000Z", "20120112T080000Z",
+                      "20120116T080000Z", "20120119T080000Z", "20120123T080000Z"]);
+
+    let time = cal.createDateTime("20120110T000000Z");
+    equal(rrule.getNextOccurrence(start, time).icalString, "20120112T080000Z");
+    time = cal.createDateTime("20121231T235959Z");
+    equal(rrule.getNextOccurrence(start, time).icalString, "20130103T080000Z");
+    time = cal.createDateTime("20120102T080000Z");
+    equal(rrule.getNextOccurrence(start, time).icalString, "20120105T080000Z");
+
+    let otherStart = cal.createDateTime("20120103T080000Z");
+    equal(rrule.getNextOccurrence(otherStart, time).icalString, "20120105T080000Z");
+    time = cal.createDateTime("20120105T080000Z");
+    equal(rrule.getNextOccurrence(otherStart, time).icalString, "20120109T080000Z");
+
+    rrule.interval = 2;
+    equal(rrule.getNextOccurrence(start, time).icalString, "20120116T080000Z");
+    rrule.setComponent("BYDAY", 1, [3]);
+    equal(rrule.getNextOccurrence(start, time).icalString, "20120117T080000Z");
+    rrule.count = 4;
+    time = cal.createDateTime("20120131T080000Z");
+    equal(rrule.getNextOccurrence(start, time).icalString, "20120214T080000Z");
+    time = cal.createDateTime("20120214T080000Z");
+    equal(rrule.getNextOccurrence(start, time), null);
+}
+
+function test_shared_plans() {
+    // Equal rules of different items share their plan, changing one of
+    // them must leave the other as it is
+    function getRule(item) {
+        return item.recurrenceInfo.getRecurrenceItemAt(0)
+                   .QueryInterface(Components.interfaces.calIRecurrenceRule);
+    }
+    function getDates(rrule, start) {
+        let rangeStart = cal.createDateTime("20120101T000000Z");
+        let rangeEnd = cal.createDateTime("20120120T000000Z");
+        return rrule.getOccurrences(start, rangeStart, rangeEnd, 0, {}).map(x => x.icalString);
+    }
+    let item1 = makeEvent("RRULE:FREQ=WEEKLY;BYDAY=MO,WE\n" +
+                          "DTSTART:20120102T080000Z\n");
+    let item2 = makeEvent("RRULE:FREQ=WEEKLY;BYDAY=WE,MO\n" +
+                          "DTSTART:20120102T080000Z\n");
+    let rrule1 = getRule(item1);
+    let rrule2 = getRule(item2);
+    let all = ["20120102T080000Z", "20120104T080000Z", "20120109T080000Z",
+               "20120111T080000Z", "20120116T080000Z", "20120118T080000Z"];
+
+    deepEqual(getDates(rrule1, item1.startDate), all);
+    deepEqual(getDates(rrule2, item2.startDate), all);
+
+    rrule2.interval = 2;
+    deepEqual(getDates(rrule2, item2.startDate),
+              ["20120102T080000Z", "20120104T080000Z", "20120116T080000Z", "20120118T080000Z"]);
+    deepEqual(getDates(rrule1, item1.startDate), all);
+}
+
+function test_occurrence_times() {
+    // The packed times are the nativeTimes of the occurrences
+    function check(rrule, start, rangeStart, rangeEnd, maxCount) {
+        let dates = rrule.getOccurrences(start, rangeStart, rangeEnd, maxCount, {});
+        let timezone = {};
+        let isDate = {};
+        let times = rrule.getOccurrenceTimes(start, rangeStart, rangeEnd, maxCount,
+                                             timezone, isDate);
+        equal(times.BYTES_PER_ELEMENT, 8);
+        deepEqual(Array.from(times), dates.map(x => x.nativeTime));
+        equal(timezone.value.tzid, start.timezone.tzid);
+        equal(isDate.value, start.isDate);
+        return times.length;
+    }
+    let rangeStart = cal.createDateTime("20120101T000000Z");
+    let rangeEnd = cal.createDateTime("20120301T000000Z");
+
+    let item = makeEvent("RRULE:FREQ=WEEKLY;BYDAY=MO,WE\n" +
+                         "DTSTART;TZID=Europe/Berlin:20120102T080000\n");
+    let rrule = item.recurrenceInfo.getRecurrenceItemAt(0)
+                    .QueryInterface(Components.interfaces.calIRecurrenceRule);
+    equal(check(rrule, item.startDate, rangeStart, rangeEnd, 0), 18);
+    equal(check(rrule, item.startDate, rangeStart, rangeEnd, 5), 5);
+    equal(check(rrule, item.startDate, rangeEnd, null, 3), 3);
+    equal(check(rrule, item.startDate, rangeStart, item.startDate, 0), 0);
+
+    item = makeEvent("RRULE:FREQ=MONTHLY;BYMONTHDAY=-1\n" +
+                     "DTSTART;VALUE=DATE:20120131\n");
+    rrule = item.recurrenceInfo.getRecurrenceItemAt(0)
+                .QueryInterface(Components.interfaces.calIRecurrenceRule);
+    equal(check(rrule, item.startDate, rangeStart, rangeEnd, 0), 2);
+
+    throws(() => rrule.getOccurrenceTimes(item.startDate, rangeStart, null, 0, {}, {}));
+}
+
+function test_recurrence_set() {
+    function check(item, rangeStart, rangeEnd, maxCount, expected) {
+        let dates = item.recurrenceInfo.getOccurrenceDates(rangeStart, rangeEnd, maxCount, {});
+        deepEqual(dates.map(x => x.getInTimezone(cal.UTC()).icalString), expected);
+    }
+
+    // libical gives the hours of this rule out of order
+    let item = makeEvent("RRULE:FREQ=DAILY;BYHOUR=16,8\n" +
+                         "DTSTART;TZID=Europe/Berlin:20120102T080000\n" +
+                         "DTEND;TZID=Europe/Berlin:20120102T090000\n" +
+                         "EXDATE;VALUE=DATE:20120103\n" +
+                         "EXDATE;TZID=Europe/Berlin:20120104T160000\n" +
+                         "RDATE;TZID=Europe/Berlin:20120105T120000\n" +
+                         "RDATE;TZID=Europe/Berlin:20120105T080000\n");
+    let occ = item.recurrenceInfo.getOccurrenceFor(cal.createDateTime("20120102T150000Z"));
+    occ.startDate = cal.createDateTime("20120105T190000Z");
+    occ.endDate = cal.createDateTime("20120105T200000Z");
+    item.recurrenceInfo.modifyException(occ, true);
+
+    let rangeStart = cal.createDateTime("20120102T000000Z");
+    let rangeEnd = cal.createDateTime("20120106T000000Z");
+    check(item, rangeStart, rangeEnd, 0,
+          ["20120102T070000Z", "20120104T070000Z", "20120105T070000Z",
+           "20120105T110000Z", "20120105T150000Z", "20120105T190000Z"]);
+    check(item, rangeStart, rangeEnd, 3,
+          ["20120102T070000Z", "20120104T070000Z", "20120105T070000Z"]);
+    // the occurrence taking up the start of the range is in it
+    check(item, cal.createDateTime("20120104T073000Z"), rangeEnd, 2,
+          ["20120104T070000Z", "20120105T070000Z"]);
+
+    let occurrences = item.recurrenceInfo.getOccurrences(rangeStart, rangeEnd, 0, {});
+    equal(occurrences.length, 6);
+    equal(occurrences[5].recurrenceId.getInTimezone(cal.UTC()).icalString, "20120102T150000Z");
+
+    throws(() => item.recurrenceInfo.getOccurrenceDates(rangeStart, null, 0, {}));
+
+    // A date takes out the occurrence on that day where it happens, not
+    // the one on that day in UTC.
+    item = makeEvent("RRULE:FREQ=DAILY;COUNT=3\n" +
+                     "DTSTART;TZID=America/New_York:20120102T190000\n" +
+                     "DTEND;TZID=America/New_York:20120102T200000\n" +
+                     "EXDATE;VALUE=DATE:20120103\n");
+    check(item, rangeStart, null, 0, ["20120103T000000Z", "20120105T000000Z"]);
+
+    // A floating date-time takes out the occurrence at that wall clock time.
+    item = makeEvent("RRULE:FREQ=DAILY;COUNT=4\n" +
+                     "DTSTART;TZID=Pacific/Auckland:20120102T080000\n" +
+                     "DTEND;TZID=Pacific/Auckland:20120102T090000\n" +
+                     "EXDATE:20120103T080000\n" +
+                     "EXDATE;VALUE=DATE:20120104\n");
+    check(item, cal.createDateTime("20111231T000000Z"), rangeEnd, 0,
+          ["20120101T190000Z", "20120104T190000Z"]);
+}
+
 function test_clone(event) {
     let oldRecurItems = event.recurrenceInfo.getRecurrenceItems({});
     let cloned = event.recurrenceInfo.clone();
@@ -62,6 +62,72 @@ add_task(function* alias_test() {
     ok(foundAlias, "There is at least one alias");
 });
 
+// check that zones.bin, which the timezone service maps, agrees with zones.json
+add_task(function* database_test() {
+    function getFile(aName) {
+        let resProtocol = Services.io.getProtocolHandler("resource")
+                                  .QueryInterface(Components.interfaces.nsIResProtocolHandler);
+        let spec = resProtocol.resolveURI(Services.io.newURI("resource://calendar/timezones/" + aName, null, null));
+        return Services.io.newURI(spec, null, null).QueryInterface(Components.interfaces.nsIFileURL).file;
+    }
+    function toArray(aEnumerator) {
+        let values = [];
+        while (aEnumerator.hasMore()) {
+            values.push(aEnumerator.getNext());
+        }
+        return values.sort();
+    }
+
+    let dbFile = getFile("zones.bin");
+    if (!dbFile.exists() || Preferences.get("calendar.icaljs", false)) {
+        do_print("No timezone database to check");
+        return;
+    }
+
+    let db = cal.getIcsService().openTimezoneDatabase(dbFile);
+    let json = readJSONFile(getFile("zones.json"));
+    equal(db.version, json.version, "database version");
+    deepEqual(toArray(db.timezoneIds), Object.keys(json.zones).sort(), "database zones");
+    deepEqual(toArray(db.aliasIds), Object.keys(json.aliases).sort(), "database aliases");
+
+    for (let tzid of Object.keys(json.zones)) {
+        let ics = {}, latitude = {}, longitude = {};
+        ok(db.getZone(tzid, ics, latitude, longitude), "database zone " + tzid);
+        equal(ics.value, json.zones[tzid].ics, "VTIMEZONE of " + tzid);
+        equal(latitude.value, json.zones[tzid].latitude, "latitude of " + tzid);
+        equal(longitude.value, json.zones[tzid].longitude, "longitude of " + tzid);
+        equal(db.getAliasTarget(tzid), "", tzid + " is no alias");
+    }
+    for (let tzid of Object.keys(json.aliases)) {
+        equal(db.getAliasTarget(tzid), json.aliases[tzid].aliasTo, "alias " + tzid);
+    }
+    ok(!db.getZone("Nowhere/Special", {}, {}, {}), "unknown zone");
+    equal(db.getZoneComponent("Nowhere/Special"), null, "no component for an unknown zone");
+
+    // The changes of the database zones, expanded in advance, have to give
+    // the same times as a copy of the VTIMEZONE that libical expands itself.
+    let tzs = cal.getTimezoneService();
+    let times = ["19700101T000000", "19961027T023000", "20070311T023000", "20071104T013000",
+                 "20161030T023000", "20170326T023000", "20350601T120000"];
+    for (let tzid of ["America/New_York", "Europe/Berlin", "Australia/Lord_Howe", "Asia/Tehran"]) {
+        let vtimezone = json.zones[tzid].ics.replace("TZID:" + tzid, "TZID:/test/" + tzid);
+        for (let time of times) {
+            let event = cal.getIcsService().parseICS("BEGIN:VCALENDAR\r\n" + vtimezone + "\r\n" +
+                                                     "BEGIN:VEVENT\r\nUID:" + time + "\r\n" +
+                                                     "DTSTART;TZID=/test/" + tzid + ":" + time + "\r\n" +
+                                                     "END:VEVENT\r\nEND:VCALENDAR\r\n", null)
+                                           .getFirstSubcomponent("VEVENT");
+            let expected = event.startTime;
+            equal(expected.timezone.tzid, "/test/" + tzid);
+
+            let dt = cal.createDateTime(time);
+            dt.timezone = tzs.getTimezone(tzid);
+            equal(dt.nativeTime, expected.nativeTime, tzid + " " + time);
+            equal(dt.timezoneOffset, expected.timezoneOffset, tzid + " offset " + time);
+        }
+    }
+});
+
 // Check completeness to avoid unintended removing of zones/aliases when updating zones.json
 // removed zones should at least remain as alias to not break UI like in bug 1210723.
 // previous.json is generated automatically by executing update-zones.py script
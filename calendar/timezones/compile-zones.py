@@ -0,0 +1,271 @@
+#!/usr/bin/python
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+"""
+This script compiles zones.json into zones.bin, the timezone database that
+libical and the timezone service map into memory instead of parsing the
+JSON and each zone's VTIMEZONE. It is run by the build:
+  python compile-zones.py zones.json zones.bin
+
+The layout is described in calendar/libical/src/libical/icaltzdb.h. Besides
+the zones, their coordinates and the aliases it holds the changes of each
+zone, expanded the way libical's icaltimezone would do it, up to the last
+year libical expands to.
+"""
+
+import json, struct, sys
+from datetime import datetime, timedelta
+
+FORMAT = 1
+# ICALTIMEZONE_MAX_YEAR in icaltimezone.c
+END_YEAR = 2035
+NO_CHANGES = 0xffffffff
+
+WEEKDAYS = ["MO", "TU", "WE", "TH", "FR", "SA", "SU"]
+
+
+class UnsupportedZone(Exception):
+    """The changes of a zone can't be expanded here, libical has to do it."""
+
+
+def parse_offset(value):
+    """Convert a UTC offset like +0130 to seconds."""
+    sign = -1 if value[0] == "-" else 1
+    digits = value.lstrip("+-")
+    seconds = int(digits[0:2]) * 3600 + int(digits[2:4]) * 60
+    if len(digits) >= 6:
+        seconds += int(digits[4:6])
+    return sign * seconds
+
+
+def parse_datetime(value):
+    """Parse a DATE or local/UTC DATE-TIME, returning (datetime, is_date, is_utc)."""
+    if len(value) == 8:
+        return datetime.strptime(value, "%Y%m%d"), True, False
+    is_utc = value.endswith("Z")
+    return datetime.strptime(value.rstrip("Z"), "%Y%m%dT%H%M%S"), False, is_utc
+
+
+def parse_vtimezone(ics):
+    """Split a VTIMEZONE into its STANDARD and DAYLIGHT components."""
+    lines = []
+    for line in ics.replace("\r\n", "\n").split("\n"):
+        if line[:1] in (" ", "\t") and lines:
+            lines[-1] += line[1:]
+        elif line:
+            lines.append(line)
+
+    components = []
+    current = None
+    for line in lines:
+        nameparams, value = line.split(":", 1)
+        params = nameparams.split(";")
+        name = params[0].upper()
+        if name == "BEGIN" and value in ("STANDARD", "DAYLIGHT"):
+            current = {"is_daylight": int(value == "DAYLIGHT"),
+                       "rrules": [], "rdates": []}
+        elif name == "END" and current is not None:
+            components.append(current)
+            current = None
+        elif current is None:
+            continue
+        elif name == "DTSTART":
+            current["dtstart"] = parse_datetime(value)[0]
+        elif name == "TZOFFSETFROM":
+            current["from"] = parse_offset(value)
+        elif name == "TZOFFSETTO":
+            current["to"] = parse_offset(value)
+        elif name == "RRULE":
+            current["rrules"].append(dict(part.split("=", 1) for part in value.split(";")))
+        elif name == "RDATE":
+            if "VALUE=PERIOD" in params:
+                raise UnsupportedZone("RDATE periods")
+            current["rdates"].extend(value.split(","))
+    return components
+
+
+def rule_days(rule, year, month, dtstart):
+    """The days of a month an RRULE with FREQ=YEARLY matches."""
+    first = datetime(year, month, 1)
+    days_in_month = ((first.replace(day=28) + timedelta(days=4)).replace(day=1) - first).days
+    days = range(1, days_in_month + 1)
+
+    if "BYMONTHDAY" in rule:
+        monthdays = [int(d) for d in rule["BYMONTHDAY"].split(",")]
+        days = [d for d in days if d in monthdays or d - days_in_month - 1 in monthdays]
+    elif "BYDAY" not in rule:
+        days = [d for d in days if d == dtstart.day]
+
+    if "BYDAY" in rule:
+        matched = []
+        for byday in rule["BYDAY"].split(","):
+            weekday = WEEKDAYS.index(byday[-2:])
+            ordinal = int(byday[:-2]) if len(byday) > 2 else 0
+            candidates = [d for d in days if datetime(year, month, d).weekday() == weekday]
+            if ordinal == 0:
+                matched.extend(candidates)
+            elif "BYMONTHDAY" in rule:
+                raise UnsupportedZone("BYDAY ordinals with BYMONTHDAY")
+            elif 0 < ordinal <= len(candidates):
+                matched.append(candidates[ordinal - 1])
+            elif 0 < -ordinal <= len(candidates):
+                matched.append(candidates[ordinal])
+        days = sorted(set(matched))
+    return days
+
+
+def expand_rrule(rule, dtstart, prev_offset, end_year):
+    """The local times of an RRULE's occurrences up to end_year."""
+    if (rule.get("FREQ") != "YEARLY" or rule.get("INTERVAL", "1") != "1" or
+            set(rule) - set(["FREQ", "INTERVAL", "BYMONTH", "BYDAY", "BYMONTHDAY",
+                             "UNTIL", "COUNT"])):
+        raise UnsupportedZone("RRULE:" + ";".join("%s=%s" % kv for kv in sorted(rule.items())))
+
+    until = None
+    if "UNTIL" in rule:
+        until, is_date, is_utc = parse_datetime(rule["UNTIL"])
+        if is_date:
+            until = until.replace(hour=23, minute=59, second=59)
+        elif is_utc:
+            until += timedelta(seconds=prev_offset)
+    count = int(rule["COUNT"]) if "COUNT" in rule else None
+
+    if "BYMONTH" in rule:
+        months = sorted(int(m) for m in rule["BYMONTH"].split(","))
+    else:
+        months = [dtstart.month]
+
+    occurrences = []
+    for year in range(dtstart.year, end_year + 1):
+        for month in months:
+            for day in rule_days(rule, year, month, dtstart):
+                occ = datetime(year, month, day, dtstart.hour, dtstart.minute, dtstart.second)
+                if occ < dtstart:
+                    continue
+                if (until is not None and occ > until) or \
+                   (count is not None and len(occurrences) == count):
+                    return occurrences
+                occurrences.append(occ)
+
+    # libical always starts with DTSTART; we only handle rules that agree.
+    if not occurrences or occurrences[0] != dtstart:
+        raise UnsupportedZone("DTSTART does not match its RRULE")
+    return occurrences
+
+
+def expand_changes(ics, end_year):
+    """Expand the changes of a VTIMEZONE like icaltimezone_expand_changes()."""
+    changes = []
+
+    def append(utc, component):
+        changes.append((utc.year, utc.month, utc.day, utc.hour, utc.minute, utc.second,
+                        component["is_daylight"], component["to"], component["from"]))
+
+    for component in parse_vtimezone(ics):
+        if not all(key in component for key in ("dtstart", "from", "to")):
+            continue
+        dtstart = component["dtstart"]
+        to_utc = timedelta(seconds=-component["from"])
+
+        if not component["rrules"] and not component["rdates"]:
+            append(dtstart + to_utc, component)
+            continue
+
+        for value in component["rdates"]:
+            rdate, is_date, is_utc = parse_datetime(value)
+            if is_date:
+                append(rdate.replace(hour=dtstart.hour, minute=dtstart.minute,
+                                     second=dtstart.second), component)
+            else:
+                append(rdate if is_utc else rdate + to_utc, component)
+
+        for rule in component["rrules"]:
+            for occ in expand_rrule(rule, dtstart, component["from"], end_year):
+                append(occ + to_utc, component)
+
+    changes.sort(key=lambda change: change[:6])
+    return changes
+
+
+class StringPool(object):
+    """NUL-terminated UTF-8 strings, each stored once."""
+    def __init__(self):
+        self.data = bytearray()
+        self.offsets = {}
+
+    def add(self, string):
+        if string not in self.offsets:
+            self.offsets[string] = len(self.data)
+            self.data += string.encode("utf-8") + b"\0"
+        return self.offsets[string]
+
+
+def compile_zones(zonesjson, end_year=END_YEAR):
+    """Return the database for the parsed contents of zones.json."""
+    def utf8_key(item):
+        return item[0].encode("utf-8")
+
+    zones = sorted(((tzid, data) for tzid, data in zonesjson["zones"].items()
+                    if isinstance(data, dict)), key=utf8_key)
+    aliases = sorted(((tzid, data) for tzid, data in zonesjson["aliases"].items()
+                      if isinstance(data, dict)), key=utf8_key)
+
+    pool = StringPool()
+    version = pool.add(zonesjson["version"])
+
+    zone_table = 40
+    alias_table = zone_table + 24 * len(zones)
+    change_tables = alias_table + 8 * len(aliases)
+
+    zone_records = []
+    change_records = bytearray()
+    for tzid, data in zones:
+        try:
+            changes = expand_changes(data["ics"], end_year)
+            offset = change_tables + len(change_records)
+            for change in changes:
+                change_records += struct.pack("<hBBBBBBii", *change)
+            count = len(changes)
+        except UnsupportedZone as ex:
+            sys.stderr.write("Not expanding %s in advance: %s\n" % (tzid, ex))
+            offset, count = 0, NO_CHANGES
+        zone_records.append((pool.add(tzid), pool.add(data["ics"]),
+                             pool.add(data.get("latitude", "")),
+                             pool.add(data.get("longitude", "")),
+                             offset, count))
+
+    alias_records = [(pool.add(tzid), pool.add(data["aliasTo"])) for tzid, data in aliases]
+
+    strings = change_tables + len(change_records)
+    size = strings + len(pool.data)
+
+    out = bytearray(struct.pack("<8sIIIiIIII", b"CALTZDB\0", FORMAT, size,
+                                strings + version, end_year,
+                                len(zone_records), zone_table,
+                                len(alias_records), alias_table))
+    for record in zone_records:
+        out += struct.pack("<IIIIII", *([strings + offset for offset in record[:4]] +
+                                        list(record[4:])))
+    for record in alias_records:
+        out += struct.pack("<II", *[strings + offset for offset in record])
+    out += change_records
+    out += pool.data
+    assert len(out) == size
+    return bytes(out)
+
+
+def main(output, zones_json_file):
+    """Entry point for the build's GENERATED_FILES."""
+    with open(zones_json_file, "r") as jsonfile:
+        zonesjson = json.load(jsonfile)
+    output.write(compile_zones(zonesjson))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.stderr.write("usage: %s zones.json zones.bin\n" % sys.argv[0])
+        sys.exit(1)
+    with open(sys.argv[2], "wb") as outfile:
+        main(outfile, sys.argv[1])